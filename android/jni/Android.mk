@@ -8,19 +8,28 @@ LOCAL_CFLAGS     += -DWILDMIDI_BUILD
 LOCAL_CFLAGS     += -fvisibility=hidden -DSYM_VISIBILITY
 
 LOCAL_SRC_FILES := \
+	src/calibrate.c \
+	src/event_store.c \
 	src/f_hmi.c \
 	src/f_hmp.c \
 	src/f_midi.c \
 	src/f_mus.c \
 	src/f_xmidi.c \
 	src/file_io.c \
+	src/gauss.c \
 	src/gus_pat.c \
 	src/internal_midi.c \
 	src/lock.c \
+	src/loudness.c \
+	src/mdi_state.c \
 	src/mus2mid.c \
+	src/patch_loader.c \
 	src/patches.c \
+	src/render_cache.c \
 	src/reverb.c \
 	src/sample.c \
+	src/shm_ring.c \
+	src/waveform.c \
 	src/wildmidi_lib.c \
 	src/wm_error.c \
 	src/xmi2mid.c
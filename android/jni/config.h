@@ -61,5 +61,8 @@
 /* Define if you have the <inttypes.h> header file. */
 #define HAVE_INTTYPES_H
 
+/* Define if you have the <dirent.h> header file. */
+#define HAVE_DIRENT_H
+
 /* Define our audio drivers */
 
@@ -31,6 +31,10 @@
 #endif
 #define MEM_CHUNK 8192
 
+/* fixed point sample positions */
+#define FPBITS 10
+#define FPMASK ((1L<<FPBITS)-1L)
+
 extern int16_t _WM_MasterVolume;
 extern uint16_t _WM_SampleRate;
 extern uint16_t _WM_MixerOptions;
@@ -40,6 +44,7 @@ extern float _WM_reverb_room_length; /* = 22.5f;   */
 
 extern float _WM_reverb_listen_posx; /* = 8.4375f; */
 extern float _WM_reverb_listen_posy; /* = 16.875f; */
+extern int _WM_reverb_decimate;      /* = 0;       */
 
 extern void _cvt_reset_options (void);
 extern uint16_t _cvt_get_option (uint16_t tag);
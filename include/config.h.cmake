@@ -61,6 +61,27 @@
 /* Define if you have the <inttypes.h> header file. */
 #cmakedefine HAVE_INTTYPES_H
 
+/* Define if you have the <dirent.h> header file. */
+#cmakedefine HAVE_DIRENT_H
+
+/* Define if you have the mlock() function. */
+#cmakedefine HAVE_MLOCK
+
+/* Define if you have the shm_open() function. */
+#cmakedefine HAVE_SHM_OPEN
+
+/* Define if you have the memfd_create() function. */
+#cmakedefine HAVE_MEMFD_CREATE
+
+/* Define if you have POSIX threads. */
+#cmakedefine HAVE_PTHREAD
+
+/* Define to trap allocations and locks in the realtime render path. */
+#cmakedefine WILDMIDI_RT_DEBUG 1
+
+/* Define to count how long _WM_Lock waits on each lock. */
+#cmakedefine WILDMIDI_LOCK_STATS 1
+
 /* Define our audio drivers */
 #cmakedefine AUDIODRV_ALSA
 #cmakedefine AUDIODRV_OSS
@@ -72,3 +93,4 @@
 #cmakedefine AUDIODRV_WINMM
 #cmakedefine AUDIODRV_OS2DART
 #cmakedefine AUDIODRV_DOSSB
+#cmakedefine AUDIODRV_SHM
@@ -0,0 +1,34 @@
+/*
+ * event_store.h -- Midi Wavetable Processing library
+ *
+ * Copyright (C) WildMIDI Developers 2001-2016
+ *
+ * This file is part of WildMIDI.
+ *
+ * WildMIDI is free software: you can redistribute and/or modify the player
+ * under the terms of the GNU General Public License and you can redistribute
+ * and/or modify the library under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3 of
+ * the licenses, or(at your option) any later version.
+ *
+ * WildMIDI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License and
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License and the
+ * GNU Lesser General Public License along with WildMIDI.  If not,  see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __EVENT_STORE_H
+#define __EVENT_STORE_H
+
+extern int _WM_InsertEvent(struct _mdi *mdi, const uint8_t *event_data, uint32_t size, uint32_t sample_pos);
+extern int _WM_DeleteEvent(struct _mdi *mdi, const uint8_t *event_data, uint32_t size, uint32_t sample_pos);
+extern int _WM_MoveEvent(struct _mdi *mdi, const uint8_t *event_data, uint32_t size,
+                         uint32_t sample_pos, uint32_t new_sample_pos);
+extern struct _event *_WM_EventAfter(struct _mdi *mdi, uint32_t sample_pos, uint32_t *event_pos);
+
+#endif /* __EVENT_STORE_H */
@@ -0,0 +1,37 @@
+/*
+ * gauss.h -- Midi Wavetable Processing library
+ *
+ * Copyright (C) WildMIDI Developers 2001-2016
+ *
+ * This file is part of WildMIDI.
+ *
+ * WildMIDI is free software: you can redistribute and/or modify the player
+ * under the terms of the GNU General Public License and you can redistribute
+ * and/or modify the library under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3 of
+ * the licenses, or(at your option) any later version.
+ *
+ * WildMIDI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License and
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License and the
+ * GNU Lesser General Public License along with WildMIDI.  If not,  see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GAUSS_H
+#define __GAUSS_H
+
+#define MAX_GAUSS_ORDER 34          /* 34 is as high as we can go before errors crop up */
+
+extern double _WM_newt_coeffs[58][58];  /* for start/end of samples */
+extern double *_WM_gauss_table;         /* *gauss_table[1<<FPBITS] */
+extern int _WM_gauss_n;
+
+extern int _WM_init_gauss(void);
+extern void _WM_free_gauss(void);
+extern double _WM_gauss_interpolate(const int16_t *data, uint32_t data_length, uint32_t sample_pos);
+
+#endif /* __GAUSS_H */
@@ -69,7 +69,8 @@ static float env_time_table[] = {
 };
 #endif /* !_WILDMIDI_LIB_C */
 
-extern struct _sample * _WM_load_gus_pat (const char *filename, int _fix_release);
+extern struct _sample * _WM_load_gus_pat (const char *filename, int _fix_release, uint8_t native_modes, int defer_data);
+extern int _WM_load_gus_pat_data (const char *filename, uint8_t native_modes, struct _sample **gus_samples, uint32_t count);
 
 #endif /* __GUS_PAT_H */
 
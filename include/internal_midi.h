@@ -43,11 +43,14 @@ struct _channel {
     uint8_t isdrum;
 };
 
+struct _event;
+
 struct _event_data {
     uint8_t channel;
     union Data {
         uint32_t value;
         char * string;
+        struct _event *next; /* ev_link */
     } data;
 };
 
@@ -70,6 +73,25 @@ struct _note {
     uint32_t right_mix_volume;
     uint8_t is_off;
     uint8_t ignore_chan_events;
+    uint8_t backward; /* for samples with SAMPLE_PINGPONG or SAMPLE_REVERSE still set */
+    uint8_t unity; /* mixed for the block already, see mix_unity_notes */
+};
+
+/*
+ Mu-law samples decoded under the Gauss window, see WM_GetOutput_Gauss.
+ Each note uses the slot its place in the note table maps to, and only
+ decodes the samples its window has moved onto since it last did.
+ */
+#define ULAW_CACHE_SLOTS 64
+#define ULAW_CACHE_SIZE 64 /* samples, more than MAX_GAUSS_ORDER + 1 */
+#define ULAW_CACHE_SLOT(mdi, nte) \
+    (&(mdi)->ulaw_cache[(((nte) - &(mdi)->note_table[0][0][0]) * 5) & (ULAW_CACHE_SLOTS - 1)])
+
+struct _ulaw_cache {
+    struct _sample *sample; /* NULL when empty */
+    uint32_t start; /* sample of data[0] */
+    uint32_t length;
+    int16_t data[ULAW_CACHE_SIZE];
 };
 
 struct _mdi;
@@ -119,7 +141,8 @@ enum _event_type {
     ev_meta_instrumentname,
     ev_meta_lyric,
     ev_meta_marker,
-    ev_meta_cuepoint
+    ev_meta_cuepoint,
+    ev_link
 };
 
 struct _event {
@@ -130,13 +153,54 @@ struct _event {
     uint32_t samples_to_next_fixed;
 };
 
+/*
+ The events of an edited handle are kept in chunks of EVENT_CHUNK_SIZE.
+ Each chunk ends in an ev_link event pointing at the next one, the last
+ chunk ends in the usual ev_null event, so anything walking the events
+ should step with WM_NEXT_EVENT. The cached start lets an edit find its
+ chunk with a binary search, then only that chunk is changed.
+ */
+#define EVENT_CHUNK_SIZE 256
+
+struct _event_chunk {
+    struct _event *events; /* EVENT_CHUNK_SIZE + 1 for the link */
+    uint32_t count;
+    uint32_t start; /* sample position of events[0] */
+};
+
+#define WM_NEXT_EVENT(e) (((e)[1].evtype != ev_link) ? &(e)[1] : (e)[1].event_data.data.next)
+
+/* mix buffer entries allocated for WM_MO_REALTIME, 4096 stereo frames */
+#define RT_MIX_BUFFER_SIZE 8192
+
+/* speed of a handle playing at a ratio of 1.0 */
+#define SPEED_NORMAL 0x10000
+
+/* the parsed events and copyright shared by a handle and its clones */
+struct _event_store {
+    int lock;
+    uint32_t refcount;
+};
+
+struct _mdi_state;
+
+/* a patch the events of a handle play, and the notes it plays them with */
+struct _song_patch {
+    struct _patch *patch;
+    uint32_t notes[4];
+};
+
 struct _mdi {
     int lock;
     uint32_t samples_to_mix;
     struct _event *events;
+    struct _event_store *event_store; /* NULL unless cloned */
     struct _event *current_event;
     uint32_t event_count;
     uint32_t events_size; /* try to stay optimally ahead to prevent reallocs */
+    struct _event_chunk *chunks; /* NULL until the events are edited */
+    uint32_t chunk_count;
+    uint32_t chunks_size;
     struct _WM_Info extra_info;
     struct _WM_Info *tmp_info;
     uint16_t midi_master_vol;
@@ -152,6 +216,8 @@ struct _mdi {
     uint32_t mix_buffer_size;
 
     struct _rvb *reverb;
+    struct _loudness *loudness; /* see WildMidi_SetLoudness */
+    struct _waveform *waveform; /* see WildMidi_SetWaveform */
 
     int32_t dyn_vol_peak;
     double dyn_vol_adjust;
@@ -159,8 +225,30 @@ struct _mdi {
     double dyn_vol_to_reach;
 
     uint8_t is_type2;
+    uint8_t async_load; /* patches it needs once open are queued, see _WM_async_load */
+    uint8_t list_only; /* patches are listed in patches but not loaded, see _WM_initMDI */
 
     char *lyric;
+    /* for WildMidi_ShmWrite, these stay when WildMidi_GetLyric takes lyric */
+    char *last_lyric;
+    uint32_t lyric_count;
+    char *last_marker;
+    uint32_t marker_count;
+
+    /* see WildMidi_SetCheckpoints */
+    struct _mdi_state *checkpoints;
+    uint32_t checkpoint_count;
+    uint32_t checkpoints_size;
+    uint32_t checkpoint_interval;
+    uint32_t checkpoint_played; /* played straight through from the start to here */
+
+    /* see WildMidi_SetSpeed, events and current_sample stay in song samples */
+    uint32_t speed; /* song samples per output sample, 16.16 */
+    uint32_t speed_frac; /* played past current_sample, in 1/65536ths of a sample */
+
+    uint16_t muted; /* channels left out of the mix, see WildMidi_SetMute */
+
+    struct _ulaw_cache ulaw_cache[ULAW_CACHE_SLOTS];
 };
 
 
@@ -238,9 +326,13 @@ extern int _WM_midi_setup_divisions(struct _mdi *mdi, uint32_t divisions);
  * All other declarations
  */
 
-extern struct _mdi * _WM_initMDI(void);
+extern struct _mdi * _WM_initMDI(uint8_t list_only);
 extern void _WM_freeMDI(struct _mdi *mdi);
+extern void _WM_free_event_strings(struct _event *events, uint32_t count);
+extern struct _mdi * _WM_cloneMDI(struct _mdi *mdi);
 extern uint32_t _WM_SetupMidiEvent(struct _mdi *mdi, const uint8_t *event_data, uint32_t inlen, uint8_t running_event);
+extern void _WM_ChannelEvent(const uint8_t *event_data, struct _event *event);
+extern int _WM_SongPatches(struct _mdi *mdi, struct _song_patch **song_patches);
 extern void _WM_ResetToStart(struct _mdi *mdi);
 extern void _WM_do_pan_adjust(struct _mdi *mdi, uint8_t ch);
 extern void _WM_do_note_off_extra(struct _note *nte);
@@ -248,5 +340,9 @@ extern void _WM_do_note_off_extra(struct _note *nte);
 extern void _WM_AdjustChannelVolumes(struct _mdi *mdi, uint8_t ch);
 extern float _WM_GetSamplesPerTick(uint32_t divisions, uint32_t tempo);
 
+/* the mixers, in wildmidi_lib.c */
+extern int _WM_mix_block(struct _mdi *mdi, int8_t *buffer, uint32_t size);
+extern void _WM_pack_output(int8_t *buffer, const int32_t *mix, uint32_t size);
+
 #endif /* __INTERNAL_MIDI_H */
 
@@ -27,10 +27,38 @@
 
 extern void _WM_Lock (int * wmlock);
 extern void _WM_Unlock (int *wmlock);
+extern int _WM_TryLock (int * wmlock);
+
+extern int _WM_LockMemory (const void *addr, size_t len);
+extern uint32_t _WM_lock_memory_failures;
 
 #if defined WM_NO_LOCK
 #define _WM_Lock(p) do {} while (0)
 #define _WM_Unlock(p) do {} while (0)
+#define _WM_TryLock(p) 0
+#endif
+
+/*
+ With WILDMIDI_LOCK_STATS (cmake -DWANT_LOCK_STATS=ON) _WM_Lock counts
+ how often each lock is taken, how often it was held elsewhere and how
+ long was spent waiting for it. Locks are told apart by the expression
+ passed to _WM_Lock, so the locks of all handles count as one.
+ */
+#ifdef WILDMIDI_LOCK_STATS
+struct _WM_LockStats {
+    const char *name;
+    uint64_t acquires;
+    uint64_t contended;
+    uint64_t wait_ns;
+};
+
+extern void _WM_LockCounted (int *wmlock, const char *name);
+extern int _WM_GetLockStats (struct _WM_LockStats *stats, int max);
+extern void _WM_ResetLockStats (void);
+
+#if !defined WM_NO_LOCK
+#define _WM_Lock(p) _WM_LockCounted((p), #p)
+#endif
 #endif
 
 #endif /* __LOCK_H */
@@ -0,0 +1,69 @@
+/*
+ * loudness.h -- Midi Wavetable Processing library
+ *
+ * Copyright (C) WildMIDI Developers 2001-2016
+ *
+ * This file is part of WildMIDI.
+ *
+ * WildMIDI is free software: you can redistribute and/or modify the player
+ * under the terms of the GNU General Public License and you can redistribute
+ * and/or modify the library under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3 of
+ * the licenses, or(at your option) any later version.
+ *
+ * WildMIDI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License and
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License and the
+ * GNU Lesser General Public License along with WildMIDI.  If not,  see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LOUDNESS_H
+#define __LOUDNESS_H
+
+#define LOUDNESS_BINS 1000 /* 0.1 LU each, from -70 to +30 LUFS */
+#define LOUDNESS_SUBS 30 /* 100ms sub-blocks in the 3s short term window */
+#define TRUE_PEAK_TAPS 12 /* per phase of the 4x interpolator */
+
+/*
+ EBU R128 measurement of the output, see WildMidi_SetLoudness. Gating
+ blocks are only kept as a count and a sum of their power per 0.1 LU,
+ so the memory used doesn't grow with the length of the output.
+ */
+struct _loudness {
+    int true_peak; /* run the interpolator */
+    /* K-weighting, a shelf then a high pass, transposed direct form II */
+    double b[2][3];
+    double a[2][2];
+    double z[2][2][2]; /* [channel][filter][state] */
+    uint32_t sub_size; /* frames in a sub-block */
+    uint32_t sub_fill;
+    double sub_sum; /* left^2 + right^2 of the sub-block so far */
+    double sub[LOUDNESS_SUBS]; /* mean squares of the last sub-blocks */
+    uint32_t sub_count;
+    uint32_t block_hist[LOUDNESS_BINS]; /* 400ms gating blocks */
+    double block_power[LOUDNESS_BINS];
+    uint32_t short_hist[LOUDNESS_BINS]; /* 3s short term loudness */
+    double short_power[LOUDNESS_BINS];
+    uint32_t samples;
+    int32_t sample_peak;
+    double peak; /* of the interpolated signal */
+    double quiet; /* samples at or under this can't raise peak */
+    double gain; /* the most the interpolator can amplify by */
+    int loud[2]; /* samples left in the history since one over quiet */
+    float phase[TRUE_PEAK_TAPS][4]; /* the four phases side by side */
+    float history[2][TRUE_PEAK_TAPS * 2]; /* stored twice to read without wrapping */
+    uint32_t history_pos;
+};
+
+struct _WM_Loudness;
+
+extern struct _loudness *_WM_init_loudness(uint32_t rate, int true_peak);
+extern void _WM_free_loudness(struct _loudness *ln);
+extern void _WM_do_loudness(struct _loudness *ln, const int32_t *buffer, uint32_t size);
+extern void _WM_get_loudness(const struct _loudness *ln, struct _WM_Loudness *loudness);
+
+#endif /* __LOUDNESS_H */
@@ -0,0 +1,60 @@
+/*
+ * mdi_state.h -- Midi Wavetable Processing library
+ *
+ * Copyright (C) WildMIDI Developers 2001-2016
+ *
+ * This file is part of WildMIDI.
+ *
+ * WildMIDI is free software: you can redistribute and/or modify the player
+ * under the terms of the GNU General Public License and you can redistribute
+ * and/or modify the library under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3 of
+ * the licenses, or(at your option) any later version.
+ *
+ * WildMIDI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License and
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License and the
+ * GNU Lesser General Public License along with WildMIDI.  If not,  see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __MDI_STATE_H
+#define __MDI_STATE_H
+
+/*
+ Playback state of a handle at a sample position, enough to carry on
+ from there as if the midi had been played from the start.
+ */
+struct _mdi_state {
+    uint32_t sample; /* current_sample, all events up to it have played */
+    struct _channel channel[16];
+    uint32_t note_count; /* notes on the mix list, in list order */
+    uint32_t slot_count; /* those and the note_table slots they reach */
+    uint16_t *slot; /* index into note_table of each copy */
+    struct _note *note; /* copies, next and replay cleared */
+    uint8_t *replay; /* the copy replays into its partner slot */
+    int32_t *reverb; /* NULL without WM_MO_REVERB */
+    uint32_t reverb_size;
+};
+
+/* checkpoint_played after a seek, checkpoints are taken again from the start */
+#define CHECKPOINTS_STOPPED 0xffffffff
+
+extern int _WM_save_state(struct _mdi *mdi, struct _mdi_state *state);
+extern void _WM_restore_state(struct _mdi *mdi, const struct _mdi_state *state);
+extern int _WM_same_notes(struct _mdi *mdi, const struct _mdi_state *state);
+extern int _WM_same_state(struct _mdi *mdi, const struct _mdi_state *state);
+extern int _WM_copy_state(struct _mdi_state *copy, const struct _mdi_state *state);
+extern void _WM_free_state(struct _mdi_state *state);
+
+extern uint8_t *_WM_pack_state(struct _mdi *mdi, uint32_t *size);
+extern int _WM_unpack_state(struct _mdi *mdi, const uint8_t *buffer, uint32_t size);
+
+extern int _WM_add_checkpoint(struct _mdi *mdi, struct _mdi *playing);
+extern void _WM_free_checkpoints(struct _mdi *mdi);
+
+#endif /* __MDI_STATE_H */
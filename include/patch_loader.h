@@ -0,0 +1,38 @@
+/*
+ * patch_loader.h -- Midi Wavetable Processing library
+ *
+ * Copyright (C) WildMIDI Developers 2001-2016
+ *
+ * This file is part of WildMIDI.
+ *
+ * WildMIDI is free software: you can redistribute and/or modify the player
+ * under the terms of the GNU General Public License and you can redistribute
+ * and/or modify the library under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3 of
+ * the licenses, or(at your option) any later version.
+ *
+ * WildMIDI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License and
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License and the
+ * GNU Lesser General Public License along with WildMIDI.  If not,  see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PATCH_LOADER_H
+#define __PATCH_LOADER_H
+
+struct _mdi;
+struct _patch;
+struct _sample;
+
+extern int _WM_async_load;
+
+extern int _WM_start_patch_loader(void);
+extern void _WM_stop_patch_loader(void);
+extern int _WM_queue_load(struct _patch *patch, struct _sample *sample);
+extern void _WM_request_patch(struct _patch *patch);
+
+#endif /* __PATCH_LOADER_H */
@@ -52,6 +52,9 @@ extern struct _patch *_WM_patch[128];
 extern int _WM_patch_lock;
 
 extern struct _patch *_WM_get_patch_data(struct _mdi *mdi, uint16_t patchid);
+extern struct _patch *_WM_hold_patch(struct _mdi *mdi, uint16_t patchid);
+extern int _WM_holds_patch(const struct _mdi *mdi, const struct _patch *patch);
+extern void _WM_add_patch(struct _mdi *mdi, struct _patch *patch);
 extern void _WM_load_patch(struct _mdi *mdi, uint16_t patchid);
 
 #endif /* __PATCHES_H */
@@ -0,0 +1,38 @@
+/*
+ * render_cache.h -- Midi Wavetable Processing library
+ *
+ * Copyright (C) WildMIDI Developers 2001-2016
+ *
+ * This file is part of WildMIDI.
+ *
+ * WildMIDI is free software: you can redistribute and/or modify the player
+ * under the terms of the GNU General Public License and you can redistribute
+ * and/or modify the library under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3 of
+ * the licenses, or(at your option) any later version.
+ *
+ * WildMIDI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License and
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License and the
+ * GNU Lesser General Public License along with WildMIDI.  If not,  see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __RENDER_CACHE_H
+#define __RENDER_CACHE_H
+
+/* FNV-1a, 64 bit */
+#define WM_HASH_INIT ((uint64_t) 0xcbf29ce484222325ULL)
+
+extern uint64_t _WM_hash_bytes(uint64_t hash, const void *data, uint32_t size);
+extern int _WM_hash_file(uint64_t *hash, const char *path);
+
+extern int _WM_set_render_cache(const char *dir, uint32_t max_mbytes);
+extern int _WM_render_cache_enabled(void);
+extern int _WM_render_cache_fetch(uint64_t key, const char *outfile);
+extern void _WM_render_cache_store(uint64_t key, const char *infile);
+
+#endif /* __RENDER_CACHE_H */
@@ -44,12 +44,23 @@ struct _rvb {
     int l_in[4];
     int r_in[4];
     int gain;
-    uint32_t max_reverb_time;
+    uint32_t max_reverb_time; /* output samples the tail lasts after the input stops */
+    /* run at 1/decimate of the output rate, see _WM_reverb_decimate */
+    int decimate;
+    int phase;
+    int32_t dec_l;
+    int32_t dec_r;
+    int32_t wet_l[2]; /* the last two outputs, interpolated between */
+    int32_t wet_r[2];
 };
 
 extern void _WM_reset_reverb (struct _rvb *rvb);
 extern struct _rvb *_WM_init_reverb(int rate, float room_x, float room_y, float listen_x, float listen_y);
 extern void _WM_free_reverb (struct _rvb *rvb);
 extern void _WM_do_reverb (struct _rvb *rvb, int32_t *buffer, int size);
+extern uint32_t _WM_reverb_state_size (struct _rvb *rvb);
+extern void _WM_get_reverb_state (struct _rvb *rvb, int32_t *state);
+extern int _WM_check_reverb_state (struct _rvb *rvb, const int32_t *state);
+extern void _WM_set_reverb_state (struct _rvb *rvb, const int32_t *state);
 
 #endif /* __REVERB_H */
@@ -0,0 +1,43 @@
+/*
+ * rt_debug.h -- Midi Wavetable Processing library
+ *
+ * Copyright (C) WildMIDI Developers 2001-2016
+ *
+ * This file is part of WildMIDI.
+ *
+ * WildMIDI is free software: you can redistribute and/or modify the player
+ * under the terms of the GNU General Public License and you can redistribute
+ * and/or modify the library under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3 of
+ * the licenses, or(at your option) any later version.
+ *
+ * WildMIDI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License and
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License and the
+ * GNU Lesser General Public License along with WildMIDI.  If not,  see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __RT_DEBUG_H
+#define __RT_DEBUG_H
+
+/*
+ With WILDMIDI_RT_DEBUG (cmake -DWANT_RT_DEBUG=ON) the library aborts when
+ the realtime render path allocates memory or waits on a lock.
+ */
+#ifdef WILDMIDI_RT_DEBUG
+extern __thread int _WM_rt_rendering;
+extern void _WM_rt_violation(const char *what);
+#define WM_RT_ENTER() (_WM_rt_rendering = 1)
+#define WM_RT_LEAVE() (_WM_rt_rendering = 0)
+#define WM_RT_CHECK(what) do { if (_WM_rt_rendering) _WM_rt_violation(what); } while (0)
+#else
+#define WM_RT_ENTER() do {} while (0)
+#define WM_RT_LEAVE() do {} while (0)
+#define WM_RT_CHECK(what) do {} while (0)
+#endif
+
+#endif /* __RT_DEBUG_H */
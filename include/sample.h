@@ -57,6 +57,11 @@ struct _sample {
     int32_t env_target[7];
     uint32_t inc_div;
     int16_t *data;
+    uint8_t *ulaw_data; /* mu-law compacted copy of data, used instead of data when set */
+    struct _sample *drum_cache; /* resampled to the output rate, see _WM_prerender_drums */
+    uint32_t data_hash; /* of data or ulaw_data, its bucket in the sample store */
+    uint32_t file_pos; /* of the sample header in the patch file */
+    uint8_t wanted; /* zone without data a song plays, see _WM_load_note_sample */
     struct _sample *next;
 
     uint32_t note_off_decay;
@@ -65,9 +70,21 @@ struct _sample {
 extern int _WM_fix_release;
 extern int _WM_auto_amp;
 extern int _WM_auto_amp_with_amp;
+extern int _WM_compact_samples;
+extern float _WM_compact_min_snr;
+extern int _WM_prerender_drums;
+extern int _WM_partial_patches;
 
-extern struct _sample *_WM_get_sample_data(struct _patch *sample_patch, uint32_t freq);
+extern const int16_t _WM_ulaw_table[256];
+
+extern struct _sample *_WM_get_sample_data(struct _mdi *mdi, struct _patch *sample_patch, uint32_t freq);
 extern int _WM_load_sample(struct _patch *sample_patch);
+extern void _WM_load_sample_async(struct _patch *sample_patch);
+extern void _WM_load_zone_async(struct _patch *sample_patch, struct _sample *sample);
+extern void _WM_free_samples(struct _patch *sample_patch);
 extern uint32_t _WM_get_decay_samples(struct _mdi * mdi, uint8_t channel, uint8_t note);
+extern void _WM_load_note_sample(struct _mdi * mdi, uint8_t channel, uint8_t note);
+extern void _WM_load_wanted_samples(struct _mdi * mdi);
+extern void _WM_load_song_zones(struct _mdi * mdi, struct _patch *patch, const uint32_t *notes);
 
 #endif /* __SAMPLE_H */
@@ -0,0 +1,54 @@
+/*
+ * shm_ring.h -- Midi Wavetable Processing library
+ *
+ * Copyright (C) WildMIDI Developers 2001-2016
+ *
+ * This file is part of WildMIDI.
+ *
+ * WildMIDI is free software: you can redistribute and/or modify the player
+ * under the terms of the GNU General Public License and you can redistribute
+ * and/or modify the library under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3 of
+ * the licenses, or(at your option) any later version.
+ *
+ * WildMIDI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License and
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License and the
+ * GNU Lesser General Public License along with WildMIDI.  If not,  see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __SHM_RING_H
+#define __SHM_RING_H
+
+/*
+ A ring of output in shared memory, see WildMidi_ShmCreate. One
+ process writes and one reads, and neither locks: the writer only
+ moves write_pos on once the audio or record under it is in place, and
+ the reader only moves read_pos on once it is done with what it read.
+ */
+struct _WM_Shm {
+    struct _WM_ShmHeader *header;
+    int8_t *ring;
+    size_t size; /* of the mapping */
+    int fd;
+    char *name; /* to unlink, NULL for memfd */
+    /* the handle records were last added for, and what had played of it */
+    void *handle;
+    uint32_t lyric_count;
+    uint32_t marker_count;
+};
+
+extern struct _WM_Shm *_WM_shm_create(const char *name, uint32_t rate, uint32_t ring_bytes);
+extern void _WM_shm_close(struct _WM_Shm *shm);
+extern uint32_t _WM_shm_space(const struct _WM_Shm *shm);
+extern int8_t *_WM_shm_claim(struct _WM_Shm *shm, uint32_t claimed, uint32_t *size);
+extern void _WM_shm_publish(struct _WM_Shm *shm, uint32_t size);
+extern void _WM_shm_add_record(struct _WM_Shm *shm, uint32_t type, uint32_t current_sample,
+                               uint32_t approx_total_samples, const char *text);
+
+#endif /* __SHM_RING_H */
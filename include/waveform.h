@@ -0,0 +1,58 @@
+/*
+ * waveform.h -- Midi Wavetable Processing library
+ *
+ * Copyright (C) WildMIDI Developers 2001-2016
+ *
+ * This file is part of WildMIDI.
+ *
+ * WildMIDI is free software: you can redistribute and/or modify the player
+ * under the terms of the GNU General Public License and you can redistribute
+ * and/or modify the library under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3 of
+ * the licenses, or(at your option) any later version.
+ *
+ * WildMIDI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License and
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License and the
+ * GNU Lesser General Public License along with WildMIDI.  If not,  see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __WAVEFORM_H
+#define __WAVEFORM_H
+
+struct _WM_WaveBin;
+
+#define WAVEFORM_RATIO 16 /* level n + 1 bins each cover 16 level n bins */
+
+/*
+ Min, max and RMS overview of the output by song position, see
+ WildMidi_SetWaveform. Only the bottom level is built from samples,
+ the levels above are worked out from the bins under them.
+ */
+struct _waveform {
+    uint32_t frames_per_bin; /* at the bottom level */
+    struct _WM_WaveBin *bins[WM_WAVEFORM_LEVELS];
+    uint32_t count[WM_WAVEFORM_LEVELS]; /* up to the last bin written */
+    uint32_t size[WM_WAVEFORM_LEVELS];
+    uint32_t end; /* the furthest song position added */
+    /* the bottom level bin being filled */
+    uint32_t next; /* the song position it has been filled up to */
+    uint32_t bin;
+    int32_t min[2];
+    int32_t max[2];
+    uint64_t sum[2]; /* of the squares */
+    uint32_t fill;
+};
+
+extern struct _waveform *_WM_init_waveform(uint32_t frames_per_bin, uint32_t total_samples);
+extern void _WM_free_waveform(struct _waveform *wf);
+extern void _WM_do_waveform(struct _waveform *wf, const int32_t *buffer, uint32_t frames,
+                            uint32_t start, uint32_t end, uint32_t speed, int realtime);
+extern uint32_t _WM_get_waveform(const struct _waveform *wf, int level, uint32_t first,
+                                 struct _WM_WaveBin *bins, uint32_t *count);
+
+#endif /* __WAVEFORM_H */
@@ -38,6 +38,7 @@
 #define WM_MO_ENHANCED_RESAMPLING 0x0002
 #define WM_MO_REVERB            0x0004
 #define WM_MO_LOOP              0x0008
+#define WM_MO_REALTIME          0x0010
 #define WM_MO_SAVEASTYPE0       0x1000
 #define WM_MO_ROUNDTEMPO        0x2000
 #define WM_MO_STRIPSILENCE      0x4000
@@ -50,6 +51,24 @@
 /* for WildMidi_GetString */
 #define WM_GS_VERSION           0x0001
 
+/* WildMidi_SetLoudness options */
+#define WM_LN_MEASURE           0x0001
+#define WM_LN_TRUE_PEAK         0x0002
+
+/* levels of bins WildMidi_GetWaveform has */
+#define WM_WAVEFORM_LEVELS      3
+
+/* the segment WildMidi_ShmCreate makes, see struct _WM_ShmHeader */
+#define WM_SHM_MAGIC            0x574d5348 /* "WMSH" */
+#define WM_SHM_VERSION          1
+#define WM_SHM_RECORDS          512
+#define WM_SHM_TEXT             112
+
+/* struct _WM_ShmRecord types */
+#define WM_SHM_POSITION         0x0001
+#define WM_SHM_LYRIC            0x0002
+#define WM_SHM_MARKER           0x0003
+
 /* set our symbol export visibility */
 #if defined _WIN32 || defined __CYGWIN__
   /* ========== NOTE TO WINDOWS DEVELOPERS:
@@ -96,6 +115,78 @@ struct _WM_Info {
     uint32_t total_midi_time;
 };
 
+/* see WildMidi_GetRenderCost */
+struct _WM_RenderCost {
+    uint32_t approx_total_samples;
+    uint16_t peak_voices;
+    uint16_t median_voices;
+    uint16_t p95_voices;
+    uint16_t p99_voices;
+    float mean_voices;
+    uint32_t event_count;
+    uint32_t peak_events_per_sec;
+    float mean_events_per_sec;
+    uint32_t patch_count;
+    uint32_t sample_bytes;
+    float cpu_load;
+    float peak_cpu_load;
+};
+
+/* see WildMidi_GetLoudness */
+struct _WM_Loudness {
+    uint32_t samples;
+    float integrated;
+    float momentary;
+    float short_term;
+    float range;
+    float sample_peak;
+    float true_peak;
+};
+
+/* see WildMidi_GetWaveform, six 16bit values and no padding */
+struct _WM_WaveBin {
+    int16_t min[2];
+    int16_t max[2];
+    uint16_t rms[2];
+};
+
+/* nanoseconds, see WildMidi_SetCostModel */
+struct _WM_CostModel {
+    float mix_ns;
+    float linear_ns;
+    float gauss_ns;
+    float reverb_ns;
+};
+
+/*
+ see WildMidi_ShmCreate, what goes with the audio up to pcm_pos of the
+ ring. Positions are bytes written in all and wrap at 4GB.
+ */
+struct _WM_ShmRecord {
+    uint32_t pcm_pos;
+    uint32_t type;
+    uint32_t current_sample;
+    uint32_t approx_total_samples;
+    char text[WM_SHM_TEXT]; /* nul terminated */
+};
+
+/* see WildMidi_ShmCreate, at the start of the segment */
+struct _WM_ShmHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size; /* the ring starts this far into the segment */
+    uint32_t ring_bytes; /* a power of 2 */
+    uint32_t rate; /* 16bit stereo, host byte order */
+    volatile uint32_t closed; /* set once the writer has finished */
+    volatile uint32_t write_pos; /* only the writer changes */
+    volatile uint32_t read_pos; /* only the reader changes */
+    volatile uint32_t record_count; /* records added in all */
+    uint32_t reserved;
+    struct _WM_ShmRecord record[WM_SHM_RECORDS]; /* record n is record[n % WM_SHM_RECORDS] */
+};
+
+struct _WM_Shm;
+
 typedef void midi;
 
 typedef void * (*_WM_VIO_Allocate)(const char *, uint32_t *);
@@ -126,9 +217,31 @@ WM_SYMBOL int WildMidi_InitVIO(struct _WM_VIO * callbacks, const char *config_fi
 WM_SYMBOL int WildMidi_MasterVolume (uint8_t master_volume);
 WM_SYMBOL midi * WildMidi_Open (const char *midifile);
 WM_SYMBOL midi * WildMidi_OpenBuffer (const uint8_t *midibuffer, uint32_t size);
+WM_SYMBOL midi * WildMidi_Clone (midi *handle);
 WM_SYMBOL int WildMidi_GetMidiOutput (midi *handle, int8_t **buffer, uint32_t *size);
 WM_SYMBOL int WildMidi_GetOutput (midi *handle, int8_t *buffer, uint32_t size);
+WM_SYMBOL int WildMidi_SetCheckpoints (midi *handle, unsigned long int interval);
+WM_SYMBOL int WildMidi_RerenderRegion (midi *handle, unsigned long int start, unsigned long int end,
+                                       int8_t *buffer, uint32_t size, unsigned long int *region_end);
+WM_SYMBOL int WildMidi_SetLoudness (midi *handle, uint16_t options);
+WM_SYMBOL int WildMidi_GetLoudness (midi *handle, struct _WM_Loudness *loudness);
+WM_SYMBOL int WildMidi_SetWaveform (midi *handle, uint32_t frames_per_bin);
+WM_SYMBOL int WildMidi_GetWaveform (midi *handle, uint8_t level, uint32_t first,
+                                    struct _WM_WaveBin *bins, uint32_t *count);
+WM_SYMBOL struct _WM_Shm * WildMidi_ShmCreate (const char *name, uint32_t rate, uint32_t ring_bytes, int *fd);
+WM_SYMBOL uint32_t WildMidi_ShmSpace (struct _WM_Shm *shm);
+WM_SYMBOL int WildMidi_ShmWrite (struct _WM_Shm *shm, midi *handle, const int8_t *buffer, uint32_t size);
+WM_SYMBOL int WildMidi_ShmRender (struct _WM_Shm *shm, midi *handle, uint32_t size);
+WM_SYMBOL int WildMidi_ShmClose (struct _WM_Shm *shm);
+WM_SYMBOL int WildMidi_GetRenderCost (midi *handle, struct _WM_RenderCost *cost);
+WM_SYMBOL int WildMidi_SetCostModel (const struct _WM_CostModel *model);
+WM_SYMBOL int WildMidi_GetCostModel (struct _WM_CostModel *model);
+WM_SYMBOL int WildMidi_Calibrate (struct _WM_CostModel *model);
+WM_SYMBOL int WildMidi_SetRenderCache (const char *dir, uint32_t max_mbytes);
+WM_SYMBOL int WildMidi_RenderToFile (const char *midifile, const char *wavfile);
 WM_SYMBOL int WildMidi_SetOption (midi *handle, uint16_t options, uint16_t setting);
+WM_SYMBOL int WildMidi_SetSpeed (midi *handle, float ratio);
+WM_SYMBOL int WildMidi_SetMute (midi *handle, uint16_t mute, uint16_t solo);
 WM_SYMBOL int WildMidi_SetCvtOption (uint16_t tag, uint16_t setting);
 WM_SYMBOL int WildMidi_ConvertToMidi (const char *file, uint8_t **out, uint32_t *size);
 WM_SYMBOL int WildMidi_ConvertBufferToMidi (const uint8_t *in, uint32_t insize,
@@ -136,6 +249,11 @@ WM_SYMBOL int WildMidi_ConvertBufferToMidi (const uint8_t *in, uint32_t insize,
 WM_SYMBOL struct _WM_Info * WildMidi_GetInfo (midi * handle);
 WM_SYMBOL int WildMidi_FastSeek (midi * handle, unsigned long int *sample_pos);
 WM_SYMBOL int WildMidi_SongSeek (midi * handle, int8_t nextsong);
+WM_SYMBOL int WildMidi_SaveState (midi * handle, uint8_t **buffer, uint32_t *size);
+WM_SYMBOL int WildMidi_RestoreState (midi * handle, const uint8_t *buffer, uint32_t size);
+WM_SYMBOL int WildMidi_InsertMidiEvent (midi * handle, const uint8_t *event, uint32_t size, unsigned long int sample_pos);
+WM_SYMBOL int WildMidi_DeleteMidiEvent (midi * handle, const uint8_t *event, uint32_t size, unsigned long int sample_pos);
+WM_SYMBOL int WildMidi_MoveMidiEvent (midi * handle, const uint8_t *event, uint32_t size, unsigned long int sample_pos, unsigned long int new_sample_pos);
 WM_SYMBOL int WildMidi_Close (midi * handle);
 WM_SYMBOL int WildMidi_Shutdown (void);
 WM_SYMBOL char * WildMidi_GetLyric (midi * handle);
@@ -151,14 +269,6 @@ WM_SYMBOL void WildMidi_ClearError (void);
 WM_SYMBOL int WildMidi_Live (midi * handle, uint32_t midi_event);
  */
 
-/* reserved for future coding
- * need to change these to use a time for cmd_pos and new_cmd_pos
-
-WM_SYMBOL int WildMidi_InsertMidiEvent (midi * handle, uint8_t char midi_cmd, *char midi_cmd_data, unsigned long int midi_cmd_data_size, unsigned long int *cmd_pos);
-WM_SYMBOL int WildMidi_DeleteMidiEvent (midi * handle, uint8_t char midi_cmd, unsigned long int *cmd_pos);
-WM_SYMBOL int WildMidi_MoveMidiEvent (midi * handle, , uint8_t char midi_cmd, unsigned long int *cmd_pos, unsigned long int *new_cmd_pos);
- */
-
 #if defined(__cplusplus)
 }
 #endif
@@ -74,6 +74,9 @@ extern audiodrv_info audiodrv_ahi;
 extern audiodrv_info audiodrv_winmm;
 extern audiodrv_info audiodrv_dart;
 extern audiodrv_info audiodrv_openal;
+extern audiodrv_info audiodrv_shm;
+
+extern void shm_output_midi(void *handle);
 
 extern void msleep(uint32_t msec);
 
@@ -0,0 +1,1280 @@
+/*
+ * bench.c -- Mixer kernel microbenchmarks
+ *
+ * Times the resampling loops, the reverb and the 16bit output packing
+ * each on their own. The voices are made up in memory rather than
+ * played from a song, so one thing can be changed at a time: the voice
+ * count, pitch, looped or one shot samples, the envelope stage, linear
+ * or gauss resampling and the block size.
+ *
+ * With --threads it instead renders many handles playing real files
+ * from a growing number of threads, to see how the library scales and
+ * where the threads wait on each other. With --memory it opens many
+ * handles at once and writes what they cost in memory as JSON.
+ *
+ * NOTE: This file is intended for developer use to measure changes to
+ *       the mixer. It uses internal functions, so it is linked against
+ *       the static library.
+ *
+ * Copyright (C) WildMIDI Developers 2001-2016
+ *
+ * This file is part of WildMIDI.
+ *
+ * WildMIDI is free software: you can redistribute and/or modify the player
+ * under the terms of the GNU General Public License and you can redistribute
+ * and/or modify the library under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3 of
+ * the licenses, or(at your option) any later version.
+ *
+ * WildMIDI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License and
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License and the
+ * GNU Lesser General Public License along with WildMIDI.  If not,  see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <getopt_long.h>
+#else
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#if defined(__GLIBC__) && ((__GLIBC__ > 2) || (__GLIBC_MINOR__ >= 33))
+#include <malloc.h>
+#define HAVE_MALLINFO2 1
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#include "wildmidi_lib.h"
+#include "common.h"
+#include "reverb.h"
+#include "sample.h"
+#include "internal_midi.h"
+#include "lock.h"
+
+static struct option const long_options[] = {
+    { "voices", 1, 0, 'v' },
+    { "pitch", 1, 0, 'p' },
+    { "block", 1, 0, 'b' },
+    { "runs", 1, 0, 'r' },
+    { "work", 1, 0, 'w' },
+    { "rate", 1, 0, 'o' },
+    { "all", 0, 0, 'a' },
+    { "threads", 1, 0, 't' },
+    { "handles", 1, 0, 'm' },
+    { "config", 1, 0, 'c' },
+    { "seconds", 1, 0, 's' },
+    { "churn", 1, 0, 'x' },
+    { "memory", 1, 0, 'M' },
+    { "help", 0, 0, 'h' },
+    { NULL, 0, NULL, 0 }
+};
+
+#define MAX_LIST 32
+#define MAX_VOICES 512
+#define MAX_BLOCK 65536
+#define MAX_RUNS 256
+#define MAX_THREADS 256
+
+/* frames per run for the kernels timed per frame */
+#define FRAME_KERNEL_FRAMES 65536
+/* the most frames a voice run mixes, one shot samples are this long */
+#define MAX_VOICE_FRAMES 65536
+
+#define BENCH_SAMPLES 8
+#define LOOP_START 2048
+#define LOOP_LENGTH 4096
+/* room for the gauss window past either end */
+#define SAMPLE_MARGIN 64
+
+enum { ENV_ATTACK, ENV_HOLD, ENV_RELEASE };
+static const char *env_names[] = { "attack", "hold", "release" };
+
+struct _list {
+    double value[MAX_LIST];
+    int count;
+    int base;
+};
+
+struct _bench_cfg {
+    int gauss;
+    uint32_t voices;
+    double ratio;
+    int loop;
+    int env;
+    uint32_t block;
+};
+
+/* mean and standard deviation over the runs, per frame or voice-frame */
+struct _bench_result {
+    double ns;
+    double ns_sd;
+    double cycles;
+    double cycles_sd;
+};
+
+static uint32_t runs = 9;
+static uint32_t work = 1 << 20;
+static uint16_t rate = 44100;
+
+static struct _mdi *mdi = NULL;
+static struct _sample loop_sample[BENCH_SAMPLES];
+static struct _sample oneshot_sample[BENCH_SAMPLES];
+static int16_t *sample_data[BENCH_SAMPLES];
+static int8_t *out_buffer = NULL;
+static int32_t *mix_buffer = NULL;
+static int32_t *dry_buffer = NULL;
+
+static char bench_config[] = "# no patches needed\n";
+
+static void *bench_allocate_file(const char *filename, uint32_t *size) {
+    char *buf = (char *) malloc(sizeof(bench_config));
+
+    (void) filename;
+    if (buf == NULL) return (NULL);
+    memcpy(buf, bench_config, sizeof(bench_config));
+    *size = sizeof(bench_config) - 1;
+    return (buf);
+}
+
+static void bench_free_file(void *buf) {
+    free(buf);
+}
+
+static double now_ns(void) {
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
+
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return ((double) count.QuadPart * 1000000000.0 / (double) freq.QuadPart);
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((double) ts.tv_sec * 1000000000.0 + (double) ts.tv_nsec);
+#endif
+}
+
+static uint64_t now_cycles(void) {
+#ifdef HAVE_TSC
+    return ((uint64_t) __rdtsc());
+#else
+    return (0);
+#endif
+}
+
+static void mean_sd(const double *val, uint32_t count, double *mean, double *sd) {
+    double sum = 0.0;
+    uint32_t i;
+
+    for (i = 0; i < count; i++) {
+        sum += val[i];
+    }
+    *mean = sum / count;
+    sum = 0.0;
+    for (i = 0; i < count; i++) {
+        sum += (val[i] - *mean) * (val[i] - *mean);
+    }
+    *sd = (count > 1) ? sqrt(sum / (count - 1)) : 0.0;
+}
+
+/*
+ Times run after one untimed warm up, prep is called before each run
+ and is not timed. base_ns and base_cycles per frame are taken off
+ each run before dividing by units, which is how the cost of mixing
+ with no voices is kept out of the per voice figures.
+ */
+static void measure(void (*prep)(const struct _bench_cfg *),
+                    void (*run)(const struct _bench_cfg *),
+                    const struct _bench_cfg *cfg, uint32_t frames,
+                    double units, double base_ns, double base_cycles,
+                    struct _bench_result *res) {
+    double ns[MAX_RUNS];
+    double cycles[MAX_RUNS];
+    double start_ns;
+    uint64_t start_cycles;
+    uint32_t i;
+
+    if (prep) prep(cfg);
+    run(cfg);
+    for (i = 0; i < runs; i++) {
+        if (prep) prep(cfg);
+        start_ns = now_ns();
+        start_cycles = now_cycles();
+        run(cfg);
+        cycles[i] = (double) (now_cycles() - start_cycles);
+        ns[i] = now_ns() - start_ns;
+        cycles[i] = (cycles[i] - base_cycles * frames) / units;
+        ns[i] = (ns[i] - base_ns * frames) / units;
+    }
+    mean_sd(ns, runs, &res->ns, &res->ns_sd);
+    mean_sd(cycles, runs, &res->cycles, &res->cycles_sd);
+}
+
+/* frames a voice run mixes, a whole number of blocks */
+static uint32_t voice_frames(const struct _bench_cfg *cfg) {
+    uint32_t frames = work / (cfg->voices ? cfg->voices : 1);
+
+    if (frames > MAX_VOICE_FRAMES) frames = MAX_VOICE_FRAMES;
+    if (frames < cfg->block) frames = cfg->block;
+    return (((frames + cfg->block - 1) / cfg->block) * cfg->block);
+}
+
+static uint32_t kernel_frames(const struct _bench_cfg *cfg) {
+    return (((FRAME_KERNEL_FRAMES + cfg->block - 1) / cfg->block) * cfg->block);
+}
+
+/*
+ Each voice plays one of BENCH_SAMPLES samples, from its own start
+ point and at its own fraction of a sample, and is detuned a little so
+ no two voices step through the gauss table together.
+ */
+static void setup_voices(const struct _bench_cfg *cfg) {
+    struct _note *prev = NULL;
+    struct _note *nte;
+    uint32_t v;
+
+    memset(mdi->note_table, 0, sizeof(mdi->note_table));
+    for (v = 0; v < cfg->voices; v++) {
+        nte = &mdi->note_table[0][v >> 7][v & 127];
+        nte->noteid = (uint16_t) v;
+        nte->velocity = 100;
+        nte->sample = cfg->loop ? &loop_sample[v % BENCH_SAMPLES]
+                                : &oneshot_sample[v % BENCH_SAMPLES];
+        nte->sample_pos = ((SAMPLE_MARGIN + ((v * 97) % LOOP_LENGTH)) << FPBITS)
+                          | (((v * 389) + 123) & FPMASK);
+        nte->sample_inc = (uint32_t) (cfg->ratio * (1 << FPBITS)) + (v % 5);
+        nte->modes = nte->sample->modes;
+        switch (cfg->env) {
+        case ENV_ATTACK:
+            nte->env = 0;
+            nte->env_level = 1 << 21;
+            nte->env_inc = 1;
+            break;
+        case ENV_HOLD:
+            nte->env = 3;
+            nte->env_level = 4194303;
+            nte->env_inc = 0;
+            break;
+        default:
+            nte->env = 5;
+            nte->env_level = 1 << 21;
+            nte->env_inc = -1;
+            break;
+        }
+        nte->left_mix_volume = 300 + (v % 200);
+        nte->right_mix_volume = 500 - (v % 200);
+        nte->active = 1;
+        nte->next = prev;
+        prev = nte;
+    }
+    mdi->note = prev;
+    mdi->extra_info.mixer_options = cfg->gauss ? WM_MO_ENHANCED_RESAMPLING : 0;
+    mdi->extra_info.current_sample = 0;
+    mdi->samples_to_mix = 0;
+}
+
+static void run_mix(const struct _bench_cfg *cfg) {
+    uint32_t frames = cfg->voices ? voice_frames(cfg) : kernel_frames(cfg);
+    uint32_t done;
+
+    for (done = 0; done < frames; done += cfg->block) {
+        _WM_mix_block(mdi, out_buffer, cfg->block * 4);
+    }
+}
+
+static void run_pack(const struct _bench_cfg *cfg) {
+    uint32_t frames = kernel_frames(cfg);
+    uint32_t done;
+
+    for (done = 0; done < frames; done += cfg->block) {
+        _WM_pack_output(out_buffer, mix_buffer, cfg->block * 4);
+    }
+}
+
+static struct _rvb *bench_rvb = NULL;
+
+static void run_reverb(const struct _bench_cfg *cfg) {
+    uint32_t frames = kernel_frames(cfg);
+    uint32_t done;
+
+    /* the dry mix is copied in each time so the levels stay the same */
+    for (done = 0; done < frames; done += cfg->block) {
+        memcpy(mix_buffer, dry_buffer, cfg->block * 2 * sizeof(int32_t));
+        _WM_do_reverb(bench_rvb, mix_buffer, cfg->block * 2);
+    }
+}
+
+static int init_bench(double max_ratio, uint32_t max_block) {
+    struct _WM_VIO vio = { bench_allocate_file, bench_free_file };
+    uint32_t oneshot_len;
+    uint32_t loop_len = LOOP_START + LOOP_LENGTH + SAMPLE_MARGIN;
+    uint32_t seed = 12345;
+    uint32_t i, j;
+
+    if (WildMidi_InitVIO(&vio, "bench.cfg", rate, 0) == -1) {
+        fprintf(stderr, "%s\n", WildMidi_GetError());
+        return (-1);
+    }
+    if ((mdi = _WM_initMDI(0)) == NULL) {
+        fprintf(stderr, "Unable to set up a handle\n");
+        return (-1);
+    }
+    /* no events, the mixer plays the notes for as long as it is asked */
+    mdi->events[0].evtype = ev_null;
+    mdi->events[0].do_event = NULL;
+    mdi->events[0].samples_to_next = 0;
+    mdi->current_event = mdi->events;
+    mdi->extra_info.approx_total_samples = 0xffffffff;
+
+    oneshot_len = (uint32_t) ((MAX_VOICE_FRAMES + max_block) * (max_ratio * 1.05))
+                  + LOOP_LENGTH + (2 * SAMPLE_MARGIN);
+    for (i = 0; i < BENCH_SAMPLES; i++) {
+        if ((sample_data[i] = (int16_t *) malloc(oneshot_len * sizeof(int16_t))) == NULL) {
+            fprintf(stderr, "Unable to allocate sample data\n");
+            return (-1);
+        }
+        for (j = 0; j < oneshot_len; j++) {
+            seed = (seed * 1103515245) + 12345;
+            sample_data[i][j] = (int16_t) ((((j * (131 + i)) & 0x3fff) - 0x2000)
+                                           + ((seed >> 20) & 0x3ff));
+        }
+
+        memset(&oneshot_sample[i], 0, sizeof(struct _sample));
+        oneshot_sample[i].data = sample_data[i];
+        oneshot_sample[i].data_length = oneshot_len << FPBITS;
+        oneshot_sample[i].loop_start = 0;
+        oneshot_sample[i].loop_end = oneshot_sample[i].data_length;
+        oneshot_sample[i].loop_size = oneshot_sample[i].data_length;
+        oneshot_sample[i].modes = SAMPLE_16BIT | SAMPLE_ENVELOPE;
+        oneshot_sample[i].env_target[0] = 4194303;
+        oneshot_sample[i].env_target[3] = 4194303;
+
+        memcpy(&loop_sample[i], &oneshot_sample[i], sizeof(struct _sample));
+        loop_sample[i].data_length = loop_len << FPBITS;
+        loop_sample[i].loop_start = LOOP_START << FPBITS;
+        loop_sample[i].loop_end = (LOOP_START + LOOP_LENGTH) << FPBITS;
+        loop_sample[i].loop_size = LOOP_LENGTH << FPBITS;
+        loop_sample[i].modes |= SAMPLE_LOOP | SAMPLE_SUSTAIN;
+    }
+
+    out_buffer = (int8_t *) malloc(max_block * 4);
+    mix_buffer = (int32_t *) malloc(max_block * 2 * sizeof(int32_t));
+    dry_buffer = (int32_t *) malloc(max_block * 2 * sizeof(int32_t));
+    if ((out_buffer == NULL) || (mix_buffer == NULL) || (dry_buffer == NULL)) {
+        fprintf(stderr, "Unable to allocate mix buffers\n");
+        return (-1);
+    }
+    for (j = 0; j < max_block * 2; j++) {
+        seed = (seed * 1103515245) + 12345;
+        dry_buffer[j] = (int32_t) ((seed >> 16) & 0x7fff) - 0x4000;
+        mix_buffer[j] = dry_buffer[j];
+    }
+    return (0);
+}
+
+static void free_bench(void) {
+    uint32_t i;
+
+    if (mdi != NULL) {
+        mdi->note = NULL;
+        _WM_freeMDI(mdi);
+    }
+    for (i = 0; i < BENCH_SAMPLES; i++) {
+        free(sample_data[i]);
+    }
+    free(out_buffer);
+    free(mix_buffer);
+    free(dry_buffer);
+    WildMidi_Shutdown();
+}
+
+static void print_header(void) {
+    printf("%-8s %-6s %6s %6s %-8s %-7s %6s %9s %8s %9s %8s\n",
+           "kernel", "interp", "voices", "ratio", "sample", "env", "block",
+           "ns", "sd", "cycles", "sd");
+}
+
+static void print_row(const char *kernel, const char *interp,
+                      const struct _bench_cfg *cfg, int voice_row,
+                      const struct _bench_result *res) {
+    printf("%-8s %-6s ", kernel, interp);
+    if (voice_row) {
+        printf("%6lu %6.2f %-8s %-7s ", (unsigned long) cfg->voices, cfg->ratio,
+               cfg->loop ? "loop" : "oneshot", env_names[cfg->env]);
+    } else {
+        printf("%6s %6s %-8s %-7s ", "-", "-", "-", "-");
+    }
+    printf("%6lu %9.3f %8.3f ", (unsigned long) cfg->block, res->ns, res->ns_sd);
+#ifdef HAVE_TSC
+    printf("%9.2f %8.2f\n", res->cycles, res->cycles_sd);
+#else
+    printf("%9s %8s\n", "-", "-");
+#endif
+}
+
+static int parse_list(const char *arg, struct _list *list, double min, double max) {
+    const char *p = arg;
+    char *end;
+    double val;
+
+    list->count = 0;
+    while (*p) {
+        val = strtod(p, &end);
+        if ((end == p) || (val < min) || (val > max) || (list->count == MAX_LIST)) {
+            return (-1);
+        }
+        list->value[list->count++] = val;
+        p = end;
+        if (*p == ',') p++;
+        else if (*p) return (-1);
+    }
+    return ((list->count) ? 0 : -1);
+}
+
+/* the base point of an axis is its default if listed, else its first entry */
+static void set_base(struct _list *list, double def) {
+    int i;
+
+    list->base = 0;
+    for (i = 0; i < list->count; i++) {
+        if (list->value[i] == def) {
+            list->base = i;
+            break;
+        }
+    }
+}
+
+static int block_index(const struct _list *blocks, uint32_t block) {
+    int i;
+
+    for (i = 0; i < blocks->count; i++) {
+        if ((uint32_t) blocks->value[i] == block) return (i);
+    }
+    return (0);
+}
+
+/* --threads */
+static uint32_t threads = 0;
+static uint32_t handles = 64;
+static double seconds = 2.0;
+static uint32_t churn = 0;
+static const char *config_file = WILDMIDI_CFG;
+
+#ifdef HAVE_PTHREAD
+
+#define MAX_LOCKS 16
+
+/* a thread renders handles first, first + step, ... in turn */
+struct _bench_thread {
+    pthread_t thread;
+    uint32_t first;
+    uint32_t step;
+    uint32_t block;
+    uint64_t frames;
+    uint32_t opens;
+    uint32_t closes;
+    double open_ns;
+    double close_ns;
+    int failed;
+};
+
+static char **bench_files = NULL;
+static uint32_t bench_file_count = 0;
+static midi **bench_handles = NULL;
+static uint32_t *bench_handle_file = NULL;
+static volatile int bench_stop = 0;
+/* the library's list of open handles has no lock, so opening and
+ * closing is done one at a time */
+static pthread_mutex_t handle_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int open_handle(uint32_t h, struct _bench_thread *t) {
+    double start;
+
+    pthread_mutex_lock(&handle_mutex);
+    start = now_ns();
+    bench_handles[h] = WildMidi_Open(bench_files[bench_handle_file[h]]);
+    t->open_ns += now_ns() - start;
+    t->opens++;
+    pthread_mutex_unlock(&handle_mutex);
+    if (bench_handles[h] == NULL) {
+        fprintf(stderr, "Unable to open %s: %s\n", bench_files[bench_handle_file[h]],
+                WildMidi_GetError());
+        return (-1);
+    }
+    return (0);
+}
+
+static void close_handle(uint32_t h, struct _bench_thread *t) {
+    double start;
+
+    if (bench_handles[h] == NULL) return;
+    pthread_mutex_lock(&handle_mutex);
+    start = now_ns();
+    WildMidi_Close(bench_handles[h]);
+    t->close_ns += now_ns() - start;
+    t->closes++;
+    pthread_mutex_unlock(&handle_mutex);
+    bench_handles[h] = NULL;
+}
+
+/* renders a block of each of its handles in turn until told to stop,
+ * reopening handles that finish or, with --churn, every churn blocks */
+static void *render_thread(void *arg) {
+    struct _bench_thread *t = (struct _bench_thread *) arg;
+    int8_t *buffer = (int8_t *) malloc(t->block * 4);
+    uint32_t blocks = 0;
+    uint32_t h;
+    int ret;
+
+    if (buffer == NULL) {
+        t->failed = 1;
+        return (NULL);
+    }
+    while (!bench_stop) {
+        for (h = t->first; (h < handles) && (!bench_stop); h += t->step) {
+            if ((ret = WildMidi_GetOutput(bench_handles[h], buffer, t->block * 4)) < 0) {
+                t->failed = 1;
+                goto _end;
+            }
+            t->frames += ret / 4;
+            if ((ret == 0) || ((churn != 0) && ((++blocks % churn) == 0))) {
+                close_handle(h, t);
+                bench_handle_file[h] = (bench_handle_file[h] + 1) % bench_file_count;
+                if (open_handle(h, t) == -1) {
+                    t->failed = 1;
+                    goto _end;
+                }
+            }
+        }
+    }
+_end:
+    free(buffer);
+    return (NULL);
+}
+
+static void print_lock_stats(uint32_t count, double elapsed_ns) {
+#ifdef WILDMIDI_LOCK_STATS
+    struct _WM_LockStats stats[MAX_LOCKS];
+    int locks = _WM_GetLockStats(stats, MAX_LOCKS);
+    int i;
+
+    for (i = 0; i < locks; i++) {
+        printf("        lock %-24s %10lu taken %7.3f%% contended %10.3f ms waited %7.3f%% of thread time\n",
+               stats[i].name, (unsigned long) stats[i].acquires,
+               (stats[i].acquires) ? (100.0 * stats[i].contended / stats[i].acquires) : 0.0,
+               stats[i].wait_ns / 1000000.0,
+               100.0 * stats[i].wait_ns / (elapsed_ns * count));
+    }
+#else
+    (void) count;
+    (void) elapsed_ns;
+#endif
+}
+
+/* renders all the handles from count threads for --seconds */
+static int run_threads(uint32_t count, uint32_t block, double *base_fps) {
+    struct _bench_thread thread[MAX_THREADS];
+    struct _bench_thread setup;
+    struct timespec wait;
+    double start, elapsed, fps;
+    uint64_t frames = 0;
+    uint32_t opens = 0, closes = 0, reopens;
+    double open_ns, close_ns = 0.0;
+    uint32_t i, h;
+    int failed = 0;
+
+    memset(&setup, 0, sizeof(setup));
+    for (h = 0; h < handles; h++) {
+        bench_handle_file[h] = h % bench_file_count;
+        if (open_handle(h, &setup) == -1) {
+            failed = 1;
+            goto _close;
+        }
+    }
+#ifdef WILDMIDI_LOCK_STATS
+    _WM_ResetLockStats();
+#endif
+
+    bench_stop = 0;
+    memset(thread, 0, sizeof(thread));
+    start = now_ns();
+    for (i = 0; i < count; i++) {
+        thread[i].first = i;
+        thread[i].step = count;
+        thread[i].block = block;
+        if (pthread_create(&thread[i].thread, NULL, render_thread, &thread[i]) != 0) {
+            fprintf(stderr, "Unable to start thread %lu\n", (unsigned long) i + 1);
+            bench_stop = 1;
+            count = i;
+            failed = 1;
+            break;
+        }
+    }
+    wait.tv_sec = (time_t) seconds;
+    wait.tv_nsec = (long) ((seconds - (double) wait.tv_sec) * 1000000000.0);
+    if (!failed) nanosleep(&wait, NULL);
+    bench_stop = 1;
+    for (i = 0; i < count; i++) {
+        pthread_join(thread[i].thread, NULL);
+    }
+    elapsed = now_ns() - start;
+
+    open_ns = setup.open_ns;
+    opens = setup.opens;
+    for (i = 0; i < count; i++) {
+        failed |= thread[i].failed;
+        frames += thread[i].frames;
+        opens += thread[i].opens;
+        open_ns += thread[i].open_ns;
+        closes += thread[i].closes;
+        close_ns += thread[i].close_ns;
+    }
+    reopens = opens - setup.opens;
+
+    if (!failed) {
+        fps = frames * 1000000000.0 / elapsed;
+        if (count == 1) *base_fps = fps;
+        printf("%7lu %12.0f %9.1fx %9.1f%% %10.1f %8.3f %8.3f\n",
+               (unsigned long) count, fps, fps / rate,
+               (*base_fps > 0.0) ? (100.0 * fps / (*base_fps * count)) : 0.0,
+               reopens * 1000000000.0 / elapsed,
+               open_ns / opens / 1000000.0,
+               (closes) ? (close_ns / closes / 1000000.0) : 0.0);
+        print_lock_stats(count, elapsed);
+    }
+
+_close:
+    for (h = 0; h < handles; h++) {
+        close_handle(h, &setup);
+    }
+    return (failed ? -1 : 0);
+}
+
+static int thread_bench(char **files, uint32_t file_count, uint32_t block) {
+    double base_fps = 0.0;
+    uint32_t count;
+    int ret = 0;
+
+    if (file_count == 0) {
+        fprintf(stderr, "--threads needs midi files to play\n");
+        return (1);
+    }
+    if (WildMidi_Init(config_file, rate, 0) == -1) {
+        fprintf(stderr, "%s\n", WildMidi_GetError());
+        return (1);
+    }
+    bench_files = files;
+    bench_file_count = file_count;
+    bench_handles = (midi **) calloc(handles, sizeof(midi *));
+    bench_handle_file = (uint32_t *) calloc(handles, sizeof(uint32_t));
+    if ((bench_handles == NULL) || (bench_handle_file == NULL)) {
+        fprintf(stderr, "Unable to allocate handles\n");
+        ret = 1;
+        goto _end;
+    }
+
+    printf("# %lu handles over %lu files, %lu frame blocks, %.1f s a run, %u Hz, %ld cpus\n",
+           (unsigned long) handles, (unsigned long) file_count,
+           (unsigned long) block, seconds, rate, sysconf(_SC_NPROCESSORS_ONLN));
+#ifndef WILDMIDI_LOCK_STATS
+    printf("# build with WANT_LOCK_STATS to see time spent waiting on locks\n");
+#endif
+    printf("%7s %12s %10s %10s %10s %8s %8s\n", "threads", "frames/s",
+           "realtime", "scaling", "reopens/s", "open ms", "close ms");
+    for (count = 1; ; count = (count * 2 < threads) ? count * 2 : threads) {
+        if (run_threads(count, block, &base_fps) == -1) {
+            ret = 1;
+            break;
+        }
+        if (count == threads) break;
+    }
+
+_end:
+    free(bench_handles);
+    free(bench_handle_file);
+    WildMidi_Shutdown();
+    return (ret);
+}
+
+#else
+
+static int thread_bench(char **files, uint32_t file_count, uint32_t block) {
+    (void) files;
+    (void) file_count;
+    (void) block;
+    fprintf(stderr, "--threads needs a build with POSIX threads\n");
+    return (1);
+}
+
+#endif /* HAVE_PTHREAD */
+
+/*
+ --memory
+
+ Opens each count of handles in turn, the files played in rotation,
+ with one more handle per file kept open throughout so the patches
+ they share stay loaded and count towards the baseline.
+ */
+struct _heap_info {
+    double in_use;
+    double free;
+    double arena;
+};
+
+/* bytes allocated for the main structures of the handles, pages of
+ * them that are never written to need not be resident */
+struct _handle_parts {
+    double mdi;
+    double note_table;
+    double events;
+    double reverb;
+    double mix_buffer;
+    double patch_list;
+};
+
+static double rss_bytes(void) {
+#ifdef __linux__
+    FILE *f = fopen("/proc/self/statm", "r");
+    unsigned long size, resident;
+    int got;
+
+    if (f == NULL) return (-1.0);
+    got = fscanf(f, "%lu %lu", &size, &resident);
+    fclose(f);
+    if (got != 2) return (-1.0);
+    return ((double) resident * sysconf(_SC_PAGESIZE));
+#else
+    return (-1.0);
+#endif
+}
+
+static int heap_info(struct _heap_info *heap) {
+#ifdef HAVE_MALLINFO2
+    struct mallinfo2 mi = mallinfo2();
+
+    heap->in_use = (double) mi.uordblks + (double) mi.hblkhd;
+    heap->free = (double) mi.fordblks;
+    heap->arena = (double) mi.arena;
+    return (0);
+#else
+    (void) heap;
+    return (-1);
+#endif
+}
+
+static void add_handle_parts(midi *handle, struct _handle_parts *parts) {
+    struct _mdi *m = (struct _mdi *) handle;
+    uint32_t i;
+
+    parts->mdi += sizeof(struct _mdi) - sizeof(m->note_table);
+    parts->note_table += sizeof(m->note_table);
+    if (m->event_store == NULL) {
+        parts->events += (double) m->events_size * sizeof(struct _event);
+        for (i = 0; i < m->chunk_count; i++) {
+            parts->events += (EVENT_CHUNK_SIZE + 1) * sizeof(struct _event);
+        }
+    }
+    if (m->reverb != NULL) {
+        parts->reverb += sizeof(struct _rvb) + ((double) m->reverb->l_buf_size
+                          + m->reverb->r_buf_size + 2) * sizeof(int32_t);
+    }
+    parts->mix_buffer += (double) m->mix_buffer_size * sizeof(int32_t);
+    parts->patch_list += (double) m->patch_count * sizeof(struct _patch *);
+}
+
+static void print_json_string(const char *str) {
+    putchar('"');
+    for (; *str; str++) {
+        if ((*str == '"') || (*str == '\\')) {
+            printf("\\%c", *str);
+        } else if ((unsigned char) *str < 0x20) {
+            printf("\\u%04x", (unsigned char) *str);
+        } else {
+            putchar(*str);
+        }
+    }
+    putchar('"');
+}
+
+static void print_json_bytes(const char *key, double bytes, int last) {
+    if (bytes < 0.0) {
+        printf("      \"%s\": null%s\n", key, last ? "" : ",");
+    } else {
+        printf("      \"%s\": %.0f%s\n", key, bytes, last ? "" : ",");
+    }
+}
+
+static void print_json_heap(const char *key, int ok, const struct _heap_info *heap) {
+    if (ok != 0) {
+        printf("      \"%s\": null,\n", key);
+        return;
+    }
+    printf("      \"%s\": { \"in_use_bytes\": %.0f, \"free_bytes\": %.0f, \"fragmentation\": %.4f },\n",
+           key, heap->in_use, heap->free,
+           (heap->arena > 0.0) ? (heap->free / heap->arena) : 0.0);
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double da = *(const double *) a;
+    double db = *(const double *) b;
+
+    return ((da < db) ? -1 : (da > db));
+}
+
+/* nearest rank */
+static double percentile(const double *sorted, uint32_t count, uint32_t percent) {
+    uint32_t rank = (uint32_t) ceil(count * (percent / 100.0));
+
+    if (rank == 0) rank = 1;
+    return (sorted[rank - 1]);
+}
+
+static void print_json_latency(const char *key, double *ns, uint32_t count, int last) {
+    const char *end = last ? "" : ",";
+
+    if (count == 0) {
+        printf("      \"%s\": null%s\n", key, end);
+        return;
+    }
+    qsort(ns, count, sizeof(double), cmp_double);
+    printf("      \"%s\": { \"p50\": %.4f, \"p90\": %.4f, \"p99\": %.4f, \"max\": %.4f }%s\n",
+           key, percentile(ns, count, 50) / 1000000.0, percentile(ns, count, 90) / 1000000.0,
+           percentile(ns, count, 99) / 1000000.0, ns[count - 1] / 1000000.0, end);
+}
+
+static int memory_run(char **files, uint32_t file_count, uint32_t count, int last) {
+    struct _handle_parts parts;
+    struct _heap_info heap_open, heap_half, heap_closed;
+    int heap_open_ok, heap_half_ok, heap_closed_ok;
+    midi **handle = (midi **) calloc(count, sizeof(midi *));
+    double *open_ns = (double *) malloc(count * sizeof(double));
+    double *close_ns = (double *) malloc(count * sizeof(double));
+    double rss_base, rss_open, rss_closed, per_handle, known, start;
+    uint32_t opened, closed = 0;
+    uint32_t i, div;
+
+    if ((handle == NULL) || (open_ns == NULL) || (close_ns == NULL)) {
+        fprintf(stderr, "Unable to allocate %lu handles\n", (unsigned long) count);
+        free(handle);
+        free(open_ns);
+        free(close_ns);
+        return (-1);
+    }
+
+    rss_base = rss_bytes();
+    for (opened = 0; opened < count; opened++) {
+        start = now_ns();
+        handle[opened] = WildMidi_Open(files[opened % file_count]);
+        open_ns[opened] = now_ns() - start;
+        if (handle[opened] == NULL) {
+            fprintf(stderr, "Stopped at %lu handles: %s\n", (unsigned long) opened,
+                    WildMidi_GetError());
+            break;
+        }
+    }
+    rss_open = rss_bytes();
+    heap_open_ok = heap_info(&heap_open);
+
+    memset(&parts, 0, sizeof(parts));
+    for (i = 0; i < opened; i++) {
+        add_handle_parts(handle[i], &parts);
+    }
+
+    /* every other handle first, to see the holes that leaves */
+    for (i = 1; i < opened; i += 2) {
+        start = now_ns();
+        WildMidi_Close(handle[i]);
+        close_ns[closed++] = now_ns() - start;
+    }
+    heap_half_ok = heap_info(&heap_half);
+    for (i = 0; i < opened; i += 2) {
+        start = now_ns();
+        WildMidi_Close(handle[i]);
+        close_ns[closed++] = now_ns() - start;
+    }
+    rss_closed = rss_bytes();
+    heap_closed_ok = heap_info(&heap_closed);
+
+    per_handle = ((rss_base >= 0.0) && (opened != 0)) ? ((rss_open - rss_base) / opened) : -1.0;
+    known = parts.mdi + parts.note_table + parts.events + parts.reverb
+            + parts.mix_buffer + parts.patch_list;
+    div = (opened != 0) ? opened : 1;
+
+    printf("    {\n");
+    printf("      \"handles\": %lu,\n", (unsigned long) count);
+    printf("      \"opened\": %lu,\n", (unsigned long) opened);
+    print_json_bytes("rss_base_bytes", rss_base, 0);
+    print_json_bytes("rss_open_bytes", rss_open, 0);
+    print_json_bytes("rss_closed_bytes", rss_closed, 0);
+    print_json_bytes("rss_per_handle_bytes", per_handle, 0);
+    printf("      \"allocated_per_handle_bytes\": { \"note_table\": %.0f, \"mdi\": %.0f, \"events\": %.0f, \"reverb\": %.0f, \"mix_buffer\": %.0f, \"patch_list\": %.0f, \"total\": %.0f },\n",
+           parts.note_table / div, parts.mdi / div, parts.events / div,
+           parts.reverb / div, parts.mix_buffer / div, parts.patch_list / div,
+           known / div);
+    print_json_heap("heap_open", heap_open_ok, &heap_open);
+    print_json_heap("heap_half_closed", heap_half_ok, &heap_half);
+    print_json_heap("heap_closed", heap_closed_ok, &heap_closed);
+    print_json_latency("open_ms", open_ns, closed, 0);
+    print_json_latency("close_ms", close_ns, closed, 1);
+    printf("    }%s\n", last ? "" : ",");
+
+    free(handle);
+    free(open_ns);
+    free(close_ns);
+    return (0);
+}
+
+static int memory_bench(char **files, uint32_t file_count, const struct _list *counts) {
+    midi **pin;
+    uint32_t i;
+    int c;
+    int ret = 0;
+
+    if (file_count == 0) {
+        fprintf(stderr, "--memory needs midi files to open\n");
+        return (1);
+    }
+    if (WildMidi_Init(config_file, rate, 0) == -1) {
+        fprintf(stderr, "%s\n", WildMidi_GetError());
+        return (1);
+    }
+    if ((pin = (midi **) calloc(file_count, sizeof(midi *))) == NULL) {
+        fprintf(stderr, "Unable to allocate handles\n");
+        WildMidi_Shutdown();
+        return (1);
+    }
+    for (i = 0; i < file_count; i++) {
+        if ((pin[i] = WildMidi_Open(files[i])) == NULL) {
+            fprintf(stderr, "Unable to open %s: %s\n", files[i], WildMidi_GetError());
+            ret = 1;
+            goto _end;
+        }
+    }
+
+    printf("{\n");
+    printf("  \"bench\": \"memory\",\n");
+    printf("  \"config\": ");
+    print_json_string(config_file);
+    printf(",\n  \"files\": %lu,\n", (unsigned long) file_count);
+    printf("  \"rate\": %u,\n", rate);
+    printf("  \"runs\": [\n");
+    for (c = 0; c < counts->count; c++) {
+        if (memory_run(files, file_count, (uint32_t) counts->value[c],
+                       (c == counts->count - 1)) == -1) {
+            ret = 1;
+            break;
+        }
+    }
+    printf("  ]\n}\n");
+
+_end:
+    for (i = 0; i < file_count; i++) {
+        if (pin[i] != NULL) WildMidi_Close(pin[i]);
+    }
+    free(pin);
+    WildMidi_Shutdown();
+    return (ret);
+}
+
+static void do_help(void) {
+    printf("Usage: wildmidi-bench [options]\n\n");
+    printf("Times the mixer kernels with made up voices. Voice rows are per\n");
+    printf("voice-frame with the cost of mixing no voices taken off, the other\n");
+    printf("rows are per frame. Without -a one axis is changed at a time from\n");
+    printf("64 voices at 1x pitch, looped, holding, in 1024 frame blocks.\n\n");
+    printf("  -v N,N,..  --voices  Voice counts, 1 to 512\n");
+    printf("  -p R,R,..  --pitch   Pitch ratios, 0.25 to 8\n");
+    printf("  -b N,N,..  --block   Block sizes in frames, 1 to 65536\n");
+    printf("  -r N       --runs    Timed runs of each, 2 to 256 (default 9)\n");
+    printf("  -w N       --work    Voice-frames mixed per run (default 1048576)\n");
+    printf("  -o N       --rate    Output rate (default 44100)\n");
+    printf("  -a         --all     Every combination of the axes\n");
+    printf("  -h         --help    This help\n\n");
+    printf("Usage: wildmidi-bench -t N [options] midifile ...\n\n");
+    printf("Renders handles playing the files from 1, 2, 4 ... up to N threads\n");
+    printf("and reports the frames rendered per second, how that scales with\n");
+    printf("the threads, how often handles were reopened and how long opening\n");
+    printf("and closing took. Builds with WANT_LOCK_STATS also report the time\n");
+    printf("spent waiting on each library lock.\n\n");
+    printf("  -t N       --threads Most threads, 1 to %d\n", MAX_THREADS);
+    printf("  -m N       --handles Handles to render (default 64)\n");
+    printf("  -c FILE    --config  Config file (default %s)\n", WILDMIDI_CFG);
+    printf("  -s S       --seconds Seconds to render for each thread count (default 2)\n");
+    printf("  -x N       --churn   Also reopen a handle every N blocks a thread renders\n");
+    printf("  -b N                 Block size in frames (default 1024)\n");
+    printf("  -o N                 Output rate (default 44100)\n\n");
+    printf("Usage: wildmidi-bench -M N,N,.. [options] midifile ...\n\n");
+    printf("Opens each number of handles over the files, then closes every other\n");
+    printf("handle and then the rest. Writes JSON with the resident memory per\n");
+    printf("handle, the bytes allocated for each main structure of a handle, the\n");
+    printf("heap in use and free after each step and percentiles of the open and\n");
+    printf("close times. fragmentation is the part of the heap that is free.\n\n");
+    printf("  -M N,N,..  --memory  Numbers of handles, 1 to 1000000\n");
+    printf("  -c FILE    --config  Config file (default %s)\n", WILDMIDI_CFG);
+    printf("  -o N                 Output rate (default 44100)\n");
+}
+
+int main(int argc, char **argv) {
+    struct _list voices = { { 1, 2, 4, 8, 16, 32, 64, 128, 256, 512 }, 10, 0 };
+    struct _list ratios = { { 0.25, 0.5, 1, 2, 4, 8 }, 6, 0 };
+    struct _list blocks = { { 64, 256, 1024, 4096 }, 4, 0 };
+    struct _list loops = { { 0, 1 }, 2, 1 };
+    struct _list envs = { { ENV_ATTACK, ENV_HOLD, ENV_RELEASE }, 3, ENV_HOLD };
+    struct _list memory = { { 0 }, 0, 0 };
+    struct _list *axis[5];
+    struct _bench_result empty[2][MAX_LIST];
+    struct _bench_result pack_res, reverb_res, voice_res;
+    struct _bench_result base_reverb, base_voice[2];
+    struct _bench_cfg cfg;
+    int idx[5];
+    int all = 0;
+    int ch, i, a, gauss, decimate;
+    double max_ratio = 0.0;
+    uint32_t max_block = 0;
+    unsigned long val;
+
+    while ((ch = getopt_long(argc, argv, "v:p:b:r:w:o:at:m:c:s:x:M:h", long_options, NULL)) != -1) {
+        switch (ch) {
+        case 'v':
+            if (parse_list(optarg, &voices, 1, MAX_VOICES) == -1) {
+                fprintf(stderr, "Voice counts must be 1 to %d\n", MAX_VOICES);
+                return (1);
+            }
+            break;
+        case 'p':
+            if (parse_list(optarg, &ratios, 0.25, 8) == -1) {
+                fprintf(stderr, "Pitch ratios must be 0.25 to 8\n");
+                return (1);
+            }
+            break;
+        case 'b':
+            if (parse_list(optarg, &blocks, 1, MAX_BLOCK) == -1) {
+                fprintf(stderr, "Block sizes must be 1 to %d frames\n", MAX_BLOCK);
+                return (1);
+            }
+            break;
+        case 'r':
+            val = strtoul(optarg, NULL, 10);
+            if ((val < 2) || (val > MAX_RUNS)) {
+                fprintf(stderr, "Runs must be 2 to %d\n", MAX_RUNS);
+                return (1);
+            }
+            runs = (uint32_t) val;
+            break;
+        case 'w':
+            val = strtoul(optarg, NULL, 10);
+            if (val == 0) {
+                fprintf(stderr, "Work must be at least 1 voice-frame\n");
+                return (1);
+            }
+            work = (uint32_t) val;
+            break;
+        case 'o':
+            val = strtoul(optarg, NULL, 10);
+            if ((val < 11025) || (val > 65535)) {
+                fprintf(stderr, "Rate must be 11025 to 65535\n");
+                return (1);
+            }
+            rate = (uint16_t) val;
+            break;
+        case 'a':
+            all = 1;
+            break;
+        case 't':
+            val = strtoul(optarg, NULL, 10);
+            if ((val < 1) || (val > MAX_THREADS)) {
+                fprintf(stderr, "Threads must be 1 to %d\n", MAX_THREADS);
+                return (1);
+            }
+            threads = (uint32_t) val;
+            break;
+        case 'm':
+            val = strtoul(optarg, NULL, 10);
+            if (val < 1) {
+                fprintf(stderr, "Handles must be at least 1\n");
+                return (1);
+            }
+            handles = (uint32_t) val;
+            break;
+        case 'c':
+            config_file = optarg;
+            break;
+        case 's':
+            seconds = strtod(optarg, NULL);
+            if ((seconds < 0.01) || (seconds > 3600.0)) {
+                fprintf(stderr, "Seconds must be 0.01 to 3600\n");
+                return (1);
+            }
+            break;
+        case 'x':
+            churn = (uint32_t) strtoul(optarg, NULL, 10);
+            break;
+        case 'M':
+            if (parse_list(optarg, &memory, 1, 1000000) == -1) {
+                fprintf(stderr, "Numbers of handles must be 1 to 1000000\n");
+                return (1);
+            }
+            for (i = 0; i < memory.count; i++) memory.value[i] = floor(memory.value[i]);
+            break;
+        case 'h':
+            do_help();
+            return (0);
+        default:
+            do_help();
+            return (1);
+        }
+    }
+
+    for (i = 0; i < voices.count; i++) voices.value[i] = floor(voices.value[i]);
+    for (i = 0; i < blocks.count; i++) {
+        blocks.value[i] = floor(blocks.value[i]);
+        if (blocks.value[i] > max_block) max_block = (uint32_t) blocks.value[i];
+    }
+    for (i = 0; i < ratios.count; i++) {
+        if (ratios.value[i] > max_ratio) max_ratio = ratios.value[i];
+    }
+    set_base(&voices, 64);
+    set_base(&ratios, 1);
+    set_base(&blocks, 1024);
+
+    if (memory.count) {
+        return (memory_bench(&argv[optind], (uint32_t) (argc - optind), &memory));
+    }
+    if (threads) {
+        return (thread_bench(&argv[optind], (uint32_t) (argc - optind),
+                             (uint32_t) blocks.value[blocks.base]));
+    }
+
+    memset(&base_reverb, 0, sizeof(base_reverb));
+    memset(base_voice, 0, sizeof(base_voice));
+    if (init_bench(max_ratio, max_block) == -1) {
+        free_bench();
+        return (1);
+    }
+
+    printf("# %u Hz, mean and sd of %lu runs, %s\n", rate, (unsigned long) runs,
+#ifdef HAVE_TSC
+           "cycles are time stamp counter ticks"
+#else
+           "no cycle counter on this machine"
+#endif
+           );
+    print_header();
+
+    /* the kernels that cost the same whatever is playing */
+    memset(&cfg, 0, sizeof(cfg));
+    for (i = 0; i < blocks.count; i++) {
+        cfg.block = (uint32_t) blocks.value[i];
+        measure(NULL, run_pack, &cfg, 0, kernel_frames(&cfg), 0, 0, &pack_res);
+        print_row("pack", "-", &cfg, 0, &pack_res);
+
+        for (decimate = 0; decimate < 2; decimate++) {
+            _WM_reverb_decimate = decimate;
+            if ((bench_rvb = _WM_init_reverb(rate, _WM_reverb_room_width,
+                    _WM_reverb_room_length, _WM_reverb_listen_posx,
+                    _WM_reverb_listen_posy)) == NULL) {
+                fprintf(stderr, "Unable to init reverb\n");
+                free_bench();
+                return (1);
+            }
+            measure(NULL, run_reverb, &cfg, 0, kernel_frames(&cfg), 0, 0, &reverb_res);
+            print_row(decimate ? "reverb/2" : "reverb", "-", &cfg, 0, &reverb_res);
+            if ((i == blocks.base) && (!decimate)) {
+                base_reverb = reverb_res;
+            }
+            _WM_free_reverb(bench_rvb);
+            bench_rvb = NULL;
+        }
+        _WM_reverb_decimate = 0;
+
+        for (gauss = 0; gauss < 2; gauss++) {
+            cfg.gauss = gauss;
+            cfg.voices = 0;
+            measure(setup_voices, run_mix, &cfg, 0, kernel_frames(&cfg), 0, 0,
+                    &empty[gauss][i]);
+            print_row("mix", gauss ? "gauss" : "linear", &cfg, 0, &empty[gauss][i]);
+        }
+        cfg.gauss = 0;
+    }
+
+    /* then the voices, on top of the cost of mixing none */
+    axis[0] = &voices;
+    axis[1] = &ratios;
+    axis[2] = &loops;
+    axis[3] = &envs;
+    axis[4] = &blocks;
+    for (gauss = 0; gauss < 2; gauss++) {
+        for (a = 0; a < 5; a++) {
+            for (i = 0; i < 5; i++) idx[i] = axis[i]->base;
+            if (all) {
+                for (i = 0; i < 5; i++) idx[i] = 0;
+            } else {
+                idx[a] = 0;
+            }
+            for (;;) {
+                int b;
+
+                /* the base point is only done with the first axis */
+                if (all || (a == 0) || (idx[a] != axis[a]->base)) {
+                    cfg.gauss = gauss;
+                    cfg.voices = (uint32_t) voices.value[idx[0]];
+                    cfg.ratio = ratios.value[idx[1]];
+                    cfg.loop = (int) loops.value[idx[2]];
+                    cfg.env = (int) envs.value[idx[3]];
+                    cfg.block = (uint32_t) blocks.value[idx[4]];
+                    b = block_index(&blocks, cfg.block);
+                    measure(setup_voices, run_mix, &cfg, voice_frames(&cfg),
+                            (double) voice_frames(&cfg) * cfg.voices,
+                            empty[gauss][b].ns, empty[gauss][b].cycles, &voice_res);
+                    print_row("voices", gauss ? "gauss" : "linear", &cfg, 1, &voice_res);
+                    if ((idx[0] == voices.base) && (idx[1] == ratios.base)
+                        && (idx[2] == loops.base) && (idx[3] == envs.base)
+                        && (idx[4] == blocks.base)) {
+                        base_voice[gauss] = voice_res;
+                    }
+                }
+                if (all) {
+                    for (i = 4; i >= 0; i--) {
+                        if (++idx[i] < axis[i]->count) break;
+                        idx[i] = 0;
+                    }
+                    if (i < 0) break;
+                } else if (++idx[a] == axis[a]->count) {
+                    break;
+                }
+            }
+            if (all) break;
+        }
+    }
+
+    printf("# cost model for WildMidi_SetCostModel: mix_ns %.1f linear_ns %.1f gauss_ns %.1f reverb_ns %.1f\n",
+           empty[0][blocks.base].ns, base_voice[0].ns, base_voice[1].ns, base_reverb.ns);
+
+    free_bench();
+    return (0);
+}
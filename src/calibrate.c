@@ -0,0 +1,197 @@
+/*
+ * calibrate.c -- Midi Wavetable Processing library
+ *
+ * Copyright (C) WildMIDI Developers 2001-2016
+ *
+ * This file is part of WildMIDI.
+ *
+ * WildMIDI is free software: you can redistribute and/or modify the player
+ * under the terms of the GNU General Public License and you can redistribute
+ * and/or modify the library under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3 of
+ * the licenses, or(at your option) any later version.
+ *
+ * WildMIDI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License and
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License and the
+ * GNU Lesser General Public License along with WildMIDI.  If not,  see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include "common.h"
+#include "wm_error.h"
+#include "wildmidi_lib.h"
+#include "internal_midi.h"
+#include "reverb.h"
+#include "sample.h"
+
+/*
+ Times the mixer on this machine for WildMidi_Calibrate. The voices are
+ made up in memory, the way wildmidi-bench makes them, so the figures
+ don't depend on the patches that are loaded. Each figure is the
+ fastest of a few runs, as anything else running can only slow a run
+ down, and with the defaults the whole calibration takes around 0.1s.
+ */
+
+#define CAL_VOICES 16
+#define CAL_BLOCK 1024 /* frames */
+#define CAL_BLOCKS 8
+#define CAL_RUNS 3
+#define CAL_MARGIN 64 /* room for the gauss window past either end */
+#define CAL_LOOP 4096
+
+static double cal_now_ns(void) {
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
+
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return ((double) count.QuadPart * 1000000000.0 / (double) freq.QuadPart);
+#elif defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((double) ts.tv_sec * 1000000000.0 + (double) ts.tv_nsec);
+#else
+    return ((double) clock() * (1000000000.0 / CLOCKS_PER_SEC));
+#endif
+}
+
+/*
+ Sustained voices on a looped sample, each at its own point in the loop
+ and detuned a little, so none of them sit on whole sample points where
+ the gauss mixer takes a short cut.
+ */
+static void cal_voices(struct _mdi *mdi, struct _sample *sample, uint32_t voices) {
+    struct _note *prev = NULL;
+    struct _note *nte;
+    uint32_t v;
+
+    memset(mdi->note_table, 0, sizeof(mdi->note_table));
+    for (v = 0; v < voices; v++) {
+        nte = &mdi->note_table[0][0][v];
+        nte->noteid = (uint16_t) v;
+        nte->velocity = 100;
+        nte->sample = sample;
+        nte->sample_pos = ((CAL_MARGIN + ((v * 257) % CAL_LOOP)) << FPBITS)
+                          | (((v * 389) + 123) & FPMASK);
+        nte->sample_inc = (1 << FPBITS) + 37 + (v * 3);
+        nte->modes = sample->modes;
+        nte->env = 3;
+        nte->env_level = 4194303;
+        nte->env_inc = 0;
+        nte->left_mix_volume = 300 + (v * 11);
+        nte->right_mix_volume = 500 - (v * 11);
+        nte->active = 1;
+        nte->next = prev;
+        prev = nte;
+    }
+    mdi->note = prev;
+}
+
+/* nanoseconds per frame to mix voices with options */
+static double cal_time(struct _mdi *mdi, struct _sample *sample, int8_t *buffer,
+                       uint32_t voices, uint16_t options) {
+    double best = 0.0;
+    double start, took;
+    uint32_t run, block;
+
+    cal_voices(mdi, sample, voices);
+    mdi->extra_info.mixer_options = options;
+    _WM_mix_block(mdi, buffer, CAL_BLOCK * 4);
+
+    for (run = 0; run < CAL_RUNS; run++) {
+        start = cal_now_ns();
+        for (block = 0; block < CAL_BLOCKS; block++) {
+            _WM_mix_block(mdi, buffer, CAL_BLOCK * 4);
+        }
+        took = cal_now_ns() - start;
+        if ((run == 0) || (took < best)) best = took;
+    }
+    return (best / (CAL_BLOCK * CAL_BLOCKS));
+}
+
+static float cal_per_voice(double with, double without) {
+    return ((with > without) ? (float) ((with - without) / CAL_VOICES) : 0.0f);
+}
+
+int _WM_calibrate(struct _WM_CostModel *model) {
+    struct _sample sample;
+    struct _mdi *mdi;
+    int16_t *data;
+    int8_t *buffer;
+    uint32_t length = CAL_LOOP + (2 * CAL_MARGIN);
+    uint32_t seed = 12345;
+    uint32_t i;
+    double base, gauss_base, took;
+
+    data = (int16_t *) malloc(length * sizeof(int16_t));
+    buffer = (int8_t *) malloc(CAL_BLOCK * 4);
+    if ((data == NULL) || (buffer == NULL)) {
+        _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, 0);
+        free(data);
+        free(buffer);
+        return (-1);
+    }
+    for (i = 0; i < length; i++) {
+        seed = (seed * 1103515245) + 12345;
+        data[i] = (int16_t) ((((i * 131) & 0x3fff) - 0x2000) + ((seed >> 20) & 0x3ff));
+    }
+    memset(&sample, 0, sizeof(struct _sample));
+    sample.data = data;
+    sample.data_length = length << FPBITS;
+    sample.loop_start = CAL_MARGIN << FPBITS;
+    sample.loop_end = (CAL_MARGIN + CAL_LOOP) << FPBITS;
+    sample.loop_size = CAL_LOOP << FPBITS;
+    sample.modes = SAMPLE_16BIT | SAMPLE_ENVELOPE | SAMPLE_LOOP | SAMPLE_SUSTAIN;
+    sample.env_target[0] = 4194303;
+    sample.env_target[3] = 4194303;
+
+    mdi = _WM_initMDI(0);
+    if ((mdi == NULL) || ((mdi->reverb = _WM_init_reverb(_WM_SampleRate,
+            _WM_reverb_room_width, _WM_reverb_room_length,
+            _WM_reverb_listen_posx, _WM_reverb_listen_posy)) == NULL)) {
+        _WM_GLOBAL_ERROR(WM_ERR_MEM, "(calibrate)", 0);
+        if (mdi) _WM_freeMDI(mdi);
+        free(data);
+        free(buffer);
+        return (-1);
+    }
+    /* no events, the mixer plays the voices for as long as it is asked */
+    mdi->events[0].evtype = ev_null;
+    mdi->events[0].do_event = NULL;
+    mdi->events[0].samples_to_next = 0;
+    mdi->current_event = mdi->events;
+    mdi->extra_info.approx_total_samples = 0xffffffff;
+
+    base = cal_time(mdi, &sample, buffer, 0, 0);
+    gauss_base = cal_time(mdi, &sample, buffer, 0, WM_MO_ENHANCED_RESAMPLING);
+    model->mix_ns = (float) base;
+    model->linear_ns = cal_per_voice(cal_time(mdi, &sample, buffer, CAL_VOICES, 0), base);
+    model->gauss_ns = cal_per_voice(cal_time(mdi, &sample, buffer, CAL_VOICES,
+                                             WM_MO_ENHANCED_RESAMPLING), gauss_base);
+    /* the cost model takes reverb_ns before decimation */
+    took = cal_time(mdi, &sample, buffer, 0, WM_MO_REVERB);
+    model->reverb_ns = (took > base) ? (float) ((took - base) * mdi->reverb->decimate) : 0.0f;
+
+    mdi->note = NULL;
+    _WM_freeMDI(mdi);
+    free(data);
+    free(buffer);
+    return (0);
+}
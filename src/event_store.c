@@ -0,0 +1,602 @@
+/*
+ * event_store.c -- Midi Wavetable Processing library
+ *
+ * Copyright (C) WildMIDI Developers 2001-2016
+ *
+ * This file is part of WildMIDI.
+ *
+ * WildMIDI is free software: you can redistribute and/or modify the player
+ * under the terms of the GNU General Public License and you can redistribute
+ * and/or modify the library under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3 of
+ * the licenses, or(at your option) any later version.
+ *
+ * WildMIDI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License and
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License and the
+ * GNU Lesser General Public License along with WildMIDI.  If not,  see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "lock.h"
+#include "wm_error.h"
+#include "wildmidi_lib.h"
+#include "internal_midi.h"
+#include "event_store.h"
+
+/*
+ Event editing. The first edit of a handle moves its events into chunks
+ (see struct _event_chunk) owned by that handle alone, copying them if
+ they are shared with clones. An edit finds its chunk with a binary search
+ on the chunk start positions and only moves events within that chunk.
+ The samples_to_next of the event before the edit takes up the change,
+ so nothing else moves in time and playback carries on where it was.
+ */
+
+/* the next event to play, kept as a chunk and index while chunks change */
+struct _cursor {
+    uint32_t chunk;
+    uint32_t index;
+};
+
+static int has_string(const struct _event *event) {
+    switch (event->evtype) {
+    case ev_meta_text:
+    case ev_meta_copyright:
+    case ev_meta_trackname:
+    case ev_meta_instrumentname:
+    case ev_meta_lyric:
+    case ev_meta_marker:
+    case ev_meta_cuepoint:
+        return (1);
+    default:
+        return (0);
+    }
+}
+
+static void free_chunks(struct _event_chunk *chunks, uint32_t chunk_count, int strings) {
+    uint32_t c;
+
+    for (c = 0; c < chunk_count; c++) {
+        if (strings)
+            _WM_free_event_strings(chunks[c].events, chunks[c].count);
+        free(chunks[c].events);
+    }
+    free(chunks);
+}
+
+/* end chunk c with a link to the next one, or the end of song */
+static void link_chunk(struct _mdi *mdi, uint32_t c) {
+    struct _event *end = &mdi->chunks[c].events[mdi->chunks[c].count];
+
+    end->do_event = NULL;
+    end->event_data.channel = 0;
+    end->samples_to_next = 0;
+    end->samples_to_next_fixed = 0;
+    if (c + 1 < mdi->chunk_count) {
+        end->evtype = ev_link;
+        end->event_data.data.next = mdi->chunks[c + 1].events;
+    } else {
+        end->evtype = ev_null;
+        end->event_data.data.value = 0;
+    }
+}
+
+/* after chunk c was added, removed or replaced */
+static void relink(struct _mdi *mdi, uint32_t c) {
+    if (c > 0)
+        link_chunk(mdi, c - 1);
+    if (c < mdi->chunk_count)
+        link_chunk(mdi, c);
+    if (c + 1 < mdi->chunk_count)
+        link_chunk(mdi, c + 1);
+    mdi->events = mdi->chunks[0].events;
+}
+
+/* the last chunk starting at or before sample_pos */
+static uint32_t find_chunk(struct _mdi *mdi, uint32_t sample_pos) {
+    uint32_t lo = 0;
+    uint32_t hi = mdi->chunk_count - 1;
+    uint32_t mid;
+
+    while (lo < hi) {
+        mid = (lo + hi + 1) >> 1;
+        if (mdi->chunks[mid].start <= sample_pos) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return (lo);
+}
+
+static void find_cursor(struct _mdi *mdi, struct _cursor *cur) {
+    struct _event *current = mdi->current_event;
+    struct _event_chunk *chunk;
+    uint32_t c;
+
+    /*
+     The current event sits at current_sample + samples_to_mix, except
+     past the end of the song, so look there first.
+     */
+    c = find_chunk(mdi, mdi->extra_info.current_sample + mdi->samples_to_mix);
+    for (;;) {
+        chunk = &mdi->chunks[c];
+        if ((current >= chunk->events) && (current <= &chunk->events[chunk->count])) {
+            cur->chunk = c;
+            cur->index = (uint32_t) (current - chunk->events);
+            return;
+        }
+        if (c == 0) break;
+        c--;
+    }
+    for (c = 0; c < mdi->chunk_count; c++) {
+        chunk = &mdi->chunks[c];
+        if ((current >= chunk->events) && (current <= &chunk->events[chunk->count])) {
+            cur->chunk = c;
+            cur->index = (uint32_t) (current - chunk->events);
+            return;
+        }
+    }
+    cur->chunk = mdi->chunk_count - 1;
+    cur->index = mdi->chunks[cur->chunk].count;
+}
+
+/* never leaves the cursor on a link */
+static struct _event *cursor_event(struct _mdi *mdi, struct _cursor *cur) {
+    if ((cur->index >= mdi->chunks[cur->chunk].count)
+        && (cur->chunk + 1 < mdi->chunk_count)) {
+        cur->chunk++;
+        cur->index = 0;
+    }
+    return (&mdi->chunks[cur->chunk].events[cur->index]);
+}
+
+/*
+ Gives mdi chunked events of its own, copying them out of the flat list
+ the parser made or out of the store shared with clones.
+ */
+static int own_chunks(struct _mdi *mdi, struct _cursor *cur) {
+    struct _event_chunk *chunks;
+    struct _event *event;
+    struct _event *copy;
+    uint32_t chunk_count;
+    uint32_t sample_pos = 0;
+    uint32_t c;
+    uint32_t i;
+    int shared = 0;
+    int last = 0;
+
+    if (mdi->event_store) {
+        _WM_Lock(&mdi->event_store->lock);
+        shared = (mdi->event_store->refcount > 1);
+        _WM_Unlock(&mdi->event_store->lock);
+    }
+    if ((mdi->chunks) && (!shared)) {
+        find_cursor(mdi, cur);
+        return (0);
+    }
+
+    chunk_count = (mdi->event_count + EVENT_CHUNK_SIZE - 1) / EVENT_CHUNK_SIZE;
+    if (chunk_count == 0)
+        chunk_count = 1;
+    chunks = (struct _event_chunk *) calloc(chunk_count, sizeof(struct _event_chunk));
+    if (chunks == NULL)
+        goto _nomem;
+    for (c = 0; c < chunk_count; c++) {
+        chunks[c].events = (struct _event *) malloc((EVENT_CHUNK_SIZE + 1) * sizeof(struct _event));
+        if (chunks[c].events == NULL)
+            goto _nomem;
+    }
+
+    /* the end of song, unless the current event turns up on the way */
+    cur->chunk = chunk_count - 1;
+    cur->index = mdi->event_count - (cur->chunk * EVENT_CHUNK_SIZE);
+
+    event = mdi->events;
+    for (c = 0; c < chunk_count; c++) {
+        chunks[c].start = sample_pos;
+        for (i = 0; (i < EVENT_CHUNK_SIZE) && (event->evtype != ev_null); i++) {
+            copy = &chunks[c].events[i];
+            memcpy(copy, event, sizeof(struct _event));
+            if ((shared) && (has_string(event))) {
+                copy->event_data.data.string = (char *) malloc(strlen(event->event_data.data.string) + 1);
+                if (copy->event_data.data.string == NULL) {
+                    chunks[c].count = i;
+                    goto _nomem;
+                }
+                strcpy(copy->event_data.data.string, event->event_data.data.string);
+            }
+            if (event == mdi->current_event) {
+                cur->chunk = c;
+                cur->index = i;
+            }
+            sample_pos += event->samples_to_next;
+            event = WM_NEXT_EVENT(event);
+        }
+        chunks[c].count = i;
+    }
+
+    if (shared) {
+        _WM_Lock(&mdi->event_store->lock);
+        last = (--mdi->event_store->refcount == 0);
+        _WM_Unlock(&mdi->event_store->lock);
+        if (last) {
+            /* the clones went while we were copying */
+            free(mdi->event_store);
+        }
+        mdi->event_store = NULL;
+    }
+    if ((!shared) || (last)) {
+        if (mdi->chunks) {
+            free_chunks(mdi->chunks, mdi->chunk_count, shared);
+        } else {
+            if (shared)
+                _WM_free_event_strings(mdi->events, mdi->event_count);
+            free(mdi->events);
+        }
+    }
+
+    mdi->chunks = chunks;
+    mdi->chunk_count = chunk_count;
+    mdi->chunks_size = chunk_count;
+    mdi->events_size = 0;
+    for (c = 0; c < chunk_count; c++) {
+        link_chunk(mdi, c);
+    }
+    mdi->events = chunks[0].events;
+    mdi->current_event = cursor_event(mdi, cur);
+    return (0);
+
+_nomem:
+    if (chunks)
+        free_chunks(chunks, chunk_count, shared);
+    _WM_GLOBAL_ERROR(WM_ERR_MEM, "to edit events", 0);
+    return (-1);
+}
+
+/* a new, empty chunk at c */
+static int add_chunk(struct _mdi *mdi, uint32_t c) {
+    struct _event *events;
+
+    if (mdi->chunk_count == mdi->chunks_size) {
+        struct _event_chunk *chunks = (struct _event_chunk *) realloc(mdi->chunks,
+                                        (mdi->chunks_size * 2) * sizeof(struct _event_chunk));
+        if (chunks == NULL) {
+            _WM_GLOBAL_ERROR(WM_ERR_MEM, "to edit events", 0);
+            return (-1);
+        }
+        mdi->chunks = chunks;
+        mdi->chunks_size *= 2;
+    }
+    events = (struct _event *) malloc((EVENT_CHUNK_SIZE + 1) * sizeof(struct _event));
+    if (events == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_MEM, "to edit events", 0);
+        return (-1);
+    }
+
+    memmove(&mdi->chunks[c + 1], &mdi->chunks[c],
+            (mdi->chunk_count - c) * sizeof(struct _event_chunk));
+    mdi->chunks[c].events = events;
+    mdi->chunks[c].count = 0;
+    mdi->chunks[c].start = 0;
+    mdi->chunk_count++;
+    return (0);
+}
+
+/* moves the top half of full chunk c into a new chunk after it */
+static int split_chunk(struct _mdi *mdi, uint32_t c, struct _cursor *cur) {
+    struct _event_chunk *from;
+    struct _event_chunk *to;
+    uint32_t half = EVENT_CHUNK_SIZE / 2;
+    uint32_t sample_pos;
+    uint32_t i;
+
+    if (add_chunk(mdi, c + 1) != 0)
+        return (-1);
+
+    from = &mdi->chunks[c];
+    to = &mdi->chunks[c + 1];
+    sample_pos = from->start;
+    for (i = 0; i < half; i++) {
+        sample_pos += from->events[i].samples_to_next;
+    }
+    to->start = sample_pos;
+    to->count = from->count - half;
+    /* the link or end of song goes with them */
+    memcpy(to->events, &from->events[half], (to->count + 1) * sizeof(struct _event));
+    from->count = half;
+
+    if (cur->chunk > c) {
+        cur->chunk++;
+    } else if ((cur->chunk == c) && (cur->index >= half)) {
+        cur->chunk++;
+        cur->index -= half;
+    }
+    relink(mdi, c);
+    return (0);
+}
+
+/* appends chunk c + 1 to chunk c, which must have room for it */
+static void merge_chunks(struct _mdi *mdi, uint32_t c, struct _cursor *cur) {
+    struct _event_chunk *to = &mdi->chunks[c];
+    struct _event_chunk *from = &mdi->chunks[c + 1];
+
+    if (to->count == 0)
+        to->start = from->start;
+    memcpy(&to->events[to->count], from->events, (from->count + 1) * sizeof(struct _event));
+
+    if (cur->chunk == c + 1) {
+        cur->chunk = c;
+        cur->index += to->count;
+    } else if (cur->chunk > c + 1) {
+        cur->chunk--;
+    }
+
+    to->count += from->count;
+    free(from->events);
+    memmove(from, from + 1, (mdi->chunk_count - c - 2) * sizeof(struct _event_chunk));
+    mdi->chunk_count--;
+    relink(mdi, c);
+}
+
+/*
+ Places event after the last one at or before sample_pos. Its
+ samples_to_next is set up here.
+ */
+static int insert_event(struct _mdi *mdi, const struct _event *event,
+                        uint32_t sample_pos, struct _cursor *cur) {
+    struct _event_chunk *chunk;
+    struct _event *prev;
+    struct _event *new_event;
+    uint32_t play_pos = mdi->extra_info.current_sample + mdi->samples_to_mix;
+    int at_end = (mdi->current_event->evtype == ev_null);
+    uint32_t prev_pos;
+    uint32_t c;
+    uint32_t i = 0;
+
+    c = find_chunk(mdi, sample_pos);
+    chunk = &mdi->chunks[c];
+    prev_pos = chunk->start;
+    while ((i + 1 < chunk->count)
+           && (prev_pos + chunk->events[i].samples_to_next <= sample_pos)) {
+        prev_pos += chunk->events[i].samples_to_next;
+        i++;
+    }
+
+    if (chunk->count == EVENT_CHUNK_SIZE) {
+        if (split_chunk(mdi, c, cur) != 0)
+            return (-1);
+        if (i >= EVENT_CHUNK_SIZE / 2) {
+            c++;
+            i -= EVENT_CHUNK_SIZE / 2;
+        }
+        chunk = &mdi->chunks[c];
+    }
+
+    /* i is the event before it, the new one goes in at i + 1 */
+    memmove(&chunk->events[i + 2], &chunk->events[i + 1],
+            (chunk->count - i) * sizeof(struct _event));
+    prev = &chunk->events[i];
+    new_event = &chunk->events[i + 1];
+    memcpy(new_event, event, sizeof(struct _event));
+
+    if ((c + 1 == mdi->chunk_count) && (i + 1 == chunk->count)
+        && (sample_pos > prev_pos + prev->samples_to_next)) {
+        /* past the end, the song gets longer */
+        mdi->extra_info.approx_total_samples += sample_pos - (prev_pos + prev->samples_to_next);
+        new_event->samples_to_next = 0;
+    } else {
+        new_event->samples_to_next = prev_pos + prev->samples_to_next - sample_pos;
+    }
+    prev->samples_to_next = sample_pos - prev_pos;
+
+    chunk->count++;
+    mdi->event_count++;
+    if ((cur->chunk == c) && (cur->index > i))
+        cur->index++;
+
+    /* still to come and before what was going to play next */
+    if ((sample_pos >= mdi->extra_info.current_sample)
+        && ((sample_pos < play_pos) || (at_end))) {
+        cur->chunk = c;
+        cur->index = i + 1;
+        mdi->samples_to_mix = sample_pos - mdi->extra_info.current_sample;
+    }
+    return (0);
+}
+
+/* the event before it takes over its samples_to_next */
+static void remove_event(struct _mdi *mdi, uint32_t c, uint32_t i, struct _cursor *cur) {
+    struct _event_chunk *chunk = &mdi->chunks[c];
+    struct _event *prev;
+    uint32_t samples = chunk->events[i].samples_to_next;
+
+    if (i > 0) {
+        prev = &chunk->events[i - 1];
+    } else {
+        prev = &mdi->chunks[c - 1].events[mdi->chunks[c - 1].count - 1];
+    }
+    prev->samples_to_next += samples;
+
+    if ((cur->chunk == c) && (cur->index == i)) {
+        /* it was next to play, now the one after it is */
+        mdi->samples_to_mix += samples;
+    } else if ((cur->chunk == c) && (cur->index > i)) {
+        cur->index--;
+    }
+
+    memmove(&chunk->events[i], &chunk->events[i + 1],
+            (chunk->count - i) * sizeof(struct _event));
+    chunk->count--;
+    mdi->event_count--;
+    if (i == 0)
+        chunk->start += samples;
+
+    /* keep the chunks from thinning out */
+    if (chunk->count == 0) {
+        if (c > 0) {
+            merge_chunks(mdi, c - 1, cur);
+        } else if (mdi->chunk_count > 1) {
+            merge_chunks(mdi, 0, cur);
+        }
+    } else if ((c + 1 < mdi->chunk_count)
+               && (chunk->count + mdi->chunks[c + 1].count <= EVENT_CHUNK_SIZE / 2)) {
+        merge_chunks(mdi, c, cur);
+    } else if ((c > 0)
+               && (mdi->chunks[c - 1].count + chunk->count <= EVENT_CHUNK_SIZE / 2)) {
+        merge_chunks(mdi, c - 1, cur);
+    }
+}
+
+static int find_event(struct _mdi *mdi, const struct _event *match,
+                      uint32_t sample_pos, struct _cursor *found) {
+    struct _event *event;
+    uint32_t c;
+    uint32_t i = 0;
+    uint32_t pos;
+
+    /* events at sample_pos can start in the chunk before its own */
+    c = (sample_pos > 0) ? find_chunk(mdi, sample_pos - 1) : 0;
+    pos = mdi->chunks[c].start;
+    while (pos <= sample_pos) {
+        if (i == mdi->chunks[c].count) {
+            if (++c == mdi->chunk_count)
+                break;
+            i = 0;
+            continue;
+        }
+        event = &mdi->chunks[c].events[i];
+        if ((pos == sample_pos) && (event->evtype == match->evtype)
+            && (event->event_data.channel == match->event_data.channel)
+            && (event->event_data.data.value == match->event_data.data.value)) {
+            found->chunk = c;
+            found->index = i;
+            return (0);
+        }
+        pos += event->samples_to_next;
+        i++;
+    }
+    _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(no such event at that position)", 0);
+    return (-1);
+}
+
+/*
+ Turns one channel message into an event. Nothing is loaded here, see
+ WildMidi_InsertMidiEvent for the patch an inserted event needs.
+ Song wide events are not editable.
+ */
+static int new_event(const uint8_t *event_data, uint32_t size, struct _event *event) {
+    uint32_t expected;
+
+    if ((size == 0) || (event_data[0] < 0x80) || (event_data[0] >= 0xf0)) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(not a channel message)", 0);
+        return (-1);
+    }
+    expected = (((event_data[0] & 0xf0) == 0xc0) || ((event_data[0] & 0xf0) == 0xd0)) ? 2 : 3;
+    if (size != expected) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(wrong size for message)", 0);
+        return (-1);
+    }
+
+    _WM_ChannelEvent(event_data, event);
+    return (0);
+}
+
+int _WM_InsertEvent(struct _mdi *mdi, const uint8_t *event_data, uint32_t size,
+                    uint32_t sample_pos) {
+    struct _event event;
+    struct _cursor cur;
+    int ret;
+
+    if (new_event(event_data, size, &event) != 0)
+        return (-1);
+    if (own_chunks(mdi, &cur) != 0)
+        return (-1);
+
+    ret = insert_event(mdi, &event, sample_pos, &cur);
+    mdi->current_event = cursor_event(mdi, &cur);
+    return (ret);
+}
+
+int _WM_DeleteEvent(struct _mdi *mdi, const uint8_t *event_data, uint32_t size,
+                    uint32_t sample_pos) {
+    struct _event event;
+    struct _cursor cur;
+    struct _cursor found;
+
+    if (new_event(event_data, size, &event) != 0)
+        return (-1);
+    if (own_chunks(mdi, &cur) != 0)
+        return (-1);
+    if (find_event(mdi, &event, sample_pos, &found) != 0)
+        return (-1);
+
+    _WM_free_event_strings(&mdi->chunks[found.chunk].events[found.index], 1);
+    remove_event(mdi, found.chunk, found.index, &cur);
+    mdi->current_event = cursor_event(mdi, &cur);
+    return (0);
+}
+
+int _WM_MoveEvent(struct _mdi *mdi, const uint8_t *event_data, uint32_t size,
+                  uint32_t sample_pos, uint32_t new_sample_pos) {
+    struct _event event;
+    struct _cursor cur;
+    struct _cursor found;
+
+    if (new_event(event_data, size, &event) != 0)
+        return (-1);
+    if (own_chunks(mdi, &cur) != 0)
+        return (-1);
+    if (find_event(mdi, &event, sample_pos, &found) != 0)
+        return (-1);
+    if (new_sample_pos == sample_pos)
+        return (0);
+
+    /*
+     The copy goes in first so a failed insert loses nothing, the
+     original is then the match left at sample_pos.
+     */
+    memcpy(&event, &mdi->chunks[found.chunk].events[found.index], sizeof(struct _event));
+    if (insert_event(mdi, &event, new_sample_pos, &cur) != 0) {
+        mdi->current_event = cursor_event(mdi, &cur);
+        return (-1);
+    }
+    find_event(mdi, &event, sample_pos, &found);
+    remove_event(mdi, found.chunk, found.index, &cur);
+    mdi->current_event = cursor_event(mdi, &cur);
+    return (0);
+}
+
+/*
+ The first event after sample_pos, and where it plays, or the end of
+ song. Events at sample_pos are taken as played.
+ */
+struct _event *_WM_EventAfter(struct _mdi *mdi, uint32_t sample_pos, uint32_t *event_pos) {
+    struct _event *event = mdi->events;
+    uint32_t pos = 0;
+    uint32_t c;
+
+    if (mdi->chunks) {
+        c = find_chunk(mdi, sample_pos);
+        event = mdi->chunks[c].events;
+        pos = mdi->chunks[c].start;
+    }
+    while ((event->do_event) && (pos <= sample_pos)) {
+        pos += event->samples_to_next;
+        event = WM_NEXT_EVENT(event);
+    }
+    *event_pos = pos;
+    return (event);
+}
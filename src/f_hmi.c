@@ -39,7 +39,7 @@
  Turns hmp file data into an event stream
  */
 struct _mdi *
-_WM_ParseNewHmi(const uint8_t *hmi_data, uint32_t hmi_size) {
+_WM_ParseNewHmi(const uint8_t *hmi_data, uint32_t hmi_size, uint8_t list_only) {
     uint32_t hmi_tmp = 0;
     const uint8_t *hmi_base = hmi_data;
     const uint8_t *data_end = hmi_data + hmi_size;
@@ -107,7 +107,7 @@ _WM_ParseNewHmi(const uint8_t *hmi_data, uint32_t hmi_size) {
         return NULL;
     }
 
-    hmi_mdi = _WM_initMDI();
+    hmi_mdi = _WM_initMDI(list_only);
 
     _WM_midi_setup_divisions(hmi_mdi, hmi_division);
 
@@ -39,7 +39,7 @@
  Turns hmp file data into an event stream
  */
 struct _mdi *
-_WM_ParseNewHmp(const uint8_t *hmp_data, uint32_t hmp_size) {
+_WM_ParseNewHmp(const uint8_t *hmp_data, uint32_t hmp_size, uint8_t list_only) {
     uint8_t is_hmp2 = 0;
     uint32_t zero_cnt = 0;
     uint32_t i = 0;
@@ -185,7 +185,7 @@ _WM_ParseNewHmp(const uint8_t *hmp_data, uint32_t hmp_size) {
         hmp_size -= 712;
     }
 
-    hmp_mdi = _WM_initMDI();
+    hmp_mdi = _WM_initMDI(list_only);
 
     _WM_midi_setup_divisions(hmp_mdi, hmp_divisions);
     _WM_midi_setup_tempo(hmp_mdi, (uint32_t)tempo_f);
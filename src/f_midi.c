@@ -38,7 +38,7 @@
 
 
 struct _mdi *
-_WM_ParseNewMidi(const uint8_t *midi_data, uint32_t midi_size) {
+_WM_ParseNewMidi(const uint8_t *midi_data, uint32_t midi_size, uint8_t list_only) {
     struct _mdi *mdi;
 
     uint32_t tmp_val;
@@ -143,7 +143,7 @@ _WM_ParseNewMidi(const uint8_t *midi_data, uint32_t midi_size) {
 
     samples_per_delta_f = _WM_GetSamplesPerTick(divisions, tempo);
 
-    mdi = _WM_initMDI();
+    mdi = _WM_initMDI(list_only);
     _WM_midi_setup_divisions(mdi,divisions);
 
     tracks = (const uint8_t **) malloc(sizeof(uint8_t *) * no_tracks);
@@ -821,7 +821,7 @@ _WM_Event2Midi(struct _mdi *mdi, uint8_t **out, uint32_t *outsize) {
                 (*out)[track_start - 2] = (track_size >> 8) & 0xff;
                 (*out)[track_start - 1] = track_size & 0xff;
 
-                if (event[1].evtype != ev_null) {
+                if (WM_NEXT_EVENT(event)->evtype != ev_null) {
                     (*out)[out_ofs++] = 'M';
                     (*out)[out_ofs++] = 'T';
                     (*out)[out_ofs++] = 'r';
@@ -974,7 +974,7 @@ _WM_Event2Midi(struct _mdi *mdi, uint8_t **out, uint32_t *outsize) {
         default:
             /* DEBUG */
             /* fprintf(stderr,"Unknown Event %.2x %.4x\n",event->event_data.channel, event->event_data.data.value); */
-            event++;
+            event = WM_NEXT_EVENT(event);
             continue;
         }
 
@@ -994,7 +994,7 @@ _WM_Event2Midi(struct _mdi *mdi, uint8_t **out, uint32_t *outsize) {
             (*out)[out_ofs++] = (((value >> 7) & 0x7f) | 0x80);
         (*out)[out_ofs++] = (value & 0x7f);
     NEXT_EVENT:
-        event++;
+        event = WM_NEXT_EVENT(event);
     } while (event->evtype != ev_null);
 
     if ((_WM_MixerOptions & WM_MO_SAVEASTYPE0) || (!mdi->is_type2)) {
@@ -45,7 +45,7 @@
  Turns mus file data into an event stream.
  */
 struct _mdi *
-_WM_ParseNewMus(const uint8_t *mus_data, uint32_t mus_size) {
+_WM_ParseNewMus(const uint8_t *mus_data, uint32_t mus_size, uint8_t list_only) {
     uint8_t mus_hdr[] = { 'M', 'U', 'S', 0x1A };
     uint32_t mus_song_ofs = 0;
     uint32_t mus_song_len = 0;
@@ -128,7 +128,7 @@ _WM_ParseNewMus(const uint8_t *mus_data, uint32_t mus_size) {
     samples_per_tick_f = _WM_GetSamplesPerTick(mus_divisions, (uint32_t)tempo_f);
 
     /* initialise the mdi structure */
-    mus_mdi = _WM_initMDI();
+    mus_mdi = _WM_initMDI(list_only);
     _WM_midi_setup_divisions(mus_mdi, mus_divisions);
     _WM_midi_setup_tempo(mus_mdi, (uint32_t)tempo_f);
 
@@ -36,7 +36,7 @@
 #include "f_xmidi.h"
 
 
-struct _mdi *_WM_ParseNewXmi(const uint8_t *xmi_data, uint32_t xmi_size) {
+struct _mdi *_WM_ParseNewXmi(const uint8_t *xmi_data, uint32_t xmi_size, uint8_t list_only) {
     struct _mdi *xmi_mdi = NULL;
     uint32_t xmi_tmpdata = 0;
     uint8_t xmi_formcnt = 0;
@@ -131,7 +131,7 @@ struct _mdi *_WM_ParseNewXmi(const uint8_t *xmi_data, uint32_t xmi_size) {
     xmi_data += 4;
     xmi_size -= 4;
 
-    xmi_mdi = _WM_initMDI();
+    xmi_mdi = _WM_initMDI(list_only);
     _WM_midi_setup_divisions(xmi_mdi, xmi_divisions);
     _WM_midi_setup_tempo(xmi_mdi, xmi_tempo);
 
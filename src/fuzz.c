@@ -0,0 +1,429 @@
+/*
+ * fuzz.c -- Render cost fuzz target
+ *
+ * Opens each input with WildMidi_OpenBuffer and renders up to
+ * WILDMIDI_FUZZ_SECONDS of it, looking for small files that are very
+ * expensive to play: note storms, retriggers, pitch bend floods, tempo
+ * maps that make songs very long. Inputs that cost more CPU time or
+ * memory per byte than any before them are written out, to be kept as
+ * a corpus for benchmarking.
+ *
+ * Built with clang this is a libFuzzer target, the library included
+ * in the coverage, and how expensive an input was is fed back as
+ * coverage too so the fuzzer keeps inputs that cost more. Try
+ *   wildmidi-fuzz -max_len=4096 -timeout=30 corpus/
+ * Built with anything else, WM_FUZZ_STANDALONE, it runs the files and
+ * directories it is given through the same target and reports the
+ * cost of each, to measure a corpus offline.
+ *
+ * With WILDMIDI_FUZZ_STATE set the inputs are not midis but changes
+ * to a state saved part way into a short song built in here, with
+ * reverb on. Each input is XORed over the state after its check hash,
+ * the hash is redone so the change gets past it, and the state is
+ * given to WildMidi_RestoreState. If that takes it, the rest of the
+ * song is rendered. That looks for states WildMidi_RestoreState should
+ * have refused, best with the library built with -fsanitize=address.
+ *
+ * Environment:
+ *   WILDMIDI_FUZZ_CFG      config file (default WILDMIDI_CFG)
+ *   WILDMIDI_FUZZ_SECONDS  most seconds of output to render (default 10)
+ *   WILDMIDI_FUZZ_OUT      directory the costly inputs are written to
+ *                          (default the current directory)
+ *   WILDMIDI_FUZZ_STATE    fuzz WildMidi_RestoreState, see above
+ *
+ * NOTE: This file is intended for developer use.
+ *
+ * Copyright (C) WildMIDI Developers 2001-2016
+ *
+ * This file is part of WildMIDI.
+ *
+ * WildMIDI is free software: you can redistribute and/or modify the player
+ * under the terms of the GNU General Public License and you can redistribute
+ * and/or modify the library under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3 of
+ * the licenses, or(at your option) any later version.
+ *
+ * WildMIDI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License and
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License and the
+ * GNU Lesser General Public License along with WildMIDI.  If not,  see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#if defined(WM_FUZZ_STANDALONE) && defined(HAVE_DIRENT_H)
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+#if defined(__GLIBC__) && ((__GLIBC__ > 2) || (__GLIBC_MINOR__ >= 33))
+#include <malloc.h>
+#define HAVE_MALLINFO2 1
+#endif
+
+#include "wildmidi_lib.h"
+#include "filenames.h"
+#include "render_cache.h"
+
+#define FUZZ_RATE 44100
+#define FUZZ_BLOCK 4096 /* frames */
+
+static int fuzz_ready = 0;
+static uint32_t fuzz_max_frames = 10 * FUZZ_RATE;
+static const char *fuzz_out = NULL;
+static int8_t fuzz_buffer[FUZZ_BLOCK * 4];
+
+/* the most costly inputs so far, per byte */
+static double worst_ns = 0.0;
+static double worst_mem = 0.0;
+
+/*
+ For WILDMIDI_FUZZ_STATE, two seconds of a scale over held chords, with
+ drums, and the state saved half a second into it.
+ */
+static const uint8_t fuzz_song[] = {
+    'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 1, 0, 96,
+    'M', 'T', 'r', 'k', 0, 0, 0, 87,
+    0x00, 0xC1, 48,
+    0x00, 0x91, 48, 90, 0x00, 0x91, 55, 90, 0x00, 0xE1, 0x00, 0x50,
+    0x00, 0x90, 60, 100, 0x00, 0x99, 36, 100,
+    0x30, 0x80, 60, 0, 0x00, 0x90, 64, 100, 0x00, 0x99, 38, 100,
+    0x30, 0x80, 64, 0, 0x00, 0x90, 67, 100, 0x00, 0x99, 42, 100,
+    0x30, 0x80, 67, 0, 0x00, 0x90, 72, 100, 0x00, 0xB0, 64, 127,
+    0x30, 0x80, 72, 0, 0x00, 0x99, 49, 110, 0x00, 0xE1, 0x00, 0x40,
+    0x60, 0xB0, 64, 0, 0x00, 0x81, 48, 0, 0x00, 0x81, 55, 0,
+    0x60, 0xFF, 0x2F, 0x00
+};
+#define FUZZ_STATE_AT (FUZZ_RATE / 2) /* frames */
+#define FUZZ_STATE_CHECKED 16 /* the check hash is of what comes after */
+
+static int fuzz_state = 0;
+static uint8_t *fuzz_saved = NULL;
+static uint32_t fuzz_saved_size = 0;
+
+#ifdef WM_FUZZ_STANDALONE
+static int fuzz_replay = 1;
+#else
+static int fuzz_replay = 0;
+#endif
+
+static double now_ns(void) {
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
+
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return ((double) count.QuadPart * 1000000000.0 / (double) freq.QuadPart);
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((double) ts.tv_sec * 1000000000.0 + (double) ts.tv_nsec);
+#endif
+}
+
+/* bytes the allocator has handed out, 0 where we can't tell */
+static double heap_in_use(void) {
+#ifdef HAVE_MALLINFO2
+    struct mallinfo2 mi = mallinfo2();
+
+    return ((double) mi.uordblks + (double) mi.hblkhd);
+#else
+    return (0.0);
+#endif
+}
+
+/*
+ Each cost band reached is a branch of its own, so with libFuzzer an
+ input that lands in a higher band than any before counts as new
+ coverage and is kept to be mutated further.
+ */
+static volatile uint32_t band_hits[2][32];
+
+#define COST_BAND(k, n) if (band + 1 > (n)) band_hits[k][n]++
+#define COST_BANDS8(k, n) COST_BAND(k, n); COST_BAND(k, n + 1); \
+    COST_BAND(k, n + 2); COST_BAND(k, n + 3); COST_BAND(k, n + 4); \
+    COST_BAND(k, n + 5); COST_BAND(k, n + 6); COST_BAND(k, n + 7)
+
+static uint32_t log2_band(double val) {
+    uint32_t band = 0;
+
+    while ((val >= 2.0) && (band < 31)) {
+        val /= 2.0;
+        band++;
+    }
+    return (band);
+}
+
+static void cpu_feedback(double ns_per_byte) {
+    uint32_t band = log2_band(ns_per_byte);
+
+    COST_BANDS8(0, 0); COST_BANDS8(0, 8); COST_BANDS8(0, 16); COST_BANDS8(0, 24);
+}
+
+static void mem_feedback(double mem_per_byte) {
+    uint32_t band = log2_band(mem_per_byte);
+
+    COST_BANDS8(1, 0); COST_BANDS8(1, 8); COST_BANDS8(1, 16); COST_BANDS8(1, 24);
+}
+
+static void save_input(const char *kind, const uint8_t *data, size_t size) {
+    char name[64];
+    char *path;
+    FILE *f;
+    uint64_t hash = _WM_hash_bytes(WM_HASH_INIT, data, (uint32_t) size);
+
+    sprintf(name, "%s-%08lx%08lx.%s", kind, (unsigned long) (hash >> 32),
+            (unsigned long) (hash & 0xffffffff), (fuzz_state) ? "state" : "mid");
+    if (fuzz_out != NULL) {
+        if ((path = (char *) malloc(strlen(fuzz_out) + strlen(name) + 2)) == NULL) return;
+        strcpy(path, fuzz_out);
+        if ((path[0] != '\0') && !IS_DIR_SEPARATOR(path[strlen(path) - 1])) {
+            strcat(path, DIR_SEPARATOR_STR);
+        }
+        strcat(path, name);
+    } else {
+        path = name;
+    }
+    if ((f = fopen(path, "wb")) != NULL) {
+        fwrite(data, 1, size, f);
+        fclose(f);
+        fprintf(stderr, "wildmidi-fuzz: saved %s\n", path);
+    }
+    if (path != name) free(path);
+}
+
+static midi *open_song(void) {
+    midi *handle = WildMidi_OpenBuffer(fuzz_song, sizeof(fuzz_song));
+
+    if ((handle != NULL) && (WildMidi_SetOption(handle, WM_MO_REVERB, WM_MO_REVERB) == -1)) {
+        WildMidi_Close(handle);
+        return (NULL);
+    }
+    return (handle);
+}
+
+static int save_song_state(void) {
+    midi *handle = open_song();
+    uint32_t frames = 0;
+    int ret;
+
+    if (handle == NULL) return (-1);
+    while (frames < FUZZ_STATE_AT) {
+        ret = FUZZ_STATE_AT - frames;
+        if (ret > FUZZ_BLOCK) ret = FUZZ_BLOCK;
+        ret = WildMidi_GetOutput(handle, fuzz_buffer, ret * 4);
+        if (ret <= 0) break;
+        frames += ret / 4;
+    }
+    ret = WildMidi_SaveState(handle, &fuzz_saved, &fuzz_saved_size);
+    WildMidi_Close(handle);
+    return (ret);
+}
+
+/* the song with the saved state changed by data restored, or NULL */
+static midi *open_state(const uint8_t *data, size_t size) {
+    midi *handle;
+    uint8_t *state;
+    uint64_t hash;
+    uint32_t i;
+
+    if ((state = (uint8_t *) malloc(fuzz_saved_size)) == NULL) return (NULL);
+    memcpy(state, fuzz_saved, fuzz_saved_size);
+    for (i = 0; (i < size) && (FUZZ_STATE_CHECKED + i < fuzz_saved_size); i++) {
+        state[FUZZ_STATE_CHECKED + i] ^= data[i];
+    }
+    hash = _WM_hash_bytes(WM_HASH_INIT, &state[FUZZ_STATE_CHECKED],
+                          fuzz_saved_size - FUZZ_STATE_CHECKED);
+    for (i = 0; i < 8; i++) {
+        state[8 + i] = (uint8_t) (hash >> (8 * i));
+    }
+
+    handle = open_song();
+    if ((handle != NULL) && (WildMidi_RestoreState(handle, state, fuzz_saved_size) == -1)) {
+        WildMidi_Close(handle);
+        handle = NULL;
+    }
+    free(state);
+    return (handle);
+}
+
+static int fuzz_init(void) {
+    const char *cfg = getenv("WILDMIDI_FUZZ_CFG");
+    const char *secs = getenv("WILDMIDI_FUZZ_SECONDS");
+
+    if (cfg == NULL) cfg = WILDMIDI_CFG;
+    if ((secs != NULL) && (atof(secs) > 0.0)) {
+        fuzz_max_frames = (uint32_t) (atof(secs) * FUZZ_RATE);
+    }
+    fuzz_out = getenv("WILDMIDI_FUZZ_OUT");
+    fuzz_state = (getenv("WILDMIDI_FUZZ_STATE") != NULL);
+    if (WildMidi_Init(cfg, FUZZ_RATE, WM_MO_ENHANCED_RESAMPLING) == -1) {
+        fprintf(stderr, "wildmidi-fuzz: %s\n", WildMidi_GetError());
+        return (-1);
+    }
+    if (fuzz_state && (save_song_state() == -1)) {
+        fprintf(stderr, "wildmidi-fuzz: can't save a state to fuzz: %s\n", WildMidi_GetError());
+        WildMidi_Shutdown();
+        return (-1);
+    }
+    fuzz_ready = 1;
+    return (0);
+}
+
+int LLVMFuzzerInitialize(int *argc, char ***argv);
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int LLVMFuzzerInitialize(int *argc, char ***argv) {
+    (void) argc;
+    (void) argv;
+    if (fuzz_init() == -1) exit(1);
+    return (0);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    midi *handle;
+    struct _WM_Info *info;
+    double start, ns, mem, heap_start, heap;
+    uint32_t frames = 0;
+    uint32_t length = 0;
+    int ret;
+
+    if (!fuzz_ready && (fuzz_init() == -1)) exit(1);
+    if ((size == 0) || (size > 0xffffffff)) return (0);
+
+    heap_start = heap_in_use();
+    start = now_ns();
+    handle = (fuzz_state) ? open_state(data, size) : WildMidi_OpenBuffer(data, (uint32_t) size);
+    if (handle == NULL) {
+        if (fuzz_replay) printf("%8lu bytes, not opened\n", (unsigned long) size);
+        WildMidi_ClearError();
+        return (0);
+    }
+    mem = heap_in_use() - heap_start;
+    if ((info = WildMidi_GetInfo(handle)) != NULL) {
+        length = info->approx_total_samples;
+    }
+    while (frames < fuzz_max_frames) {
+        if ((ret = WildMidi_GetOutput(handle, fuzz_buffer, sizeof(fuzz_buffer))) <= 0) break;
+        frames += ret / 4;
+    }
+    heap = heap_in_use() - heap_start;
+    if (heap > mem) mem = heap;
+    WildMidi_Close(handle);
+    ns = now_ns() - start;
+    WildMidi_ClearError();
+
+    cpu_feedback(ns / size);
+    mem_feedback(mem / size);
+
+    if (fuzz_replay) {
+        printf("%8lu bytes %10.3f ms %12.0f ns/byte %10.0f bytes/byte %8.1f s rendered of %.1f\n",
+               (unsigned long) size, ns / 1000000.0, ns / size, mem / size,
+               (double) frames / FUZZ_RATE, (double) length / FUZZ_RATE);
+    }
+    if (ns / size > worst_ns) {
+        worst_ns = ns / size;
+        if (!fuzz_replay) {
+            fprintf(stderr, "wildmidi-fuzz: most cpu so far %.0f ns/byte, %lu bytes, %.3f ms\n",
+                    worst_ns, (unsigned long) size, ns / 1000000.0);
+            save_input("cpu", data, size);
+        }
+    }
+    if (mem / size > worst_mem) {
+        worst_mem = mem / size;
+        if (!fuzz_replay) {
+            fprintf(stderr, "wildmidi-fuzz: most memory so far %.0f bytes/byte, %lu bytes, %.0f bytes\n",
+                    worst_mem, (unsigned long) size, mem);
+            save_input("mem", data, size);
+        }
+    }
+    return (0);
+}
+
+#ifdef WM_FUZZ_STANDALONE
+
+static int run_file(const char *path) {
+    FILE *f;
+    uint8_t *data;
+    long size;
+
+    if ((f = fopen(path, "rb")) == NULL) {
+        fprintf(stderr, "Unable to open %s\n", path);
+        return (-1);
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if ((size <= 0) || ((data = (uint8_t *) malloc(size)) == NULL)) {
+        fclose(f);
+        return (0);
+    }
+    if (fread(data, 1, size, f) == (size_t) size) {
+        printf("%s\n", path);
+        LLVMFuzzerTestOneInput(data, (size_t) size);
+    }
+    free(data);
+    fclose(f);
+    return (0);
+}
+
+static int run_path(const char *path) {
+#ifdef HAVE_DIRENT_H
+    struct stat st;
+    DIR *dir;
+    struct dirent *de;
+    char *file;
+
+    if ((stat(path, &st) == 0) && S_ISDIR(st.st_mode)) {
+        if ((dir = opendir(path)) == NULL) {
+            fprintf(stderr, "Unable to open %s\n", path);
+            return (-1);
+        }
+        while ((de = readdir(dir)) != NULL) {
+            if (de->d_name[0] == '.') continue;
+            if ((file = (char *) malloc(strlen(path) + strlen(de->d_name) + 2)) == NULL) break;
+            sprintf(file, "%s%s%s", path, DIR_SEPARATOR_STR, de->d_name);
+            run_path(file);
+            free(file);
+        }
+        closedir(dir);
+        return (0);
+    }
+#endif
+    return (run_file(path));
+}
+
+int main(int argc, char **argv) {
+    int i;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: wildmidi-fuzz file|directory ...\n");
+        fprintf(stderr, "Reports what each input costs to open and render.\n");
+        return (1);
+    }
+    if (LLVMFuzzerInitialize(&argc, &argv) != 0) return (1);
+    for (i = 1; i < argc; i++) {
+        run_path(argv[i]);
+    }
+    printf("# most per byte: %.0f ns, %.0f bytes\n", worst_ns, worst_mem);
+    free(fuzz_saved);
+    WildMidi_Shutdown();
+    return (0);
+}
+
+#endif /* WM_FUZZ_STANDALONE */
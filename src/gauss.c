@@ -0,0 +1,166 @@
+/*
+ * gauss.c -- Midi Wavetable Processing library
+ *
+ * Copyright (C) WildMIDI Developers 2001-2016
+ *
+ * This file is part of WildMIDI.
+ *
+ * WildMIDI is free software: you can redistribute and/or modify the player
+ * under the terms of the GNU General Public License and you can redistribute
+ * and/or modify the library under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3 of
+ * the licenses, or(at your option) any later version.
+ *
+ * WildMIDI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License and
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License and the
+ * GNU Lesser General Public License along with WildMIDI.  If not,  see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "common.h"
+#include "gauss.h"
+
+/* Gauss Interpolation code adapted from code supplied by Eric. A. Welsh */
+double _WM_newt_coeffs[58][58];
+double *_WM_gauss_table = NULL;
+int _WM_gauss_n = MAX_GAUSS_ORDER;
+
+/*
+ Called from WildMidi_Init so the tables are ready before any handle can
+ render, the mixer never has to build them.
+ */
+int _WM_init_gauss(void) {
+    /* init gauss table */
+    int n = _WM_gauss_n;
+    int m, i, k, n_half = (n >> 1);
+    int j;
+    int sign;
+    double ck;
+    double x, x_inc, xz;
+    double z[MAX_GAUSS_ORDER + 1];
+    double sin_xz[MAX_GAUSS_ORDER + 1];
+    double sin_z[MAX_GAUSS_ORDER + 1][MAX_GAUSS_ORDER + 1];
+    double *gptr, *t;
+
+    if (_WM_gauss_table) {
+        return (0);
+    }
+
+    _WM_newt_coeffs[0][0] = 1;
+    for (i = 0; i <= n; i++) {
+        _WM_newt_coeffs[i][0] = 1;
+        _WM_newt_coeffs[i][i] = 1;
+
+        if (i > 1) {
+            _WM_newt_coeffs[i][0] = _WM_newt_coeffs[i - 1][0] / i;
+            _WM_newt_coeffs[i][i] = _WM_newt_coeffs[i - 1][0] / i;
+        }
+
+        for (j = 1; j < i; j++) {
+            _WM_newt_coeffs[i][j] = _WM_newt_coeffs[i - 1][j - 1]
+                    + _WM_newt_coeffs[i - 1][j];
+            if (i > 1)
+                _WM_newt_coeffs[i][j] /= i;
+        }
+        z[i] = i / (4 * M_PI);
+    }
+
+    for (i = 0; i <= n; i++)
+        for (j = 0, sign = (int) pow(-1, i); j <= i; j++, sign *= -1)
+            _WM_newt_coeffs[i][j] *= sign;
+
+    t = (double *) malloc((1<<FPBITS) * (n + 1) * sizeof(double));
+    if (t == NULL) {
+        return (-1);
+    }
+
+    /* the denominators don't depend on the position */
+    for (k = 0; k <= n; k++)
+        for (i = 0; i <= n; i++)
+            sin_z[k][i] = sin(z[k] - z[i]);
+
+    x_inc = 1.0 / (1<<FPBITS);
+    for (m = 0, x = 0.0; m < (1<<FPBITS); m++, x += x_inc) {
+        xz = (x + n_half) / (4 * M_PI);
+        gptr = &t[m * (n + 1)];
+
+        for (i = 0; i <= n; i++)
+            sin_xz[i] = sin(xz - z[i]);
+
+        for (k = 0; k <= n; k++) {
+            ck = 1.0;
+
+            for (i = 0; i <= n; i++) {
+                if (i == k)
+                    continue;
+
+                ck *= sin_xz[i] / sin_z[k][i];
+            }
+            *gptr++ = ck;
+        }
+    }
+
+    _WM_gauss_table = t;
+    return (0);
+}
+
+void _WM_free_gauss(void) {
+    free(_WM_gauss_table);
+    _WM_gauss_table = NULL;
+}
+
+/*
+ Interpolate a single point of a sample, the same way the Gauss mixer
+ does. For use outside of the mixer, e.g. when resampling patch data.
+ */
+double _WM_gauss_interpolate(const int16_t *data, uint32_t data_length, uint32_t sample_pos) {
+    const int16_t *sptr;
+    const double *gptr, *gend;
+    double y, xd;
+    int left, right, temp_n;
+    int ii, jj;
+
+    /* check to see if we're near one of the ends */
+    left = sample_pos >> FPBITS;
+    right = (data_length >> FPBITS) - left - 1;
+    temp_n = (right << 1) - 1;
+    if (temp_n <= 0)
+        temp_n = 1;
+    if (temp_n > (left << 1) + 1)
+        temp_n = (left << 1) + 1;
+
+    /* use Newton if we can't fill the window */
+    if (temp_n < _WM_gauss_n) {
+        xd = sample_pos & FPMASK;
+        xd /= (1L << FPBITS);
+        xd += temp_n >> 1;
+        y = 0;
+        sptr = data + (sample_pos >> FPBITS) - (temp_n >> 1);
+        for (ii = temp_n; ii;) {
+            for (jj = 0; jj <= ii; jj++)
+                y += sptr[jj] * _WM_newt_coeffs[ii][jj];
+            y *= xd - --ii;
+        }
+        y += *sptr;
+    } else { /* otherwise, use Gauss as usual */
+        y = 0;
+        gptr = &_WM_gauss_table[(sample_pos & FPMASK) * (_WM_gauss_n + 1)];
+        gend = gptr + _WM_gauss_n;
+        sptr = data + (sample_pos >> FPBITS) - (_WM_gauss_n >> 1);
+        do {
+            y += *(sptr++) * *(gptr++);
+        } while (gptr <= gend);
+    }
+
+    return (y);
+}
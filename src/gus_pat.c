@@ -692,44 +692,209 @@ static int convert_16urp(uint8_t *data, struct _sample *gus_sample) {
 
 /* sample loading */
 
-struct _sample * _WM_load_gus_pat(const char *filename, int fix_release) {
-    uint8_t *gus_patch;
-    uint32_t gus_size;
-    uint32_t gus_ptr;
-    uint8_t no_of_samples;
+static int (*do_convert[])(uint8_t *data, struct _sample *gus_sample) = {
+    convert_8s,
+    convert_16s,
+    convert_8u,
+    convert_16u,
+    convert_8sp,
+    convert_16sp,
+    convert_8up,
+    convert_16up,
+    convert_8sr,
+    convert_16sr,
+    convert_8ur,
+    convert_16ur,
+    convert_8srp,
+    convert_16srp,
+    convert_8urp,
+    convert_16urp
+};
+
+/*
+ Read the sample whose header starts at gus_ptr, converting its data
+ unless load_data is 0. Returns the number of bytes the sample takes up
+ in the patch file, 0 on error.
+ */
+static uint32_t read_gus_sample(const char *filename, uint8_t *gus_patch,
+        uint32_t gus_size, uint32_t gus_ptr, struct _sample *gus_sample,
+        uint8_t native_modes, int load_data) {
+    uint32_t start_ptr = gus_ptr;
     uint8_t envsusreltime, envreltime;
-    struct _sample *gus_sample = NULL;
-    struct _sample *first_gus_sample = NULL;
+    uint32_t tmp_cnt;
+    uint8_t convert_modes;
+    uint32_t tmp_loop;
     uint32_t i = 0;
 
-    int (*do_convert[])(uint8_t *data, struct _sample *gus_sample) = {
-        convert_8s,
-        convert_16s,
-        convert_8u,
-        convert_16u,
-        convert_8sp,
-        convert_16sp,
-        convert_8up,
-        convert_16up,
-        convert_8sr,
-        convert_16sr,
-        convert_8ur,
-        convert_16ur,
-        convert_8srp,
-        convert_16srp,
-        convert_8urp,
-        convert_16urp
-    };
-    uint32_t tmp_loop;
+    if ((gus_ptr > gus_size) || ((gus_size - gus_ptr) < 96)) {
+        _WM_GLOBAL_ERROR(WM_ERR_CORUPT, filename, 0);
+        return 0;
+    }
 
-    WMIDI_UNUSED(fix_release);
+    gus_sample->next = NULL;
+    gus_sample->file_pos = gus_ptr;
+    gus_sample->ulaw_data = NULL;
+    gus_sample->drum_cache = NULL;
+    gus_sample->wanted = 0;
+    gus_sample->loop_fraction = gus_patch[gus_ptr + 7];
+    gus_sample->data_length = (gus_patch[gus_ptr + 11] << 24)
+                            | (gus_patch[gus_ptr + 10] << 16)
+                            | (gus_patch[gus_ptr + 9]  <<  8)
+                            |  gus_patch[gus_ptr + 8];
+    if (gus_sample->data_length > (gus_size - gus_ptr - 96)) {
+        _WM_GLOBAL_ERROR(WM_ERR_CORUPT, filename, 0);
+        return 0;
+    }
+    gus_sample->loop_start  = (gus_patch[gus_ptr + 15] << 24)
+                            | (gus_patch[gus_ptr + 14] << 16)
+                            | (gus_patch[gus_ptr + 13] <<  8)
+                            |  gus_patch[gus_ptr + 12];
+    gus_sample->loop_end    = (gus_patch[gus_ptr + 19] << 24)
+                            | (gus_patch[gus_ptr + 18] << 16)
+                            | (gus_patch[gus_ptr + 17] <<  8)
+                            |  gus_patch[gus_ptr + 16];
+    gus_sample->rate        = (gus_patch[gus_ptr + 21] << 8)
+                            |  gus_patch[gus_ptr + 20];
+    gus_sample->freq_low    = (gus_patch[gus_ptr + 25] << 24)
+                            | (gus_patch[gus_ptr + 24] << 16)
+                            | (gus_patch[gus_ptr + 23] <<  8)
+                            |  gus_patch[gus_ptr + 22];
+    gus_sample->freq_high   = (gus_patch[gus_ptr + 29] << 24)
+                            | (gus_patch[gus_ptr + 28] << 16)
+                            | (gus_patch[gus_ptr + 27] <<  8)
+                            |  gus_patch[gus_ptr + 26];
+    gus_sample->freq_root   = (gus_patch[gus_ptr + 33] << 24)
+                            | (gus_patch[gus_ptr + 32] << 16)
+                            | (gus_patch[gus_ptr + 31] <<  8)
+                            |  gus_patch[gus_ptr + 30];
+
+    /* This is done this way instead of ((freq * 1024) / rate) to avoid 32bit overflow. */
+    /* Result is 0.001% inaccurate */
+    gus_sample->inc_div = ((gus_sample->freq_root * 512) / gus_sample->rate) * 2;
 
-    SAMPLE_CONVERT_DEBUG(_WM_FUNCTION); SAMPLE_CONVERT_DEBUG(filename);
+#if 0
+    /* We dont use this info at this time, kept in here for info */
+    printf("\rTremolo Sweep: %i, Rate: %i, Depth %i\n",
+            gus_patch[gus_ptr+49], gus_patch[gus_ptr+50], gus_patch[gus_ptr+51]);
+    printf("\rVibrato Sweep: %i, Rate: %i, Depth %i\n",
+            gus_patch[gus_ptr+52], gus_patch[gus_ptr+53], gus_patch[gus_ptr+54]);
+#endif
+    gus_sample->modes = gus_patch[gus_ptr + 55];
+    GUSPAT_START_DEBUG(); GUSPAT_MODE_DEBUG(gus_patch[gus_ptr+55], SAMPLE_16BIT, "16bit "); GUSPAT_MODE_DEBUG(gus_patch[gus_ptr+55], SAMPLE_UNSIGNED, "Unsigned "); GUSPAT_MODE_DEBUG(gus_patch[gus_ptr+55], SAMPLE_LOOP, "Loop "); GUSPAT_MODE_DEBUG(gus_patch[gus_ptr+55], SAMPLE_PINGPONG, "PingPong "); GUSPAT_MODE_DEBUG(gus_patch[gus_ptr+55], SAMPLE_REVERSE, "Reverse "); GUSPAT_MODE_DEBUG(gus_patch[gus_ptr+55], SAMPLE_SUSTAIN, "Sustain "); GUSPAT_MODE_DEBUG(gus_patch[gus_ptr+55], SAMPLE_ENVELOPE, "Envelope "); GUSPAT_MODE_DEBUG(gus_patch[gus_ptr+55], SAMPLE_CLAMPED, "Clamped "); GUSPAT_END_DEBUG();
+
+    if (gus_sample->loop_start > gus_sample->loop_end) {
+        tmp_loop = gus_sample->loop_end;
+        gus_sample->loop_end = gus_sample->loop_start;
+        gus_sample->loop_start = tmp_loop;
+        gus_sample->loop_fraction =
+                ((gus_sample->loop_fraction & 0x0f) << 4)
+                        | ((gus_sample->loop_fraction & 0xf0) >> 4);
+    }
+
+    /* All sorts of annoying things happen with pat files.
+       One of them is that the sustained release time and
+       normal release time gets mixed up because software got muddled */
+    envsusreltime = env_time_table[gus_patch[gus_ptr + 40]];
+    envreltime = env_time_table[gus_patch[gus_ptr + 41]];
+    if (envsusreltime < envreltime) {
+        /* EXPERIMENTAL */
+        gus_patch[gus_ptr + 40] = gus_patch[gus_ptr + 41];
+        /* timidity does this: */
+        gus_patch[gus_ptr + 41] = 0x3f;
+        gus_patch[gus_ptr + 42] = 0x3f;
+
+        gus_patch[gus_ptr + 46] = gus_patch[gus_ptr + 47];
+        gus_patch[gus_ptr + 47] = 0;
+        gus_patch[gus_ptr + 48] = 0;
+    }
 
-    if ((gus_patch = (uint8_t *) _WM_BufferFile(filename, &gus_size)) == NULL) {
+    /* lets set up the envelope data */
+    for (i = 0; i < 6; i++) {
+        GUSPAT_INT_DEBUG("Envelope #",i);
+        if (gus_sample->modes & SAMPLE_ENVELOPE) {
+            uint8_t env_rate = gus_patch[gus_ptr + 37 + i];
+            gus_sample->env_target[i] = 16448 * gus_patch[gus_ptr + 43 + i];
+            GUSPAT_INT_DEBUG("Envelope Level",gus_patch[gus_ptr+43+i]); GUSPAT_FLOAT_DEBUG("Envelope Time",env_time_table[env_rate]);
+            gus_sample->env_rate[i] = (int32_t) (4194303.0f
+                    / ((float) _WM_SampleRate * env_time_table[env_rate]));
+            GUSPAT_INT_DEBUG("Envelope Rate",gus_sample->env_rate[i]); GUSPAT_INT_DEBUG("GUSPAT Rate",env_rate);
+            if (gus_sample->env_rate[i] == 0) {
+                _WM_DEBUG_MSG("%s: Warning: found invalid envelope(%u) rate setting in %s. Using %f instead.",
+                              _WM_FUNCTION, i, filename, env_time_table[63]);
+                gus_sample->env_rate[i] = (int32_t) (4194303.0f
+                        / ((float) _WM_SampleRate * env_time_table[63]));
+                GUSPAT_FLOAT_DEBUG("Envelope Time",env_time_table[63]);
+            }
+        } else {
+            gus_sample->env_target[i] = 4194303;
+            gus_sample->env_rate[i] = (int32_t) (4194303.0f
+                    / ((float) _WM_SampleRate * env_time_table[63]));
+            GUSPAT_FLOAT_DEBUG("Envelope Time",env_time_table[63]);
+        }
+    }
+
+    gus_sample->env_target[6] = 0;
+    gus_sample->env_rate[6] = (int32_t) (4194303.0f
+            / ((float) _WM_SampleRate * env_time_table[63]));
+
+    gus_ptr += 96;
+    tmp_cnt = gus_sample->data_length;
+
+    /* ping pong and reverse samples the mixer is to play as they are
+       are converted as plain forward samples and keep their mode bits */
+    convert_modes = gus_sample->modes & ~(native_modes & (SAMPLE_PINGPONG | SAMPLE_REVERSE));
+    if (!load_data) {
+        /* see _WM_load_gus_pat_data */
+        gus_sample->data = NULL;
+    } else if (do_convert[(((convert_modes & 0x18) >> 1)
+            | (convert_modes & 0x03))](&gus_patch[gus_ptr], gus_sample)
+            == -1) {
+        return 0;
+    }
+
+    /*
+     Test and set decay expected decay time after a note off
+     NOTE: This sets samples for full range decay
+     */
+    if (gus_sample->modes & SAMPLE_ENVELOPE) {
+        float samples_f = 0;
+
+        if (gus_sample->modes & SAMPLE_CLAMPED) {
+            samples_f = (4194301.0f - (float)gus_sample->env_target[5]) / gus_sample->env_rate[5];
+        } else {
+            if (gus_sample->modes & SAMPLE_SUSTAIN) {
+                samples_f = (4194301.0f - (float)gus_sample->env_target[3]) / gus_sample->env_rate[3];
+                samples_f += (float)(gus_sample->env_target[3] - gus_sample->env_target[4]) / gus_sample->env_rate[4];
+            } else {
+                samples_f = (4194301.0f - (float)gus_sample->env_target[4]) / gus_sample->env_rate[4];
+            }
+            samples_f += (float)(gus_sample->env_target[4] - gus_sample->env_target[5]) / gus_sample->env_rate[5];
+        }
+        samples_f += (float)gus_sample->env_target[5] / gus_sample->env_rate[6];
+
+        gus_sample->note_off_decay = (uint32_t)samples_f;
+
+    } else {
+        gus_sample->note_off_decay = gus_sample->data_length * _WM_SampleRate / gus_sample->rate;
+    }
+
+    gus_ptr += tmp_cnt;
+    gus_sample->loop_start = (gus_sample->loop_start << 10)
+            | (((gus_sample->loop_fraction & 0x0f) << 10) / 16);
+    gus_sample->loop_end = (gus_sample->loop_end << 10)
+            | (((gus_sample->loop_fraction & 0xf0) << 6) / 16);
+    gus_sample->loop_size = gus_sample->loop_end - gus_sample->loop_start;
+    gus_sample->data_length = gus_sample->data_length << 10;
+    return (gus_ptr - start_ptr);
+}
+
+static uint8_t *buffer_gus_pat(const char *filename, uint32_t *gus_size) {
+    uint8_t *gus_patch;
+
+    if ((gus_patch = (uint8_t *) _WM_BufferFile(filename, gus_size)) == NULL) {
         return NULL;
     }
-    if (gus_size < 239) {
+    if (*gus_size < 239) {
         _WM_GLOBAL_ERROR(WM_ERR_CORUPT, filename, 0);
         _WM_FreeBufferFile(gus_patch);
         return NULL;
@@ -750,14 +915,42 @@ struct _sample * _WM_load_gus_pat(const char *filename, int fix_release) {
         _WM_FreeBufferFile(gus_patch);
         return NULL;
     }
+    return gus_patch;
+}
+
+/*
+ With defer_data set, the samples of multi sample patches are returned
+ without data, to be loaded by _WM_load_gus_pat_data when a note needs
+ them.
+ */
+struct _sample * _WM_load_gus_pat(const char *filename, int fix_release,
+        uint8_t native_modes, int defer_data) {
+    uint8_t *gus_patch;
+    uint32_t gus_size;
+    uint32_t gus_ptr;
+    uint32_t gus_used;
+    uint8_t no_of_samples;
+    struct _sample *gus_sample = NULL;
+    struct _sample *first_gus_sample = NULL;
+
+    WMIDI_UNUSED(fix_release);
+
+    SAMPLE_CONVERT_DEBUG(_WM_FUNCTION); SAMPLE_CONVERT_DEBUG(filename);
+
+    if ((gus_patch = buffer_gus_pat(filename, &gus_size)) == NULL) {
+        return NULL;
+    }
 
     GUSPAT_FILENAME_DEBUG(filename);
     GUSPAT_INT_DEBUG("voices",gus_patch[83]);
 
     no_of_samples = gus_patch[198];
+    if (no_of_samples < 2) {
+        /* nothing to gain */
+        defer_data = 0;
+    }
     gus_ptr = 239;
     while (no_of_samples) {
-        uint32_t tmp_cnt;
         if (first_gus_sample == NULL) {
             first_gus_sample = (struct _sample *) malloc(sizeof(struct _sample));
             gus_sample = first_gus_sample;
@@ -771,149 +964,56 @@ struct _sample * _WM_load_gus_pat(const char *filename, int fix_release) {
             return NULL;
         }
 
-        gus_sample->next = NULL;
-        gus_sample->loop_fraction = gus_patch[gus_ptr + 7];
-        gus_sample->data_length = (gus_patch[gus_ptr + 11] << 24)
-                                | (gus_patch[gus_ptr + 10] << 16)
-                                | (gus_patch[gus_ptr + 9]  <<  8)
-                                |  gus_patch[gus_ptr + 8];
-        gus_sample->loop_start  = (gus_patch[gus_ptr + 15] << 24)
-                                | (gus_patch[gus_ptr + 14] << 16)
-                                | (gus_patch[gus_ptr + 13] <<  8)
-                                |  gus_patch[gus_ptr + 12];
-        gus_sample->loop_end    = (gus_patch[gus_ptr + 19] << 24)
-                                | (gus_patch[gus_ptr + 18] << 16)
-                                | (gus_patch[gus_ptr + 17] <<  8)
-                                |  gus_patch[gus_ptr + 16];
-        gus_sample->rate        = (gus_patch[gus_ptr + 21] << 8)
-                                |  gus_patch[gus_ptr + 20];
-        gus_sample->freq_low    = (gus_patch[gus_ptr + 25] << 24)
-                                | (gus_patch[gus_ptr + 24] << 16)
-                                | (gus_patch[gus_ptr + 23] <<  8)
-                                |  gus_patch[gus_ptr + 22];
-        gus_sample->freq_high   = (gus_patch[gus_ptr + 29] << 24)
-                                | (gus_patch[gus_ptr + 28] << 16)
-                                | (gus_patch[gus_ptr + 27] <<  8)
-                                |  gus_patch[gus_ptr + 26];
-        gus_sample->freq_root   = (gus_patch[gus_ptr + 33] << 24)
-                                | (gus_patch[gus_ptr + 32] << 16)
-                                | (gus_patch[gus_ptr + 31] <<  8)
-                                |  gus_patch[gus_ptr + 30];
-
-        /* This is done this way instead of ((freq * 1024) / rate) to avoid 32bit overflow. */
-        /* Result is 0.001% inaccurate */
-        gus_sample->inc_div = ((gus_sample->freq_root * 512) / gus_sample->rate) * 2;
-
-#if 0
-        /* We dont use this info at this time, kept in here for info */
-        printf("\rTremolo Sweep: %i, Rate: %i, Depth %i\n",
-                gus_patch[gus_ptr+49], gus_patch[gus_ptr+50], gus_patch[gus_ptr+51]);
-        printf("\rVibrato Sweep: %i, Rate: %i, Depth %i\n",
-                gus_patch[gus_ptr+52], gus_patch[gus_ptr+53], gus_patch[gus_ptr+54]);
-#endif
-        gus_sample->modes = gus_patch[gus_ptr + 55];
-        GUSPAT_START_DEBUG(); GUSPAT_MODE_DEBUG(gus_patch[gus_ptr+55], SAMPLE_16BIT, "16bit "); GUSPAT_MODE_DEBUG(gus_patch[gus_ptr+55], SAMPLE_UNSIGNED, "Unsigned "); GUSPAT_MODE_DEBUG(gus_patch[gus_ptr+55], SAMPLE_LOOP, "Loop "); GUSPAT_MODE_DEBUG(gus_patch[gus_ptr+55], SAMPLE_PINGPONG, "PingPong "); GUSPAT_MODE_DEBUG(gus_patch[gus_ptr+55], SAMPLE_REVERSE, "Reverse "); GUSPAT_MODE_DEBUG(gus_patch[gus_ptr+55], SAMPLE_SUSTAIN, "Sustain "); GUSPAT_MODE_DEBUG(gus_patch[gus_ptr+55], SAMPLE_ENVELOPE, "Envelope "); GUSPAT_MODE_DEBUG(gus_patch[gus_ptr+55], SAMPLE_CLAMPED, "Clamped "); GUSPAT_END_DEBUG();
-
-        if (gus_sample->loop_start > gus_sample->loop_end) {
-            tmp_loop = gus_sample->loop_end;
-            gus_sample->loop_end = gus_sample->loop_start;
-            gus_sample->loop_start = tmp_loop;
-            gus_sample->loop_fraction =
-                    ((gus_sample->loop_fraction & 0x0f) << 4)
-                            | ((gus_sample->loop_fraction & 0xf0) >> 4);
-        }
-
-        /* All sorts of annoying things happen with pat files.
-           One of them is that the sustained release time and
-           normal release time gets mixed up because software got muddled */
-        envsusreltime = env_time_table[gus_patch[gus_ptr + 40]];
-        envreltime = env_time_table[gus_patch[gus_ptr + 41]];
-        if (envsusreltime < envreltime) {
-            /* EXPERIMENTAL */
-            gus_patch[gus_ptr + 40] = gus_patch[gus_ptr + 41];
-            /* timidity does this: */
-            gus_patch[gus_ptr + 41] = 0x3f;
-            gus_patch[gus_ptr + 42] = 0x3f;
-
-            gus_patch[gus_ptr + 46] = gus_patch[gus_ptr + 47];
-            gus_patch[gus_ptr + 47] = 0;
-            gus_patch[gus_ptr + 48] = 0;
-        }
-
-        /* lets set up the envelope data */
-        for (i = 0; i < 6; i++) {
-            GUSPAT_INT_DEBUG("Envelope #",i);
-            if (gus_sample->modes & SAMPLE_ENVELOPE) {
-                uint8_t env_rate = gus_patch[gus_ptr + 37 + i];
-                gus_sample->env_target[i] = 16448 * gus_patch[gus_ptr + 43 + i];
-                GUSPAT_INT_DEBUG("Envelope Level",gus_patch[gus_ptr+43+i]); GUSPAT_FLOAT_DEBUG("Envelope Time",env_time_table[env_rate]);
-                gus_sample->env_rate[i] = (int32_t) (4194303.0f
-                        / ((float) _WM_SampleRate * env_time_table[env_rate]));
-                GUSPAT_INT_DEBUG("Envelope Rate",gus_sample->env_rate[i]); GUSPAT_INT_DEBUG("GUSPAT Rate",env_rate);
-                if (gus_sample->env_rate[i] == 0) {
-                    _WM_DEBUG_MSG("%s: Warning: found invalid envelope(%u) rate setting in %s. Using %f instead.",
-                                  _WM_FUNCTION, i, filename, env_time_table[63]);
-                    gus_sample->env_rate[i] = (int32_t) (4194303.0f
-                            / ((float) _WM_SampleRate * env_time_table[63]));
-                    GUSPAT_FLOAT_DEBUG("Envelope Time",env_time_table[63]);
-                }
-            } else {
-                gus_sample->env_target[i] = 4194303;
-                gus_sample->env_rate[i] = (int32_t) (4194303.0f
-                        / ((float) _WM_SampleRate * env_time_table[63]));
-                GUSPAT_FLOAT_DEBUG("Envelope Time",env_time_table[63]);
-            }
-        }
-
-        gus_sample->env_target[6] = 0;
-        gus_sample->env_rate[6] = (int32_t) (4194303.0f
-                / ((float) _WM_SampleRate * env_time_table[63]));
-
-        gus_ptr += 96;
-        tmp_cnt = gus_sample->data_length;
-
-        if (do_convert[(((gus_sample->modes & 0x18) >> 1)
-                | (gus_sample->modes & 0x03))](&gus_patch[gus_ptr], gus_sample)
-                == -1) {
+        gus_used = read_gus_sample(filename, gus_patch, gus_size, gus_ptr,
+                                   gus_sample, native_modes, !defer_data);
+        if (gus_used == 0) {
             _WM_FreeBufferFile(gus_patch);
             return NULL;
         }
+        gus_ptr += gus_used;
+        no_of_samples--;
+    }
+    _WM_FreeBufferFile(gus_patch);
+    return first_gus_sample;
+}
 
-        /*
-         Test and set decay expected decay time after a note off
-         NOTE: This sets samples for full range decay
-         */
-        if (gus_sample->modes & SAMPLE_ENVELOPE) {
-            float samples_f = 0;
+/*
+ Load the data of samples _WM_load_gus_pat returned without it, all from
+ one read of the file. Only the fields the conversion sets are updated,
+ the rest may have been adjusted for the patch since. A sample that
+ can't be read is left without data, -1 is only returned if the file
+ can't be.
+ */
+int _WM_load_gus_pat_data(const char *filename, uint8_t native_modes,
+        struct _sample **gus_samples, uint32_t count) {
+    uint8_t *gus_patch;
+    uint32_t gus_size;
+    uint32_t i;
+    struct _sample *gus_sample;
+    struct _sample tmp_sample;
 
-            if (gus_sample->modes & SAMPLE_CLAMPED) {
-                samples_f = (4194301.0f - (float)gus_sample->env_target[5]) / gus_sample->env_rate[5];
-            } else {
-                if (gus_sample->modes & SAMPLE_SUSTAIN) {
-                    samples_f = (4194301.0f - (float)gus_sample->env_target[3]) / gus_sample->env_rate[3];
-                    samples_f += (float)(gus_sample->env_target[3] - gus_sample->env_target[4]) / gus_sample->env_rate[4];
-                } else {
-                    samples_f = (4194301.0f - (float)gus_sample->env_target[4]) / gus_sample->env_rate[4];
-                }
-                samples_f += (float)(gus_sample->env_target[4] - gus_sample->env_target[5]) / gus_sample->env_rate[5];
-            }
-            samples_f += (float)gus_sample->env_target[5] / gus_sample->env_rate[6];
+    SAMPLE_CONVERT_DEBUG(_WM_FUNCTION); SAMPLE_CONVERT_DEBUG(filename);
 
-            gus_sample->note_off_decay = (uint32_t)samples_f;
+    if ((gus_patch = buffer_gus_pat(filename, &gus_size)) == NULL) {
+        return -1;
+    }
 
-        } else {
-            gus_sample->note_off_decay = gus_sample->data_length * _WM_SampleRate / gus_sample->rate;
+    for (i = 0; i < count; i++) {
+        gus_sample = gus_samples[i];
+        if (read_gus_sample(filename, gus_patch, gus_size, gus_sample->file_pos,
+                            &tmp_sample, native_modes, 1) == 0) {
+            continue;
         }
-
-        gus_ptr += tmp_cnt;
-        gus_sample->loop_start = (gus_sample->loop_start << 10)
-                | (((gus_sample->loop_fraction & 0x0f) << 10) / 16);
-        gus_sample->loop_end = (gus_sample->loop_end << 10)
-                | (((gus_sample->loop_fraction & 0xf0) << 6) / 16);
-        gus_sample->loop_size = gus_sample->loop_end - gus_sample->loop_start;
-        gus_sample->data_length = gus_sample->data_length << 10;
-        no_of_samples--;
+        gus_sample->data = tmp_sample.data;
+        gus_sample->data_length = tmp_sample.data_length;
+        gus_sample->loop_start = tmp_sample.loop_start;
+        gus_sample->loop_end = tmp_sample.loop_end;
+        gus_sample->loop_size = tmp_sample.loop_size;
+        gus_sample->loop_fraction = tmp_sample.loop_fraction;
+        gus_sample->note_off_decay = tmp_sample.note_off_decay;
+        gus_sample->modes = (gus_sample->modes & ~(SAMPLE_PINGPONG | SAMPLE_REVERSE))
+                          | (tmp_sample.modes & (SAMPLE_PINGPONG | SAMPLE_REVERSE));
     }
     _WM_FreeBufferFile(gus_patch);
-    return first_gus_sample;
+    return 0;
 }
@@ -33,10 +33,14 @@
 #include "lock.h"
 #include "wm_error.h"
 #include "reverb.h"
+#include "loudness.h"
 #include "sample.h"
 #include "wildmidi_lib.h"
 #include "patches.h"
+#include "patch_loader.h"
 #include "internal_midi.h"
+#include "mdi_state.h"
+#include "waveform.h"
 
 #define HOLD_OFF 0x02
 
@@ -692,10 +696,14 @@ void _WM_do_note_on(struct _mdi *mdi, struct _event_data *data) {
         }
     }
 
-    sample = _WM_get_sample_data(patch, (freq / 100));
+    sample = _WM_get_sample_data(mdi, patch, (freq / 100));
     if (sample == NULL) {
         return;
     }
+    if (sample->drum_cache) {
+        /* already at the output rate and pitch */
+        sample = sample->drum_cache;
+    }
 
     nte = &mdi->note_table[0][ch][note];
 
@@ -734,7 +742,15 @@ void _WM_do_note_on(struct _mdi *mdi, struct _event_data *data) {
     nte->noteid = (ch << 8) | note;
     nte->patch = patch;
     nte->sample = sample;
-    nte->sample_pos = 0;
+    ULAW_CACHE_SLOT(mdi, nte)->sample = NULL;
+    if (sample->modes & SAMPLE_REVERSE) {
+        /* not unrolled when loaded, play it from the end */
+        nte->sample_pos = sample->data_length - (1 << 10);
+        nte->backward = 1;
+    } else {
+        nte->sample_pos = 0;
+        nte->backward = 0;
+    }
     nte->sample_inc = get_inc(mdi, nte);
     nte->velocity = velocity;
     nte->env = 0;
@@ -1051,6 +1067,11 @@ void _WM_do_patch(struct _mdi *mdi, struct _event_data *data) {
     if (!mdi->channel[ch].isdrum) {
         mdi->channel[ch].patch = _WM_get_patch_data(mdi,
                                                 ((mdi->channel[ch].bank << 8) | data->data.value));
+        if ((mdi->async_load) && (mdi->channel[ch].patch != NULL)
+            && (_WM_holds_patch(mdi, mdi->channel[ch].patch))) {
+            /* a head start on its first note */
+            _WM_request_patch(mdi->channel[ch].patch);
+        }
     } else {
         mdi->channel[ch].bank = data->data.value;
     }
@@ -1194,7 +1215,11 @@ void _WM_Release_Allowance(struct _mdi *mdi) {
             if (note->modes & SAMPLE_LOOP) {
                 note->modes ^= SAMPLE_LOOP;
             }
-            release = note->sample->data_length - note->sample_pos;
+            if (note->modes & SAMPLE_REVERSE) {
+                release = note->sample_pos;
+            } else {
+                release = note->sample->data_length - note->sample_pos;
+            }
         }
 
         if (release > longest_release) longest_release = release;
@@ -1321,6 +1346,8 @@ void _WM_do_meta_text(struct _mdi *mdi, struct _event_data *data) {
 #endif
     if (mdi->extra_info.mixer_options & WM_MO_TEXTASLYRIC) {
         mdi->lyric = data->data.string;
+        mdi->last_lyric = data->data.string;
+        mdi->lyric_count++;
     }
 
     return;
@@ -1374,6 +1401,8 @@ void _WM_do_meta_lyric(struct _mdi *mdi, struct _event_data *data) {
 #endif
     if (!(mdi->extra_info.mixer_options & WM_MO_TEXTASLYRIC)) {
         mdi->lyric = data->data.string;
+        mdi->last_lyric = data->data.string;
+        mdi->lyric_count++;
     }
     return;
 }
@@ -1384,10 +1413,9 @@ void _WM_do_meta_marker(struct _mdi *mdi, struct _event_data *data) {
 #ifdef DEBUG_MIDI
     uint8_t ch = data->channel;
     MIDI_EVENT_SDEBUG(_WM_FUNCTION, ch, data->data.string);
-#else
-    WMIDI_UNUSED(data);
 #endif
-    WMIDI_UNUSED(mdi);
+    mdi->last_marker = data->data.string;
+    mdi->marker_count++;
     return;
 }
 
@@ -1410,9 +1438,15 @@ void _WM_ResetToStart(struct _mdi *mdi) {
     mdi->current_event = mdi->events;
     mdi->samples_to_mix = 0;
     mdi->extra_info.current_sample = 0;
+    mdi->speed_frac = 0;
 
     _WM_do_sysex_gm_reset(mdi, NULL);
 
+    if ((mdi->event_store) || (mdi->chunks)) {
+        /* shared with clones or edited, the parser has already done the rest */
+        return;
+    }
+
     /* Ensure last event is NULL */
     _WM_CheckEventMemoryPool(mdi);
     mdi->events[mdi->event_count].evtype = ev_null;
@@ -1490,6 +1524,8 @@ static int midi_setup_noteon(struct _mdi *mdi, uint8_t channel,
 
     if (mdi->channel[channel].isdrum)
         _WM_load_patch(mdi, ((mdi->channel[channel].bank << 8) | (note | 0x80)));
+    if (velocity)
+        _WM_load_note_sample(mdi, channel, note);
     return (0);
 }
 
@@ -1507,13 +1543,11 @@ static int midi_setup_aftertouch(struct _mdi *mdi, uint8_t channel,
     return (0);
 }
 
-static int midi_setup_control(struct _mdi *mdi, uint8_t channel,
-                              uint8_t controller, uint8_t setting) {
-    void (*tmp_event)(struct _mdi *mdi, struct _event_data *data);
+/* the event type and handler for controller */
+static enum _event_type control_event(uint8_t controller,
+                        void (**do_event)(struct _mdi *mdi, struct _event_data *data)) {
     enum _event_type ev;
 
-    MIDI_EVENT_DEBUG(_WM_FUNCTION,channel, controller);
-
     switch (controller) {
         /*
          **********************************************************************
@@ -1524,80 +1558,95 @@ static int midi_setup_control(struct _mdi *mdi, uint8_t channel,
          */
         case 0:
             ev = ev_control_bank_select;
-            tmp_event = _WM_do_control_bank_select;
-            mdi->channel[channel].bank = setting;
+            *do_event = _WM_do_control_bank_select;
             break;
         case 6:
             ev = ev_control_data_entry_course;
-            tmp_event = _WM_do_control_data_entry_course;
+            *do_event = _WM_do_control_data_entry_course;
             break;
         case 7:
             ev = ev_control_channel_volume;
-            tmp_event = _WM_do_control_channel_volume;
-            mdi->channel[channel].volume = setting;
+            *do_event = _WM_do_control_channel_volume;
             break;
         case 8:
             ev = ev_control_channel_balance;
-            tmp_event = _WM_do_control_channel_balance;
+            *do_event = _WM_do_control_channel_balance;
             break;
         case 10:
             ev = ev_control_channel_pan;
-            tmp_event = _WM_do_control_channel_pan;
+            *do_event = _WM_do_control_channel_pan;
             break;
         case 11:
             ev = ev_control_channel_expression;
-            tmp_event = _WM_do_control_channel_expression;
+            *do_event = _WM_do_control_channel_expression;
             break;
         case 38:
             ev = ev_control_data_entry_fine;
-            tmp_event = _WM_do_control_data_entry_fine;
+            *do_event = _WM_do_control_data_entry_fine;
             break;
         case 64:
             ev = ev_control_channel_hold;
-            tmp_event = _WM_do_control_channel_hold;
+            *do_event = _WM_do_control_channel_hold;
             break;
         case 96:
             ev = ev_control_data_increment;
-            tmp_event = _WM_do_control_data_increment;
+            *do_event = _WM_do_control_data_increment;
             break;
         case 97:
             ev = ev_control_data_decrement;
-            tmp_event = _WM_do_control_data_decrement;
+            *do_event = _WM_do_control_data_decrement;
             break;
         case 98:
             ev = ev_control_non_registered_param_fine;
-            tmp_event = _WM_do_control_non_registered_param_fine;
+            *do_event = _WM_do_control_non_registered_param_fine;
             break;
         case 99:
             ev = ev_control_non_registered_param_course;
-            tmp_event = _WM_do_control_non_registered_param_course;
+            *do_event = _WM_do_control_non_registered_param_course;
             break;
         case 100:
             ev = ev_control_registered_param_fine;
-            tmp_event = _WM_do_control_registered_param_fine;
+            *do_event = _WM_do_control_registered_param_fine;
             break;
         case 101:
             ev = ev_control_registered_param_course;
-            tmp_event = _WM_do_control_registered_param_course;
+            *do_event = _WM_do_control_registered_param_course;
             break;
         case 120:
             ev = ev_control_channel_sound_off;
-            tmp_event = _WM_do_control_channel_sound_off;
+            *do_event = _WM_do_control_channel_sound_off;
             break;
         case 121:
             ev = ev_control_channel_controllers_off;
-            tmp_event = _WM_do_control_channel_controllers_off;
+            *do_event = _WM_do_control_channel_controllers_off;
             break;
         case 123:
             ev = ev_control_channel_notes_off;
-            tmp_event = _WM_do_control_channel_notes_off;
+            *do_event = _WM_do_control_channel_notes_off;
             break;
         default:
             ev = ev_control_dummy;
-            tmp_event = _WM_do_control_dummy;
+            *do_event = _WM_do_control_dummy;
             break;
     }
 
+    return (ev);
+}
+
+static int midi_setup_control(struct _mdi *mdi, uint8_t channel,
+                              uint8_t controller, uint8_t setting) {
+    void (*tmp_event)(struct _mdi *mdi, struct _event_data *data);
+    enum _event_type ev;
+
+    MIDI_EVENT_DEBUG(_WM_FUNCTION,channel, controller);
+
+    ev = control_event(controller, &tmp_event);
+    if (controller == 0) {
+        mdi->channel[channel].bank = setting;
+    } else if (controller == 7) {
+        mdi->channel[channel].volume = setting;
+    }
+
     _WM_CheckEventMemoryPool(mdi);
     mdi->events[mdi->event_count].evtype = ev;
     mdi->events[mdi->event_count].do_event = tmp_event;
@@ -1915,13 +1964,34 @@ static int midi_setup_cuepoint(struct _mdi *mdi, char * text) {
     return (0);
 }
 
+/*
+ In realtime mode the mix buffer is allocated up front and
+ WildMidi_GetOutput mixes in blocks that fit it.
+ */
+static void alloc_rt_mix_buffer(struct _mdi *mdi) {
+    if (!(_WM_MixerOptions & WM_MO_REALTIME))
+        return;
+
+    mdi->mix_buffer = (int32_t *) calloc(RT_MIX_BUFFER_SIZE, sizeof(int32_t));
+    if (mdi->mix_buffer == NULL)
+        return;
+    mdi->mix_buffer_size = RT_MIX_BUFFER_SIZE;
+    _WM_LockMemory(mdi->mix_buffer, RT_MIX_BUFFER_SIZE * sizeof(int32_t));
+}
+
+/*
+ With list_only the patches the song uses are added to mdi->patches
+ without loading their samples, for a handle that is only looked at,
+ such as to find the render cache key of a song.
+ */
 struct _mdi *
-_WM_initMDI(void) {
+_WM_initMDI(uint8_t list_only) {
     struct _mdi *mdi;
 
     mdi = (struct _mdi *) malloc(sizeof(struct _mdi));
     memset(mdi, 0, (sizeof(struct _mdi)));
 
+    mdi->list_only = list_only;
     mdi->extra_info.copyright = NULL;
     mdi->extra_info.mixer_options = _WM_MixerOptions;
 
@@ -1942,17 +2012,120 @@ _WM_initMDI(void) {
     mdi->dyn_vol_peak = 0;
     mdi->dyn_vol_to_reach = 1.0;
 
+    mdi->speed = SPEED_NORMAL;
+
     mdi->is_type2 = 0;
 
     mdi->lyric = NULL;
 
+    alloc_rt_mix_buffer(mdi);
+
     _WM_do_sysex_gm_reset(mdi, NULL);
 
     return (mdi);
 }
 
+/*
+ A new handle playing the same song from the start. The events and
+ copyright are shared with mdi rather than copied, the clone is set up
+ like any new handle and only takes what describes the song, and the
+ options, from mdi. Caller must hold mdi->lock.
+ */
+struct _mdi *
+_WM_cloneMDI(struct _mdi *mdi) {
+    struct _mdi *clone;
+    struct _patch **patches;
+    uint32_t i, j;
+
+    if (mdi->event_store == NULL) {
+        mdi->event_store = (struct _event_store *) malloc(sizeof(struct _event_store));
+        if (mdi->event_store == NULL) {
+            _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, 0);
+            return (NULL);
+        }
+        mdi->event_store->lock = 0;
+        mdi->event_store->refcount = 1;
+    }
+
+    clone = _WM_initMDI(0);
+
+    clone->reverb = _WM_init_reverb(_WM_SampleRate, _WM_reverb_room_width,
+            _WM_reverb_room_length, _WM_reverb_listen_posx, _WM_reverb_listen_posy);
+    patches = (struct _patch **) realloc(clone->patches,
+                                         sizeof(struct _patch *) * (mdi->patch_count + 1));
+    if ((clone->reverb == NULL) || (patches == NULL)) {
+        _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, 0);
+        _WM_freeMDI(clone);
+        return (NULL);
+    }
+    clone->patches = patches;
+
+    /* the clone holds its own references to the patches,
+       _WM_initMDI has already taken the one it loads */
+    _WM_Lock(&_WM_patch_lock);
+    for (i = 0; i < mdi->patch_count; i++) {
+        for (j = 0; j < clone->patch_count; j++) {
+            if (clone->patches[j] == mdi->patches[i])
+                break;
+        }
+        if (j == clone->patch_count) {
+            clone->patches[clone->patch_count++] = mdi->patches[i];
+            mdi->patches[i]->inuse_count++;
+        }
+    }
+    _WM_Unlock(&_WM_patch_lock);
+
+    /* the song, shared */
+    free(clone->events);
+    _WM_Lock(&mdi->event_store->lock);
+    mdi->event_store->refcount++;
+    _WM_Unlock(&mdi->event_store->lock);
+    clone->event_store = mdi->event_store;
+    clone->events = mdi->events;
+    clone->event_count = mdi->event_count;
+    clone->events_size = mdi->events_size;
+    clone->chunks = mdi->chunks;
+    clone->chunk_count = mdi->chunk_count;
+    clone->chunks_size = mdi->chunks_size;
+    clone->current_event = clone->events;
+    clone->is_type2 = mdi->is_type2;
+    clone->extra_info = mdi->extra_info;
+    clone->extra_info.current_sample = 0;
+
+    /* and how it is to be played, the rest starts as on a new handle,
+       see WildMidi_Clone(3) */
+    clone->async_load = mdi->async_load;
+    clone->speed = mdi->speed;
+    clone->muted = mdi->muted;
+
+    /* as _WM_ResetToStart, which the parser has already run on the events */
+    _WM_do_sysex_gm_reset(clone, NULL);
+
+    return (clone);
+}
+
+/* Free up the string event storage */
+void _WM_free_event_strings(struct _event *events, uint32_t count) {
+    uint32_t i;
+
+    for (i = 0; i < count; i++) {
+        switch (events[i].evtype) {
+        case ev_meta_text:
+        case ev_meta_copyright:
+        case ev_meta_trackname:
+        case ev_meta_instrumentname:
+        case ev_meta_lyric:
+        case ev_meta_marker:
+        case ev_meta_cuepoint:
+            free(events[i].event_data.data.string);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
 void _WM_freeMDI(struct _mdi *mdi) {
-    struct _sample *tmp_sample;
     uint32_t i;
 
     if (mdi->patch_count != 0) {
@@ -1961,12 +2134,7 @@ void _WM_freeMDI(struct _mdi *mdi) {
             mdi->patches[i]->inuse_count--;
             if (mdi->patches[i]->inuse_count == 0) {
                 /* free samples here */
-                while (mdi->patches[i]->first_sample) {
-                    tmp_sample = mdi->patches[i]->first_sample->next;
-                    free(mdi->patches[i]->first_sample->data);
-                    free(mdi->patches[i]->first_sample);
-                    mdi->patches[i]->first_sample = tmp_sample;
-                }
+                _WM_free_samples(mdi->patches[i]);
                 mdi->patches[i]->loaded = 0;
             }
         }
@@ -1974,27 +2142,35 @@ void _WM_freeMDI(struct _mdi *mdi) {
         free(mdi->patches);
     }
 
-    if (mdi->event_count != 0) {
-        for (i = 0; i < mdi->event_count; i++) {
-            /* Free up the string event storage */
-            switch (mdi->events[i].evtype) {
-            case ev_meta_text:
-            case ev_meta_copyright:
-            case ev_meta_trackname:
-            case ev_meta_instrumentname:
-            case ev_meta_lyric:
-            case ev_meta_marker:
-            case ev_meta_cuepoint:
-                free(mdi->events[i].event_data.data.string);
-                break;
-            default:
-                break;
-            }
+    if (mdi->event_store) {
+        _WM_Lock(&mdi->event_store->lock);
+        if (--mdi->event_store->refcount != 0) {
+            /* still used by a clone */
+            _WM_Unlock(&mdi->event_store->lock);
+            mdi->events = NULL;
+            mdi->event_count = 0;
+            mdi->chunks = NULL;
+            mdi->chunk_count = 0;
+        } else {
+            _WM_Unlock(&mdi->event_store->lock);
+            free(mdi->event_store);
         }
     }
 
-    free(mdi->events);
+    if (mdi->chunks) {
+        for (i = 0; i < mdi->chunk_count; i++) {
+            _WM_free_event_strings(mdi->chunks[i].events, mdi->chunks[i].count);
+            free(mdi->chunks[i].events);
+        }
+        free(mdi->chunks);
+    } else {
+        _WM_free_event_strings(mdi->events, mdi->event_count);
+        free(mdi->events);
+    }
+    _WM_free_checkpoints(mdi);
     _WM_free_reverb(mdi->reverb);
+    _WM_free_loudness(mdi->loudness);
+    _WM_free_waveform(mdi->waveform);
     free(mdi->mix_buffer);
     if (mdi->tmp_info) {
         free(mdi->tmp_info->copyright);
@@ -2003,6 +2179,163 @@ void _WM_freeMDI(struct _mdi *mdi) {
     free(mdi);
 }
 
+/*
+ The event for a complete channel message, as _WM_SetupMidiEvent would
+ set it up but without touching the handle, see _WM_InsertEvent.
+ */
+void _WM_ChannelEvent(const uint8_t *event_data, struct _event *event) {
+    uint8_t channel = event_data[0] & 0x0f;
+    uint8_t data_1 = event_data[1] & 0x7f;
+
+    event->event_data.channel = channel;
+    event->samples_to_next = 0;
+    event->samples_to_next_fixed = 0;
+
+    switch (event_data[0] & 0xf0) {
+        case 0x90:
+            if (event_data[2] != 0) {
+                event->evtype = ev_note_on;
+                event->do_event = _WM_do_note_on;
+                event->event_data.data.value = (data_1 << 8) | event_data[2];
+                break;
+            }
+            /* A velocity of 0 in a note on is actually a note off */
+            /* fall through */
+        case 0x80:
+            event->evtype = ev_note_off;
+            event->do_event = _WM_do_note_off;
+            event->event_data.data.value = (data_1 << 8) | event_data[2];
+            break;
+        case 0xa0:
+            event->evtype = ev_aftertouch;
+            event->do_event = _WM_do_aftertouch;
+            event->event_data.data.value = (data_1 << 8) | event_data[2];
+            break;
+        case 0xb0:
+            event->evtype = control_event(event_data[1], &event->do_event);
+            if (event->evtype != ev_control_dummy) {
+                event->event_data.data.value = event_data[2];
+            } else {
+                event->event_data.data.value = (event_data[1] << 8) | event_data[2];
+            }
+            break;
+        case 0xc0:
+            event->evtype = ev_patch;
+            event->do_event = _WM_do_patch;
+            event->event_data.data.value = event_data[1];
+            break;
+        case 0xd0:
+            event->evtype = ev_channel_pressure;
+            event->do_event = _WM_do_channel_pressure;
+            event->event_data.data.value = event_data[1];
+            break;
+        default: /* 0xe0 */
+            event->evtype = ev_pitch;
+            event->do_event = _WM_do_pitch;
+            event->event_data.data.value = (event_data[2] << 7) | data_1;
+            break;
+    }
+}
+
+/*
+ The patches the events of mdi can play and the notes they play, found
+ by going through them as playing them would: program changes and drum
+ notes with the bank their channel has by then, following bank selects,
+ drum track sysexes and resets. Caller must hold mdi->lock. Returns how
+ many there are in the new *song_patches, -1 if out of memory.
+ */
+int _WM_SongPatches(struct _mdi *mdi, struct _song_patch **song_patches) {
+    struct _event *event;
+    struct _song_patch *list = NULL;
+    struct _song_patch *tmp_list;
+    struct _patch *patch;
+    struct _patch *channel_patch[16];
+    uint32_t count = 0;
+    uint32_t size = 0;
+    uint32_t i;
+    uint8_t bank[16];
+    uint8_t isdrum[16];
+    uint8_t ch;
+    uint8_t note;
+
+    /* as _WM_do_sysex_gm_reset, which _WM_ResetToStart starts with */
+    memset(bank, 0, sizeof(bank));
+    memset(isdrum, 0, sizeof(isdrum));
+    isdrum[9] = 1;
+    for (i = 0; i < 16; i++) {
+        channel_patch[i] = _WM_get_patch_data(mdi, 0);
+    }
+
+    for (event = mdi->events; event->do_event; event = WM_NEXT_EVENT(event)) {
+        ch = event->event_data.channel & 0x0f;
+        switch (event->evtype) {
+            case ev_control_bank_select:
+                bank[ch] = (uint8_t) event->event_data.data.value;
+                continue;
+            case ev_patch:
+                if (isdrum[ch]) {
+                    bank[ch] = (uint8_t) event->event_data.data.value;
+                } else {
+                    channel_patch[ch] = _WM_get_patch_data(mdi, ((bank[ch] << 8)
+                                                | (event->event_data.data.value & 0x7f)));
+                }
+                continue;
+            case ev_note_on:
+                if ((event->event_data.data.value & 0xff) == 0)
+                    continue;
+                note = (event->event_data.data.value >> 8) & 0x7f;
+                if (isdrum[ch]) {
+                    patch = _WM_get_patch_data(mdi, ((bank[ch] << 8) | note | 0x80));
+                } else {
+                    patch = channel_patch[ch];
+                }
+                break;
+            case ev_sysex_roland_drum_track:
+                isdrum[ch] = (event->event_data.data.value > 0);
+                if (!isdrum[ch]) {
+                    channel_patch[ch] = _WM_get_patch_data(mdi, 0);
+                }
+                continue;
+            case ev_sysex_gm_reset:
+            case ev_sysex_roland_reset:
+            case ev_sysex_yamaha_reset:
+                memset(bank, 0, sizeof(bank));
+                memset(isdrum, 0, sizeof(isdrum));
+                isdrum[9] = 1;
+                for (i = 0; i < 16; i++) {
+                    channel_patch[i] = _WM_get_patch_data(mdi, 0);
+                }
+                continue;
+            default:
+                continue;
+        }
+        if (patch == NULL)
+            continue;
+
+        for (i = 0; i < count; i++) {
+            if (list[i].patch == patch)
+                break;
+        }
+        if (i == count) {
+            if (count == size) {
+                size += 32;
+                tmp_list = (struct _song_patch *) realloc(list, size * sizeof(struct _song_patch));
+                if (tmp_list == NULL) {
+                    free(list);
+                    return (-1);
+                }
+                list = tmp_list;
+            }
+            memset(&list[count], 0, sizeof(struct _song_patch));
+            list[count++].patch = patch;
+        }
+        list[i].notes[note >> 5] |= 1U << (note & 31);
+    }
+
+    *song_patches = list;
+    return ((int) count);
+}
+
 uint32_t _WM_SetupMidiEvent(struct _mdi *mdi, const uint8_t * event_data, uint32_t input_length, uint8_t running_event) {
     /*
      Only add standard MIDI and Sysex events in here.
@@ -42,7 +42,30 @@
 #include <unistd.h> /* usleep() */
 #endif
 
+#endif /* !WM_NO_LOCK */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#ifdef HAVE_MLOCK
+#include <errno.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#ifdef WILDMIDI_LOCK_STATS
+#include <time.h>
+#endif
+
+#include "common.h"
 #include "lock.h"
+#include "rt_debug.h"
+#include "wm_error.h"
+
+#ifdef WILDMIDI_LOCK_STATS
+#undef _WM_Lock
+#endif
+
+#if !defined(WM_NO_LOCK)
 
 /*
  _WM_Lock(wmlock)
@@ -56,6 +79,7 @@
  If lock fails the process retries until successful.
  */
 void _WM_Lock(int * wmlock) {
+    WM_RT_CHECK("_WM_Lock");
     LOCK_START:
     /* Check if lock is clear, if so set it */
     if (__builtin_expect(((*wmlock) == 0), 1)) {
@@ -84,6 +108,27 @@ void _WM_Lock(int * wmlock) {
     goto LOCK_START;
 }
 
+/*
+ _WM_TryLock(wmlock)
+
+ wmlock = a pointer to a value
+
+ returns 0 if the lock was set, -1 if it is held elsewhere
+
+ Same as _WM_Lock but returns instead of waiting,
+ for the realtime render path.
+ */
+int _WM_TryLock(int * wmlock) {
+    if (__builtin_expect(((*wmlock) == 0), 1)) {
+        (*wmlock)++;
+        if (__builtin_expect(((*wmlock) == 1), 1)) {
+            return (0);
+        }
+        (*wmlock)--;
+    }
+    return (-1);
+}
+
 /*
  _WM_Unlock(wmlock)
 
@@ -100,4 +145,152 @@ void _WM_Unlock(int *wmlock) {
     }
 }
 
+#ifdef WILDMIDI_LOCK_STATS
+
+#define LOCK_SITES 64
+
+/* one per _WM_Lock expression, found by the address of its string */
+static struct _WM_LockStats lock_sites[LOCK_SITES];
+
+static struct _WM_LockStats *lock_site(const char *name) {
+    uint32_t start = (uint32_t) (((uintptr_t) name >> 3) % LOCK_SITES);
+    uint32_t i;
+    struct _WM_LockStats *site;
+
+    for (i = 0; i < LOCK_SITES; i++) {
+        site = &lock_sites[(start + i) % LOCK_SITES];
+        if (site->name == name) {
+            return (site);
+        }
+        if ((site->name == NULL)
+            && (__sync_bool_compare_and_swap(&site->name, (const char *) NULL, name)
+                || (site->name == name))) {
+            return (site);
+        }
+    }
+    return (NULL); /* more expressions than sites, not counted */
+}
+
+static uint64_t lock_time_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec);
+}
+
+/*
+ _WM_LockCounted(wmlock, name)
+
+ What _WM_Lock is with WILDMIDI_LOCK_STATS, name is the expression
+ the lock was given as.
+ */
+void _WM_LockCounted(int *wmlock, const char *name) {
+    struct _WM_LockStats *site = lock_site(name);
+    uint64_t start;
+
+    WM_RT_CHECK("_WM_Lock");
+    if (_WM_TryLock(wmlock) == 0) {
+        if (site) __sync_fetch_and_add(&site->acquires, 1);
+        return;
+    }
+    start = lock_time_ns();
+    _WM_Lock(wmlock);
+    if (site) {
+        __sync_fetch_and_add(&site->acquires, 1);
+        __sync_fetch_and_add(&site->contended, 1);
+        __sync_fetch_and_add(&site->wait_ns, lock_time_ns() - start);
+    }
+}
+
+/*
+ _WM_GetLockStats(stats, max)
+
+ Copies the counts of up to max locks into stats, the same expression
+ used in different places counting as one lock.
+
+ returns the number of locks copied
+ */
+int _WM_GetLockStats(struct _WM_LockStats *stats, int max) {
+    int count = 0;
+    int i, j;
+    const char *name;
+
+    for (i = 0; i < LOCK_SITES; i++) {
+        if ((name = lock_sites[i].name) == NULL) continue;
+        if (name[0] == '&') name++;
+        for (j = 0; j < count; j++) {
+            if (strcmp(stats[j].name, name) == 0) break;
+        }
+        if (j == count) {
+            if (count == max) continue;
+            stats[j].name = name;
+            stats[j].acquires = 0;
+            stats[j].contended = 0;
+            stats[j].wait_ns = 0;
+            count++;
+        }
+        stats[j].acquires += lock_sites[i].acquires;
+        stats[j].contended += lock_sites[i].contended;
+        stats[j].wait_ns += lock_sites[i].wait_ns;
+    }
+    return (count);
+}
+
+/* only exact while no other thread is taking locks */
+void _WM_ResetLockStats(void) {
+    int i;
+
+    for (i = 0; i < LOCK_SITES; i++) {
+        lock_sites[i].acquires = 0;
+        lock_sites[i].contended = 0;
+        lock_sites[i].wait_ns = 0;
+    }
+}
+
+#endif /* WILDMIDI_LOCK_STATS */
+
 #endif /* !WM_NO_LOCK */
+
+/* how often _WM_LockMemory couldn't lock, see _WM_LockMemory */
+uint32_t _WM_lock_memory_failures = 0;
+
+/*
+ _WM_LockMemory(addr, len)
+
+ Keeps memory the realtime render path reads from being paged out.
+ There is no matching unlock: mlock works on whole pages which can be
+ shared with other locked buffers, the lock goes with the memory when
+ it is returned to the system.
+
+ The pages are touched first so they are in memory even if mlock fails,
+ as it does once RLIMIT_MEMLOCK is reached. Failures are counted in
+ _WM_lock_memory_failures and the first one is reported.
+
+ returns 0 if the memory is locked, -1 if not
+ */
+int _WM_LockMemory(const void *addr, size_t len) {
+    const volatile uint8_t *page = (const volatile uint8_t *) addr;
+    size_t page_size = 4096;
+    size_t i;
+
+    if ((addr == NULL) || (len == 0))
+        return (0);
+
+#ifdef HAVE_MLOCK
+    if (sysconf(_SC_PAGESIZE) > 0)
+        page_size = (size_t) sysconf(_SC_PAGESIZE);
+#endif
+    for (i = 0; i < len; i += page_size) {
+        (void) page[i];
+    }
+    (void) page[len - 1];
+
+#ifdef HAVE_MLOCK
+    if (mlock(addr, len) == 0)
+        return (0);
+    if (_WM_lock_memory_failures++ == 0) {
+        _WM_DEBUG_MSG("mlock: %s, realtime memory may be paged out", strerror(errno));
+    }
+#endif
+    return (-1);
+}
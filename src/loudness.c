@@ -0,0 +1,323 @@
+/*
+ * loudness.c -- Midi Wavetable Processing library
+ *
+ * Copyright (C) WildMIDI Developers 2001-2016
+ *
+ * This file is part of WildMIDI.
+ *
+ * WildMIDI is free software: you can redistribute and/or modify the player
+ * under the terms of the GNU General Public License and you can redistribute
+ * and/or modify the library under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3 of
+ * the licenses, or(at your option) any later version.
+ *
+ * WildMIDI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License and
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License and the
+ * GNU Lesser General Public License along with WildMIDI.  If not,  see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "wildmidi_lib.h"
+#include "loudness.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define ABSOLUTE_GATE -70.0
+#define BLOCK_SUBS 4 /* 400ms gating blocks */
+
+/*
+ ITU-R BS.1770 K-weighting, with the filters worked out for the output
+ rate the same way libebur128 does rather than using the 48kHz table.
+ */
+static void k_weighting(struct _loudness *ln, uint32_t rate) {
+    double f0, g, q, k, vh, vb, a0;
+
+    f0 = 1681.974450955533;
+    g = 3.999843853973347;
+    q = 0.7071752369554196;
+    k = tan(M_PI * f0 / (double) rate);
+    vh = pow(10.0, g / 20.0);
+    vb = pow(vh, 0.4996667741545416);
+    a0 = 1.0 + k / q + k * k;
+    ln->b[0][0] = (vh + vb * k / q + k * k) / a0;
+    ln->b[0][1] = 2.0 * (k * k - vh) / a0;
+    ln->b[0][2] = (vh - vb * k / q + k * k) / a0;
+    ln->a[0][0] = 2.0 * (k * k - 1.0) / a0;
+    ln->a[0][1] = (1.0 - k / q + k * k) / a0;
+
+    f0 = 38.13547087602444;
+    q = 0.5003270373238773;
+    k = tan(M_PI * f0 / (double) rate);
+    a0 = 1.0 + k / q + k * k;
+    ln->b[1][0] = 1.0;
+    ln->b[1][1] = -2.0;
+    ln->b[1][2] = 1.0;
+    ln->a[1][0] = 2.0 * (k * k - 1.0) / a0;
+    ln->a[1][1] = (1.0 - k / q + k * k) / a0;
+}
+
+/*
+ 4x oversampling for the true peak, a Hann windowed sinc split into its
+ four phases, each scaled to a gain of 1. Only run while the history
+ holds a sample loud enough to make a new peak, which after the first
+ loud notes is seldom.
+ */
+static void true_peak_filter(struct _loudness *ln) {
+    double h[TRUE_PEAK_TAPS];
+    double t, sum, gain;
+    int p, i;
+
+    ln->gain = 0.0;
+    for (p = 0; p < 4; p++) {
+        sum = 0.0;
+        for (i = 0; i < TRUE_PEAK_TAPS; i++) {
+            t = (double) (i * 4 + p) - ((TRUE_PEAK_TAPS * 4 - 1) / 2.0);
+            h[i] = sin(M_PI * t / 4.0) / (M_PI * t / 4.0)
+                    * (0.5 + 0.5 * cos(M_PI * t / (TRUE_PEAK_TAPS * 2)));
+            sum += h[i];
+        }
+        gain = 0.0;
+        for (i = 0; i < TRUE_PEAK_TAPS; i++) {
+            ln->phase[i][p] = (float) (h[i] / sum);
+            gain += fabs(h[i] / sum);
+        }
+        if (gain > ln->gain) ln->gain = gain;
+    }
+}
+
+struct _loudness *_WM_init_loudness(uint32_t rate, int true_peak) {
+    struct _loudness *ln = (struct _loudness *) malloc(sizeof(struct _loudness));
+
+    if (ln == NULL) return (NULL);
+    memset(ln, 0, sizeof(struct _loudness));
+    ln->true_peak = true_peak;
+    ln->sub_size = rate / 10;
+    k_weighting(ln, rate);
+    if (true_peak) {
+        true_peak_filter(ln);
+    }
+    return (ln);
+}
+
+void _WM_free_loudness(struct _loudness *ln) {
+    free(ln);
+}
+
+static double to_lufs(double power) {
+    if (power <= 0.0) return (-HUGE_VAL);
+    return (-0.691 + 10.0 * log10(power));
+}
+
+/* the histogram bin of power, -1 if under the absolute gate */
+static int power_bin(double power) {
+    double lufs = to_lufs(power);
+    int bin;
+
+    if (lufs < ABSOLUTE_GATE) return (-1);
+    bin = (int) ((lufs - ABSOLUTE_GATE) * 10.0);
+    if (bin >= LOUDNESS_BINS) bin = LOUDNESS_BINS - 1;
+    return (bin);
+}
+
+/* mean square over the last count sub-blocks */
+static double window_power(const struct _loudness *ln, uint32_t count) {
+    double sum = 0.0;
+    uint32_t i;
+
+    if (count > ln->sub_count) count = ln->sub_count;
+    if (count == 0) return (0.0);
+    for (i = 1; i <= count; i++) {
+        sum += ln->sub[(ln->sub_count - i) % LOUDNESS_SUBS];
+    }
+    return (sum / count);
+}
+
+static void end_sub_block(struct _loudness *ln) {
+    double power;
+    int bin;
+
+    ln->sub[ln->sub_count % LOUDNESS_SUBS] = ln->sub_sum / ln->sub_size;
+    ln->sub_count++;
+    ln->sub_sum = 0.0;
+    ln->sub_fill = 0;
+
+    if (ln->sub_count >= BLOCK_SUBS) {
+        power = window_power(ln, BLOCK_SUBS);
+        if ((bin = power_bin(power)) >= 0) {
+            ln->block_hist[bin]++;
+            ln->block_power[bin] += power;
+        }
+    }
+    if (ln->sub_count >= LOUDNESS_SUBS) {
+        power = window_power(ln, LOUDNESS_SUBS);
+        if ((bin = power_bin(power)) >= 0) {
+            ln->short_hist[bin]++;
+            ln->short_power[bin] += power;
+        }
+    }
+}
+
+static inline double k_filter(struct _loudness *ln, int ch, double in) {
+    double *z;
+    double out;
+    int f;
+
+    for (f = 0; f < 2; f++) {
+        z = ln->z[ch][f];
+        out = ln->b[f][0] * in + z[0];
+        z[0] = ln->b[f][1] * in - ln->a[f][0] * out + z[1];
+        z[1] = ln->b[f][2] * in - ln->a[f][1] * out;
+        in = out;
+    }
+    return (in);
+}
+
+/* the largest of the four interpolated points */
+static inline float interpolate(const float (*phase)[4], const float *history) {
+    float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    float peak = 0.0f;
+    int i, p;
+
+    for (i = 0; i < TRUE_PEAK_TAPS; i++) {
+        for (p = 0; p < 4; p++) {
+            sum[p] += phase[i][p] * history[i];
+        }
+    }
+    for (p = 0; p < 4; p++) {
+        if (fabsf(sum[p]) > peak) peak = fabsf(sum[p]);
+    }
+    return (peak);
+}
+
+/*
+ Measures size 32bit samples of stereo mix, as they will be packed into
+ the output by _WM_pack_output.
+ */
+void _WM_do_loudness(struct _loudness *ln, const int32_t *buffer, uint32_t size) {
+    int32_t mix;
+    int32_t out;
+    double sample;
+    double y;
+    uint32_t i;
+    int ch;
+
+    for (i = 0; i < size; i += 2) {
+        for (ch = 0; ch < 2; ch++) {
+            mix = buffer[i + ch];
+            out = (mix & 0x7fff) - ((mix < 0) ? 0x8000 : 0);
+            sample = (double) out / 32768.0;
+            if (out < 0) out = -out;
+            if (out > ln->sample_peak) ln->sample_peak = out;
+
+            y = k_filter(ln, ch, sample);
+            ln->sub_sum += y * y;
+
+            if (ln->true_peak) {
+                ln->history[ch][ln->history_pos] = (float) sample;
+                ln->history[ch][ln->history_pos + TRUE_PEAK_TAPS] = (float) sample;
+                if (fabs(sample) > ln->quiet) {
+                    ln->loud[ch] = TRUE_PEAK_TAPS;
+                }
+                if (ln->loud[ch]) {
+                    ln->loud[ch]--;
+                    y = interpolate(ln->phase, &ln->history[ch][ln->history_pos + 1]);
+                    if (y > ln->peak) {
+                        ln->peak = y;
+                        ln->quiet = y / ln->gain;
+                    }
+                }
+            }
+        }
+        if (ln->true_peak) {
+            if (++ln->history_pos == TRUE_PEAK_TAPS) ln->history_pos = 0;
+        }
+        if (++ln->sub_fill == ln->sub_size) {
+            end_sub_block(ln);
+        }
+    }
+    ln->samples += size / 2;
+}
+
+/* mean power of the histogram bins from first on, 0 if they are empty */
+static double hist_power(const uint32_t *hist, const double *power, int first, uint32_t *count) {
+    double sum = 0.0;
+    uint32_t n = 0;
+    int i;
+
+    for (i = first; i < LOUDNESS_BINS; i++) {
+        sum += power[i];
+        n += hist[i];
+    }
+    if (count) *count = n;
+    return (n ? (sum / n) : 0.0);
+}
+
+/* the first bin above the gate relative to the mean power of hist */
+static int relative_gate(const uint32_t *hist, const double *power, double gate) {
+    double mean = hist_power(hist, power, 0, NULL);
+    int bin;
+
+    if (mean <= 0.0) return (LOUDNESS_BINS);
+    bin = (int) ceil((to_lufs(mean) + gate - ABSOLUTE_GATE) * 10.0);
+    if (bin < 0) bin = 0;
+    return (bin);
+}
+
+/* the bin at which the histogram from first on reaches fraction of its count */
+static int hist_percentile(const uint32_t *hist, int first, uint32_t count, double fraction) {
+    uint32_t target = (uint32_t) (count * fraction);
+    uint32_t n = 0;
+    int i;
+
+    for (i = first; i < LOUDNESS_BINS; i++) {
+        n += hist[i];
+        if (n > target) break;
+    }
+    return ((i < LOUDNESS_BINS) ? i : (LOUDNESS_BINS - 1));
+}
+
+void _WM_get_loudness(const struct _loudness *ln, struct _WM_Loudness *loudness) {
+    uint32_t count;
+    double peak;
+    int gate;
+
+    loudness->samples = ln->samples;
+
+    gate = relative_gate(ln->block_hist, ln->block_power, -10.0);
+    loudness->integrated = (float) to_lufs(hist_power(ln->block_hist, ln->block_power, gate, NULL));
+    loudness->momentary = (float) to_lufs(window_power(ln, BLOCK_SUBS));
+    loudness->short_term = (float) to_lufs(window_power(ln, LOUDNESS_SUBS));
+
+    /* EBU Tech 3342 loudness range, 10th to 95th percentile */
+    gate = relative_gate(ln->short_hist, ln->short_power, -20.0);
+    hist_power(ln->short_hist, ln->short_power, gate, &count);
+    if (count) {
+        loudness->range = (float) ((hist_percentile(ln->short_hist, gate, count, 0.95)
+                - hist_percentile(ln->short_hist, gate, count, 0.10)) / 10.0);
+    } else {
+        loudness->range = 0.0f;
+    }
+
+    peak = ln->sample_peak / 32768.0;
+    loudness->sample_peak = (float) ((peak > 0.0) ? (20.0 * log10(peak)) : -HUGE_VAL);
+    if (ln->true_peak) {
+        if (ln->peak > peak) peak = ln->peak;
+        loudness->true_peak = (float) ((peak > 0.0) ? (20.0 * log10(peak)) : -HUGE_VAL);
+    } else {
+        loudness->true_peak = loudness->sample_peak;
+    }
+}
@@ -0,0 +1,793 @@
+/*
+ * mdi_state.c -- Midi Wavetable Processing library
+ *
+ * Copyright (C) WildMIDI Developers 2001-2016
+ *
+ * This file is part of WildMIDI.
+ *
+ * WildMIDI is free software: you can redistribute and/or modify the player
+ * under the terms of the GNU General Public License and you can redistribute
+ * and/or modify the library under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3 of
+ * the licenses, or(at your option) any later version.
+ *
+ * WildMIDI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License and
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License and the
+ * GNU Lesser General Public License along with WildMIDI.  If not,  see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "wm_error.h"
+#include "wildmidi_lib.h"
+#include "internal_midi.h"
+#include "patches.h"
+#include "sample.h"
+#include "reverb.h"
+#include "event_store.h"
+#include "render_cache.h"
+#include "mdi_state.h"
+
+/*
+ A note is saved as its place in note_table so the copy can go back
+ into any handle playing the same midi. The only other note a saved one
+ can reach is its partner in the other half of the table: the one it
+ replays into, or for a note in the second half the one note on reads
+ before replaying into it. Those are saved too, any other note_table
+ slot is inactive and is never read before it is set up again.
+ */
+#define NOTE_SLOTS (16 * 128) /* the partner slot is index ^ NOTE_SLOTS */
+
+static int same_channel(const struct _channel *a, const struct _channel *b) {
+    return ((a->bank == b->bank) && (a->patch == b->patch)
+            && (a->hold == b->hold) && (a->volume == b->volume)
+            && (a->pressure == b->pressure) && (a->expression == b->expression)
+            && (a->balance == b->balance) && (a->pan == b->pan)
+            && (a->left_adjust == b->left_adjust)
+            && (a->right_adjust == b->right_adjust)
+            && (a->pitch == b->pitch) && (a->pitch_range == b->pitch_range)
+            && (a->pitch_adjust == b->pitch_adjust)
+            && (a->reg_data == b->reg_data) && (a->reg_non == b->reg_non)
+            && (a->isdrum == b->isdrum));
+}
+
+static int same_note(const struct _note *a, const struct _note *b) {
+    return ((a->noteid == b->noteid) && (a->velocity == b->velocity)
+            && (a->patch == b->patch) && (a->sample == b->sample)
+            && (a->sample_pos == b->sample_pos)
+            && (a->sample_inc == b->sample_inc)
+            && (a->env_inc == b->env_inc) && (a->env == b->env)
+            && (a->env_level == b->env_level) && (a->modes == b->modes)
+            && (a->hold == b->hold) && (a->active == b->active)
+            && (a->left_mix_volume == b->left_mix_volume)
+            && (a->right_mix_volume == b->right_mix_volume)
+            && (a->is_off == b->is_off)
+            && (a->ignore_chan_events == b->ignore_chan_events)
+            && (a->backward == b->backward));
+}
+
+static int has_slot(const struct _mdi_state *state, uint16_t index) {
+    uint32_t i;
+
+    for (i = 0; i < state->slot_count; i++) {
+        if (state->slot[i] == index)
+            return (1);
+    }
+    return (0);
+}
+
+static int add_slot(struct _mdi *mdi, struct _mdi_state *state, uint16_t index) {
+    struct _note *nte = &mdi->note_table[0][0][0] + index;
+    struct _note *copy = &state->note[state->slot_count];
+
+    if ((nte->replay != NULL)
+        && (nte->replay != &mdi->note_table[0][0][0] + (index ^ NOTE_SLOTS))) {
+        return (-1);
+    }
+    memcpy(copy, nte, sizeof(struct _note));
+    copy->next = NULL;
+    copy->replay = NULL;
+    state->slot[state->slot_count] = index;
+    state->replay[state->slot_count] = (nte->replay != NULL);
+    state->slot_count++;
+    return (0);
+}
+
+/* returns -1 if out of memory or the notes can not be saved */
+int _WM_save_state(struct _mdi *mdi, struct _mdi_state *state) {
+    struct _note *first = &mdi->note_table[0][0][0];
+    struct _note *nte;
+    uint32_t count = 0;
+    uint32_t i;
+    uint16_t partner;
+
+    memset(state, 0, sizeof(struct _mdi_state));
+    state->sample = mdi->extra_info.current_sample;
+    memcpy(state->channel, mdi->channel, sizeof(state->channel));
+
+    for (nte = mdi->note; nte != NULL; nte = nte->next) {
+        count++;
+    }
+    if (count) {
+        state->slot = (uint16_t *) malloc(count * 2 * sizeof(uint16_t));
+        state->note = (struct _note *) malloc(count * 2 * sizeof(struct _note));
+        state->replay = (uint8_t *) malloc(count * 2);
+        if ((state->slot == NULL) || (state->note == NULL) || (state->replay == NULL))
+            goto _fail;
+
+        for (nte = mdi->note; nte != NULL; nte = nte->next) {
+            if (add_slot(mdi, state, (uint16_t) (nte - first)) != 0)
+                goto _fail;
+        }
+        state->note_count = state->slot_count;
+        for (i = 0; i < state->note_count; i++) {
+            if ((state->replay[i]) || (state->slot[i] & NOTE_SLOTS)) {
+                partner = state->slot[i] ^ NOTE_SLOTS;
+                if ((!has_slot(state, partner)) && (add_slot(mdi, state, partner) != 0))
+                    goto _fail;
+            }
+        }
+    }
+
+    if ((mdi->extra_info.mixer_options & WM_MO_REVERB) && (mdi->reverb != NULL)) {
+        state->reverb_size = _WM_reverb_state_size(mdi->reverb);
+        state->reverb = (int32_t *) malloc(state->reverb_size * sizeof(int32_t));
+        if (state->reverb == NULL)
+            goto _fail;
+        _WM_get_reverb_state(mdi->reverb, state->reverb);
+    }
+    return (0);
+
+_fail:
+    _WM_free_state(state);
+    return (-1);
+}
+
+/* mdi must be playing the same midi, with the same patches */
+void _WM_restore_state(struct _mdi *mdi, const struct _mdi_state *state) {
+    struct _note *first = &mdi->note_table[0][0][0];
+    struct _note *nte;
+    struct _event *event;
+    uint32_t event_pos;
+    uint32_t i;
+
+    memcpy(mdi->channel, state->channel, sizeof(mdi->channel));
+
+    memset(mdi->note_table, 0, sizeof(mdi->note_table));
+    for (i = 0; i < ULAW_CACHE_SLOTS; i++) {
+        mdi->ulaw_cache[i].sample = NULL;
+    }
+    for (i = 0; i < state->slot_count; i++) {
+        nte = first + state->slot[i];
+        memcpy(nte, &state->note[i], sizeof(struct _note));
+        if (state->replay[i])
+            nte->replay = first + (state->slot[i] ^ NOTE_SLOTS);
+    }
+    mdi->note = NULL;
+    for (i = state->note_count; i > 0; i--) {
+        nte = first + state->slot[i - 1];
+        nte->next = mdi->note;
+        mdi->note = nte;
+    }
+
+    if (mdi->reverb != NULL) {
+        if ((state->reverb != NULL)
+            && (state->reverb_size == _WM_reverb_state_size(mdi->reverb))) {
+            _WM_set_reverb_state(mdi->reverb, state->reverb);
+        } else {
+            _WM_reset_reverb(mdi->reverb);
+        }
+    }
+
+    mdi->extra_info.current_sample = state->sample;
+    mdi->speed_frac = 0;
+    event = _WM_EventAfter(mdi, state->sample, &event_pos);
+    mdi->current_event = event;
+    mdi->samples_to_mix = (event->do_event) ? (event_pos - state->sample) : 0;
+    mdi->lyric = NULL;
+}
+
+/*
+ Whether the notes of mdi would play on from here as they did from
+ state, the reverb aside. Assumes the events still to come are the same.
+ */
+int _WM_same_notes(struct _mdi *mdi, const struct _mdi_state *state) {
+    struct _note *first = &mdi->note_table[0][0][0];
+    struct _note *nte;
+    uint32_t i;
+
+    if (mdi->extra_info.current_sample != state->sample)
+        return (0);
+    for (i = 0; i < 16; i++) {
+        if (!same_channel(&mdi->channel[i], &state->channel[i]))
+            return (0);
+    }
+
+    i = 0;
+    for (nte = mdi->note; nte != NULL; nte = nte->next) {
+        if ((i == state->note_count) || ((nte - first) != state->slot[i]))
+            return (0);
+        i++;
+    }
+    if (i != state->note_count)
+        return (0);
+    for (i = 0; i < state->slot_count; i++) {
+        nte = first + state->slot[i];
+        if ((!same_note(nte, &state->note[i]))
+            || ((nte->replay != NULL) != state->replay[i])) {
+            return (0);
+        }
+    }
+    return (1);
+}
+
+/*
+ Whether mdi would play on from here exactly as it did from state.
+ Assumes the events still to come are the same.
+ */
+int _WM_same_state(struct _mdi *mdi, const struct _mdi_state *state) {
+    int32_t *reverb;
+    int same;
+
+    if (!_WM_same_notes(mdi, state))
+        return (0);
+    if ((mdi->extra_info.mixer_options & WM_MO_REVERB) && (mdi->reverb != NULL)) {
+        if ((state->reverb == NULL)
+            || (state->reverb_size != _WM_reverb_state_size(mdi->reverb))) {
+            return (0);
+        }
+        reverb = (int32_t *) malloc(state->reverb_size * sizeof(int32_t));
+        if (reverb == NULL)
+            return (0);
+        _WM_get_reverb_state(mdi->reverb, reverb);
+        same = (memcmp(reverb, state->reverb, state->reverb_size * sizeof(int32_t)) == 0);
+        free(reverb);
+        return (same);
+    }
+    return (1);
+}
+
+/* returns -1 if out of memory */
+int _WM_copy_state(struct _mdi_state *copy, const struct _mdi_state *state) {
+    memcpy(copy, state, sizeof(struct _mdi_state));
+    copy->slot = NULL;
+    copy->note = NULL;
+    copy->replay = NULL;
+    copy->reverb = NULL;
+
+    if (state->slot_count) {
+        copy->slot = (uint16_t *) malloc(state->slot_count * sizeof(uint16_t));
+        copy->note = (struct _note *) malloc(state->slot_count * sizeof(struct _note));
+        copy->replay = (uint8_t *) malloc(state->slot_count);
+        if ((copy->slot == NULL) || (copy->note == NULL) || (copy->replay == NULL))
+            goto _fail;
+        memcpy(copy->slot, state->slot, state->slot_count * sizeof(uint16_t));
+        memcpy(copy->note, state->note, state->slot_count * sizeof(struct _note));
+        memcpy(copy->replay, state->replay, state->slot_count);
+    }
+    if (state->reverb != NULL) {
+        copy->reverb = (int32_t *) malloc(state->reverb_size * sizeof(int32_t));
+        if (copy->reverb == NULL)
+            goto _fail;
+        memcpy(copy->reverb, state->reverb, state->reverb_size * sizeof(int32_t));
+    }
+    return (0);
+
+_fail:
+    _WM_free_state(copy);
+    return (-1);
+}
+
+void _WM_free_state(struct _mdi_state *state) {
+    free(state->slot);
+    free(state->note);
+    free(state->replay);
+    free(state->reverb);
+    memset(state, 0, sizeof(struct _mdi_state));
+}
+
+/*
+ Adds the state of playing, mdi itself or a handle playing the same
+ midi, to the checkpoints of mdi. They are kept in sample order so
+ this must be the latest.
+ */
+int _WM_add_checkpoint(struct _mdi *mdi, struct _mdi *playing) {
+    struct _mdi_state *checkpoints;
+    uint32_t size;
+
+    if (mdi->checkpoint_count == mdi->checkpoints_size) {
+        size = (mdi->checkpoints_size) ? (mdi->checkpoints_size * 2) : 16;
+        checkpoints = (struct _mdi_state *) realloc(mdi->checkpoints,
+                                                    size * sizeof(struct _mdi_state));
+        if (checkpoints == NULL)
+            return (-1);
+        mdi->checkpoints = checkpoints;
+        mdi->checkpoints_size = size;
+    }
+    if (_WM_save_state(playing, &mdi->checkpoints[mdi->checkpoint_count]) != 0)
+        return (-1);
+    mdi->checkpoint_count++;
+    return (0);
+}
+
+void _WM_free_checkpoints(struct _mdi *mdi) {
+    uint32_t i;
+
+    for (i = 0; i < mdi->checkpoint_count; i++) {
+        _WM_free_state(&mdi->checkpoints[i]);
+    }
+    free(mdi->checkpoints);
+    mdi->checkpoints = NULL;
+    mdi->checkpoint_count = 0;
+    mdi->checkpoints_size = 0;
+}
+
+/*
+ A saved state, see WildMidi_SaveState. All values are little endian.
+ Patches are named by patchid and samples by where their header is in
+ the patch file, so the state can be restored in another process that
+ opened the same midi with the same config.
+
+ "WMST", version, check (2 x 32 bit hash of all that follows), rate,
+ mixer options, event hash (2 x 32 bit), current event index,
+ current_sample, samples_to_mix,
+ 16 channels of CHANNEL_BYTES, note_count, slot_count,
+ slot_count notes of NOTE_BYTES, reverb_size, reverb_size x 32 bit
+ */
+#define STATE_VERSION 1
+#define HEADER_BYTES 44
+#define CHECKED_FROM 16
+#define CHANNEL_BYTES 25
+#define NOTE_BYTES 44
+#define NO_PATCH 0xffff
+
+/* the mixer options that belong to the handle */
+#define STATE_OPTIONS (WM_MO_LOG_VOLUME | WM_MO_ENHANCED_RESAMPLING | WM_MO_REVERB \
+                       | WM_MO_LOOP | WM_MO_TEXTASLYRIC)
+
+enum {
+    SAMPLE_NONE = 0,
+    SAMPLE_PATCH,
+    SAMPLE_DRUM_CACHE
+};
+
+struct _reader {
+    const uint8_t *data;
+    uint32_t left;
+};
+
+static uint8_t *put_le(uint8_t *p, uint32_t val, int bytes) {
+    while (bytes--) {
+        *p++ = val & 0xff;
+        val >>= 8;
+    }
+    return (p);
+}
+
+/* 0 once the data runs out, check with reader.left */
+static uint32_t get_le(struct _reader *r, int bytes) {
+    uint32_t val = 0;
+    int i;
+
+    if (r->left < (uint32_t) bytes) {
+        r->left = 0;
+        r->data = NULL;
+        return (0);
+    }
+    for (i = 0; i < bytes; i++) {
+        val |= (uint32_t) r->data[i] << (8 * i);
+    }
+    r->data += bytes;
+    r->left -= bytes;
+    return (val);
+}
+
+static uint64_t hash_le(uint64_t hash, uint32_t val) {
+    uint8_t bytes[4];
+
+    put_le(bytes, val, 4);
+    return (_WM_hash_bytes(hash, bytes, 4));
+}
+
+/* of the events mdi plays, also giving the index of the current one */
+static uint64_t event_hash(struct _mdi *mdi, uint32_t *current) {
+    struct _event *event = mdi->events;
+    uint64_t hash = hash_le(WM_HASH_INIT, mdi->extra_info.approx_total_samples);
+    uint32_t i = 0;
+    const char *text;
+
+    *current = 0;
+    for (;;) {
+        if (event == mdi->current_event)
+            *current = i;
+        hash = hash_le(hash, (uint32_t) event->evtype);
+        if (!event->do_event)
+            break;
+        hash = hash_le(hash, event->event_data.channel);
+        switch (event->evtype) {
+        case ev_meta_text:
+        case ev_meta_copyright:
+        case ev_meta_trackname:
+        case ev_meta_instrumentname:
+        case ev_meta_lyric:
+        case ev_meta_marker:
+        case ev_meta_cuepoint:
+            text = event->event_data.data.string;
+            hash = _WM_hash_bytes(hash, text, (uint32_t) strlen(text));
+            break;
+        default:
+            hash = hash_le(hash, event->event_data.data.value);
+            break;
+        }
+        hash = hash_le(hash, event->samples_to_next);
+        event = WM_NEXT_EVENT(event);
+        i++;
+    }
+    return (hash);
+}
+
+static uint16_t patch_name(const struct _patch *patch) {
+    return ((patch != NULL) ? patch->patchid : NO_PATCH);
+}
+
+static struct _patch *find_patch(struct _mdi *mdi, uint16_t name, int *bad) {
+    struct _patch *patch;
+
+    if (name == NO_PATCH)
+        return (NULL);
+    patch = _WM_get_patch_data(mdi, name);
+    /* one mdi holds no reference on could be freed under it */
+    if ((patch == NULL) || (patch->patchid != name) || (!_WM_holds_patch(mdi, patch)))
+        *bad = 1;
+    return (patch);
+}
+
+static uint8_t *put_note(uint8_t *p, const struct _note *nte) {
+    const struct _sample *sample = NULL;
+    uint8_t kind = SAMPLE_NONE;
+
+    if ((nte->patch != NULL) && (nte->sample != NULL)) {
+        for (sample = nte->patch->first_sample; sample != NULL; sample = sample->next) {
+            if (sample == nte->sample) {
+                kind = SAMPLE_PATCH;
+                break;
+            }
+            if (sample->drum_cache == nte->sample) {
+                kind = SAMPLE_DRUM_CACHE;
+                break;
+            }
+        }
+    }
+    p = put_le(p, nte->noteid, 2);
+    p = put_le(p, nte->velocity, 1);
+    p = put_le(p, patch_name(nte->patch), 2);
+    p = put_le(p, kind, 1);
+    p = put_le(p, (sample != NULL) ? sample->file_pos : 0, 4);
+    p = put_le(p, nte->sample_pos, 4);
+    p = put_le(p, nte->sample_inc, 4);
+    p = put_le(p, (uint32_t) nte->env_inc, 4);
+    p = put_le(p, nte->env, 1);
+    p = put_le(p, (uint32_t) nte->env_level, 4);
+    p = put_le(p, nte->modes, 1);
+    p = put_le(p, nte->hold, 1);
+    p = put_le(p, nte->active, 1);
+    p = put_le(p, nte->left_mix_volume, 4);
+    p = put_le(p, nte->right_mix_volume, 4);
+    p = put_le(p, nte->is_off, 1);
+    p = put_le(p, nte->ignore_chan_events, 1);
+    p = put_le(p, nte->backward, 1);
+    return (p);
+}
+
+static void get_note(struct _mdi *mdi, struct _reader *r, struct _note *nte, int *bad) {
+    struct _sample *sample = NULL;
+    uint8_t kind;
+    uint32_t file_pos;
+
+    memset(nte, 0, sizeof(struct _note));
+    nte->noteid = (uint16_t) get_le(r, 2);
+    nte->velocity = (uint8_t) get_le(r, 1);
+    nte->patch = find_patch(mdi, (uint16_t) get_le(r, 2), bad);
+    kind = (uint8_t) get_le(r, 1);
+    file_pos = get_le(r, 4);
+    if (kind != SAMPLE_NONE) {
+        if (nte->patch != NULL) {
+            for (sample = nte->patch->first_sample; sample != NULL; sample = sample->next) {
+                if (sample->file_pos == file_pos)
+                    break;
+            }
+        }
+        if ((sample != NULL) && (kind == SAMPLE_DRUM_CACHE))
+            sample = sample->drum_cache;
+        if ((sample == NULL) || ((sample->data == NULL) && (sample->ulaw_data == NULL)))
+            *bad = 1;
+    }
+    nte->sample = sample;
+    nte->sample_pos = get_le(r, 4);
+    nte->sample_inc = get_le(r, 4);
+    nte->env_inc = (int32_t) get_le(r, 4);
+    nte->env = (uint8_t) get_le(r, 1);
+    nte->env_level = (int32_t) get_le(r, 4);
+    nte->modes = (uint8_t) get_le(r, 1);
+    nte->hold = (uint8_t) get_le(r, 1);
+    nte->active = (uint8_t) get_le(r, 1);
+    nte->left_mix_volume = get_le(r, 4);
+    nte->right_mix_volume = get_le(r, 4);
+    nte->is_off = (uint8_t) get_le(r, 1);
+    nte->ignore_chan_events = (uint8_t) get_le(r, 1);
+    nte->backward = (uint8_t) get_le(r, 1);
+    if (nte->env > 6)
+        *bad = 1;
+}
+
+/* also keeps a corrupt saved state from linking a note into the list twice */
+static int has_slot_before(const struct _mdi_state *state, uint32_t count) {
+    uint32_t i;
+
+    for (i = 0; i < count; i++) {
+        if (state->slot[i] == state->slot[count])
+            return (1);
+    }
+    return (0);
+}
+
+static int is_replayed(const struct _mdi_state *state, uint16_t index) {
+    uint32_t i;
+
+    for (i = 0; i < state->slot_count; i++) {
+        if ((state->slot[i] == (index ^ NOTE_SLOTS)) && (state->replay[i]))
+            return (1);
+    }
+    return (0);
+}
+
+/* the current state of mdi in a new buffer, NULL if out of memory */
+uint8_t *_WM_pack_state(struct _mdi *mdi, uint32_t *size) {
+    struct _mdi_state state;
+    struct _channel *chan;
+    uint8_t *buffer;
+    uint8_t *p;
+    uint64_t hash;
+    uint32_t current;
+    uint32_t i;
+
+    if (_WM_save_state(mdi, &state) != 0)
+        return (NULL);
+
+    *size = HEADER_BYTES + (16 * CHANNEL_BYTES) + 8 + (state.slot_count * NOTE_BYTES)
+            + 4 + (state.reverb_size * 4);
+    buffer = (uint8_t *) malloc(*size);
+    if (buffer == NULL) {
+        _WM_free_state(&state);
+        return (NULL);
+    }
+
+    hash = event_hash(mdi, &current);
+    p = buffer;
+    memcpy(p, "WMST", 4);
+    p += 4;
+    p = put_le(p, STATE_VERSION, 4);
+    p += 8; /* check, filled in last */
+    p = put_le(p, _WM_SampleRate, 4);
+    p = put_le(p, mdi->extra_info.mixer_options & STATE_OPTIONS, 4);
+    p = put_le(p, (uint32_t) (hash & 0xffffffff), 4);
+    p = put_le(p, (uint32_t) (hash >> 32), 4);
+    p = put_le(p, current, 4);
+    p = put_le(p, mdi->extra_info.current_sample, 4);
+    p = put_le(p, mdi->samples_to_mix, 4);
+
+    for (i = 0; i < 16; i++) {
+        chan = &state.channel[i];
+        p = put_le(p, patch_name(chan->patch), 2);
+        p = put_le(p, chan->bank, 1);
+        p = put_le(p, chan->hold, 1);
+        p = put_le(p, chan->volume, 1);
+        p = put_le(p, chan->pressure, 1);
+        p = put_le(p, chan->expression, 1);
+        p = put_le(p, (uint8_t) chan->balance, 1);
+        p = put_le(p, (uint8_t) chan->pan, 1);
+        p = put_le(p, (uint16_t) chan->left_adjust, 2);
+        p = put_le(p, (uint16_t) chan->right_adjust, 2);
+        p = put_le(p, (uint16_t) chan->pitch, 2);
+        p = put_le(p, (uint16_t) chan->pitch_range, 2);
+        p = put_le(p, (uint32_t) chan->pitch_adjust, 4);
+        p = put_le(p, chan->reg_data, 2);
+        p = put_le(p, chan->reg_non, 1);
+        p = put_le(p, chan->isdrum, 1);
+    }
+
+    p = put_le(p, state.note_count, 4);
+    p = put_le(p, state.slot_count, 4);
+    for (i = 0; i < state.slot_count; i++) {
+        p = put_le(p, state.slot[i], 2);
+        p = put_le(p, state.replay[i], 1);
+        p = put_note(p, &state.note[i]);
+    }
+
+    p = put_le(p, state.reverb_size, 4);
+    for (i = 0; i < state.reverb_size; i++) {
+        p = put_le(p, (uint32_t) state.reverb[i], 4);
+    }
+
+    hash = _WM_hash_bytes(WM_HASH_INIT, &buffer[CHECKED_FROM], *size - CHECKED_FROM);
+    put_le(&buffer[8], (uint32_t) (hash & 0xffffffff), 4);
+    put_le(&buffer[12], (uint32_t) (hash >> 32), 4);
+
+    _WM_free_state(&state);
+    return (buffer);
+}
+
+/*
+ Checks all of a saved state before any of it goes into mdi, which must
+ be playing the same midi with the same patches and rate.
+ */
+int _WM_unpack_state(struct _mdi *mdi, const uint8_t *buffer, uint32_t size) {
+    struct _mdi_state state;
+    struct _reader r;
+    struct _channel *chan;
+    struct _note *nte;
+    struct _event *event;
+    uint64_t hash;
+    uint32_t current;
+    uint32_t options;
+    uint32_t event_index;
+    uint32_t samples_to_mix;
+    uint32_t i;
+    int bad = 0;
+
+    memset(&state, 0, sizeof(state));
+    r.data = buffer;
+    r.left = size;
+
+    if ((size < HEADER_BYTES) || (memcmp(buffer, "WMST", 4) != 0)) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID, "(not a saved state)", 0);
+        return (-1);
+    }
+    get_le(&r, 4);
+    if (get_le(&r, 4) != STATE_VERSION) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID, "(unsupported state version)", 0);
+        return (-1);
+    }
+    hash = get_le(&r, 4);
+    hash |= (uint64_t) get_le(&r, 4) << 32;
+    if (hash != _WM_hash_bytes(WM_HASH_INIT, &buffer[CHECKED_FROM], size - CHECKED_FROM)) {
+        _WM_GLOBAL_ERROR(WM_ERR_CORUPT, "(saved state)", 0);
+        return (-1);
+    }
+    if (get_le(&r, 4) != _WM_SampleRate) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(state saved at another rate)", 0);
+        return (-1);
+    }
+    options = get_le(&r, 4) & STATE_OPTIONS;
+    hash = get_le(&r, 4);
+    hash |= (uint64_t) get_le(&r, 4) << 32;
+    if (hash != event_hash(mdi, &current)) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(state saved from another midi)", 0);
+        return (-1);
+    }
+    event_index = get_le(&r, 4);
+    state.sample = get_le(&r, 4);
+    samples_to_mix = get_le(&r, 4);
+
+    for (i = 0; i < 16; i++) {
+        chan = &state.channel[i];
+        chan->patch = find_patch(mdi, (uint16_t) get_le(&r, 2), &bad);
+        chan->bank = (uint8_t) get_le(&r, 1);
+        chan->hold = (uint8_t) get_le(&r, 1);
+        chan->volume = (uint8_t) get_le(&r, 1);
+        chan->pressure = (uint8_t) get_le(&r, 1);
+        chan->expression = (uint8_t) get_le(&r, 1);
+        chan->balance = (int8_t) get_le(&r, 1);
+        chan->pan = (int8_t) get_le(&r, 1);
+        chan->left_adjust = (int16_t) get_le(&r, 2);
+        chan->right_adjust = (int16_t) get_le(&r, 2);
+        chan->pitch = (int16_t) get_le(&r, 2);
+        chan->pitch_range = (int16_t) get_le(&r, 2);
+        chan->pitch_adjust = (int32_t) get_le(&r, 4);
+        chan->reg_data = (uint16_t) get_le(&r, 2);
+        chan->reg_non = (uint8_t) get_le(&r, 1);
+        chan->isdrum = (uint8_t) get_le(&r, 1);
+        /* the levels index the volume tables */
+        if ((chan->bank > 127) || (chan->volume > 127) || (chan->pressure > 127)
+            || (chan->expression > 127) || (chan->balance < 0) || (chan->pan < 0)
+            || (chan->isdrum > 1))
+            goto _corrupt;
+    }
+
+    state.note_count = get_le(&r, 4);
+    state.slot_count = get_le(&r, 4);
+    if ((state.slot_count > (2 * NOTE_SLOTS)) || (state.note_count > state.slot_count)
+        || (state.slot_count > (r.left / NOTE_BYTES))) {
+        goto _corrupt;
+    }
+    if (state.slot_count) {
+        state.slot = (uint16_t *) malloc(state.slot_count * sizeof(uint16_t));
+        state.note = (struct _note *) malloc(state.slot_count * sizeof(struct _note));
+        state.replay = (uint8_t *) malloc(state.slot_count);
+        if ((state.slot == NULL) || (state.note == NULL) || (state.replay == NULL))
+            goto _nomem;
+    }
+    for (i = 0; i < state.slot_count; i++) {
+        state.slot[i] = (uint16_t) get_le(&r, 2);
+        state.replay[i] = (uint8_t) get_le(&r, 1);
+        get_note(mdi, &r, &state.note[i], &bad);
+        if ((state.slot[i] >= (2 * NOTE_SLOTS)) || (has_slot_before(&state, i))
+            || (state.note[i].velocity > 127))
+            goto _corrupt;
+    }
+    for (i = 0; i < state.slot_count; i++) {
+        /* the notes that get mixed, with their sample's modes less
+           SAMPLE_LOOP once released, as the mixers leave them */
+        if ((i < state.note_count) || (is_replayed(&state, state.slot[i]))) {
+            nte = &state.note[i];
+            if ((nte->noteid != (((state.slot[i] >> 7) & 0x0f) << 8 | (state.slot[i] & 0x7f)))
+                || (nte->sample == NULL) || (nte->sample_pos >= nte->sample->data_length)
+                || ((nte->modes | SAMPLE_LOOP) != (nte->sample->modes | SAMPLE_LOOP))
+                || ((nte->modes & SAMPLE_LOOP) && !(nte->sample->modes & SAMPLE_LOOP))
+                || ((nte->backward) && !(nte->modes & (SAMPLE_PINGPONG | SAMPLE_REVERSE)))) {
+                goto _corrupt;
+            }
+        }
+        if ((state.replay[i]) && (!has_slot(&state, state.slot[i] ^ NOTE_SLOTS)))
+            goto _corrupt;
+    }
+
+    state.reverb_size = get_le(&r, 4);
+    if (state.reverb_size) {
+        if ((mdi->reverb == NULL)
+            || (state.reverb_size != _WM_reverb_state_size(mdi->reverb))) {
+            _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(state saved with another reverb)", 0);
+            goto _fail;
+        }
+        if (r.left / 4 < state.reverb_size)
+            goto _corrupt;
+        state.reverb = (int32_t *) malloc(state.reverb_size * sizeof(int32_t));
+        if (state.reverb == NULL)
+            goto _nomem;
+        for (i = 0; i < state.reverb_size; i++) {
+            state.reverb[i] = (int32_t) get_le(&r, 4);
+        }
+        if (_WM_check_reverb_state(mdi->reverb, state.reverb) != 0)
+            goto _corrupt;
+    }
+    if ((r.data == NULL) || (r.left != 0))
+        goto _corrupt;
+    if (bad) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(state uses patches this midi has not loaded)", 0);
+        goto _fail;
+    }
+
+    event = mdi->events;
+    for (i = 0; (i < event_index) && (event->do_event); i++) {
+        event = WM_NEXT_EVENT(event);
+    }
+    if (i != event_index)
+        goto _corrupt;
+
+    mdi->extra_info.mixer_options = (mdi->extra_info.mixer_options & ~STATE_OPTIONS) | options;
+    _WM_restore_state(mdi, &state);
+    mdi->current_event = event;
+    mdi->samples_to_mix = samples_to_mix;
+    _WM_free_state(&state);
+    return (0);
+
+_corrupt:
+    _WM_GLOBAL_ERROR(WM_ERR_CORUPT, "(saved state)", 0);
+    goto _fail;
+_nomem:
+    _WM_GLOBAL_ERROR(WM_ERR_MEM, "to restore state", 0);
+_fail:
+    _WM_free_state(&state);
+    return (-1);
+}
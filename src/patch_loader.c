@@ -0,0 +1,215 @@
+/*
+ * patch_loader.c -- Midi Wavetable Processing library
+ *
+ * Copyright (C) WildMIDI Developers 2001-2016
+ *
+ * This file is part of WildMIDI.
+ *
+ * WildMIDI is free software: you can redistribute and/or modify the player
+ * under the terms of the GNU General Public License and you can redistribute
+ * and/or modify the library under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3 of
+ * the licenses, or(at your option) any later version.
+ *
+ * WildMIDI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License and
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License and the
+ * GNU Lesser General Public License along with WildMIDI.  If not,  see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "common.h"
+#include "wildmidi_lib.h"
+#include "lock.h"
+#include "internal_midi.h"
+#include "patches.h"
+#include "sample.h"
+#include "patch_loader.h"
+
+/*
+ With _WM_async_load, patches and sample zones a playing handle finds
+ missing are read by a loader thread, never by the thread rendering or
+ editing. Asking for a load never waits: if the queue is busy or full
+ the request is dropped, and made again by the next note that needs it.
+
+ A zone request holds a reference on its patch so the sample it fills
+ can't be freed under it. A whole patch holds the loader's reference
+ only while it is read, given back once its samples are in place. The
+ handles keep it loaded: each holds a reference on every patch its
+ events can play, taken when it was opened or edited, never while it
+ renders.
+ */
+
+#ifdef HAVE_PTHREAD
+
+struct _load_request {
+    struct _patch *patch;
+    struct _sample *sample; /* NULL for the whole patch */
+};
+
+#define LOAD_QUEUE_SIZE 64
+
+static struct _load_request load_queue[LOAD_QUEUE_SIZE];
+static uint32_t queue_start = 0;
+static uint32_t queue_count = 0;
+static struct _load_request loading; /* taken off the queue, being loaded */
+static int loader_running = 0;
+static int loader_quit = 0;
+static pthread_t loader_thread;
+static pthread_mutex_t loader_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t loader_cond = PTHREAD_COND_INITIALIZER;
+
+/* loader_mutex must be held */
+static int is_queued(struct _patch *patch, struct _sample *sample) {
+    struct _load_request *request;
+    uint32_t i;
+
+    if ((loading.patch == patch) && (loading.sample == sample))
+        return (1);
+    for (i = 0; i < queue_count; i++) {
+        request = &load_queue[(queue_start + i) % LOAD_QUEUE_SIZE];
+        if ((request->patch == patch) && (request->sample == sample))
+            return (1);
+    }
+    return (0);
+}
+
+static void *loader_main(void *arg) {
+    WMIDI_UNUSED(arg);
+
+    pthread_mutex_lock(&loader_mutex);
+    for (;;) {
+        while ((queue_count == 0) && (!loader_quit)) {
+            pthread_cond_wait(&loader_cond, &loader_mutex);
+        }
+        if (loader_quit)
+            break;
+
+        loading = load_queue[queue_start];
+        queue_start = (queue_start + 1) % LOAD_QUEUE_SIZE;
+        queue_count--;
+        pthread_mutex_unlock(&loader_mutex);
+
+        if (loading.sample) {
+            _WM_load_zone_async(loading.patch, loading.sample);
+        } else {
+            _WM_load_sample_async(loading.patch);
+        }
+
+        pthread_mutex_lock(&loader_mutex);
+        loading.patch = NULL;
+        loading.sample = NULL;
+    }
+    pthread_mutex_unlock(&loader_mutex);
+    return (NULL);
+}
+
+int _WM_start_patch_loader(void) {
+    if (loader_running)
+        return (0);
+
+    queue_start = 0;
+    queue_count = 0;
+    loading.patch = NULL;
+    loading.sample = NULL;
+    loader_quit = 0;
+    if (pthread_create(&loader_thread, NULL, loader_main, NULL) != 0)
+        return (-1);
+    loader_running = 1;
+    return (0);
+}
+
+/* call with no handle rendering, the patches must still be there */
+void _WM_stop_patch_loader(void) {
+    struct _load_request *request;
+    uint32_t i;
+
+    if (!loader_running)
+        return;
+
+    pthread_mutex_lock(&loader_mutex);
+    loader_quit = 1;
+    pthread_cond_signal(&loader_cond);
+    pthread_mutex_unlock(&loader_mutex);
+    pthread_join(loader_thread, NULL);
+    loader_running = 0;
+
+    /* the references of zone requests it never got to */
+    _WM_Lock(&_WM_patch_lock);
+    for (i = 0; i < queue_count; i++) {
+        request = &load_queue[(queue_start + i) % LOAD_QUEUE_SIZE];
+        if (request->sample) {
+            request->patch->inuse_count--;
+        }
+    }
+    _WM_Unlock(&_WM_patch_lock);
+    queue_count = 0;
+}
+
+/*
+ sample == NULL asks for the whole patch. A zone request takes over a
+ reference the caller holds for it when 0 is returned.
+ Returns 0 if queued, 1 if not needed or to be asked for again later,
+ -1 if the loader isn't running and the caller has to load it itself.
+ */
+int _WM_queue_load(struct _patch *patch, struct _sample *sample) {
+    int ret = 1;
+
+    if (!loader_running)
+        return (-1);
+    if ((sample == NULL) && (patch->loaded))
+        return (1);
+
+    /* whoever is asking may be rendering */
+    if (pthread_mutex_trylock(&loader_mutex) != 0)
+        return (1);
+    if ((!loader_quit) && (queue_count < LOAD_QUEUE_SIZE)
+            && (!is_queued(patch, sample))) {
+        load_queue[(queue_start + queue_count) % LOAD_QUEUE_SIZE].patch = patch;
+        load_queue[(queue_start + queue_count) % LOAD_QUEUE_SIZE].sample = sample;
+        queue_count++;
+        pthread_cond_signal(&loader_cond);
+        ret = 0;
+    }
+    pthread_mutex_unlock(&loader_mutex);
+    return (ret);
+}
+
+#else /* no threads, everything loads where it is needed as before */
+
+int _WM_start_patch_loader(void) {
+    return (-1);
+}
+
+void _WM_stop_patch_loader(void) {
+}
+
+int _WM_queue_load(struct _patch *patch, struct _sample *sample) {
+    WMIDI_UNUSED(patch);
+    WMIDI_UNUSED(sample);
+    return (-1);
+}
+
+#endif /* HAVE_PTHREAD */
+
+/*
+ For the render path, a patch mdi holds and is about to play, queued if
+ the loader hasn't put its samples in place yet. Never waits or
+ allocates, the reference was taken when mdi was opened or edited.
+ */
+void _WM_request_patch(struct _patch *patch) {
+    if ((patch != NULL) && (!patch->loaded)) {
+        _WM_queue_load(patch, NULL);
+    }
+}
@@ -27,75 +27,147 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include "common.h"
 #include "wildmidi_lib.h"
 #include "internal_midi.h"
 #include "lock.h"
 #include "patches.h"
 #include "sample.h"
+#include "patch_loader.h"
 
 struct _patch *_WM_patch[128];
 int _WM_patch_lock = 0;
 
-struct _patch *
-_WM_get_patch_data(struct _mdi *mdi, uint16_t patchid) {
-    struct _patch *search_patch;
-
-    _WM_Lock(&_WM_patch_lock);
-
-    search_patch = _WM_patch[patchid & 0x007F];
-
-    if (search_patch == NULL) {
-        _WM_Unlock(&_WM_patch_lock);
-        return (NULL);
-    }
+/* _WM_patch_lock must be held, see _WM_get_patch_data */
+static struct _patch *find_patch(uint16_t patchid) {
+    struct _patch *search_patch = _WM_patch[patchid & 0x007F];
 
     while (search_patch) {
         if (search_patch->patchid == patchid) {
-            _WM_Unlock(&_WM_patch_lock);
             return (search_patch);
         }
         search_patch = search_patch->next;
     }
     if ((patchid >> 8) != 0) {
-        _WM_Unlock(&_WM_patch_lock);
-        return (_WM_get_patch_data(mdi, patchid & 0x00FF));
+        return (find_patch(patchid & 0x00FF));
     }
-    _WM_Unlock(&_WM_patch_lock);
     return (NULL);
 }
 
-void _WM_load_patch(struct _mdi *mdi, uint16_t patchid) {
-    uint32_t i;
-    struct _patch *tmp_patch = NULL;
+struct _patch *
+_WM_get_patch_data(struct _mdi *mdi, uint16_t patchid) {
+    struct _patch *search_patch;
 
-    for (i = 0; i < mdi->patch_count; i++) {
-        if (mdi->patches[i]->patchid == patchid) {
-            return;
-        }
+    WMIDI_UNUSED(mdi);
+
+    if (_WM_MixerOptions & WM_MO_REALTIME) {
+        /* the patch lists only change in WildMidi_Init and
+           WildMidi_Shutdown, no need to lock on the render path */
+        return (find_patch(patchid));
     }
 
+    _WM_Lock(&_WM_patch_lock);
+    search_patch = find_patch(patchid);
+    _WM_Unlock(&_WM_patch_lock);
+    return (search_patch);
+}
+
+/*
+ Takes a reference on patchid, loading its samples, or queuing them with
+ mdi->async_load, unless mdi->list_only. Only reads those settings of
+ mdi so it can be called without the handle lock, the reference is
+ handed to mdi with _WM_add_patch. Returns NULL if there is no such
+ patch or it can't be loaded.
+ */
+struct _patch *_WM_hold_patch(struct _mdi *mdi, uint16_t patchid) {
+    struct _patch *tmp_patch = NULL;
+
     tmp_patch = _WM_get_patch_data(mdi, patchid);
     if (tmp_patch == NULL) {
-        return;
+        return (NULL);
     }
 
     _WM_Lock(&_WM_patch_lock);
+    if (mdi->list_only) {
+        goto _hold_patch;
+    }
+    if ((mdi->async_load) && (_WM_queue_load(tmp_patch, NULL) != -1)) {
+        /* taken now whether it is loaded or still on its way,
+           the samples appear once the loader has them in place */
+        goto _hold_patch;
+    }
+
     if (!tmp_patch->loaded) {
         if (_WM_load_sample(tmp_patch) == -1) {
             _WM_Unlock(&_WM_patch_lock);
-            return;
+            return (NULL);
         }
     }
 
     if (tmp_patch->first_sample == NULL) {
         _WM_Unlock(&_WM_patch_lock);
-        return;
+        return (NULL);
     }
 
-    mdi->patch_count++;
-    mdi->patches = (struct _patch **) realloc(mdi->patches,
-                           (sizeof(struct _patch*) * mdi->patch_count));
-    mdi->patches[mdi->patch_count - 1] = tmp_patch;
+_hold_patch:
+
     tmp_patch->inuse_count++;
     _WM_Unlock(&_WM_patch_lock);
+    return (tmp_patch);
+}
+
+/*
+ Whether mdi holds a reference on patch, and so may play it. Neither
+ locks nor allocates, the render path asks before every sample it looks
+ up: only the patches held when the song was opened or last edited play.
+ */
+int _WM_holds_patch(const struct _mdi *mdi, const struct _patch *patch) {
+    uint32_t i;
+
+    for (i = 0; i < mdi->patch_count; i++) {
+        if (mdi->patches[i] == patch) {
+            return (1);
+        }
+    }
+    return (0);
+}
+
+/*
+ Hands a reference from _WM_hold_patch to mdi, or gives it back if mdi
+ already has the patch.
+ */
+void _WM_add_patch(struct _mdi *mdi, struct _patch *patch) {
+    struct _patch **patches;
+
+    if (patch == NULL)
+        return;
+
+    if (!_WM_holds_patch(mdi, patch)) {
+        patches = (struct _patch **) realloc(mdi->patches,
+                              (sizeof(struct _patch*) * (mdi->patch_count + 1)));
+        if (patches != NULL) {
+            mdi->patches = patches;
+            mdi->patches[mdi->patch_count++] = patch;
+            return;
+        }
+    }
+
+    _WM_Lock(&_WM_patch_lock);
+    if (--patch->inuse_count == 0) {
+        _WM_free_samples(patch);
+        patch->loaded = 0;
+    }
+    _WM_Unlock(&_WM_patch_lock);
+}
+
+void _WM_load_patch(struct _mdi *mdi, uint16_t patchid) {
+    uint32_t i;
+
+    for (i = 0; i < mdi->patch_count; i++) {
+        if (mdi->patches[i]->patchid == patchid) {
+            return;
+        }
+    }
+
+    _WM_add_patch(mdi, _WM_hold_patch(mdi, patchid));
 }
@@ -0,0 +1,114 @@
+/*
+ * out_shm.c -- shared memory output
+ *
+ * Copyright (C) WildMidi Developers 2026
+ *
+ * This file is part of WildMIDI.
+ *
+ * WildMIDI is free software: you can redistribute and/or modify the player
+ * under the terms of the GNU General Public License and you can redistribute
+ * and/or modify the library under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3 of
+ * the licenses, or(at your option) any later version.
+ *
+ * WildMIDI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License and
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License and the
+ * GNU Lesser General Public License along with WildMIDI.  If not,  see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "wildmidi_lib.h"
+#include "wildplay.h"
+
+#ifdef AUDIODRV_SHM
+
+#define SHM_DEFAULT_NAME "/wildmidi"
+#define SHM_RING_BYTES 262144 /* about 1.5s at 44100Hz */
+#define SHM_READER_TIMEOUT 2000 /* ms the ring can stay full before giving up on the reader */
+
+static struct _WM_Shm *shm_output;
+static midi *shm_midi; /* the positions, lyrics and markers go with its output */
+
+void shm_output_midi(void *handle) {
+    shm_midi = handle;
+}
+
+static int open_shm_output(const char *output, unsigned int *rate) {
+    const char *name = (output[0] != '\0') ? output : SHM_DEFAULT_NAME;
+
+    shm_output = WildMidi_ShmCreate(name, *rate, SHM_RING_BYTES, NULL);
+    if (shm_output == NULL) {
+        fprintf(stderr, "Error: unable to create shared memory %s\r\n%s\r\n",
+                name, WildMidi_GetError());
+        WildMidi_ClearError();
+        return (-1);
+    }
+    printf("Writing to shared memory %s\n", name);
+    return (0);
+}
+
+/*
+ Waits on the reader while the ring is full, as a sound card would, but
+ not for ever: with nothing taken for SHM_READER_TIMEOUT there is taken
+ to be no reader.
+ */
+static int send_shm_output(void *buffer, int size) {
+    int8_t *data = (int8_t *) buffer;
+    uint32_t waited = 0;
+    int res;
+
+    while (size > 0) {
+        res = WildMidi_ShmWrite(shm_output, shm_midi, data, (uint32_t) size);
+        if (res < 0) {
+            fprintf(stderr, "\rError: shared memory write failed\r\n");
+            return (-1);
+        }
+        if (res == 0) {
+            if (waited >= SHM_READER_TIMEOUT) {
+                fprintf(stderr, "\rError: no reader has taken from the shared memory ring for %u ms\r\n",
+                        SHM_READER_TIMEOUT);
+                return (-1);
+            }
+            msleep(5);
+            waited += 5;
+            continue;
+        }
+        waited = 0;
+        data += res;
+        size -= res;
+    }
+    return (0);
+}
+
+static void close_shm_output(void) {
+    if (shm_output == NULL)
+        return;
+    printf("Closing shared memory output\r\n");
+    WildMidi_ShmClose(shm_output);
+    shm_output = NULL;
+    shm_midi = NULL;
+}
+
+static void pause_shm_output(void) {}
+static void resume_shm_output(void) {}
+
+audiodrv_info audiodrv_shm = {
+    "shm",
+    "Shared memory ring for local readers",
+    open_shm_output,
+    send_shm_output,
+    close_shm_output,
+    pause_shm_output,
+    resume_shm_output
+};
+
+#endif /* AUDIODRV_SHM */
@@ -72,6 +72,9 @@ static const audiodrv_info *available_outputs[] = {
 #endif
 #ifdef AUDIODRV_OPENAL
     &audiodrv_openal,
+#endif
+#ifdef AUDIODRV_SHM
+    &audiodrv_shm,
 #endif
     NULL /* nul terminate */
 };
@@ -243,7 +246,7 @@ static struct option const long_options[] = {
     { "rate", 1, 0, 'r' },
     { "mastervol", 1, 0, 'm' },
     { "config", 1, 0, 'c' },
-#if defined(AUDIODRV_OSS) || defined(AUDIODRV_NETBSD) || defined(AUDIODRV_ALSA)
+#if defined(AUDIODRV_OSS) || defined(AUDIODRV_NETBSD) || defined(AUDIODRV_ALSA) || defined(AUDIODRV_SHM)
     { "device", 1, 0, 'd' },
 #endif
     { "wavout", 1, 0, 'o' },
@@ -261,6 +264,8 @@ static struct option const long_options[] = {
     { "textaslyric", 0, 0, 'a' },
     { "playfrom", 1, 0, 'i'},
     { "playto", 1, 0, 'j'},
+    { "cachedir", 1, 0, 'C'},
+    { "cachesize", 1, 0, 'Z'},
     { NULL, 0, NULL, 0 }
 };
 
@@ -288,9 +293,14 @@ static void do_help(void) {
            available_outputs[get_default_output()]->name);
     printf("  -o W  --wavout=W    Save output to W in 16bit stereo format wav file\n");
     printf("                     (implies '-P wave' )\n");
-#if defined(AUDIODRV_OSS) || defined(AUDIODRV_NETBSD)|| defined(AUDIODRV_ALSA)
+    printf("  -C D  --cachedir=D  With -o, keep renders in directory D and reuse them\n");
+    printf("                      when the same file is rendered with the same\n");
+    printf("                      config and options again\n");
+    printf("  -Z N  --cachesize=N Limit the render cache to N MB, default is 1024\n");
+#if defined(AUDIODRV_OSS) || defined(AUDIODRV_NETBSD)|| defined(AUDIODRV_ALSA) || defined(AUDIODRV_SHM)
     printf("  -d D  --device=D    For alsa, netbsd or oss output: use device 'D'\n");
-    printf("                      instead of the default\n");
+    printf("                      instead of the default, for shm output: name\n");
+    printf("                      the shared memory 'D'\n");
 #endif
     printf("Software Wavetable Options:\n");
     printf("  -l    --log_vol     Use log volume adjustments\n");
@@ -327,6 +337,31 @@ static void do_syntax(void) {
 }
 
 static char config_file[1024];
+static char cache_dir[1024];
+static uint32_t cache_size = 1024;
+
+static int render_cached(const char *file, const char *wavfile,
+                         uint16_t mixer_options, uint8_t master_volume) {
+    int ret = 0;
+
+    if (WildMidi_Init(config_file, rate, mixer_options) == -1) {
+        fprintf(stderr, "%s\r\n", WildMidi_GetError());
+        WildMidi_ClearError();
+        return (1);
+    }
+    WildMidi_MasterVolume(master_volume);
+
+    printf("Rendering %s to %s\r\n", file, wavfile);
+    if ((WildMidi_SetRenderCache(cache_dir, cache_size) == -1)
+     || (WildMidi_RenderToFile(file, wavfile) == -1)) {
+        fprintf(stderr, "%s\r\n", WildMidi_GetError());
+        WildMidi_ClearError();
+        ret = 1;
+    }
+
+    WildMidi_Shutdown();
+    return (ret);
+}
 
 int main(int argc, char **argv) {
     char output[1024];
@@ -374,12 +409,13 @@ int main(int argc, char **argv) {
 
     playback_id = get_default_output();
     config_file[0] = 0;
+    cache_dir[0] = 0;
     output[0] = 0;
     midi_file[0] = 0;
 
     do_version();
     while (1) {
-        i = getopt_long(argc, argv, "0vho:tx:g:P:f:lr:c:m:btak:p:ed:nsi:j:", long_options,
+        i = getopt_long(argc, argv, "0vho:tx:g:P:f:lr:c:m:btak:p:ed:nsi:j:C:Z:", long_options,
                 &option_index);
         if (i == -1)
             break;
@@ -424,7 +460,7 @@ int main(int argc, char **argv) {
             break;
         case 'o': /* Wav Output    */
             playback_id = 1;
-        #if defined(AUDIODRV_OSS) || defined(AUDIODRV_ALSA)
+        #if defined(AUDIODRV_OSS) || defined(AUDIODRV_ALSA) || defined(AUDIODRV_SHM)
             WMPLAY_FALLTHROUGH;
         case 'd': /* Device Output */
         #endif
@@ -492,6 +528,17 @@ int main(int argc, char **argv) {
         case 'j':
             play_to = (unsigned long int)(atof(optarg) * (double)rate);
             break;
+        case 'C': /* Render Cache */
+            if (!*optarg) {
+                fprintf(stderr, "Error: empty cache directory name.\n");
+                return (1);
+            }
+            strncpy(cache_dir, optarg, sizeof(cache_dir));
+            cache_dir[sizeof(cache_dir) - 1] = 0;
+            break;
+        case 'Z': /* Render Cache Size */
+            cache_size = (uint32_t) atoi(optarg);
+            break;
         default:
             do_syntax();
             return (1);
@@ -538,6 +585,17 @@ int main(int argc, char **argv) {
         config_file[sizeof(config_file) - 1] = 0;
     }
 
+    /* whole file renders to wav can be served from the render cache */
+    if (cache_dir[0] != '\0') {
+        if ((playback_id != 1) || test_midi || play_from || play_to
+         || (argc - optind != 1)) {
+            fprintf(stderr, "--cachedir needs --wavout and a single midi file,"
+                            " without --playfrom or --playto\n");
+            return (1);
+        }
+        return (render_cached(argv[optind], output, mixer_options, master_volume));
+    }
+
 #ifdef WILDMIDI_AMIGA
     amiga_sysinit();
 #endif
@@ -611,6 +669,9 @@ int main(int argc, char **argv) {
             printf("\rPlaying test midi no. %i ", test_count);
         }
 
+#ifdef AUDIODRV_SHM
+        shm_output_midi(midi_ptr);
+#endif
         wm_info = WildMidi_GetInfo(midi_ptr);
 
         apr_mins = wm_info->approx_total_samples / (rate * 60);
@@ -818,6 +879,9 @@ int main(int argc, char **argv) {
             }
         }
         NEXTMIDI: fprintf(stderr, "\r\n");
+#ifdef AUDIODRV_SHM
+        shm_output_midi(NULL);
+#endif
         if (WildMidi_Close(midi_ptr) == -1) {
             ret_err = WildMidi_GetError();
             fprintf(stderr, "OOPS: failed closing midi handle!\r\n%s\r\n",ret_err);
@@ -0,0 +1,456 @@
+/*
+ * render_cache.c -- Midi Wavetable Processing library
+ *
+ * Copyright (C) WildMIDI Developers 2001-2016
+ *
+ * This file is part of WildMIDI.
+ *
+ * WildMIDI is free software: you can redistribute and/or modify the player
+ * under the terms of the GNU General Public License and you can redistribute
+ * and/or modify the library under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3 of
+ * the licenses, or(at your option) any later version.
+ *
+ * WildMIDI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License and
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License and the
+ * GNU Lesser General Public License along with WildMIDI.  If not,  see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WILDMIDI_AMIGA
+#include <sys/types.h>
+#include <sys/stat.h>
+#endif
+#ifdef _WIN32
+#include <windows.h>
+#include <sys/utime.h>
+#define WM_CACHE_LRU 1
+#elif defined(HAVE_DIRENT_H)
+#include <dirent.h>
+#include <utime.h>
+#define WM_CACHE_LRU 1
+#endif
+
+#include "common.h"
+#include "lock.h"
+#include "wm_error.h"
+#include "filenames.h"
+#include "file_io.h"
+#include "render_cache.h"
+
+/*
+ Finished renders are kept as wav files named after the 64 bit key of
+ everything that went into them, so a repeated render is a file copy.
+ Where the directory can be listed, a cache hit updates the file time
+ and the least recently used files are removed to stay under the limit.
+ */
+
+#define CACHE_NAME_LEN 16 /* hex digits of the key */
+
+struct _cache_entry {
+    char name[CACHE_NAME_LEN + 5];
+    uint64_t stamp;
+    uint64_t size;
+};
+
+static int cache_lock = 0;
+static char *cache_dir = NULL;
+static uint64_t cache_max_bytes = 0;
+
+uint64_t _WM_hash_bytes(uint64_t hash, const void *data, uint32_t size) {
+    const uint8_t *p = (const uint8_t *) data;
+
+    while (size--) {
+        hash ^= *p++;
+        hash *= (uint64_t) 0x100000001b3ULL;
+    }
+    return (hash);
+}
+
+/*
+ The content hashes of the patch files in render keys, remembered with
+ the size and modification time they were taken at so a file is only
+ read again once it changes.
+ */
+struct _file_hash {
+    char *path;
+    uint64_t size;
+    int64_t mtime;
+    uint64_t hash;
+    struct _file_hash *next;
+};
+
+static int file_hash_lock = 0;
+static struct _file_hash *file_hashes = NULL;
+
+static void free_file_hashes(void) {
+    struct _file_hash *tmp;
+
+    _WM_Lock(&file_hash_lock);
+    while (file_hashes) {
+        tmp = file_hashes->next;
+        free(file_hashes->path);
+        free(file_hashes);
+        file_hashes = tmp;
+    }
+    _WM_Unlock(&file_hash_lock);
+}
+
+/*
+ Hashes the content of path into hash. Returns -1 if it can't be read.
+ The file is only read when it isn't known with its current size and
+ time, or when file reads go through callbacks stat knows nothing of.
+ */
+int _WM_hash_file(uint64_t *hash, const char *path) {
+    uint64_t file_hash = WM_HASH_INIT;
+    uint8_t *data;
+    uint32_t size;
+#ifndef WILDMIDI_AMIGA
+    struct _file_hash *known;
+    struct stat st;
+    int memo = ((_WM_BufferFile == _WM_BufferFileImpl) && (stat(path, &st) == 0));
+
+    if (memo) {
+        _WM_Lock(&file_hash_lock);
+        for (known = file_hashes; known; known = known->next) {
+            if (strcmp(known->path, path) == 0)
+                break;
+        }
+        if ((known) && (known->size == (uint64_t) st.st_size)
+                && (known->mtime == (int64_t) st.st_mtime)) {
+            *hash = _WM_hash_bytes(*hash, &known->hash, sizeof(known->hash));
+            _WM_Unlock(&file_hash_lock);
+            return (0);
+        }
+        _WM_Unlock(&file_hash_lock);
+    }
+#endif
+
+    if ((data = (uint8_t *) _WM_BufferFile(path, &size)) == NULL) {
+        return (-1);
+    }
+    file_hash = _WM_hash_bytes(file_hash, data, size);
+    _WM_FreeBufferFile(data);
+    *hash = _WM_hash_bytes(*hash, &file_hash, sizeof(file_hash));
+
+#ifndef WILDMIDI_AMIGA
+    if (memo) {
+        _WM_Lock(&file_hash_lock);
+        for (known = file_hashes; known; known = known->next) {
+            if (strcmp(known->path, path) == 0)
+                break;
+        }
+        if (known == NULL) {
+            known = (struct _file_hash *) malloc(sizeof(struct _file_hash));
+            if (known != NULL) {
+                known->path = (char *) malloc(strlen(path) + 1);
+                if (known->path == NULL) {
+                    free(known);
+                    known = NULL;
+                } else {
+                    strcpy(known->path, path);
+                    known->next = file_hashes;
+                    file_hashes = known;
+                }
+            }
+        }
+        if (known != NULL) {
+            /* not fatal if it couldn't be kept, it is just read again */
+            known->size = (uint64_t) st.st_size;
+            known->mtime = (int64_t) st.st_mtime;
+            known->hash = file_hash;
+        }
+        _WM_Unlock(&file_hash_lock);
+    }
+#endif
+    return (0);
+}
+
+/* dir == NULL turns the cache off, max_mbytes == 0 means no limit */
+int _WM_set_render_cache(const char *dir, uint32_t max_mbytes) {
+    char *new_dir = NULL;
+
+    if ((dir != NULL) && (dir[0] != '\0')) {
+#ifndef WILDMIDI_AMIGA
+        struct stat st;
+
+        if ((stat(dir, &st) != 0) || ((st.st_mode & S_IFMT) != S_IFDIR)) {
+            _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(cache dir is not a directory)", 0);
+            return (-1);
+        }
+#endif
+        new_dir = (char *) malloc(strlen(dir) + 1);
+        if (new_dir == NULL) {
+            _WM_GLOBAL_ERROR(WM_ERR_MEM, "to set render cache", 0);
+            return (-1);
+        }
+        strcpy(new_dir, dir);
+    }
+
+    _WM_Lock(&cache_lock);
+    free(cache_dir);
+    cache_dir = new_dir;
+    cache_max_bytes = (uint64_t) max_mbytes << 20;
+    _WM_Unlock(&cache_lock);
+    if (new_dir == NULL) {
+        free_file_hashes();
+    }
+    return (0);
+}
+
+int _WM_render_cache_enabled(void) {
+    return (cache_dir != NULL);
+}
+
+/* call with cache_lock held */
+static char *cache_path(const char *name, const char *ext) {
+    size_t dir_len = strlen(cache_dir);
+    char *path = (char *) malloc(dir_len + 1 + strlen(name) + strlen(ext) + 1);
+
+    if (path == NULL) return (NULL);
+    strcpy(path, cache_dir);
+    if ((dir_len != 0) && !IS_DIR_SEPARATOR(path[dir_len - 1])) {
+        strcat(path, DIR_SEPARATOR_STR);
+    }
+    strcat(path, name);
+    strcat(path, ext);
+    return (path);
+}
+
+static void key_name(uint64_t key, char *name) {
+    sprintf(name, "%08lx%08lx", (unsigned long) (key >> 32),
+            (unsigned long) (key & 0xffffffff));
+}
+
+static int copy_file(const char *from, const char *to) {
+    uint8_t buf[16384];
+    FILE *in;
+    FILE *out;
+    size_t got;
+    int ret = 0;
+
+    if ((in = fopen(from, "rb")) == NULL) {
+        return (-1);
+    }
+    if ((out = fopen(to, "wb")) == NULL) {
+        fclose(in);
+        return (-1);
+    }
+    while ((got = fread(buf, 1, sizeof(buf), in)) != 0) {
+        if (fwrite(buf, 1, got, out) != got) {
+            ret = -1;
+            break;
+        }
+    }
+    if (ferror(in)) ret = -1;
+    fclose(in);
+    if (fclose(out) != 0) ret = -1;
+    if (ret != 0) remove(to);
+    return (ret);
+}
+
+#ifdef WM_CACHE_LRU
+static int is_cache_name(const char *name) {
+    int i;
+
+    for (i = 0; i < CACHE_NAME_LEN; i++) {
+        if (!(((name[i] >= '0') && (name[i] <= '9'))
+              || ((name[i] >= 'a') && (name[i] <= 'f')))) {
+            return (0);
+        }
+    }
+    return (strcmp(&name[CACHE_NAME_LEN], ".wav") == 0);
+}
+
+static int add_entry(struct _cache_entry **entries, uint32_t *count,
+                     uint32_t *alloced, const char *name,
+                     uint64_t stamp, uint64_t size) {
+    if (*count == *alloced) {
+        struct _cache_entry *tmp = (struct _cache_entry *) realloc(*entries,
+                                    (*alloced + 64) * sizeof(struct _cache_entry));
+        if (tmp == NULL) return (-1);
+        *entries = tmp;
+        *alloced += 64;
+    }
+    strcpy((*entries)[*count].name, name);
+    (*entries)[*count].stamp = stamp;
+    (*entries)[*count].size = size;
+    (*count)++;
+    return (0);
+}
+
+static int cmp_entry(const void *a, const void *b) {
+    const struct _cache_entry *ea = (const struct _cache_entry *) a;
+    const struct _cache_entry *eb = (const struct _cache_entry *) b;
+
+    if (ea->stamp < eb->stamp) return (-1);
+    if (ea->stamp > eb->stamp) return (1);
+    return (0);
+}
+
+/* call with cache_lock held */
+static void evict_cache(void) {
+    struct _cache_entry *entries = NULL;
+    uint32_t count = 0;
+    uint32_t alloced = 0;
+    uint64_t total = 0;
+    uint32_t i;
+    char *path;
+#ifdef _WIN32
+    WIN32_FIND_DATAA fd;
+    HANDLE fh;
+
+    if ((path = cache_path("*", ".wav")) == NULL) return;
+    fh = FindFirstFileA(path, &fd);
+    free(path);
+    if (fh == INVALID_HANDLE_VALUE) return;
+    do {
+        if (!is_cache_name(fd.cFileName)) continue;
+        if (add_entry(&entries, &count, &alloced, fd.cFileName,
+                      ((uint64_t) fd.ftLastWriteTime.dwHighDateTime << 32)
+                      | fd.ftLastWriteTime.dwLowDateTime,
+                      ((uint64_t) fd.nFileSizeHigh << 32) | fd.nFileSizeLow) != 0) {
+            break;
+        }
+    } while (FindNextFileA(fh, &fd));
+    FindClose(fh);
+#else
+    DIR *dir;
+    struct dirent *de;
+    struct stat st;
+
+    if ((dir = opendir(cache_dir)) == NULL) return;
+    while ((de = readdir(dir)) != NULL) {
+        if (!is_cache_name(de->d_name)) continue;
+        if ((path = cache_path(de->d_name, "")) == NULL) break;
+        if (stat(path, &st) == 0) {
+            if (add_entry(&entries, &count, &alloced, de->d_name,
+                          (uint64_t) st.st_mtime, (uint64_t) st.st_size) != 0) {
+                free(path);
+                break;
+            }
+        }
+        free(path);
+    }
+    closedir(dir);
+#endif
+
+    for (i = 0; i < count; i++) {
+        total += entries[i].size;
+    }
+    if (total > cache_max_bytes) {
+        qsort(entries, count, sizeof(struct _cache_entry), cmp_entry);
+        for (i = 0; (i < count) && (total > cache_max_bytes); i++) {
+            if ((path = cache_path(entries[i].name, "")) == NULL) break;
+            if (remove(path) == 0) {
+                total -= entries[i].size;
+            }
+            free(path);
+        }
+    }
+    free(entries);
+}
+#endif /* WM_CACHE_LRU */
+
+/* the path the render for key is stored at, NULL when the cache is off */
+static char *key_path(uint64_t key, const char *ext) {
+    char name[CACHE_NAME_LEN + 1];
+    char *path = NULL;
+
+    _WM_Lock(&cache_lock);
+    if (cache_dir != NULL) {
+        key_name(key, name);
+        path = cache_path(name, ext);
+    }
+    _WM_Unlock(&cache_lock);
+    return (path);
+}
+
+/*
+ Copies the render stored under key to outfile.
+ Returns 0 on a hit, -1 on a miss or when the cache is off.
+
+ The copy is made to outfile.tmp without cache_lock held so stores and
+ other fetches go on meanwhile, a file evicted under it is a miss.
+ */
+int _WM_render_cache_fetch(uint64_t key, const char *outfile) {
+    char *path;
+    char *tmp_outfile;
+    int ret = -1;
+
+    if ((path = key_path(key, ".wav")) == NULL) {
+        return (-1);
+    }
+    tmp_outfile = (char *) malloc(strlen(outfile) + 5);
+    if (tmp_outfile != NULL) {
+        strcpy(tmp_outfile, outfile);
+        strcat(tmp_outfile, ".tmp");
+        if (copy_file(path, tmp_outfile) == 0) {
+            /* rename won't replace a file everywhere */
+            if ((rename(tmp_outfile, outfile) == 0)
+                    || ((remove(outfile) == 0) && (rename(tmp_outfile, outfile) == 0))) {
+#ifdef WM_CACHE_LRU
+                _WM_Lock(&cache_lock);
+                utime(path, NULL);
+                _WM_Unlock(&cache_lock);
+#endif
+                ret = 0;
+            } else {
+                remove(tmp_outfile);
+            }
+        }
+        free(tmp_outfile);
+    }
+    free(path);
+    return (ret);
+}
+
+/*
+ Adds infile to the cache under key. Failing to do so is not an error,
+ the render it came from is still good.
+
+ It is copied to a .tmp file without cache_lock held, which is only
+ taken to rename it into place and evict.
+ */
+void _WM_render_cache_store(uint64_t key, const char *infile) {
+    static uint32_t tmp_count = 0;
+    char tmp_ext[20];
+    char *path;
+    char *tmp_path;
+
+    /* a name of its own, the same render may be stored twice at once */
+    _WM_Lock(&cache_lock);
+    sprintf(tmp_ext, ".%lu.tmp", (unsigned long) tmp_count++);
+    _WM_Unlock(&cache_lock);
+    path = key_path(key, ".wav");
+    tmp_path = key_path(key, tmp_ext);
+
+    /* written under another name first so a reader
+     * never sees a partial file */
+    if ((path != NULL) && (tmp_path != NULL)
+            && (copy_file(infile, tmp_path) == 0)) {
+        _WM_Lock(&cache_lock);
+        if (rename(tmp_path, path) != 0) {
+            remove(tmp_path);
+        }
+#ifdef WM_CACHE_LRU
+        if ((cache_dir != NULL) && (cache_max_bytes != 0)) {
+            evict_cache();
+        }
+#endif
+        _WM_Unlock(&cache_lock);
+    }
+    free(path);
+    free(tmp_path);
+}
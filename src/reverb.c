@@ -26,6 +26,7 @@
 #include <stdint.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "common.h"
 #include "reverb.h"
@@ -51,6 +52,13 @@ void _WM_reset_reverb(struct _rvb *rvb) {
             }
         }
     }
+    rvb->phase = 0;
+    rvb->dec_l = 0;
+    rvb->dec_r = 0;
+    for (i = 0; i < 2; i++) {
+        rvb->wet_l[i] = 0;
+        rvb->wet_r[i] = 0;
+    }
 }
 
 /*
@@ -174,6 +182,20 @@ _WM_init_reverb(int rate, float room_x, float room_y, float listen_x,
         return NULL;
     }
 
+    /*
+     The filter bands top out at 4kHz, so the reverb can run at a lower
+     rate as long as that stays at 22050 or above. The coefficients and
+     delays below are then worked out for the lower rate.
+     */
+    rtn_rvb->decimate = 1;
+    if (_WM_reverb_decimate) {
+        while ((rtn_rvb->decimate < 4)
+               && ((rate / (rtn_rvb->decimate * 2)) >= 22050)) {
+            rtn_rvb->decimate *= 2;
+        }
+    }
+    rate /= rtn_rvb->decimate;
+
     for (j = 0; j < 8; j++) {
         double SPL_RFL_XOFS = 0;
         double SPL_RFL_YOFS = 0;
@@ -267,6 +289,15 @@ _WM_init_reverb(int rate, float room_x, float room_y, float listen_x,
     rtn_rvb->r_buf = (int32_t *) malloc(sizeof(int32_t) * (rtn_rvb->r_buf_size + 1));
     rtn_rvb->r_out = 0;
 
+    /*
+     How long, in output samples, the wet signal takes to die away once
+     its input stops. Measured at about 8 trips round the longer buffer
+     plus the tail of the filters, this leaves twice that.
+     */
+    rtn_rvb->max_reverb_time = (uint32_t) ((16
+            * ((rtn_rvb->l_buf_size > rtn_rvb->r_buf_size) ? rtn_rvb->l_buf_size : rtn_rvb->r_buf_size)
+            + (rate / 4)) * rtn_rvb->decimate);
+
     for (i = 0; i < 4; i++) {
         rtn_rvb->l_sp_in[i] = (int) ((float) rate * (SPL_DST[i] / 340.29));
         rtn_rvb->l_sp_in[i + 4] = (int) ((float) rate
@@ -292,86 +323,247 @@ void _WM_free_reverb(struct _rvb *rvb) {
     free(rvb);
 }
 
-void _WM_do_reverb(struct _rvb *rvb, int32_t *buffer, int size) {
-    int i, j, k;
+/*
+ One sample of the reverb network. Takes the dry input, returns the
+ filtered reflections and feeds dry plus wet back into the buffers.
+ */
+static void reverb_step(struct _rvb *rvb, int32_t dry_l, int32_t dry_r,
+        int32_t *wet_l, int32_t *wet_r) {
+    int j, k;
     int32_t l_buf_flt = 0;
     int32_t r_buf_flt = 0;
     int32_t l_rfl = 0;
     int32_t r_rfl = 0;
+    int32_t tmp_l_val = 0;
+    int32_t tmp_r_val = 0;
+    int32_t l_sum = 0;
+    int32_t r_sum = 0;
     int vol_div = 64;
 
-    for (i = 0; i < size; i += 2) {
-        int32_t tmp_l_val = 0;
-        int32_t tmp_r_val = 0;
-        /*
-         add the initial reflections
-         from each speaker, 4 to go the left, 4 go to the right buffers
-         */
-        tmp_l_val = buffer[i] / vol_div;
-        tmp_r_val = buffer[i + 1] / vol_div;
-        for (j = 0; j < 4; j++) {
-            rvb->l_buf[rvb->l_sp_in[j]] += tmp_l_val;
-            rvb->l_sp_in[j] = (rvb->l_sp_in[j] + 1) % rvb->l_buf_size;
-            rvb->l_buf[rvb->r_sp_in[j]] += tmp_r_val;
-            rvb->r_sp_in[j] = (rvb->r_sp_in[j] + 1) % rvb->l_buf_size;
-
-            rvb->r_buf[rvb->l_sp_in[j + 4]] += tmp_l_val;
-            rvb->l_sp_in[j + 4] = (rvb->l_sp_in[j + 4] + 1) % rvb->r_buf_size;
-            rvb->r_buf[rvb->r_sp_in[j + 4]] += tmp_r_val;
-            rvb->r_sp_in[j + 4] = (rvb->r_sp_in[j + 4] + 1) % rvb->r_buf_size;
+    /*
+     add the initial reflections
+     from each speaker, 4 to go the left, 4 go to the right buffers
+     */
+    tmp_l_val = dry_l / vol_div;
+    tmp_r_val = dry_r / vol_div;
+    for (j = 0; j < 4; j++) {
+        rvb->l_buf[rvb->l_sp_in[j]] += tmp_l_val;
+        rvb->l_sp_in[j] = (rvb->l_sp_in[j] + 1) % rvb->l_buf_size;
+        rvb->l_buf[rvb->r_sp_in[j]] += tmp_r_val;
+        rvb->r_sp_in[j] = (rvb->r_sp_in[j] + 1) % rvb->l_buf_size;
+
+        rvb->r_buf[rvb->l_sp_in[j + 4]] += tmp_l_val;
+        rvb->l_sp_in[j + 4] = (rvb->l_sp_in[j + 4] + 1) % rvb->r_buf_size;
+        rvb->r_buf[rvb->r_sp_in[j + 4]] += tmp_r_val;
+        rvb->r_sp_in[j + 4] = (rvb->r_sp_in[j + 4] + 1) % rvb->r_buf_size;
+    }
+
+    /*
+     filter the reverb output
+     */
+    l_rfl = rvb->l_buf[rvb->l_out];
+    rvb->l_buf[rvb->l_out] = 0;
+    rvb->l_out = (rvb->l_out + 1) % rvb->l_buf_size;
+
+    r_rfl = rvb->r_buf[rvb->r_out];
+    rvb->r_buf[rvb->r_out] = 0;
+    rvb->r_out = (rvb->r_out + 1) % rvb->r_buf_size;
+
+    for (k = 0; k < 8; k++) {
+        for (j = 0; j < 6; j++) {
+            l_buf_flt = ((l_rfl * rvb->coeff[k][j][0])
+                    + (rvb->l_buf_flt_in[k][j][0] * rvb->coeff[k][j][1])
+                    + (rvb->l_buf_flt_in[k][j][1] * rvb->coeff[k][j][2])
+                    - (rvb->l_buf_flt_out[k][j][0] * rvb->coeff[k][j][3])
+                    - (rvb->l_buf_flt_out[k][j][1] * rvb->coeff[k][j][4]))
+                    / 1024;
+            rvb->l_buf_flt_in[k][j][1] = rvb->l_buf_flt_in[k][j][0];
+            rvb->l_buf_flt_in[k][j][0] = l_rfl;
+            rvb->l_buf_flt_out[k][j][1] = rvb->l_buf_flt_out[k][j][0];
+            rvb->l_buf_flt_out[k][j][0] = l_buf_flt;
+            l_sum += l_buf_flt / 8;
+
+            r_buf_flt = ((r_rfl * rvb->coeff[k][j][0])
+                    + (rvb->r_buf_flt_in[k][j][0] * rvb->coeff[k][j][1])
+                    + (rvb->r_buf_flt_in[k][j][1] * rvb->coeff[k][j][2])
+                    - (rvb->r_buf_flt_out[k][j][0] * rvb->coeff[k][j][3])
+                    - (rvb->r_buf_flt_out[k][j][1] * rvb->coeff[k][j][4]))
+                    / 1024;
+            rvb->r_buf_flt_in[k][j][1] = rvb->r_buf_flt_in[k][j][0];
+            rvb->r_buf_flt_in[k][j][0] = r_rfl;
+            rvb->r_buf_flt_out[k][j][1] = rvb->r_buf_flt_out[k][j][0];
+            rvb->r_buf_flt_out[k][j][0] = r_buf_flt;
+            r_sum += r_buf_flt / 8;
         }
+    }
 
-        /*
-         filter the reverb output and add to buffer
-         */
-        l_rfl = rvb->l_buf[rvb->l_out];
-        rvb->l_buf[rvb->l_out] = 0;
-        rvb->l_out = (rvb->l_out + 1) % rvb->l_buf_size;
-
-        r_rfl = rvb->r_buf[rvb->r_out];
-        rvb->r_buf[rvb->r_out] = 0;
-        rvb->r_out = (rvb->r_out + 1) % rvb->r_buf_size;
-
-        for (k = 0; k < 8; k++) {
-            for (j = 0; j < 6; j++) {
-                l_buf_flt = ((l_rfl * rvb->coeff[k][j][0])
-                        + (rvb->l_buf_flt_in[k][j][0] * rvb->coeff[k][j][1])
-                        + (rvb->l_buf_flt_in[k][j][1] * rvb->coeff[k][j][2])
-                        - (rvb->l_buf_flt_out[k][j][0] * rvb->coeff[k][j][3])
-                        - (rvb->l_buf_flt_out[k][j][1] * rvb->coeff[k][j][4]))
-                        / 1024;
-                rvb->l_buf_flt_in[k][j][1] = rvb->l_buf_flt_in[k][j][0];
-                rvb->l_buf_flt_in[k][j][0] = l_rfl;
-                rvb->l_buf_flt_out[k][j][1] = rvb->l_buf_flt_out[k][j][0];
-                rvb->l_buf_flt_out[k][j][0] = l_buf_flt;
-                buffer[i] += l_buf_flt / 8;
-
-                r_buf_flt = ((r_rfl * rvb->coeff[k][j][0])
-                        + (rvb->r_buf_flt_in[k][j][0] * rvb->coeff[k][j][1])
-                        + (rvb->r_buf_flt_in[k][j][1] * rvb->coeff[k][j][2])
-                        - (rvb->r_buf_flt_out[k][j][0] * rvb->coeff[k][j][3])
-                        - (rvb->r_buf_flt_out[k][j][1] * rvb->coeff[k][j][4]))
-                        / 1024;
-                rvb->r_buf_flt_in[k][j][1] = rvb->r_buf_flt_in[k][j][0];
-                rvb->r_buf_flt_in[k][j][0] = r_rfl;
-                rvb->r_buf_flt_out[k][j][1] = rvb->r_buf_flt_out[k][j][0];
-                rvb->r_buf_flt_out[k][j][0] = r_buf_flt;
-                buffer[i + 1] += r_buf_flt / 8;
-            }
+    /*
+     add filtered result back into the buffers but on the opposite side
+     */
+    tmp_l_val = (dry_r + r_sum) / vol_div;
+    tmp_r_val = (dry_l + l_sum) / vol_div;
+    for (j = 0; j < 4; j++) {
+        rvb->l_buf[rvb->l_in[j]] += tmp_l_val;
+        rvb->l_in[j] = (rvb->l_in[j] + 1) % rvb->l_buf_size;
+
+        rvb->r_buf[rvb->r_in[j]] += tmp_r_val;
+        rvb->r_in[j] = (rvb->r_in[j] + 1) % rvb->r_buf_size;
+    }
+
+    *wet_l = l_sum;
+    *wet_r = r_sum;
+}
+
+void _WM_do_reverb(struct _rvb *rvb, int32_t *buffer, int size) {
+    int i;
+    int32_t wet_l;
+    int32_t wet_r;
+
+    if (rvb->decimate == 1) {
+        for (i = 0; i < size; i += 2) {
+            reverb_step(rvb, buffer[i], buffer[i + 1], &wet_l, &wet_r);
+            buffer[i] += wet_l;
+            buffer[i + 1] += wet_r;
         }
+        return;
+    }
 
-        /*
-         add filtered result back into the buffers but on the opposite side
-         */
-        tmp_l_val = buffer[i + 1] / vol_div;
-        tmp_r_val = buffer[i] / vol_div;
-        for (j = 0; j < 4; j++) {
-            rvb->l_buf[rvb->l_in[j]] += tmp_l_val;
-            rvb->l_in[j] = (rvb->l_in[j] + 1) % rvb->l_buf_size;
-
-            rvb->r_buf[rvb->r_in[j]] += tmp_r_val;
-            rvb->r_in[j] = (rvb->r_in[j] + 1) % rvb->r_buf_size;
+    /*
+     Decimated: the dry input is averaged over decimate samples for each
+     step, and the wet output is linearly interpolated between the last
+     two steps, which delays it by one step. The phase carries over
+     between calls so the output does not depend on the block size.
+     */
+    for (i = 0; i < size; i += 2) {
+        rvb->dec_l += buffer[i];
+        rvb->dec_r += buffer[i + 1];
+        rvb->phase++;
+
+        buffer[i] += rvb->wet_l[0] + (rvb->wet_l[1] - rvb->wet_l[0])
+                * rvb->phase / rvb->decimate;
+        buffer[i + 1] += rvb->wet_r[0] + (rvb->wet_r[1] - rvb->wet_r[0])
+                * rvb->phase / rvb->decimate;
+
+        if (rvb->phase == rvb->decimate) {
+            reverb_step(rvb, rvb->dec_l / rvb->decimate,
+                    rvb->dec_r / rvb->decimate, &wet_l, &wet_r);
+            rvb->wet_l[0] = rvb->wet_l[1];
+            rvb->wet_l[1] = wet_l;
+            rvb->wet_r[0] = rvb->wet_r[1];
+            rvb->wet_r[1] = wet_r;
+            rvb->dec_l = 0;
+            rvb->dec_r = 0;
+            rvb->phase = 0;
         }
     }
 }
 
+/*
+ Reverb state as int32 values, so playback can be picked up again
+ part way into a midi. The coefficients never change and are left out.
+ */
+#define RVB_FILTER_SIZE (4 * 8 * 6 * 2)
+#define RVB_POS_SIZE (2 + 8 + 8 + 4 + 4 + 7)
+
+uint32_t _WM_reverb_state_size(struct _rvb *rvb) {
+    return (RVB_FILTER_SIZE + RVB_POS_SIZE + rvb->l_buf_size + rvb->r_buf_size);
+}
+
+void _WM_get_reverb_state(struct _rvb *rvb, int32_t *state) {
+    int i;
+
+    memcpy(state, rvb->l_buf_flt_in, sizeof(rvb->l_buf_flt_in));
+    state += 8 * 6 * 2;
+    memcpy(state, rvb->l_buf_flt_out, sizeof(rvb->l_buf_flt_out));
+    state += 8 * 6 * 2;
+    memcpy(state, rvb->r_buf_flt_in, sizeof(rvb->r_buf_flt_in));
+    state += 8 * 6 * 2;
+    memcpy(state, rvb->r_buf_flt_out, sizeof(rvb->r_buf_flt_out));
+    state += 8 * 6 * 2;
+
+    *state++ = rvb->l_out;
+    *state++ = rvb->r_out;
+    for (i = 0; i < 8; i++) {
+        *state++ = rvb->l_sp_in[i];
+        *state++ = rvb->r_sp_in[i];
+    }
+    for (i = 0; i < 4; i++) {
+        *state++ = rvb->l_in[i];
+        *state++ = rvb->r_in[i];
+    }
+    *state++ = rvb->phase;
+    *state++ = rvb->dec_l;
+    *state++ = rvb->dec_r;
+    for (i = 0; i < 2; i++) {
+        *state++ = rvb->wet_l[i];
+        *state++ = rvb->wet_r[i];
+    }
+
+    memcpy(state, rvb->l_buf, rvb->l_buf_size * sizeof(int32_t));
+    state += rvb->l_buf_size;
+    memcpy(state, rvb->r_buf, rvb->r_buf_size * sizeof(int32_t));
+}
+
+/*
+ Whether the buffer positions and phase in state are ones rvb can have,
+ so a state from elsewhere can't send _WM_do_reverb outside its
+ buffers. Returns 0 if so.
+ */
+int _WM_check_reverb_state(struct _rvb *rvb, const int32_t *state) {
+    int i;
+
+    state += RVB_FILTER_SIZE;
+    if ((state[0] < 0) || (state[0] >= rvb->l_buf_size)
+        || (state[1] < 0) || (state[1] >= rvb->r_buf_size))
+        return (-1);
+    state += 2;
+    /* the first 4 of each side go into l_buf, the others into r_buf */
+    for (i = 0; i < 16; i++) {
+        if ((state[i] < 0) || (state[i] >= ((i < 8) ? rvb->l_buf_size : rvb->r_buf_size)))
+            return (-1);
+    }
+    state += 16;
+    for (i = 0; i < 8; i++) {
+        if ((state[i] < 0) || (state[i] >= ((i & 1) ? rvb->r_buf_size : rvb->l_buf_size)))
+            return (-1);
+    }
+    state += 8;
+    if ((state[0] < 0) || (state[0] >= rvb->decimate))
+        return (-1);
+    return (0);
+}
+
+void _WM_set_reverb_state(struct _rvb *rvb, const int32_t *state) {
+    int i;
+
+    memcpy(rvb->l_buf_flt_in, state, sizeof(rvb->l_buf_flt_in));
+    state += 8 * 6 * 2;
+    memcpy(rvb->l_buf_flt_out, state, sizeof(rvb->l_buf_flt_out));
+    state += 8 * 6 * 2;
+    memcpy(rvb->r_buf_flt_in, state, sizeof(rvb->r_buf_flt_in));
+    state += 8 * 6 * 2;
+    memcpy(rvb->r_buf_flt_out, state, sizeof(rvb->r_buf_flt_out));
+    state += 8 * 6 * 2;
+
+    rvb->l_out = *state++;
+    rvb->r_out = *state++;
+    for (i = 0; i < 8; i++) {
+        rvb->l_sp_in[i] = *state++;
+        rvb->r_sp_in[i] = *state++;
+    }
+    for (i = 0; i < 4; i++) {
+        rvb->l_in[i] = *state++;
+        rvb->r_in[i] = *state++;
+    }
+    rvb->phase = *state++;
+    rvb->dec_l = *state++;
+    rvb->dec_r = *state++;
+    for (i = 0; i < 2; i++) {
+        rvb->wet_l[i] = *state++;
+        rvb->wet_r[i] = *state++;
+    }
+
+    memcpy(rvb->l_buf, state, rvb->l_buf_size * sizeof(int32_t));
+    state += rvb->l_buf_size;
+    memcpy(rvb->r_buf, state, rvb->r_buf_size * sizeof(int32_t));
+}
@@ -0,0 +1,69 @@
+/*
+ * rt_debug.c -- Midi Wavetable Processing library
+ *
+ * Copyright (C) WildMIDI Developers 2001-2016
+ *
+ * This file is part of WildMIDI.
+ *
+ * WildMIDI is free software: you can redistribute and/or modify the player
+ * under the terms of the GNU General Public License and you can redistribute
+ * and/or modify the library under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3 of
+ * the licenses, or(at your option) any later version.
+ *
+ * WildMIDI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License and
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License and the
+ * GNU Lesser General Public License along with WildMIDI.  If not,  see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "rt_debug.h"
+
+/*
+ Only built with WANT_RT_DEBUG, which links with
+ -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=free
+ so the allocator calls come through here.
+ */
+
+__thread int _WM_rt_rendering = 0;
+
+void _WM_rt_violation(const char *what) {
+    /* fprintf may allocate */
+    _WM_rt_rendering = 0;
+    fprintf(stderr, "libWildMidi: %s called from the realtime render path\n", what);
+    abort();
+}
+
+extern void *__real_malloc(size_t size);
+extern void *__real_calloc(size_t nmemb, size_t size);
+extern void *__real_realloc(void *ptr, size_t size);
+extern void __real_free(void *ptr);
+
+void *__wrap_malloc(size_t size) {
+    WM_RT_CHECK("malloc");
+    return (__real_malloc(size));
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+    WM_RT_CHECK("calloc");
+    return (__real_calloc(nmemb, size));
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    WM_RT_CHECK("realloc");
+    return (__real_realloc(ptr, size));
+}
+
+void __wrap_free(void *ptr) {
+    WM_RT_CHECK("free");
+    __real_free(ptr);
+}
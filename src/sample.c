@@ -23,26 +23,128 @@
 
 #include "config.h"
 
+#include <math.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "lock.h"
 #include "common.h"
 #include "patches.h"
 #include "gus_pat.h"
+#include "gauss.h"
 #include "wildmidi_lib.h"
 #include "internal_midi.h"
 #include "sample.h"
+#include "patch_loader.h"
 
 /*
  FIXME: Need to decide if this stuff needs to be broken up for different formats.
  */
 
-uint32_t _WM_get_decay_samples(struct _mdi * mdi, uint8_t channel, uint8_t note) {
+/* G.711 mu-law to 16bit linear */
+const int16_t _WM_ulaw_table[256] = {
+    -32124, -31100, -30076, -29052, -28028, -27004, -25980, -24956,
+    -23932, -22908, -21884, -20860, -19836, -18812, -17788, -16764,
+    -15996, -15484, -14972, -14460, -13948, -13436, -12924, -12412,
+    -11900, -11388, -10876, -10364,  -9852,  -9340,  -8828,  -8316,
+     -7932,  -7676,  -7420,  -7164,  -6908,  -6652,  -6396,  -6140,
+     -5884,  -5628,  -5372,  -5116,  -4860,  -4604,  -4348,  -4092,
+     -3900,  -3772,  -3644,  -3516,  -3388,  -3260,  -3132,  -3004,
+     -2876,  -2748,  -2620,  -2492,  -2364,  -2236,  -2108,  -1980,
+     -1884,  -1820,  -1756,  -1692,  -1628,  -1564,  -1500,  -1436,
+     -1372,  -1308,  -1244,  -1180,  -1116,  -1052,   -988,   -924,
+      -876,   -844,   -812,   -780,   -748,   -716,   -684,   -652,
+      -620,   -588,   -556,   -524,   -492,   -460,   -428,   -396,
+      -372,   -356,   -340,   -324,   -308,   -292,   -276,   -260,
+      -244,   -228,   -212,   -196,   -180,   -164,   -148,   -132,
+      -120,   -112,   -104,    -96,    -88,    -80,    -72,    -64,
+       -56,    -48,    -40,    -32,    -24,    -16,     -8,      0,
+     32124,  31100,  30076,  29052,  28028,  27004,  25980,  24956,
+     23932,  22908,  21884,  20860,  19836,  18812,  17788,  16764,
+     15996,  15484,  14972,  14460,  13948,  13436,  12924,  12412,
+     11900,  11388,  10876,  10364,   9852,   9340,   8828,   8316,
+      7932,   7676,   7420,   7164,   6908,   6652,   6396,   6140,
+      5884,   5628,   5372,   5116,   4860,   4604,   4348,   4092,
+      3900,   3772,   3644,   3516,   3388,   3260,   3132,   3004,
+      2876,   2748,   2620,   2492,   2364,   2236,   2108,   1980,
+      1884,   1820,   1756,   1692,   1628,   1564,   1500,   1436,
+      1372,   1308,   1244,   1180,   1116,   1052,    988,    924,
+       876,    844,    812,    780,    748,    716,    684,    652,
+       620,    588,    556,    524,    492,    460,    428,    396,
+       372,    356,    340,    324,    308,    292,    276,    260,
+       244,    228,    212,    196,    180,    164,    148,    132,
+       120,    112,    104,     96,     88,     80,     72,     64,
+        56,     48,     40,     32,     24,     16,      8,      0
+};
+
+static uint8_t ulaw_encode(int16_t pcm) {
+    int32_t value = pcm;
+    uint8_t sign = 0;
+    uint8_t exponent = 7;
+    uint32_t mask;
+
+    if (value < 0) {
+        value = -value;
+        sign = 0x80;
+    }
+    if (value > 32635)
+        value = 32635;
+    value += 0x84;
+
+    for (mask = 0x4000; !(value & mask) && exponent; mask >>= 1)
+        exponent--;
+
+    return ~(sign | (exponent << 4) | ((value >> (exponent + 3)) & 0x0F));
+}
+
+/*
+ Replace the 16bit data of a sample with 8bit mu-law if doing so keeps
+ the signal to noise ratio above _WM_compact_min_snr.
+ */
+static void compact_sample(struct _sample *sample) {
+    uint32_t i;
+    uint32_t data_cnt = (sample->data_length >> 10) + 2;
+    uint8_t *ulaw_data;
+    double signal = 0.0;
+    double noise = 0.0;
+    double diff;
+
+    ulaw_data = (uint8_t *) malloc(data_cnt);
+    if (ulaw_data == NULL)
+        return;
+
+    for (i = 0; i < data_cnt; i++) {
+        ulaw_data[i] = ulaw_encode(sample->data[i]);
+        diff = (double)(sample->data[i] - _WM_ulaw_table[ulaw_data[i]]);
+        signal += (double)sample->data[i] * (double)sample->data[i];
+        noise += diff * diff;
+    }
+
+    if ((noise > 0.0) && ((10.0 * log10(signal / noise)) < _WM_compact_min_snr)) {
+        free(ulaw_data);
+        return;
+    }
+
+    free(sample->data);
+    sample->data = NULL;
+    sample->ulaw_data = ulaw_data;
+}
+
+/* the freq a note played with patch picks its sample with */
+static uint32_t note_freq(const struct _patch *patch, uint8_t note) {
+    if ((patch->patchid & 0x80) && (patch->note)) {
+        /* a drum patch with a note of its own */
+        return (_WM_freq_table[(patch->note % 12) * 100] >> (10 - (patch->note / 12)));
+    }
+    return (_WM_freq_table[(note % 12) * 100] >> (10 - (note / 12)));
+}
+
+/* the patch a note on channel plays and the freq it picks its sample with */
+static struct _patch *get_note_patch(struct _mdi * mdi, uint8_t channel, uint8_t note,
+                                     uint32_t *freq) {
     struct _patch *patch = NULL;
-    struct _sample *sample = NULL;
-    uint32_t freq = 0;
-    uint32_t decay_samples = 0;
 
     if (mdi->channel[channel].isdrum) {
         patch = _WM_get_patch_data(mdi,
@@ -52,23 +154,28 @@ uint32_t _WM_get_decay_samples(struct _mdi * mdi, uint8_t channel, uint8_t note)
         patch = mdi->channel[channel].patch;
     }
 
-    if (patch == NULL) return (0);
+    if (patch == NULL) return (NULL);
 
-    /* first get the freq we need so we can check the right sample */
-    if (patch->patchid & 0x80) {
-        /* is a drum patch */
-        if (patch->note) {
-            freq = _WM_freq_table[(patch->note % 12) * 100]
-                                              >> (10 - (patch->note / 12));
-        } else {
-            freq = _WM_freq_table[(note % 12) * 100] >> (10 - (note / 12));
-        }
-    } else {
-        freq = _WM_freq_table[(note % 12) * 100] >> (10 - (note / 12));
-    }
+    *freq = note_freq(patch, note);
+    return (patch);
+}
+
+static struct _sample *get_note_sample(struct _mdi * mdi, uint8_t channel, uint8_t note) {
+    struct _patch *patch = NULL;
+    uint32_t freq = 0;
+
+    if ((patch = get_note_patch(mdi, channel, note, &freq)) == NULL)
+        return (NULL);
 
     /* get the sample */
-    sample = _WM_get_sample_data(patch, (freq / 100));
+    return (_WM_get_sample_data(mdi, patch, (freq / 100)));
+}
+
+uint32_t _WM_get_decay_samples(struct _mdi * mdi, uint8_t channel, uint8_t note) {
+    struct _sample *sample = NULL;
+    uint32_t decay_samples = 0;
+
+    sample = get_note_sample(mdi, channel, note);
     if (sample == NULL) return (0);
 
     decay_samples = sample->note_off_decay;
@@ -76,31 +183,22 @@ uint32_t _WM_get_decay_samples(struct _mdi * mdi, uint8_t channel, uint8_t note)
     return (decay_samples);
 }
 
-
-struct _sample *_WM_get_sample_data(struct _patch *sample_patch, uint32_t freq) {
+static struct _sample *find_zone(struct _sample *first_sample, uint32_t freq) {
     struct _sample *last_sample = NULL;
     struct _sample *return_sample = NULL;
 
-    _WM_Lock(&_WM_patch_lock);
-    if (sample_patch == NULL) {
-        _WM_Unlock(&_WM_patch_lock);
-        return (NULL);
-    }
-    if (sample_patch->first_sample == NULL) {
-        _WM_Unlock(&_WM_patch_lock);
+    if (first_sample == NULL) {
         return (NULL);
     }
     if (freq == 0) {
-        _WM_Unlock(&_WM_patch_lock);
-        return (sample_patch->first_sample);
+        return (first_sample);
     }
 
-    return_sample = sample_patch->first_sample;
-    last_sample = sample_patch->first_sample;
+    return_sample = first_sample;
+    last_sample = first_sample;
     while (last_sample) {
         if (freq > last_sample->freq_low) {
             if (freq < last_sample->freq_high) {
-                _WM_Unlock(&_WM_patch_lock);
                 return (last_sample);
             } else {
                 return_sample = last_sample;
@@ -108,23 +206,296 @@ struct _sample *_WM_get_sample_data(struct _patch *sample_patch, uint32_t freq)
         }
         last_sample = last_sample->next;
     }
-    _WM_Unlock(&_WM_patch_lock);
     return (return_sample);
 }
 
+/*
+ The loader thread puts the samples of a patch in place while a realtime
+ handle may be looking through them without _WM_patch_lock. first_sample
+ is published with a release store once the samples are set up, and read
+ with an acquire load, so a handle that sees it sees them whole.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define publish_samples(patch, first) \
+    __atomic_store_n(&(patch)->first_sample, (first), __ATOMIC_RELEASE)
+#define published_samples(patch) \
+    __atomic_load_n(&(patch)->first_sample, __ATOMIC_ACQUIRE)
+#else
+#define publish_samples(patch, first) ((patch)->first_sample = (first))
+#define published_samples(patch) ((patch)->first_sample)
+#endif
+
+/* _WM_patch_lock must be held, see _WM_get_sample_data */
+static struct _sample *find_sample(struct _patch *sample_patch, uint32_t freq) {
+    if (sample_patch == NULL) {
+        return (NULL);
+    }
+    return (find_zone(sample_patch->first_sample, freq));
+}
+
+/*
+ Called for the note ons found while parsing a song. With
+ _WM_partial_patches the zone the note plays is marked wanted, and
+ _WM_load_wanted_samples loads the marked zones of each patch from one
+ read of its file once the song is parsed.
+ */
+void _WM_load_note_sample(struct _mdi * mdi, uint8_t channel, uint8_t note) {
+    struct _patch *patch = NULL;
+    struct _sample *sample = NULL;
+    uint32_t freq = 0;
+
+    if (!_WM_partial_patches)
+        return;
+    if ((patch = get_note_patch(mdi, channel, note, &freq)) == NULL)
+        return;
+
+    _WM_Lock(&_WM_patch_lock);
+    sample = find_sample(patch, (freq / 100));
+    if ((sample) && (sample->data == NULL) && (sample->ulaw_data == NULL)) {
+        sample->wanted = 1;
+    }
+    _WM_Unlock(&_WM_patch_lock);
+}
+
+/*
+ Converted sample data is shared between samples with identical content,
+ gus patch sets often use the same waveform in several files or point
+ several patch lines to the same file with different options.
+
+ The store is protected by _WM_patch_lock, held by everything that loads
+ or frees samples.
+ */
+struct _sample_store {
+    uint32_t hash;
+    uint32_t size;
+    void *data;
+    uint32_t refcount;
+    struct _sample_store *next;
+};
+
+#define SAMPLE_STORE_SIZE 256
+static struct _sample_store *sample_store[SAMPLE_STORE_SIZE];
+
+static uint32_t sample_data_hash(const uint8_t *data, uint32_t size) {
+    /* FNV-1a */
+    uint32_t hash = 2166136261U;
+    while (size--) {
+        hash ^= *data++;
+        hash *= 16777619U;
+    }
+    return (hash);
+}
+
+/*
+ Returns the data to use, freeing data if an identical copy was stored.
+ The hash is kept with the sample so releasing the data only has to
+ look in its bucket.
+ */
+static void *share_sample_data(void *data, uint32_t size, uint32_t *data_hash) {
+    uint32_t hash = sample_data_hash((const uint8_t *) data, size);
+    struct _sample_store *store = sample_store[hash % SAMPLE_STORE_SIZE];
+
+    *data_hash = hash;
+    while (store) {
+        if ((store->hash == hash) && (store->size == size)
+                && (memcmp(store->data, data, size) == 0)) {
+            store->refcount++;
+            free(data);
+            return (store->data);
+        }
+        store = store->next;
+    }
+
+    store = (struct _sample_store *) malloc(sizeof(struct _sample_store));
+    if (store == NULL) {
+        /* not fatal, the data just isn't shared */
+        return (data);
+    }
+    store->hash = hash;
+    store->size = size;
+    store->data = data;
+    store->refcount = 1;
+    store->next = sample_store[hash % SAMPLE_STORE_SIZE];
+    sample_store[hash % SAMPLE_STORE_SIZE] = store;
+    return (data);
+}
+
+static void release_sample_data(void *data, uint32_t hash) {
+    struct _sample_store **link = &sample_store[hash % SAMPLE_STORE_SIZE];
+    struct _sample_store *store;
+
+    if (data == NULL)
+        return;
+
+    while ((store = *link) != NULL) {
+        if (store->data == data) {
+            if (--store->refcount == 0) {
+                *link = store->next;
+                free(store);
+                free(data);
+            }
+            return;
+        }
+        link = &store->next;
+    }
+
+    /* never made it into the store */
+    free(data);
+}
+
+/* _WM_patch_lock must be held */
+static void release_sample(struct _sample *sample) {
+    release_sample_data(sample->data, sample->data_hash);
+    release_sample_data(sample->ulaw_data, sample->data_hash);
+}
+
+/* _WM_patch_lock must be held */
+static void store_sample_data(struct _sample *sample) {
+    if (sample->ulaw_data) {
+        sample->ulaw_data = (uint8_t *) share_sample_data(sample->ulaw_data,
+                                (sample->data_length >> 10) + 2, &sample->data_hash);
+        if (_WM_MixerOptions & WM_MO_REALTIME) {
+            _WM_LockMemory(sample->ulaw_data, (sample->data_length >> 10) + 2);
+        }
+    } else {
+        sample->data = (int16_t *) share_sample_data(sample->data,
+                                ((sample->data_length >> 10) + 2) * sizeof(int16_t),
+                                &sample->data_hash);
+        if (_WM_MixerOptions & WM_MO_REALTIME) {
+            _WM_LockMemory(sample->data, ((sample->data_length >> 10) + 2) * sizeof(int16_t));
+        }
+    }
+}
+
+/*
+ Resample a one shot drum sample to the output rate at the pitch it is
+ played at, using the Gauss interpolation. With inc_div set to match,
+ notes step through the result one sample at a time.
+ */
+static struct _sample *prerender_drum(struct _sample *sample, uint32_t freq) {
+    struct _sample *drum_cache;
+    uint32_t inc_div = freq / ((_WM_SampleRate * 100) / 1024);
+    uint32_t sample_inc;
+    uint32_t data_cnt;
+    uint32_t i;
+    double y;
+
+    if (sample->modes & (SAMPLE_LOOP | SAMPLE_PINGPONG | SAMPLE_REVERSE))
+        return (NULL);
+
+    sample_inc = (inc_div * 1024) / sample->inc_div;
+    if ((inc_div == 0) || (sample_inc == 0))
+        return (NULL);
+
+    data_cnt = (uint32_t) (((uint64_t) sample->data_length + sample_inc - 1) / sample_inc);
+    /* very low pitched drums aren't worth the memory */
+    if (data_cnt > ((sample->data_length >> 10) << 3))
+        return (NULL);
+
+    drum_cache = (struct _sample *) malloc(sizeof(struct _sample));
+    if (drum_cache == NULL)
+        return (NULL);
+    memcpy(drum_cache, sample, sizeof(struct _sample));
+
+    drum_cache->data = (int16_t *) calloc((data_cnt + 2), sizeof(int16_t));
+    if (drum_cache->data == NULL) {
+        free(drum_cache);
+        return (NULL);
+    }
+
+    for (i = 0; i < data_cnt; i++) {
+        y = _WM_gauss_interpolate(sample->data, sample->data_length,
+                                  (uint32_t) ((uint64_t) i * sample_inc));
+        if (y > 32767.0) {
+            drum_cache->data[i] = 32767;
+        } else if (y < -32768.0) {
+            drum_cache->data[i] = -32768;
+        } else {
+            drum_cache->data[i] = (int16_t) floor(y + 0.5);
+        }
+    }
+
+    drum_cache->data_length = data_cnt << 10;
+    drum_cache->loop_start = 0;
+    drum_cache->loop_end = 0;
+    drum_cache->loop_size = 0;
+    drum_cache->loop_fraction = 0;
+    drum_cache->rate = _WM_SampleRate;
+    drum_cache->inc_div = inc_div;
+    drum_cache->ulaw_data = NULL;
+    drum_cache->drum_cache = NULL;
+    drum_cache->next = NULL;
+
+    return (drum_cache);
+}
+
+/* the pitch drum notes of a patch are played at */
+static uint32_t drum_freq(struct _patch *sample_patch) {
+    uint8_t drum_note = (sample_patch->note) ? sample_patch->note : (sample_patch->patchid & 0x7F);
+
+    return (_WM_freq_table[(drum_note % 12) * 100] >> (10 - (drum_note / 12)));
+}
+
+/* is sample the one drum notes of the patch play, see _WM_prerender_drums */
+static int is_drum_zone(struct _patch *sample_patch, struct _sample *first_sample,
+                        struct _sample *sample) {
+    if ((!_WM_prerender_drums) || (!(sample_patch->patchid & 0x0080)))
+        return (0);
+    return (sample == find_zone(first_sample, drum_freq(sample_patch) / 100));
+}
+
+/*
+ Sample data is ready, prerender and compact it as wanted. Only touches
+ the sample itself so it needs no lock.
+ */
+static void prepare_sample(struct _patch *sample_patch, struct _sample *sample,
+                           int drum_zone) {
+    if (drum_zone) {
+        sample->drum_cache = prerender_drum(sample, drum_freq(sample_patch));
+        if ((sample->drum_cache) && (_WM_compact_samples)) {
+            compact_sample(sample->drum_cache);
+        }
+    }
+
+    if (_WM_compact_samples) {
+        compact_sample(sample);
+    }
+}
+
+/* _WM_patch_lock must be held */
+static void finish_sample(struct _sample *sample) {
+    if (sample->drum_cache) {
+        store_sample_data(sample->drum_cache);
+    }
+    store_sample_data(sample);
+}
+
+/* for a prepared sample that turned out not to be needed */
+static void drop_sample_data(struct _sample *sample) {
+    if (sample->drum_cache) {
+        free(sample->drum_cache->data);
+        free(sample->drum_cache->ulaw_data);
+        free(sample->drum_cache);
+    }
+    free(sample->data);
+    free(sample->ulaw_data);
+}
+
 /* sample loading */
 
-int
-_WM_load_sample(struct _patch *sample_patch) {
+/*
+ Reads and converts the samples of a patch, returning them ready to be
+ put in the store. Needs no lock, the list isn't the patch's yet.
+ */
+static struct _sample *load_samples(struct _patch *sample_patch, int defer_data) {
+    struct _sample *first_sample = NULL;
     struct _sample *guspat = NULL;
     struct _sample *tmp_sample = NULL;
     uint32_t i = 0;
 
-    /* we only want to try loading the guspat once. */
-    sample_patch->loaded = 1;
-
-    if ((guspat = _WM_load_gus_pat(sample_patch->filename, _WM_fix_release)) == NULL) {
-        return (-1);
+    if ((guspat = _WM_load_gus_pat(sample_patch->filename, _WM_fix_release,
+                                   sample_patch->keep, defer_data)) == NULL) {
+        return (NULL);
     }
 
     if (_WM_auto_amp) {
@@ -165,7 +536,7 @@ _WM_load_sample(struct _patch *sample_patch) {
         }
     }
 
-    sample_patch->first_sample = guspat;
+    first_sample = guspat;
 
     if (sample_patch->patchid & 0x0080) {
         if (!(sample_patch->keep & SAMPLE_LOOP)) {
@@ -174,14 +545,14 @@ _WM_load_sample(struct _patch *sample_patch) {
                 guspat = guspat->next;
             } while (guspat);
         }
-        guspat = sample_patch->first_sample;
+        guspat = first_sample;
         if (!(sample_patch->keep & SAMPLE_ENVELOPE)) {
             do {
                 guspat->modes &= 0xBF;
                 guspat = guspat->next;
             } while (guspat);
         }
-        guspat = sample_patch->first_sample;
+        guspat = first_sample;
     }
 
     if (sample_patch->patchid == 47) {
@@ -194,7 +565,7 @@ _WM_load_sample(struct _patch *sample_patch) {
             }
             guspat = guspat->next;
         } while (guspat);
-        guspat = sample_patch->first_sample;
+        guspat = first_sample;
     }
 
     do {
@@ -228,7 +599,359 @@ _WM_load_sample(struct _patch *sample_patch) {
             }
         }
 
+        if (guspat->data) {
+            prepare_sample(sample_patch, guspat,
+                           is_drum_zone(sample_patch, first_sample, guspat));
+        }
+
         guspat = guspat->next;
     } while (guspat);
+    return (first_sample);
+}
+
+/* _WM_patch_lock must be held */
+static void finish_samples(struct _sample *first_sample) {
+    struct _sample *sample;
+
+    for (sample = first_sample; sample; sample = sample->next) {
+        if ((sample->data) || (sample->ulaw_data)) {
+            finish_sample(sample);
+        }
+    }
+}
+
+/* _WM_patch_lock must be held */
+int
+_WM_load_sample(struct _patch *sample_patch) {
+    struct _sample *first_sample;
+
+    /* we only want to try loading the guspat once. */
+    sample_patch->loaded = 1;
+
+    /* auto amp needs all the sample data up front, and realtime mode
+       can't load it later */
+    first_sample = load_samples(sample_patch,
+                                (_WM_partial_patches && !_WM_auto_amp
+                                 && !(_WM_MixerOptions & WM_MO_REALTIME)));
+    if (first_sample == NULL) {
+        return (-1);
+    }
+    finish_samples(first_sample);
+    sample_patch->first_sample = first_sample;
     return (0);
 }
+
+/*
+ The loader thread side of _WM_load_sample, see _WM_async_load. The patch
+ is read with _WM_patch_lock released so nothing waits on the file, and
+ shows up whole once it is in place. It is loaded whole even with
+ _WM_partial_patches, a zone at a time would leave the first notes silent
+ twice over.
+ */
+void _WM_load_sample_async(struct _patch *sample_patch) {
+    struct _sample *first_sample;
+
+    _WM_Lock(&_WM_patch_lock);
+    if (sample_patch->loaded) {
+        _WM_Unlock(&_WM_patch_lock);
+        return;
+    }
+    sample_patch->loaded = 1;
+    /* the loader's, for as long as it reads, see patch_loader.c */
+    sample_patch->inuse_count++;
+    _WM_Unlock(&_WM_patch_lock);
+
+    first_sample = load_samples(sample_patch, 0);
+
+    _WM_Lock(&_WM_patch_lock);
+    if (first_sample != NULL) {
+        finish_samples(first_sample);
+        publish_samples(sample_patch, first_sample);
+    }
+    if (--sample_patch->inuse_count == 0) {
+        /* every handle that wanted it has gone */
+        _WM_free_samples(sample_patch);
+        sample_patch->loaded = 0;
+    }
+    _WM_Unlock(&_WM_patch_lock);
+}
+
+/*
+ _WM_patch_lock must be held. The zones to load, sample if not NULL and
+ those marked wanted, into a malloc'd list. Returns their number.
+ */
+static uint32_t zones_to_load(struct _patch *sample_patch, struct _sample *sample,
+                              struct _sample ***zones) {
+    struct _sample *tmp_sample;
+    uint32_t count = 0;
+
+    *zones = NULL;
+    for (tmp_sample = sample_patch->first_sample; tmp_sample; tmp_sample = tmp_sample->next) {
+        if (((tmp_sample == sample) || (tmp_sample->wanted))
+                && (tmp_sample->data == NULL) && (tmp_sample->ulaw_data == NULL)) {
+            count++;
+        }
+    }
+    if (count == 0)
+        return (0);
+
+    *zones = (struct _sample **) malloc(count * sizeof(struct _sample *));
+    if (*zones == NULL)
+        return (0);
+    count = 0;
+    for (tmp_sample = sample_patch->first_sample; tmp_sample; tmp_sample = tmp_sample->next) {
+        if (((tmp_sample == sample) || (tmp_sample->wanted))
+                && (tmp_sample->data == NULL) && (tmp_sample->ulaw_data == NULL)) {
+            (*zones)[count++] = tmp_sample;
+        }
+    }
+    return (count);
+}
+
+/*
+ _WM_patch_lock must be held. Loads sample, if not NULL, along with the
+ zones of the patch marked wanted, reading the patch file once.
+ */
+static int load_sample_zones(struct _patch *sample_patch, struct _sample *sample) {
+    struct _sample **zones;
+    uint32_t count;
+    uint32_t i;
+
+    if ((count = zones_to_load(sample_patch, sample, &zones)) == 0) {
+        return ((sample) ? -1 : 0);
+    }
+    if (_WM_load_gus_pat_data(sample_patch->filename, sample_patch->keep,
+                              zones, count) == -1) {
+        free(zones);
+        return (-1);
+    }
+    for (i = 0; i < count; i++) {
+        zones[i]->wanted = 0;
+        if (zones[i]->data == NULL)
+            continue;
+        prepare_sample(sample_patch, zones[i],
+                       is_drum_zone(sample_patch, sample_patch->first_sample, zones[i]));
+        finish_sample(zones[i]);
+    }
+    free(zones);
+    return (((sample) && (sample->data == NULL) && (sample->ulaw_data == NULL)) ? -1 : 0);
+}
+
+/*
+ Loads the zones marked wanted while mdi was parsed, see
+ _WM_load_note_sample.
+ */
+void _WM_load_wanted_samples(struct _mdi * mdi) {
+    uint32_t i;
+
+    if (!_WM_partial_patches)
+        return;
+
+    _WM_Lock(&_WM_patch_lock);
+    for (i = 0; i < mdi->patch_count; i++) {
+        load_sample_zones(mdi->patches[i], NULL);
+    }
+    _WM_Unlock(&_WM_patch_lock);
+}
+
+/*
+ After an edit, loads the zones of patch that notes, a bitmap of the
+ notes the edited song plays it with, need and don't have yet, so that
+ nothing is read while rendering. With mdi->async_load they are queued
+ for the loader instead, the edit doesn't wait on the patch file either.
+ */
+void _WM_load_song_zones(struct _mdi * mdi, struct _patch *patch, const uint32_t *notes) {
+    struct _sample *sample;
+    struct _sample *first_wanted = NULL;
+    uint32_t note;
+    int queued = -1;
+
+    if ((!_WM_partial_patches) || (patch == NULL))
+        return;
+
+    _WM_Lock(&_WM_patch_lock);
+    for (note = 0; note < 128; note++) {
+        if (!(notes[note >> 5] & (1U << (note & 31))))
+            continue;
+        sample = find_sample(patch, (note_freq(patch, (uint8_t) note) / 100));
+        if ((sample) && (sample->data == NULL) && (sample->ulaw_data == NULL)) {
+            sample->wanted = 1;
+            if (first_wanted == NULL)
+                first_wanted = sample;
+        }
+    }
+    if (first_wanted != NULL) {
+        if (mdi->async_load) {
+            patch->inuse_count++;
+            queued = _WM_queue_load(patch, first_wanted);
+            if (queued != 0) {
+                patch->inuse_count--;
+            }
+        }
+        if (queued == -1) {
+            load_sample_zones(patch, NULL);
+        }
+    }
+    _WM_Unlock(&_WM_patch_lock);
+}
+
+/*
+ The loader thread side of load_sample_zones, see _WM_async_load. The
+ zones are filled in on copies with _WM_patch_lock released, then copied
+ into place. Gives back the reference the request was queued with.
+ */
+void _WM_load_zone_async(struct _patch *sample_patch, struct _sample *sample) {
+    struct _sample **zones;
+    struct _sample **tmp_zones = NULL;
+    struct _sample *next_sample;
+    uint8_t *drum_zone = NULL;
+    uint32_t count;
+    uint32_t i;
+    int loaded = 0;
+
+    _WM_Lock(&_WM_patch_lock);
+    if ((count = zones_to_load(sample_patch, sample, &zones)) != 0) {
+        tmp_zones = (struct _sample **) malloc(count * sizeof(struct _sample *));
+        drum_zone = (uint8_t *) malloc(count);
+        if ((tmp_zones == NULL) || (drum_zone == NULL)) {
+            count = 0;
+        }
+        for (i = 0; i < count; i++) {
+            tmp_zones[i] = (struct _sample *) malloc(sizeof(struct _sample));
+            if (tmp_zones[i] == NULL) {
+                count = i;
+                break;
+            }
+            memcpy(tmp_zones[i], zones[i], sizeof(struct _sample));
+            drum_zone[i] = (uint8_t) is_drum_zone(sample_patch, sample_patch->first_sample,
+                                                  zones[i]);
+        }
+    }
+    _WM_Unlock(&_WM_patch_lock);
+
+    if ((count) && (_WM_load_gus_pat_data(sample_patch->filename, sample_patch->keep,
+                                          tmp_zones, count) == 0)) {
+        for (i = 0; i < count; i++) {
+            if (tmp_zones[i]->data) {
+                prepare_sample(sample_patch, tmp_zones[i], drum_zone[i]);
+            }
+        }
+        loaded = 1;
+    }
+
+    _WM_Lock(&_WM_patch_lock);
+    /* the reference the request holds kept the zones in place */
+    for (i = 0; (loaded) && (i < count); i++) {
+        zones[i]->wanted = 0;
+        if ((tmp_zones[i]->data == NULL) && (tmp_zones[i]->ulaw_data == NULL))
+            continue;
+        if ((zones[i]->data == NULL) && (zones[i]->ulaw_data == NULL)) {
+            finish_sample(tmp_zones[i]);
+            next_sample = zones[i]->next;
+            memcpy(zones[i], tmp_zones[i], sizeof(struct _sample));
+            zones[i]->next = next_sample;
+            zones[i]->wanted = 0;
+        } else {
+            /* loaded where it was needed meanwhile */
+            drop_sample_data(tmp_zones[i]);
+        }
+    }
+    if (--sample_patch->inuse_count == 0) {
+        /* every handle using it closed while it loaded */
+        _WM_free_samples(sample_patch);
+        sample_patch->loaded = 0;
+    }
+    _WM_Unlock(&_WM_patch_lock);
+
+    for (i = 0; i < count; i++) {
+        free(tmp_zones[i]);
+    }
+    free(tmp_zones);
+    free(drum_zone);
+    free(zones);
+}
+
+/* the loaded zone nearest in pitch to sample, to play while sample loads */
+static struct _sample *loaded_zone(struct _sample *first_sample, struct _sample *sample) {
+    struct _sample *return_sample = NULL;
+    uint32_t distance = 0xffffffff;
+    uint32_t tmp_distance;
+
+    for (; first_sample; first_sample = first_sample->next) {
+        if ((first_sample->data == NULL) && (first_sample->ulaw_data == NULL))
+            continue;
+        tmp_distance = (first_sample->freq_root > sample->freq_root)
+                     ? (first_sample->freq_root - sample->freq_root)
+                     : (sample->freq_root - first_sample->freq_root);
+        if (tmp_distance < distance) {
+            distance = tmp_distance;
+            return_sample = first_sample;
+        }
+    }
+    return (return_sample);
+}
+
+/*
+ Only the patches mdi holds play, see _WM_holds_patch, so the samples
+ looked up can't be freed under it. Nothing is read here: with
+ _WM_partial_patches the zones the song plays were loaded when it was
+ opened or edited, see _WM_load_note_sample and _WM_load_song_zones. One
+ still missing, such as after a WildMidi_RestoreState, is queued for the
+ loader with mdi->async_load, and the note plays from the loaded zone
+ nearest in pitch meanwhile, or for good without it.
+ */
+struct _sample *_WM_get_sample_data(struct _mdi *mdi, struct _patch *sample_patch, uint32_t freq) {
+    struct _sample *return_sample = NULL;
+
+    if (_WM_MixerOptions & WM_MO_REALTIME) {
+        /* patches are loaded whole in realtime mode and can't be freed
+           while a handle playing them holds a reference */
+        if ((sample_patch == NULL) || (!_WM_holds_patch(mdi, sample_patch))) {
+            return (NULL);
+        }
+        return_sample = find_zone(published_samples(sample_patch), freq);
+        if ((return_sample == NULL) && (mdi->async_load)) {
+            _WM_request_patch(sample_patch);
+        }
+        return (return_sample);
+    }
+
+    if ((sample_patch == NULL) || (!_WM_holds_patch(mdi, sample_patch))) {
+        return (NULL);
+    }
+    _WM_Lock(&_WM_patch_lock);
+    return_sample = find_sample(sample_patch, freq);
+    if (return_sample == NULL) {
+        _WM_Unlock(&_WM_patch_lock);
+        if (mdi->async_load) {
+            _WM_request_patch(sample_patch);
+        }
+        return (NULL);
+    } else if ((return_sample->data == NULL) && (return_sample->ulaw_data == NULL)) {
+        /* zone not loaded yet, see _WM_partial_patches */
+        if (mdi->async_load) {
+            sample_patch->inuse_count++;
+            if (_WM_queue_load(sample_patch, return_sample) != 0) {
+                sample_patch->inuse_count--;
+            }
+        }
+        return_sample = loaded_zone(sample_patch->first_sample, return_sample);
+    }
+    _WM_Unlock(&_WM_patch_lock);
+    return (return_sample);
+}
+
+void _WM_free_samples(struct _patch *sample_patch) {
+    struct _sample *tmp_sample;
+
+    while (sample_patch->first_sample) {
+        tmp_sample = sample_patch->first_sample->next;
+        if (sample_patch->first_sample->drum_cache) {
+            release_sample(sample_patch->first_sample->drum_cache);
+            free(sample_patch->first_sample->drum_cache);
+        }
+        release_sample(sample_patch->first_sample);
+        free(sample_patch->first_sample);
+        sample_patch->first_sample = tmp_sample;
+    }
+}
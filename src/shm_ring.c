@@ -0,0 +1,238 @@
+/*
+ * shm_ring.c -- Midi Wavetable Processing library
+ *
+ * Copyright (C) WildMIDI Developers 2001-2016
+ *
+ * This file is part of WildMIDI.
+ *
+ * WildMIDI is free software: you can redistribute and/or modify the player
+ * under the terms of the GNU General Public License and you can redistribute
+ * and/or modify the library under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3 of
+ * the licenses, or(at your option) any later version.
+ *
+ * WildMIDI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License and
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License and the
+ * GNU Lesser General Public License along with WildMIDI.  If not,  see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "config.h"
+
+#if defined(HAVE_SHM_OPEN) || defined(HAVE_MEMFD_CREATE)
+#define WM_SHM_SUPPORTED 1
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* memfd_create */
+#endif
+#endif
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WM_SHM_SUPPORTED
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "common.h"
+#include "wm_error.h"
+#include "wildmidi_lib.h"
+#include "shm_ring.h"
+
+#ifdef WM_SHM_SUPPORTED
+
+#define SHM_PAGE 4096
+
+struct _WM_Shm *_WM_shm_create(const char *name, uint32_t rate, uint32_t ring_bytes) {
+    struct _WM_Shm *shm;
+    struct _WM_ShmHeader *header;
+    uint32_t header_size = (sizeof(struct _WM_ShmHeader) + SHM_PAGE - 1) & ~(SHM_PAGE - 1);
+    void *map;
+
+    shm = (struct _WM_Shm *) calloc(1, sizeof(struct _WM_Shm));
+    if (shm == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, errno);
+        return (NULL);
+    }
+    shm->fd = -1;
+    if ((name != NULL) && (name[0] != '\0')) {
+#ifdef HAVE_SHM_OPEN
+        if ((shm->name = (char *) malloc(strlen(name) + 1)) == NULL) {
+            _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, errno);
+            free(shm);
+            return (NULL);
+        }
+        strcpy(shm->name, name);
+        /* never take over a segment another writer, or a crashed one, left */
+        shm->fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+        if ((shm->fd == -1) && (errno == EEXIST)) {
+            _WM_GLOBAL_ERROR(WM_ERR_OPEN, "(shared memory segment already exists, in use or left behind)", errno);
+            free(shm->name);
+            free(shm);
+            return (NULL);
+        }
+#else
+        errno = ENOSYS;
+#endif
+    } else {
+#ifdef HAVE_MEMFD_CREATE
+        shm->fd = memfd_create("wildmidi", MFD_CLOEXEC);
+#else
+        errno = ENOSYS;
+#endif
+    }
+    if (shm->fd == -1) {
+        _WM_GLOBAL_ERROR(WM_ERR_OPEN, (shm->name) ? shm->name : "(memfd)", errno);
+        free(shm->name);
+        free(shm);
+        return (NULL);
+    }
+
+    shm->size = (size_t) header_size + ring_bytes;
+    if (ftruncate(shm->fd, (off_t) shm->size) == -1) {
+        _WM_GLOBAL_ERROR(WM_ERR_WRITE, (shm->name) ? shm->name : "(memfd)", errno);
+        _WM_shm_close(shm);
+        return (NULL);
+    }
+    map = mmap(NULL, shm->size, PROT_READ | PROT_WRITE, MAP_SHARED, shm->fd, 0);
+    if (map == MAP_FAILED) {
+        _WM_GLOBAL_ERROR(WM_ERR_MEM, "(mmap)", errno);
+        _WM_shm_close(shm);
+        return (NULL);
+    }
+    header = (struct _WM_ShmHeader *) map;
+    shm->header = header;
+    shm->ring = (int8_t *) map + header_size;
+
+    memset(header, 0, header_size);
+    header->version = WM_SHM_VERSION;
+    header->header_size = header_size;
+    header->ring_bytes = ring_bytes;
+    header->rate = rate;
+    /* a reader that finds the magic finds the rest in place */
+    __sync_synchronize();
+    header->magic = WM_SHM_MAGIC;
+    return (shm);
+}
+
+/* marks the ring closed for the reader, and unlinks a named segment */
+void _WM_shm_close(struct _WM_Shm *shm) {
+    if (shm->header != NULL) {
+        __sync_synchronize();
+        shm->header->closed = 1;
+        munmap(shm->header, shm->size);
+    }
+    if (shm->fd != -1) {
+        close(shm->fd);
+#ifdef HAVE_SHM_OPEN
+        if (shm->name) shm_unlink(shm->name);
+#endif
+    }
+    free(shm->name);
+    free(shm);
+}
+
+uint32_t _WM_shm_space(const struct _WM_Shm *shm) {
+    const struct _WM_ShmHeader *header = shm->header;
+
+    return (header->ring_bytes - (header->write_pos - header->read_pos));
+}
+
+/*
+ Where to put up to *size bytes after the claimed bytes already taken
+ since the last _WM_shm_publish, cut down to what is free and fits
+ before the ring wraps. The barrier keeps the writes into the claimed
+ space from going ahead of the load of read_pos, the reader has one
+ between copying out and storing read_pos to match.
+ */
+int8_t *_WM_shm_claim(struct _WM_Shm *shm, uint32_t claimed, uint32_t *size) {
+    uint32_t pos = (shm->header->write_pos + claimed) & (shm->header->ring_bytes - 1);
+    uint32_t space = _WM_shm_space(shm) - claimed;
+
+    __sync_synchronize();
+    if (*size > space) *size = space;
+    if (*size > (shm->header->ring_bytes - pos)) *size = shm->header->ring_bytes - pos;
+    return (&shm->ring[pos]);
+}
+
+void _WM_shm_publish(struct _WM_Shm *shm, uint32_t size) {
+    __sync_synchronize();
+    shm->header->write_pos += size;
+}
+
+/*
+ Records go at the write position, the reader can tell one it copied
+ was overwritten under it by record_count having moved WM_SHM_RECORDS
+ or more past it.
+ */
+void _WM_shm_add_record(struct _WM_Shm *shm, uint32_t type, uint32_t current_sample,
+                        uint32_t approx_total_samples, const char *text) {
+    struct _WM_ShmHeader *header = shm->header;
+    uint32_t count = header->record_count;
+    struct _WM_ShmRecord *record = &header->record[count % WM_SHM_RECORDS];
+
+    record->pcm_pos = header->write_pos;
+    record->type = type;
+    record->current_sample = current_sample;
+    record->approx_total_samples = approx_total_samples;
+    if (text != NULL) {
+        strncpy(record->text, text, WM_SHM_TEXT - 1);
+        record->text[WM_SHM_TEXT - 1] = '\0';
+    } else {
+        record->text[0] = '\0';
+    }
+    __sync_synchronize();
+    header->record_count = count + 1;
+}
+
+#else /* !WM_SHM_SUPPORTED */
+
+struct _WM_Shm *_WM_shm_create(const char *name, uint32_t rate, uint32_t ring_bytes) {
+    WMIDI_UNUSED(name);
+    WMIDI_UNUSED(rate);
+    WMIDI_UNUSED(ring_bytes);
+    _WM_GLOBAL_ERROR(WM_ERR_OPEN, "(no shared memory on this system)", 0);
+    return (NULL);
+}
+
+/* _WM_shm_create never makes one, so these are never called */
+void _WM_shm_close(struct _WM_Shm *shm) {
+    free(shm);
+}
+
+uint32_t _WM_shm_space(const struct _WM_Shm *shm) {
+    WMIDI_UNUSED(shm);
+    return (0);
+}
+
+int8_t *_WM_shm_claim(struct _WM_Shm *shm, uint32_t claimed, uint32_t *size) {
+    WMIDI_UNUSED(shm);
+    WMIDI_UNUSED(claimed);
+    *size = 0;
+    return (NULL);
+}
+
+void _WM_shm_publish(struct _WM_Shm *shm, uint32_t size) {
+    WMIDI_UNUSED(shm);
+    WMIDI_UNUSED(size);
+}
+
+void _WM_shm_add_record(struct _WM_Shm *shm, uint32_t type, uint32_t current_sample,
+                        uint32_t approx_total_samples, const char *text) {
+    WMIDI_UNUSED(shm);
+    WMIDI_UNUSED(type);
+    WMIDI_UNUSED(current_sample);
+    WMIDI_UNUSED(approx_total_samples);
+    WMIDI_UNUSED(text);
+}
+
+#endif /* WM_SHM_SUPPORTED */
@@ -0,0 +1,254 @@
+/*
+ * waveform.c -- Midi Wavetable Processing library
+ *
+ * Copyright (C) WildMIDI Developers 2001-2016
+ *
+ * This file is part of WildMIDI.
+ *
+ * WildMIDI is free software: you can redistribute and/or modify the player
+ * under the terms of the GNU General Public License and you can redistribute
+ * and/or modify the library under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3 of
+ * the licenses, or(at your option) any later version.
+ *
+ * WildMIDI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License and
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License and the
+ * GNU Lesser General Public License along with WildMIDI.  If not,  see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "wildmidi_lib.h"
+#include "waveform.h"
+
+struct _waveform *_WM_init_waveform(uint32_t frames_per_bin, uint32_t total_samples) {
+    struct _waveform *wf = (struct _waveform *) malloc(sizeof(struct _waveform));
+    uint32_t bins = total_samples / frames_per_bin + 1;
+    int i;
+
+    if (wf == NULL) return (NULL);
+    memset(wf, 0, sizeof(struct _waveform));
+    wf->frames_per_bin = frames_per_bin;
+    wf->next = 0xffffffff;
+    /* room for the whole song, so WM_MO_REALTIME rendering never has to grow them */
+    for (i = 0; i < WM_WAVEFORM_LEVELS; i++) {
+        wf->bins[i] = (struct _WM_WaveBin *) calloc(bins, sizeof(struct _WM_WaveBin));
+        if (wf->bins[i] == NULL) {
+            _WM_free_waveform(wf);
+            return (NULL);
+        }
+        wf->size[i] = bins;
+        bins = bins / WAVEFORM_RATIO + 1;
+    }
+    return (wf);
+}
+
+void _WM_free_waveform(struct _waveform *wf) {
+    int i;
+
+    if (wf == NULL) return;
+    for (i = 0; i < WM_WAVEFORM_LEVELS; i++) {
+        free(wf->bins[i]);
+    }
+    free(wf);
+}
+
+/* makes room for bin at level, 0 if there isn't */
+static int reserve_bin(struct _waveform *wf, int level, uint32_t bin, int realtime) {
+    struct _WM_WaveBin *bins;
+    uint32_t size = wf->size[level];
+
+    if (bin < size) return (1);
+    if (realtime) return (0);
+    while (size <= bin) {
+        size *= 2;
+    }
+    bins = (struct _WM_WaveBin *) realloc(wf->bins[level], size * sizeof(struct _WM_WaveBin));
+    if (bins == NULL) return (0);
+    memset(&bins[wf->size[level]], 0, (size - wf->size[level]) * sizeof(struct _WM_WaveBin));
+    wf->bins[level] = bins;
+    wf->size[level] = size;
+    return (1);
+}
+
+/* writes out the bottom level bin being filled, as far as it is */
+static void store_bin(struct _waveform *wf, int realtime) {
+    struct _WM_WaveBin *bin;
+    int ch;
+
+    if ((wf->fill == 0) || (!reserve_bin(wf, 0, wf->bin, realtime))) return;
+    bin = &wf->bins[0][wf->bin];
+    for (ch = 0; ch < 2; ch++) {
+        bin->min[ch] = (int16_t) wf->min[ch];
+        bin->max[ch] = (int16_t) wf->max[ch];
+        bin->rms[ch] = (uint16_t) (sqrt((double) wf->sum[ch] / wf->fill) + 0.5);
+    }
+    if (wf->bin >= wf->count[0]) wf->count[0] = wf->bin + 1;
+}
+
+static void start_bin(struct _waveform *wf, uint32_t bin) {
+    int ch;
+
+    wf->bin = bin;
+    wf->fill = 0;
+    for (ch = 0; ch < 2; ch++) {
+        wf->min[ch] = 32767;
+        wf->max[ch] = -32768;
+        wf->sum[ch] = 0;
+    }
+}
+
+/* works out the bins of level from those under them, for bins first to last of the level below */
+static void merge_bins(struct _waveform *wf, int level, uint32_t first, uint32_t last, int realtime) {
+    const struct _WM_WaveBin *child;
+    struct _WM_WaveBin *bin;
+    uint32_t parent, i, end;
+    uint32_t span = wf->frames_per_bin; /* of a child */
+    uint32_t frames, weight;
+    double sum[2];
+    int ch;
+
+    for (i = 1; i < (uint32_t) level; i++) {
+        span *= WAVEFORM_RATIO;
+    }
+    for (parent = first / WAVEFORM_RATIO; parent <= last / WAVEFORM_RATIO; parent++) {
+        if (!reserve_bin(wf, level, parent, realtime)) return;
+        bin = &wf->bins[level][parent];
+        end = (parent + 1) * WAVEFORM_RATIO;
+        if (end > wf->count[level - 1]) end = wf->count[level - 1];
+        i = parent * WAVEFORM_RATIO;
+        if (end <= i) return;
+        child = &wf->bins[level - 1][i];
+        for (ch = 0; ch < 2; ch++) {
+            bin->min[ch] = child->min[ch];
+            bin->max[ch] = child->max[ch];
+            sum[ch] = 0.0;
+        }
+        frames = 0;
+        for (; i < end; i++, child++) {
+            /* only the bin at the end of the song is short */
+            weight = ((wf->end - i * span) < span) ? (wf->end - i * span) : span;
+            for (ch = 0; ch < 2; ch++) {
+                if (child->min[ch] < bin->min[ch]) bin->min[ch] = child->min[ch];
+                if (child->max[ch] > bin->max[ch]) bin->max[ch] = child->max[ch];
+                sum[ch] += (double) child->rms[ch] * child->rms[ch] * weight;
+            }
+            frames += weight;
+        }
+        for (ch = 0; ch < 2; ch++) {
+            bin->rms[ch] = (uint16_t) (sqrt(sum[ch] / frames) + 0.5);
+        }
+        if (parent >= wf->count[level]) wf->count[level] = parent + 1;
+    }
+}
+
+/*
+ Adds frames of mix that play song samples pos to pos + song, which
+ differ from frames with WildMidi_SetSpeed.
+ */
+static void add_frames(struct _waveform *wf, const int32_t *buffer, uint32_t frames,
+                       uint32_t pos, uint32_t song, int realtime) {
+    uint32_t first_bin, last_bin;
+    uint32_t end = pos + song;
+    uint32_t done = 0;
+    uint64_t boundary;
+    uint32_t run;
+    int32_t mix, out;
+    int ch, level;
+
+    if (frames == 0) return;
+    if (pos != wf->next) {
+        /* seeked, looped or just started */
+        start_bin(wf, pos / wf->frames_per_bin);
+    }
+    first_bin = wf->bin;
+
+    while (done < frames) {
+        boundary = (uint64_t) (wf->bin + 1) * wf->frames_per_bin;
+        if (boundary > end) {
+            run = frames - done;
+        } else if (song == frames) {
+            run = (uint32_t) boundary - pos - done;
+        } else {
+            run = (uint32_t) ((boundary - pos) * frames / song) - done;
+        }
+        done += run;
+        wf->fill += run;
+        while (run) {
+            for (ch = 0; ch < 2; ch++) {
+                mix = *buffer++;
+                /* the sample _WM_pack_output writes */
+                out = (mix & 0x7fff) - ((mix < 0) ? 0x8000 : 0);
+                if (out < wf->min[ch]) wf->min[ch] = out;
+                if (out > wf->max[ch]) wf->max[ch] = out;
+                wf->sum[ch] += (uint64_t) ((int64_t) out * out);
+            }
+            run--;
+        }
+        if (boundary <= end) {
+            store_bin(wf, realtime);
+            start_bin(wf, wf->bin + 1);
+        }
+    }
+    store_bin(wf, realtime);
+    wf->next = end;
+    if (end > wf->end) wf->end = end;
+
+    last_bin = (wf->fill) ? wf->bin : (wf->bin - 1);
+    if (last_bin < first_bin) return;
+    for (level = 1; level < WM_WAVEFORM_LEVELS; level++) {
+        merge_bins(wf, level, first_bin, last_bin, realtime);
+        first_bin /= WAVEFORM_RATIO;
+        last_bin /= WAVEFORM_RATIO;
+    }
+}
+
+/*
+ Adds a block of frames of mix that played from song position start to
+ end at speed, see WildMidi_SetSpeed. If the song looped back to its
+ start on the way the block is added in two parts.
+ */
+void _WM_do_waveform(struct _waveform *wf, const int32_t *buffer, uint32_t frames,
+                     uint32_t start, uint32_t end, uint32_t speed, int realtime) {
+    uint32_t song = (uint32_t) (((uint64_t) frames * speed + 0x8000) >> 16);
+    uint32_t slack = (speed >> 16) + 1; /* what the song can run on past an event */
+    uint32_t after;
+
+    if ((end >= start) && ((end - start) + slack >= song) && ((end - start) <= song + slack)) {
+        add_frames(wf, buffer, frames, start, (end - start), realtime);
+    } else if (end < song) {
+        after = (uint32_t) (((uint64_t) end << 16) / speed);
+        if (after > frames) after = frames;
+        add_frames(wf, buffer, frames - after, start,
+                   (uint32_t) (((uint64_t) (frames - after) * speed) >> 16), realtime);
+        add_frames(wf, &buffer[(frames - after) * 2], after, 0, end, realtime);
+    } else {
+        add_frames(wf, buffer, frames, end - song, song, realtime);
+    }
+}
+
+/* copies up to count bins of level from first on, returns how many there are in all */
+uint32_t _WM_get_waveform(const struct _waveform *wf, int level, uint32_t first,
+                          struct _WM_WaveBin *bins, uint32_t *count) {
+    uint32_t total = wf->count[level];
+    uint32_t copy = 0;
+
+    if ((bins != NULL) && (count != NULL) && (first < total)) {
+        copy = total - first;
+        if (copy > *count) copy = *count;
+        memcpy(bins, &wf->bins[level][first], copy * sizeof(struct _WM_WaveBin));
+    }
+    if (count != NULL) *count = copy;
+    return (total);
+}
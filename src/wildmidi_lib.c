@@ -37,6 +37,8 @@
 #include "file_io.h"
 #include "lock.h"
 #include "reverb.h"
+#include "loudness.h"
+#include "gauss.h"
 #include "gus_pat.h"
 #include "common.h"
 #include "wildmidi_lib.h"
@@ -51,6 +53,14 @@
 #include "sample.h"
 #include "mus2mid.h"
 #include "xmi2mid.h"
+#include "rt_debug.h"
+#include "render_cache.h"
+#include "event_store.h"
+#include "mdi_state.h"
+#include "waveform.h"
+#include "patch_loader.h"
+#include "calibrate.h"
+#include "shm_ring.h"
 
 /*
  * =========================
@@ -79,10 +89,16 @@ float _WM_reverb_room_length = 22.5f;
 
 float _WM_reverb_listen_posx = 8.4375f;
 float _WM_reverb_listen_posy = 16.875f;
+int _WM_reverb_decimate = 0;
 
 int _WM_fix_release = 0;
 int _WM_auto_amp = 0;
 int _WM_auto_amp_with_amp = 0;
+int _WM_compact_samples = 0;
+float _WM_compact_min_snr = 36.0f;
+int _WM_prerender_drums = 0;
+int _WM_partial_patches = 0;
+int _WM_async_load = 0;
 
 struct _miditrack {
     uint32_t length;
@@ -97,86 +113,6 @@ struct _mdi_patches {
     struct _mdi_patch *next;
 };
 
-#define FPBITS 10
-#define FPMASK ((1L<<FPBITS)-1L)
-
-
-/* Gauss Interpolation code adapted from code supplied by Eric. A. Welsh */
-static double newt_coeffs[58][58];  /* for start/end of samples */
-#define MAX_GAUSS_ORDER 34          /* 34 is as high as we can go before errors crop up */
-static double *gauss_table = NULL;  /* *gauss_table[1<<FPBITS] */
-static int gauss_n = MAX_GAUSS_ORDER;
-static int gauss_lock;
-
-static void init_gauss(void) {
-    /* init gauss table */
-    int n = gauss_n;
-    int m, i, k, n_half = (n >> 1);
-    int j;
-    int sign;
-    double ck;
-    double x, x_inc, xz;
-    double z[35];
-    double *gptr, *t;
-
-    _WM_Lock(&gauss_lock);
-    if (gauss_table) {
-        _WM_Unlock(&gauss_lock);
-        return;
-    }
-
-    newt_coeffs[0][0] = 1;
-    for (i = 0; i <= n; i++) {
-        newt_coeffs[i][0] = 1;
-        newt_coeffs[i][i] = 1;
-
-        if (i > 1) {
-            newt_coeffs[i][0] = newt_coeffs[i - 1][0] / i;
-            newt_coeffs[i][i] = newt_coeffs[i - 1][0] / i;
-        }
-
-        for (j = 1; j < i; j++) {
-            newt_coeffs[i][j] = newt_coeffs[i - 1][j - 1]
-                    + newt_coeffs[i - 1][j];
-            if (i > 1)
-                newt_coeffs[i][j] /= i;
-        }
-        z[i] = i / (4 * M_PI);
-    }
-
-    for (i = 0; i <= n; i++)
-        for (j = 0, sign = (int) pow(-1, i); j <= i; j++, sign *= -1)
-            newt_coeffs[i][j] *= sign;
-
-    t = (double *) malloc((1<<FPBITS) * (n + 1) * sizeof(double));
-    x_inc = 1.0 / (1<<FPBITS);
-    for (m = 0, x = 0.0; m < (1<<FPBITS); m++, x += x_inc) {
-        xz = (x + n_half) / (4 * M_PI);
-        gptr = &t[m * (n + 1)];
-
-        for (k = 0; k <= n; k++) {
-            ck = 1.0;
-
-            for (i = 0; i <= n; i++) {
-                if (i == k)
-                    continue;
-
-                ck *= (sin(xz - z[i])) / (sin(z[k] - z[i]));
-            }
-            *gptr++ = ck;
-        }
-    }
-
-    gauss_table = t;
-    _WM_Unlock(&gauss_lock);
-}
-
-static void free_gauss(void) {
-    _WM_Lock(&gauss_lock);
-    free(gauss_table);
-    gauss_table = NULL;
-    _WM_Unlock(&gauss_lock);
-}
 
 struct _hndl {
     void * handle;
@@ -222,17 +158,11 @@ static void WM_InitPatches(void) {
 static void WM_FreePatches(void) {
     int i;
     struct _patch * tmp_patch;
-    struct _sample * tmp_sample;
 
     _WM_Lock(&_WM_patch_lock);
     for (i = 0; i < 128; i++) {
         while (_WM_patch[i]) {
-            while (_WM_patch[i]->first_sample) {
-                tmp_sample = _WM_patch[i]->first_sample->next;
-                free(_WM_patch[i]->first_sample->data);
-                free(_WM_patch[i]->first_sample);
-                _WM_patch[i]->first_sample = tmp_sample;
-            }
+            _WM_free_samples(_WM_patch[i]);
             free(_WM_patch[i]->filename);
             tmp_patch = _WM_patch[i]->next;
             free(_WM_patch[i]);
@@ -559,6 +489,23 @@ static int load_config(const char *config_file, const char *conf_dir) {
                     } else if (wm_strcasecmp(line_tokens[0], "auto_amp_with_amp") == 0) {
                         _WM_auto_amp = 1;
                         _WM_auto_amp_with_amp = 1;
+                    } else if (wm_strcasecmp(line_tokens[0], "reverb_decimate") == 0) {
+                        _WM_reverb_decimate = 1;
+                    } else if (wm_strcasecmp(line_tokens[0], "prerender_drums") == 0) {
+                        _WM_prerender_drums = 1;
+                    } else if (wm_strcasecmp(line_tokens[0], "partial_patches") == 0) {
+                        _WM_partial_patches = 1;
+                    } else if (wm_strcasecmp(line_tokens[0], "async_load") == 0) {
+                        _WM_async_load = 1;
+                    } else if (wm_strcasecmp(line_tokens[0], "compact_samples") == 0) {
+                        _WM_compact_samples = 1;
+                        if (line_tokens[1]) {
+                            if (!wm_isdigit(line_tokens[1][0])) {
+                                _WM_DEBUG_MSG("%s: syntax error in compact_samples line", config_file);
+                            } else {
+                                _WM_compact_min_snr = (float) atof(line_tokens[1]);
+                            }
+                        }
                     } else if (wm_isdigit(line_tokens[0][0])) {
                         patchid = (patchid & 0xFF80)
                                 | (atoi(line_tokens[0]) & 0x7F);
@@ -742,6 +689,10 @@ static int load_config(const char *config_file, const char *conf_dir) {
                                 tmp_patch->keep |= SAMPLE_LOOP;
                             } else if (wm_strcasecmp(line_tokens[token_count], "keep=env") == 0) {
                                 tmp_patch->keep |= SAMPLE_ENVELOPE;
+                            } else if (wm_strcasecmp(line_tokens[token_count], "keep=pingpong") == 0) {
+                                tmp_patch->keep |= SAMPLE_PINGPONG;
+                            } else if (wm_strcasecmp(line_tokens[token_count], "keep=reverse") == 0) {
+                                tmp_patch->keep |= SAMPLE_REVERSE;
                             } else if (wm_strcasecmp(line_tokens[token_count], "remove=sustain") == 0) {
                                 tmp_patch->remove |= SAMPLE_SUSTAIN;
                             } else if (wm_strcasecmp(line_tokens[token_count], "remove=clamped") == 0) {
@@ -818,22 +769,215 @@ static int add_handle(void * handle) {
 #endif
 
 
+/*
+ Step a note through a sample that kept SAMPLE_PINGPONG and/or
+ SAMPLE_REVERSE (keep=pingpong, keep=reverse) instead of having its loop
+ unrolled when it was loaded.
+ Returns 1 once the note has run off the end of the sample.
+ */
+static inline int native_sample_step(struct _note *nte) {
+    struct _sample *sample = nte->sample;
+    int64_t pos = nte->sample_pos;
+    int64_t loop_start = sample->loop_start;
+    int64_t loop_end = sample->loop_end;
+
+    if (nte->backward) {
+        pos -= nte->sample_inc;
+        if (pos < loop_start) {
+            if (!(nte->modes & SAMPLE_REVERSE)) {
+                /* ping pong on its way back, always bounce */
+                pos = (loop_start << 1) - pos;
+                if (pos > loop_end)
+                    pos = loop_end;
+                nte->backward = 0;
+            } else if ((nte->modes & SAMPLE_LOOP)
+                    && (nte->sample_pos >= sample->loop_start)) {
+                if (nte->modes & SAMPLE_PINGPONG) {
+                    pos = (loop_start << 1) - pos;
+                    if (pos > loop_end)
+                        pos = loop_end;
+                    nte->backward = 0;
+                } else {
+                    pos = loop_end - ((loop_start - pos) % sample->loop_size);
+                }
+            } else if (pos < 0) {
+                return (1);
+            }
+        }
+    } else {
+        pos += nte->sample_inc;
+        if (pos > loop_end) {
+            if (nte->modes & SAMPLE_REVERSE) {
+                /* reversed ping pong on its way back, always bounce */
+                pos = (loop_end << 1) - pos;
+                if (pos < loop_start)
+                    pos = loop_start;
+                nte->backward = 1;
+            } else if ((nte->modes & SAMPLE_LOOP)
+                    && (nte->sample_pos <= sample->loop_end)) {
+                pos = (loop_end << 1) - pos;
+                if (pos < loop_start)
+                    pos = loop_start;
+                nte->backward = 1;
+            } else if (pos >= sample->data_length) {
+                return (1);
+            }
+        }
+    }
+
+    nte->sample_pos = (uint32_t) pos;
+    return (0);
+}
+
+/*
+ Notes that step through a one shot sample exactly one sample per output
+ sample at a level that can't change before the next event, as drum
+ notes on a sample from _WM_prerender_drums do, need neither
+ interpolation nor envelope work. Those that play on past the next
+ count output samples are mixed straight into buffer here, as the
+ mixers would have, and marked so the mixer passes over them.
+
+ The mixers interpolate nothing on a sample point, but the Gauss mixer
+ switches to Newton within its window of the ends of the sample, so it
+ asks for notes to be head samples in and tail samples from the end.
+ */
+static void mix_unity_notes(struct _mdi *mdi, int32_t *buffer, uint32_t count,
+                            uint32_t head, uint32_t tail) {
+    struct _note *note_data;
+    const int16_t *data;
+    const uint8_t *ulaw_data;
+    int32_t *out;
+    int32_t premix, env, left_vol, right_vol;
+    uint32_t data_pos;
+    uint32_t i;
+
+    for (note_data = mdi->note; note_data != NULL; note_data = note_data->next) {
+        if ((note_data->sample_inc != (1 << FPBITS)) || (note_data->sample_pos & FPMASK)
+                || (note_data->env_inc != 0)
+                || (note_data->modes & (SAMPLE_LOOP | SAMPLE_PINGPONG | SAMPLE_REVERSE))) {
+            continue;
+        }
+        data_pos = note_data->sample_pos >> FPBITS;
+        if ((data_pos < head) || ((data_pos + count + tail) > (note_data->sample->data_length >> FPBITS))) {
+            continue;
+        }
+        note_data->unity = 1;
+        if ((mdi->muted) && (mdi->muted & (1 << (note_data->noteid >> 8)))) {
+            note_data->sample_pos += count << FPBITS;
+            continue;
+        }
+
+        env = note_data->env_level >> 12;
+        left_vol = (int32_t) note_data->left_mix_volume;
+        right_vol = (int32_t) note_data->right_mix_volume;
+        out = buffer;
+        if (note_data->sample->ulaw_data) {
+            ulaw_data = &note_data->sample->ulaw_data[data_pos];
+            for (i = 0; i < count; i++) {
+                premix = (_WM_ulaw_table[ulaw_data[i]] * env) / 1024;
+                *out++ += (premix * left_vol) / 1024;
+                *out++ += (premix * right_vol) / 1024;
+            }
+        } else {
+            data = &note_data->sample->data[data_pos];
+            for (i = 0; i < count; i++) {
+                premix = (data[i] * env) / 1024;
+                *out++ += (premix * left_vol) / 1024;
+                *out++ += (premix * right_vol) / 1024;
+            }
+        }
+        note_data->sample_pos += count << FPBITS;
+    }
+}
+
+static void end_unity_notes(struct _mdi *mdi) {
+    struct _note *note_data;
+
+    for (note_data = mdi->note; note_data != NULL; note_data = note_data->next) {
+        note_data->unity = 0;
+    }
+}
+
+/*
+ With WildMidi_SetSpeed the events stay in song samples and the output
+ is stretched over them. speed_frames gives the output frames to mix
+ until the next event is due, at most max, and speed_advance moves the
+ song on by the frames mixed. Whatever speed_frac has run on past an
+ event is taken off the time to the next one.
+ */
+static inline uint32_t speed_frames(struct _mdi *mdi, uint32_t max) {
+    uint64_t due = (uint64_t) mdi->samples_to_mix << 16;
+
+    if (mdi->speed_frac >= due) {
+        /* already played past the next event */
+        mdi->extra_info.current_sample += mdi->samples_to_mix;
+        mdi->speed_frac -= (uint32_t) due;
+        mdi->samples_to_mix = 0;
+        return (0);
+    }
+    due = (due - mdi->speed_frac + mdi->speed - 1) / mdi->speed;
+    return ((due < max) ? (uint32_t) due : max);
+}
+
+static inline void speed_advance(struct _mdi *mdi, uint32_t frames) {
+    uint64_t pos = (uint64_t) frames * mdi->speed + mdi->speed_frac;
+    uint32_t played = (uint32_t) (pos >> 16);
+
+    if (played > mdi->samples_to_mix) {
+        played = mdi->samples_to_mix;
+    }
+    mdi->extra_info.current_sample += played;
+    mdi->samples_to_mix -= played;
+    mdi->speed_frac = (uint32_t) (pos - ((uint64_t) played << 16));
+}
+
+/*
+ Writes size bytes of 16bit stereo output from the 32bit mix, keeping
+ the low 15 bits and the sign of each sample.
+ */
+void _WM_pack_output(int8_t *buffer, const int32_t *mix, uint32_t size) {
+    uint32_t i;
+    int32_t left_mix, right_mix;
+
+    for (i = 0; i < size; i += 4) {
+        left_mix = *mix++;
+        right_mix = *mix++;
+
+        /*
+         * ===================
+         * Write to the buffer
+         * ===================
+         */
+#ifdef WORDS_BIGENDIAN
+        (*buffer++) = ((left_mix >> 8) & 0x7f) | ((left_mix >> 24) & 0x80);
+        (*buffer++) = left_mix & 0xff;
+        (*buffer++) = ((right_mix >> 8) & 0x7f) | ((right_mix >> 24) & 0x80);
+        (*buffer++) = right_mix & 0xff;
+#else
+        (*buffer++) = left_mix & 0xff;
+        (*buffer++) = ((left_mix >> 8) & 0x7f) | ((left_mix >> 24) & 0x80);
+        (*buffer++) = right_mix & 0xff;
+        (*buffer++) = ((right_mix >> 8) & 0x7f) | ((right_mix >> 24) & 0x80);
+#endif
+    }
+}
+
 static int WM_GetOutput_Linear(midi * handle, int8_t *buffer, uint32_t size) {
     uint32_t buffer_used = 0;
-    uint32_t i, env_ptr;
+    uint32_t env_ptr;
     struct _mdi *mdi = (struct _mdi *) handle;
     uint32_t real_samples_to_mix = 0;
     uint32_t data_pos;
     int32_t premix, left_mix, right_mix;
+    int32_t sample_a, sample_b;
 /*  int32_t vol_mul; */
     struct _note *note_data = NULL;
     uint32_t count;
+    uint16_t muted = mdi->muted;
     struct _event *event = mdi->current_event;
     int32_t *tmp_buffer;
     int32_t *out_buffer;
 
-    _WM_Lock(&mdi->lock);
-
     buffer_used = 0;
     memset(buffer, 0, size);
 
@@ -860,7 +1004,7 @@ static int WM_GetOutput_Linear(midi * handle, int8_t *buffer, uint32_t size) {
                     event = mdi->current_event;
                 } else {
                     mdi->samples_to_mix = event->samples_to_next;
-                    event++;
+                    event = WM_NEXT_EVENT(event);
                     mdi->current_event = event;
                 }
             }
@@ -877,7 +1021,12 @@ static int WM_GetOutput_Linear(midi * handle, int8_t *buffer, uint32_t size) {
                 }
             }
         }
-        if (__builtin_expect((mdi->samples_to_mix > (size >> 2)), 1)) {
+        if (__builtin_expect((mdi->speed != SPEED_NORMAL), 0)) {
+            real_samples_to_mix = speed_frames(mdi, (size >> 2));
+            if (real_samples_to_mix == 0) {
+                continue;
+            }
+        } else if (__builtin_expect((mdi->samples_to_mix > (size >> 2)), 1)) {
             real_samples_to_mix = size >> 2;
         } else {
             real_samples_to_mix = mdi->samples_to_mix;
@@ -888,6 +1037,7 @@ static int WM_GetOutput_Linear(midi * handle, int8_t *buffer, uint32_t size) {
 
         /* do mixing here */
         count = real_samples_to_mix;
+        mix_unity_notes(mdi, tmp_buffer, count, 0, 1);
 
         do {
             note_data = mdi->note;
@@ -901,8 +1051,24 @@ static int WM_GetOutput_Linear(midi * handle, int8_t *buffer, uint32_t size) {
                      * resample the sample
                      * ===================
                      */
+                    if (__builtin_expect((note_data->unity), 0)) {
+                        /* already mixed, see mix_unity_notes */
+                        note_data = note_data->next;
+                        continue;
+                    }
+                    if (__builtin_expect((muted != 0), 0)
+                            && (muted & (1 << (note_data->noteid >> 8)))) {
+                        /* keeps playing through its sample, only unheard */
+                        goto _STEP_THIS_NOTE;
+                    }
                     data_pos = note_data->sample_pos >> FPBITS;
-                    premix = ((note_data->sample->data[data_pos] + (((note_data->sample->data[data_pos + 1] - note_data->sample->data[data_pos]) * (int32_t)(note_data->sample_pos & FPMASK)) / 1024)) * (note_data->env_level >> 12)) / 1024;
+                    if (__builtin_expect((note_data->sample->ulaw_data != NULL), 0)) {
+                        sample_a = _WM_ulaw_table[note_data->sample->ulaw_data[data_pos]];
+                        sample_b = _WM_ulaw_table[note_data->sample->ulaw_data[data_pos + 1]];
+                        premix = ((sample_a + (((sample_b - sample_a) * (int32_t)(note_data->sample_pos & FPMASK)) / 1024)) * (note_data->env_level >> 12)) / 1024;
+                    } else {
+                        premix = ((note_data->sample->data[data_pos] + (((note_data->sample->data[data_pos + 1] - note_data->sample->data[data_pos]) * (int32_t)(note_data->sample_pos & FPMASK)) / 1024)) * (note_data->env_level >> 12)) / 1024;
+                    }
 
                     left_mix += (premix * (int32_t)note_data->left_mix_volume) / 1024;
                     right_mix += (premix * (int32_t)note_data->right_mix_volume) / 1024;
@@ -929,23 +1095,29 @@ static int WM_GetOutput_Linear(midi * handle, int8_t *buffer, uint32_t size) {
                     fprintf(stderr,"\r\n");
 #endif
 
-                    note_data->sample_pos += note_data->sample_inc;
+                    _STEP_THIS_NOTE:
+                    if (__builtin_expect((note_data->modes & (SAMPLE_PINGPONG | SAMPLE_REVERSE)), 0)) {
+                        if (native_sample_step(note_data))
+                            goto _END_THIS_NOTE;
+                    } else {
+                        note_data->sample_pos += note_data->sample_inc;
+
+                        if (__builtin_expect((note_data->modes & SAMPLE_LOOP), 1)) {
+                            if (__builtin_expect(
+                                                 (note_data->sample_pos > note_data->sample->loop_end),
+                                                 0)) {
+                                note_data->sample_pos = note_data->sample->loop_start
+                                    + ((note_data->sample_pos
+                                        - note_data->sample->loop_start)
+                                    % note_data->sample->loop_size);
+                            }
 
-                    if (__builtin_expect((note_data->modes & SAMPLE_LOOP), 1)) {
-                        if (__builtin_expect(
-                                             (note_data->sample_pos > note_data->sample->loop_end),
-                                             0)) {
-                            note_data->sample_pos = note_data->sample->loop_start
-                                + ((note_data->sample_pos
-                                    - note_data->sample->loop_start)
-                                % note_data->sample->loop_size);
+                        } else if (__builtin_expect(
+                                                      (note_data->sample_pos
+                                                       >= note_data->sample->data_length),
+                                                      0)) {
+                            goto _END_THIS_NOTE;
                         }
-
-                    } else if (__builtin_expect(
-                                                  (note_data->sample_pos
-                                                   >= note_data->sample->data_length),
-                                                  0)) {
-                        goto _END_THIS_NOTE;
                     }
 
                     if (__builtin_expect((note_data->env_inc == 0), 0)) {
@@ -1087,14 +1259,19 @@ static int WM_GetOutput_Linear(midi * handle, int8_t *buffer, uint32_t size) {
                     continue;
                 }
             }
-            *tmp_buffer++ = left_mix;
-            *tmp_buffer++ = right_mix;
+            *tmp_buffer++ += left_mix;
+            *tmp_buffer++ += right_mix;
         } while (--count);
+        end_unity_notes(mdi);
 
         buffer_used += real_samples_to_mix * 4;
         size -= (real_samples_to_mix << 2);
-        mdi->extra_info.current_sample += real_samples_to_mix;
-        mdi->samples_to_mix -= real_samples_to_mix;
+        if (__builtin_expect((mdi->speed != SPEED_NORMAL), 0)) {
+            speed_advance(mdi, real_samples_to_mix);
+        } else {
+            mdi->extra_info.current_sample += real_samples_to_mix;
+            mdi->samples_to_mix -= real_samples_to_mix;
+        }
     } while (size);
 
     tmp_buffer = out_buffer;
@@ -1105,35 +1282,47 @@ static int WM_GetOutput_Linear(midi * handle, int8_t *buffer, uint32_t size) {
 
     /* _WM_DynamicVolumeAdjust(mdi, tmp_buffer, (buffer_used/2)); */
 
-    for (i = 0; i < buffer_used; i += 4) {
-        left_mix = *tmp_buffer++;
-        right_mix = *tmp_buffer++;
-
-        /*
-         * ===================
-         * Write to the buffer
-         * ===================
-         */
-#ifdef WORDS_BIGENDIAN
-        (*buffer++) = ((left_mix >> 8) & 0x7f) | ((left_mix >> 24) & 0x80);
-        (*buffer++) = left_mix & 0xff;
-        (*buffer++) = ((right_mix >> 8) & 0x7f) | ((right_mix >> 24) & 0x80);
-        (*buffer++) = right_mix & 0xff;
-#else
-        (*buffer++) = left_mix & 0xff;
-        (*buffer++) = ((left_mix >> 8) & 0x7f) | ((left_mix >> 24) & 0x80);
-        (*buffer++) = right_mix & 0xff;
-        (*buffer++) = ((right_mix >> 8) & 0x7f) | ((right_mix >> 24) & 0x80);
-#endif
-    }
+    _WM_pack_output(buffer, tmp_buffer, buffer_used);
 
-    _WM_Unlock(&mdi->lock);
     return (buffer_used);
 }
 
+/*
+ Expands the mu-law samples start to start + count under the
+ interpolation window, through the cache slot of the note. Samples
+ already decoded for the window before are moved down rather than
+ decoded again, and the slot is filled on past the window so the next
+ few windows find all theirs there.
+ */
+static inline int16_t *ulaw_decode_window(struct _mdi *mdi, struct _note *nte,
+                                          uint32_t start, uint32_t count) {
+    struct _ulaw_cache *cache = ULAW_CACHE_SLOT(mdi, nte);
+    const uint8_t *ulaw_data = nte->sample->ulaw_data;
+    uint32_t end = (nte->sample->data_length >> FPBITS) + 2; /* of ulaw_data */
+    uint32_t keep = 0;
+    uint32_t i;
+
+    if (__builtin_expect(((cache->sample == nte->sample) && (start >= cache->start)), 1)) {
+        if ((start + count) <= (cache->start + cache->length)) {
+            return (&cache->data[start - cache->start]);
+        }
+        if (start < (cache->start + cache->length)) {
+            keep = cache->start + cache->length - start;
+            memmove(cache->data, &cache->data[start - cache->start], keep * sizeof(int16_t));
+        }
+    }
+    cache->sample = nte->sample;
+    cache->start = start;
+    cache->length = ((end - start) < ULAW_CACHE_SIZE) ? (end - start) : ULAW_CACHE_SIZE;
+    for (i = keep; i < cache->length; i++) {
+        cache->data[i] = _WM_ulaw_table[ulaw_data[start + i]];
+    }
+    return (cache->data);
+}
+
 static int WM_GetOutput_Gauss(midi * handle, int8_t *buffer, uint32_t size) {
     uint32_t buffer_used = 0;
-    uint32_t i, env_ptr;
+    uint32_t env_ptr;
     struct _mdi *mdi = (struct _mdi *) handle;
     uint32_t real_samples_to_mix = 0;
     uint32_t data_pos;
@@ -1145,12 +1334,11 @@ static int WM_GetOutput_Gauss(midi * handle, int8_t *buffer, uint32_t size) {
     double *gptr, *gend;
     int left, right, temp_n;
     int ii, jj;
+    uint16_t muted = mdi->muted;
     struct _event *event = mdi->current_event;
     int32_t *tmp_buffer;
     int32_t *out_buffer;
 
-    _WM_Lock(&mdi->lock);
-
     buffer_used = 0;
     memset(buffer, 0, size);
 
@@ -1177,7 +1365,7 @@ static int WM_GetOutput_Gauss(midi * handle, int8_t *buffer, uint32_t size) {
                     event = mdi->current_event;
                 } else {
                     mdi->samples_to_mix = event->samples_to_next;
-                    event++;
+                    event = WM_NEXT_EVENT(event);
                     mdi->current_event = event;
                 }
             }
@@ -1195,7 +1383,12 @@ static int WM_GetOutput_Gauss(midi * handle, int8_t *buffer, uint32_t size) {
                 }
             }
         }
-        if (__builtin_expect((mdi->samples_to_mix > (size >> 2)), 1)) {
+        if (__builtin_expect((mdi->speed != SPEED_NORMAL), 0)) {
+            real_samples_to_mix = speed_frames(mdi, (size >> 2));
+            if (real_samples_to_mix == 0) {
+                continue;
+            }
+        } else if (__builtin_expect((mdi->samples_to_mix > (size >> 2)), 1)) {
             real_samples_to_mix = size >> 2;
         } else {
             real_samples_to_mix = mdi->samples_to_mix;
@@ -1206,6 +1399,7 @@ static int WM_GetOutput_Gauss(midi * handle, int8_t *buffer, uint32_t size) {
 
         /* do mixing here */
         count = real_samples_to_mix;
+        mix_unity_notes(mdi, tmp_buffer, count, (_WM_gauss_n >> 1), ((_WM_gauss_n + 2) >> 1));
         do {
             note_data = mdi->note;
             left_mix = right_mix = 0;
@@ -1216,6 +1410,16 @@ static int WM_GetOutput_Gauss(midi * handle, int8_t *buffer, uint32_t size) {
                      * resample the sample
                      * ===================
                      */
+                    if (__builtin_expect((note_data->unity), 0)) {
+                        /* already mixed, see mix_unity_notes */
+                        note_data = note_data->next;
+                        continue;
+                    }
+                    if (__builtin_expect((muted != 0), 0)
+                            && (muted & (1 << (note_data->noteid >> 8)))) {
+                        /* keeps playing through its sample, only unheard */
+                        goto _STEP_THIS_NOTE;
+                    }
                     data_pos = note_data->sample_pos >> FPBITS;
 
                     /* check to see if we're near one of the ends */
@@ -1229,28 +1433,45 @@ static int WM_GetOutput_Gauss(midi * handle, int8_t *buffer, uint32_t size) {
                         temp_n = (left << 1) + 1;
 
                     /* use Newton if we can't fill the window */
-                    if (temp_n < gauss_n) {
+                    if (temp_n < _WM_gauss_n) {
                         xd = note_data->sample_pos & FPMASK;
                         xd /= (1L << FPBITS);
                         xd += temp_n >> 1;
                         y = 0;
-                        sptr = note_data->sample->data
-                                + (note_data->sample_pos >> FPBITS)
-                                - (temp_n >> 1);
+                        if (note_data->sample->ulaw_data) {
+                            sptr = ulaw_decode_window(mdi, note_data,
+                                    data_pos - (temp_n >> 1), temp_n + 1);
+                        } else {
+                            sptr = note_data->sample->data
+                                    + (note_data->sample_pos >> FPBITS)
+                                    - (temp_n >> 1);
+                        }
                         for (ii = temp_n; ii;) {
                             for (jj = 0; jj <= ii; jj++)
-                                y += sptr[jj] * newt_coeffs[ii][jj];
+                                y += sptr[jj] * _WM_newt_coeffs[ii][jj];
                             y *= xd - --ii;
                         }
                         y += *sptr;
+                    } else if (!(note_data->sample_pos & FPMASK)) {
+                        /* on a sample point the window reduces to the sample itself */
+                        if (note_data->sample->ulaw_data) {
+                            y = _WM_ulaw_table[note_data->sample->ulaw_data[data_pos]];
+                        } else {
+                            y = note_data->sample->data[data_pos];
+                        }
                     } else { /* otherwise, use Gauss as usual */
                         y = 0;
-                        gptr = &gauss_table[(note_data->sample_pos & FPMASK) *
-                                     (gauss_n + 1)];
-                        gend = gptr + gauss_n;
-                        sptr = note_data->sample->data
-                                + (note_data->sample_pos >> FPBITS)
-                                - (gauss_n >> 1);
+                        gptr = &_WM_gauss_table[(note_data->sample_pos & FPMASK) *
+                                     (_WM_gauss_n + 1)];
+                        gend = gptr + _WM_gauss_n;
+                        if (note_data->sample->ulaw_data) {
+                            sptr = ulaw_decode_window(mdi, note_data,
+                                    data_pos - (_WM_gauss_n >> 1), _WM_gauss_n + 1);
+                        } else {
+                            sptr = note_data->sample->data
+                                    + (note_data->sample_pos >> FPBITS)
+                                    - (_WM_gauss_n >> 1);
+                        }
                         do {
                             y += *(sptr++) * *(gptr++);
                         } while (gptr <= gend);
@@ -1266,21 +1487,27 @@ static int WM_GetOutput_Gauss(midi * handle, int8_t *buffer, uint32_t size) {
                      * sample position checking
                      * ========================
                      */
-                    note_data->sample_pos += note_data->sample_inc;
-                    if (__builtin_expect(
-                                         (note_data->sample_pos > note_data->sample->loop_end),
-                                         0)) {
-                        if (note_data->modes & SAMPLE_LOOP) {
-                            note_data->sample_pos =
-                            note_data->sample->loop_start
-                            + ((note_data->sample_pos
-                                - note_data->sample->loop_start)
-                               % note_data->sample->loop_size);
-                        } else if (__builtin_expect(
-                                                    (note_data->sample_pos
-                                                     >= note_data->sample->data_length),
-                                                    0)) {
+                    _STEP_THIS_NOTE:
+                    if (__builtin_expect((note_data->modes & (SAMPLE_PINGPONG | SAMPLE_REVERSE)), 0)) {
+                        if (native_sample_step(note_data))
                             goto _END_THIS_NOTE;
+                    } else {
+                        note_data->sample_pos += note_data->sample_inc;
+                        if (__builtin_expect(
+                                             (note_data->sample_pos > note_data->sample->loop_end),
+                                             0)) {
+                            if (note_data->modes & SAMPLE_LOOP) {
+                                note_data->sample_pos =
+                                note_data->sample->loop_start
+                                + ((note_data->sample_pos
+                                    - note_data->sample->loop_start)
+                                   % note_data->sample->loop_size);
+                            } else if (__builtin_expect(
+                                                        (note_data->sample_pos
+                                                         >= note_data->sample->data_length),
+                                                        0)) {
+                                goto _END_THIS_NOTE;
+                            }
                         }
                     }
 
@@ -1422,14 +1649,19 @@ static int WM_GetOutput_Gauss(midi * handle, int8_t *buffer, uint32_t size) {
                     continue;
                 }
             }
-            *tmp_buffer++ = left_mix;
-            *tmp_buffer++ = right_mix;
+            *tmp_buffer++ += left_mix;
+            *tmp_buffer++ += right_mix;
         } while (--count);
+        end_unity_notes(mdi);
 
         buffer_used += real_samples_to_mix * 4;
         size -= (real_samples_to_mix << 2);
-        mdi->extra_info.current_sample += real_samples_to_mix;
-        mdi->samples_to_mix -= real_samples_to_mix;
+        if (__builtin_expect((mdi->speed != SPEED_NORMAL), 0)) {
+            speed_advance(mdi, real_samples_to_mix);
+        } else {
+            mdi->extra_info.current_sample += real_samples_to_mix;
+            mdi->samples_to_mix -= real_samples_to_mix;
+        }
     } while (size);
 
     tmp_buffer = out_buffer;
@@ -1440,28 +1672,7 @@ static int WM_GetOutput_Gauss(midi * handle, int8_t *buffer, uint32_t size) {
 
     /* _WM_DynamicVolumeAdjust(mdi, tmp_buffer, (buffer_used/2)); */
 
-    for (i = 0; i < buffer_used; i += 4) {
-        left_mix = *tmp_buffer++;
-        right_mix = *tmp_buffer++;
-
-        /*
-         * ===================
-         * Write to the buffer
-         * ===================
-         */
-#ifdef WORDS_BIGENDIAN
-        (*buffer++) = ((left_mix >> 8) & 0x7f) | ((left_mix >> 24) & 0x80);
-        (*buffer++) = left_mix & 0xff;
-        (*buffer++) = ((right_mix >> 8) & 0x7f) | ((right_mix >> 24) & 0x80);
-        (*buffer++) = right_mix & 0xff;
-#else
-        (*buffer++) = left_mix & 0xff;
-        (*buffer++) = ((left_mix >> 8) & 0x7f) | ((left_mix >> 24) & 0x80);
-        (*buffer++) = right_mix & 0xff;
-        (*buffer++) = ((right_mix >> 8) & 0x7f) | ((right_mix >> 24) & 0x80);
-#endif
-    }
-    _WM_Unlock(&mdi->lock);
+    _WM_pack_output(buffer, tmp_buffer, buffer_used);
     return (buffer_used);
 }
 
@@ -1548,30 +1759,47 @@ static int _WM_Init(const struct _WM_VIO *callbacks,
     _WM_BufferFile = callbacks->allocate_file;
     _WM_FreeBufferFile = callbacks->free_file;
 
+    if (_WM_init_gauss() == -1) {
+        _WM_GLOBAL_ERROR(WM_ERR_MEM, "to init gauss tables", errno);
+        return (-1);
+    }
+
     WM_InitPatches();
     if (WM_LoadConfig(config_file) == -1) {
+        _WM_free_gauss();
         return (-1);
     }
 
-    if (mixer_options & 0x0FF0) {
+    if (mixer_options & 0x0FE0) {
         _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(invalid option)",
                 0);
         WM_FreePatches();
+        _WM_free_gauss();
         return (-1);
     }
     _WM_MixerOptions = mixer_options;
+    if (mixer_options & WM_MO_REALTIME) {
+        _WM_LockMemory(_WM_gauss_table,
+                (1 << FPBITS) * (_WM_gauss_n + 1) * sizeof(double));
+    }
 
     if (rate < 11025) {
         _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG,
                 "(rate out of bounds, range is 11025 - 65535)", 0);
         WM_FreePatches();
+        _WM_free_gauss();
         return (-1);
     }
     _WM_SampleRate = rate;
 
-    gauss_lock = 0;
     _WM_patch_lock = 0;
     _WM_MasterVolume = 948;
+
+    if ((_WM_async_load) && (_WM_start_patch_loader() == -1)) {
+        /* not fatal, patches load where they are needed instead */
+        _WM_DEBUG_MSG("async_load: can't start the loader thread");
+        _WM_async_load = 0;
+    }
     WM_Initialized = 1;
 
     return (0);
@@ -1652,11 +1880,26 @@ WM_SYMBOL int WildMidi_Close(midi * handle) {
     return (0);
 }
 
+/* picks the parser for the midi format, see _WM_initMDI for list_only */
+static struct _mdi *parse_midi(const uint8_t *mididata, uint32_t midisize, uint8_t list_only) {
+    uint8_t mus_hdr[] = { 'M', 'U', 'S', 0x1A };
+    uint8_t xmi_hdr[] = { 'F', 'O', 'R', 'M' };
+
+    if (memcmp(mididata,"HMIMIDIP", 8) == 0) {
+        return (_WM_ParseNewHmp(mididata, midisize, list_only));
+    } else if (memcmp(mididata, "HMI-MIDISONG061595", 18) == 0) {
+        return (_WM_ParseNewHmi(mididata, midisize, list_only));
+    } else if (memcmp(mididata, mus_hdr, 4) == 0) {
+        return (_WM_ParseNewMus(mididata, midisize, list_only));
+    } else if (memcmp(mididata, xmi_hdr, 4) == 0) {
+        return (_WM_ParseNewXmi(mididata, midisize, list_only));
+    }
+    return (_WM_ParseNewMidi(mididata, midisize, list_only));
+}
+
 WM_SYMBOL midi *WildMidi_Open(const char *midifile) {
     uint8_t *mididata = NULL;
     uint32_t midisize = 0;
-    uint8_t mus_hdr[] = { 'M', 'U', 'S', 0x1A };
-    uint8_t xmi_hdr[] = { 'F', 'O', 'R', 'M' };
     midi * ret = NULL;
 
     if (!WM_Initialized) {
@@ -1675,23 +1918,16 @@ WM_SYMBOL midi *WildMidi_Open(const char *midifile) {
         _WM_GLOBAL_ERROR(WM_ERR_CORUPT, "(too short)", 0);
         return (NULL);
     }
-    if (memcmp(mididata,"HMIMIDIP", 8) == 0) {
-        ret = (void *) _WM_ParseNewHmp(mididata, midisize);
-    } else if (memcmp(mididata, "HMI-MIDISONG061595", 18) == 0) {
-        ret = (void *) _WM_ParseNewHmi(mididata, midisize);
-    } else if (memcmp(mididata, mus_hdr, 4) == 0) {
-        ret = (void *) _WM_ParseNewMus(mididata, midisize);
-    } else if (memcmp(mididata, xmi_hdr, 4) == 0) {
-        ret = (void *) _WM_ParseNewXmi(mididata, midisize);
-    } else {
-        ret = (void *) _WM_ParseNewMidi(mididata, midisize);
-    }
+    ret = (void *) parse_midi(mididata, midisize, 0);
     _WM_FreeBufferFile(mididata);
 
     if (ret) {
         if (add_handle(ret) != 0) {
             WildMidi_Close(ret);
             ret = NULL;
+        } else {
+            _WM_load_wanted_samples((struct _mdi *) ret);
+            ((struct _mdi *) ret)->async_load = (uint8_t) _WM_async_load;
         }
     }
 
@@ -1699,8 +1935,6 @@ WM_SYMBOL midi *WildMidi_Open(const char *midifile) {
 }
 
 WM_SYMBOL midi *WildMidi_OpenBuffer(const uint8_t *midibuffer, uint32_t size) {
-    uint8_t mus_hdr[] = { 'M', 'U', 'S', 0x1A };
-    uint8_t xmi_hdr[] = { 'F', 'O', 'R', 'M' };
     midi * ret = NULL;
 
     if (!WM_Initialized) {
@@ -1720,18 +1954,39 @@ WM_SYMBOL midi *WildMidi_OpenBuffer(const uint8_t *midibuffer, uint32_t size) {
         _WM_GLOBAL_ERROR(WM_ERR_CORUPT, "(too short)", 0);
         return (NULL);
     }
-    if (memcmp(midibuffer,"HMIMIDIP", 8) == 0) {
-        ret = (void *) _WM_ParseNewHmp(midibuffer, size);
-    } else if (memcmp(midibuffer, "HMI-MIDISONG061595", 18) == 0) {
-        ret = (void *) _WM_ParseNewHmi(midibuffer, size);
-    } else if (memcmp(midibuffer, mus_hdr, 4) == 0) {
-        ret = (void *) _WM_ParseNewMus(midibuffer, size);
-    } else if (memcmp(midibuffer, xmi_hdr, 4) == 0) {
-        ret = (void *) _WM_ParseNewXmi(midibuffer, size);
-    } else {
-        ret = (void *) _WM_ParseNewMidi(midibuffer, size);
+    ret = (void *) parse_midi(midibuffer, size, 0);
+
+    if (ret) {
+        if (add_handle(ret) != 0) {
+            WildMidi_Close(ret);
+            ret = NULL;
+        } else {
+            _WM_load_wanted_samples((struct _mdi *) ret);
+            ((struct _mdi *) ret)->async_load = (uint8_t) _WM_async_load;
+        }
+    }
+
+    return (ret);
+}
+
+WM_SYMBOL midi *WildMidi_Clone(midi * handle) {
+    struct _mdi *mdi;
+    midi * ret = NULL;
+
+    if (!WM_Initialized) {
+        _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
+        return (NULL);
+    }
+    if (handle == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL handle)", 0);
+        return (NULL);
     }
 
+    mdi = (struct _mdi *) handle;
+    _WM_Lock(&mdi->lock);
+    ret = (void *) _WM_cloneMDI(mdi);
+    _WM_Unlock(&mdi->lock);
+
     if (ret) {
         if (add_handle(ret) != 0) {
             WildMidi_Close(ret);
@@ -1763,6 +2018,8 @@ WM_SYMBOL int WildMidi_FastSeek(midi * handle, unsigned long int *sample_pos) {
     mdi = (struct _mdi *) handle;
     _WM_Lock(&mdi->lock);
     event = mdi->current_event;
+    mdi->checkpoint_played = CHECKPOINTS_STOPPED;
+    mdi->speed_frac = 0;
 
     /* make sure we haven't asked for a positions beyond the end of the song. */
     if (*sample_pos > mdi->extra_info.approx_total_samples) {
@@ -1803,7 +2060,7 @@ WM_SYMBOL int WildMidi_FastSeek(midi * handle, unsigned long int *sample_pos) {
                 mdi->extra_info.current_sample += mdi->samples_to_mix;
                 mdi->samples_to_mix = 0;
             }
-            event++;
+            event = WM_NEXT_EVENT(event);
         }
         mdi->current_event = event;
     }
@@ -1838,6 +2095,8 @@ WM_SYMBOL int WildMidi_SongSeek (midi * handle, int8_t nextsong) {
     struct _mdi *mdi;
     struct _event *event;
     struct _event *event_new;
+    struct _event *song_start;
+    struct _event *prev_song_start;
     struct _note *note_data;
 
     if (!WM_Initialized) {
@@ -1861,29 +2120,30 @@ WM_SYMBOL int WildMidi_SongSeek (midi * handle, int8_t nextsong) {
         _WM_Unlock(&mdi->lock);
         return (-1);
     }
+    mdi->checkpoint_played = CHECKPOINTS_STOPPED;
 
-    event = mdi->current_event;
+    /*
+     * Find the start of this song and of the one before it. The
+     * events are walked forwards as they may be split into chunks,
+     * a song starts at the first event and after each end of track.
+     */
+    song_start = mdi->events;
+    prev_song_start = mdi->events;
+    for (event = mdi->events; event != mdi->current_event; event = event_new) {
+        event_new = WM_NEXT_EVENT(event);
+        if (event->evtype == ev_meta_endoftrack) {
+            prev_song_start = song_start;
+            song_start = event_new;
+        }
+    }
 
     if (nextsong == -1) {
         /* goto start of previous song */
         /*
-         * So with this one we have to go back 2 eof's
-         * then forward 1 event to get to the start of
-         * the previous song.
-         * NOTE: We will automatically stop at the start 
+         * NOTE: We will automatically stop at the start
          * of the data.
          */
-        uint8_t eof_cnt = 1;
-        while (event != mdi->events) {
-            if (event[-1].evtype == ev_meta_endoftrack) {
-                if (eof_cnt == 0) {
-                    break;
-                }
-                eof_cnt = 0;
-            }
-            event--;
-        }
-        event_new = event;
+        event_new = prev_song_start;
         event = mdi->events;
         _WM_ResetToStart((struct _mdi *) handle);
 
@@ -1891,15 +2151,14 @@ WM_SYMBOL int WildMidi_SongSeek (midi * handle, int8_t nextsong) {
         /* goto start of next song */
         while (event->evtype != ev_null) {
             if (event->evtype == ev_meta_endoftrack) {
-                event++;
+                event = WM_NEXT_EVENT(event);
                 if (event->evtype == ev_null) {
-                    event--;
                     goto START_THIS_SONG;
                 } else {
                     break;
                 }
             }
-            event++;
+            event = WM_NEXT_EVENT(event);
         }
         event_new = event;
         event = mdi->current_event;
@@ -1907,14 +2166,7 @@ WM_SYMBOL int WildMidi_SongSeek (midi * handle, int8_t nextsong) {
     } else {
     START_THIS_SONG:
         /* goto start of this song */
-        /* first find the offset */
-        while (event != mdi->events) {
-            if (event[-1].evtype == ev_meta_endoftrack) {
-                break;
-            }
-            event--;
-        }
-        event_new = event;
+        event_new = song_start;
         event = mdi->events;
         _WM_ResetToStart((struct _mdi *) handle);
     }
@@ -1922,7 +2174,7 @@ WM_SYMBOL int WildMidi_SongSeek (midi * handle, int8_t nextsong) {
     while (event != event_new) {
         event->do_event(mdi, &event->event_data);
         mdi->extra_info.current_sample += event->samples_to_next;
-        event++;
+        event = WM_NEXT_EVENT(event);
     }
 
     mdi->current_event = event;
@@ -1943,7 +2195,267 @@ WM_SYMBOL int WildMidi_SongSeek (midi * handle, int8_t nextsong) {
     return (0);
 }
 
+WM_SYMBOL int WildMidi_SaveState(midi * handle, uint8_t **buffer, uint32_t *size) {
+    struct _mdi *mdi;
+
+    if (!WM_Initialized) {
+        _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
+        return (-1);
+    }
+    if (handle == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL handle)", 0);
+        return (-1);
+    }
+    if ((buffer == NULL) || (size == NULL)) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL buffer pointer)", 0);
+        return (-1);
+    }
+
+    mdi = (struct _mdi *) handle;
+    _WM_Lock(&mdi->lock);
+    *buffer = _WM_pack_state(mdi, size);
+    _WM_Unlock(&mdi->lock);
+    if (*buffer == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_MEM, "to save state", 0);
+        return (-1);
+    }
+    return (0);
+}
+
+WM_SYMBOL int WildMidi_RestoreState(midi * handle, const uint8_t *buffer, uint32_t size) {
+    struct _mdi *mdi;
+    int ret;
+
+    if (!WM_Initialized) {
+        _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
+        return (-1);
+    }
+    if (handle == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL handle)", 0);
+        return (-1);
+    }
+    if (buffer == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL buffer pointer)", 0);
+        return (-1);
+    }
+
+    mdi = (struct _mdi *) handle;
+    _WM_Lock(&mdi->lock);
+    ret = _WM_unpack_state(mdi, buffer, size);
+    if (ret == 0) {
+        mdi->checkpoint_played = CHECKPOINTS_STOPPED;
+    }
+    _WM_Unlock(&mdi->lock);
+    return (ret);
+}
+
+static int check_edit(midi * handle, const uint8_t *event, uint32_t size) {
+    if (!WM_Initialized) {
+        _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
+        return (-1);
+    }
+    if (handle == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL handle)", 0);
+        return (-1);
+    }
+    if ((event == NULL) || (size == 0)) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(no midi event)", 0);
+        return (-1);
+    }
+    return (0);
+}
+
+/*
+ After an edit, takes a reference on each patch the events can now play
+ that mdi holds none on, loading it or queuing it with async_load while
+ the handle plays on, and with partial_patches the zones their notes
+ need. Whatever plays is in place before it renders, the render path
+ only checks with _WM_holds_patch. Old references stay until the handle
+ is closed, the edit may yet be undone.
+ */
+static void hold_song_patches(struct _mdi *mdi) {
+    struct _song_patch *song_patches = NULL;
+    int count;
+    int held;
+    int i;
+
+    _WM_Lock(&mdi->lock);
+    count = _WM_SongPatches(mdi, &song_patches);
+    _WM_Unlock(&mdi->lock);
+    if (count < 0) {
+        _WM_GLOBAL_ERROR(WM_ERR_MEM, "(to hold the edited song's patches)", errno);
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        _WM_Lock(&mdi->lock);
+        held = _WM_holds_patch(mdi, song_patches[i].patch);
+        _WM_Unlock(&mdi->lock);
+        if (held)
+            continue;
+        song_patches[i].patch = _WM_hold_patch(mdi, song_patches[i].patch->patchid);
+        _WM_Lock(&mdi->lock);
+        _WM_add_patch(mdi, song_patches[i].patch);
+        _WM_Unlock(&mdi->lock);
+    }
+    for (i = 0; i < count; i++) {
+        _WM_load_song_zones(mdi, song_patches[i].patch, song_patches[i].notes);
+    }
+    free(song_patches);
+}
+
+WM_SYMBOL int WildMidi_InsertMidiEvent (midi * handle, const uint8_t *event, uint32_t size, unsigned long int sample_pos) {
+    struct _mdi *mdi;
+    int ret;
+
+    if (check_edit(handle, event, size) != 0)
+        return (-1);
+    if (sample_pos > 0xffffffffUL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(sample position out of range)", 0);
+        return (-1);
+    }
+
+    mdi = (struct _mdi *) handle;
+    _WM_Lock(&mdi->lock);
+    ret = _WM_InsertEvent(mdi, event, size, (uint32_t) sample_pos);
+    _WM_Unlock(&mdi->lock);
+    if (ret == 0) {
+        hold_song_patches(mdi);
+    }
+    return (ret);
+}
+
+WM_SYMBOL int WildMidi_DeleteMidiEvent (midi * handle, const uint8_t *event, uint32_t size, unsigned long int sample_pos) {
+    struct _mdi *mdi;
+    int ret;
+
+    if (check_edit(handle, event, size) != 0)
+        return (-1);
+    if (sample_pos > 0xffffffffUL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(sample position out of range)", 0);
+        return (-1);
+    }
+
+    mdi = (struct _mdi *) handle;
+    _WM_Lock(&mdi->lock);
+    ret = _WM_DeleteEvent(mdi, event, size, (uint32_t) sample_pos);
+    _WM_Unlock(&mdi->lock);
+    if (ret == 0) {
+        hold_song_patches(mdi);
+    }
+    return (ret);
+}
+
+WM_SYMBOL int WildMidi_MoveMidiEvent (midi * handle, const uint8_t *event, uint32_t size, unsigned long int sample_pos, unsigned long int new_sample_pos) {
+    struct _mdi *mdi;
+    int ret;
+
+    if (check_edit(handle, event, size) != 0)
+        return (-1);
+    if ((sample_pos > 0xffffffffUL) || (new_sample_pos > 0xffffffffUL)) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(sample position out of range)", 0);
+        return (-1);
+    }
+
+    mdi = (struct _mdi *) handle;
+    _WM_Lock(&mdi->lock);
+    ret = _WM_MoveEvent(mdi, event, size, (uint32_t) sample_pos, (uint32_t) new_sample_pos);
+    _WM_Unlock(&mdi->lock);
+    if (ret == 0) {
+        hold_song_patches(mdi);
+    }
+    return (ret);
+}
+
+/* mixes size bytes of output with the mixer the handle is set to */
+int _WM_mix_block(struct _mdi *mdi, int8_t *buffer, uint32_t size) {
+    uint32_t start = mdi->extra_info.current_sample;
+    int ret;
+
+    if (mdi->extra_info.mixer_options & WM_MO_ENHANCED_RESAMPLING) {
+        ret = WM_GetOutput_Gauss(mdi, buffer, size);
+    } else {
+        ret = WM_GetOutput_Linear(mdi, buffer, size);
+    }
+
+    /* measured on the mix the block was packed from, while it is in cache */
+    if (ret > 0) {
+        if (mdi->loudness) {
+            _WM_do_loudness(mdi->loudness, mdi->mix_buffer, (ret / 2));
+        }
+        if (mdi->waveform) {
+            _WM_do_waveform(mdi->waveform, mdi->mix_buffer, (ret / 4), start,
+                            mdi->extra_info.current_sample, mdi->speed,
+                            (mdi->extra_info.mixer_options & WM_MO_REALTIME));
+        }
+    }
+    return (ret);
+}
+
+/*
+ WM_MO_REALTIME rendering, safe to call from an audio callback: it never
+ waits, allocates or loads anything. If another call is using the handle
+ the block is silent, and the output is mixed in pieces that fit the mix
+ buffer allocated when the handle was opened.
+ */
+static int WM_GetOutput_RealTime(struct _mdi *mdi, int8_t *buffer, uint32_t size) {
+    uint32_t done = 0;
+    uint32_t block;
+    int ret;
+
+    if (_WM_TryLock(&mdi->lock) != 0) {
+        memset(buffer, 0, size);
+        return (size);
+    }
+    if (mdi->mix_buffer == NULL) {
+        _WM_Unlock(&mdi->lock);
+        _WM_GLOBAL_ERROR(WM_ERR_MEM, "(no mix buffer)", 0);
+        return (-1);
+    }
+
+    WM_RT_ENTER();
+    do {
+        block = size - done;
+        if (block > (mdi->mix_buffer_size * 2)) {
+            block = mdi->mix_buffer_size * 2;
+        }
+        ret = _WM_mix_block(mdi, &buffer[done], block);
+        done += ret;
+    } while ((done < size) && ((uint32_t) ret == block));
+    WM_RT_LEAVE();
+
+    _WM_Unlock(&mdi->lock);
+    return (done);
+}
+
+/*
+ Checkpoints are only taken while the midi plays straight through from
+ the start, once all the events up to the current sample have played.
+ */
+static void take_checkpoint(struct _mdi *mdi, uint32_t played) {
+    uint32_t current = mdi->extra_info.current_sample;
+    uint32_t next = mdi->checkpoint_interval;
+
+    if ((played != mdi->checkpoint_played) || (current < played)) {
+        /* seeked or looped */
+        mdi->checkpoint_played = CHECKPOINTS_STOPPED;
+        return;
+    }
+    mdi->checkpoint_played = current;
+
+    if (mdi->checkpoint_count) {
+        next += mdi->checkpoints[mdi->checkpoint_count - 1].sample;
+    }
+    if ((current >= next) && (mdi->samples_to_mix)) {
+        _WM_add_checkpoint(mdi, mdi);
+    }
+}
+
 WM_SYMBOL int WildMidi_GetOutput(midi * handle, int8_t *buffer, uint32_t size) {
+    struct _mdi *mdi;
+    uint32_t played;
+    int ret;
+
     if (__builtin_expect((!WM_Initialized), 0)) {
         _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
         return (-1);
@@ -1964,32 +2476,50 @@ WM_SYMBOL int WildMidi_GetOutput(midi * handle, int8_t *buffer, uint32_t size) {
         return (-1);
     }
 
-    if (((struct _mdi *) handle)->extra_info.mixer_options & WM_MO_ENHANCED_RESAMPLING) {
-        if (!gauss_table) init_gauss();
-        return (WM_GetOutput_Gauss(handle, buffer, size));
+    mdi = (struct _mdi *) handle;
+    if (mdi->extra_info.mixer_options & WM_MO_REALTIME) {
+        return (WM_GetOutput_RealTime(mdi, buffer, size));
+    }
+
+    _WM_Lock(&mdi->lock);
+    played = mdi->extra_info.current_sample;
+    ret = _WM_mix_block(mdi, buffer, size);
+    if (mdi->checkpoint_interval) {
+        take_checkpoint(mdi, played);
     }
-    return (WM_GetOutput_Linear(handle, buffer, size));
+    _WM_Unlock(&mdi->lock);
+    return (ret);
 }
 
-WM_SYMBOL int WildMidi_GetMidiOutput(midi * handle, int8_t **buffer, uint32_t *size) {
-    if (__builtin_expect((!WM_Initialized), 0)) {
+WM_SYMBOL int WildMidi_SetCheckpoints(midi * handle, unsigned long int interval) {
+    struct _mdi *mdi;
+
+    if (!WM_Initialized) {
         _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
         return (-1);
     }
-    if (__builtin_expect((handle == NULL), 0)) {
+    if (handle == NULL) {
         _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL handle)", 0);
         return (-1);
     }
-    if (__builtin_expect((buffer == NULL), 0)) {
-        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL buffer pointer)", 0);
+    if (interval > 0xffffffff) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(interval too large)", 0);
         return (-1);
     }
-    return _WM_Event2Midi((struct _mdi *)handle, (uint8_t **)buffer, size);
-}
 
+    mdi = (struct _mdi *) handle;
+    _WM_Lock(&mdi->lock);
+    _WM_free_checkpoints(mdi);
+    mdi->checkpoint_interval = (uint32_t) interval;
+    mdi->checkpoint_played = 0;
+    _WM_Unlock(&mdi->lock);
+    return (0);
+}
 
-WM_SYMBOL int WildMidi_SetOption(midi * handle, uint16_t options, uint16_t setting) {
+WM_SYMBOL int WildMidi_SetLoudness(midi * handle, uint16_t options) {
     struct _mdi *mdi;
+    struct _loudness *loudness = NULL;
+    struct _loudness *old;
 
     if (!WM_Initialized) {
         _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
@@ -1999,30 +2529,1052 @@ WM_SYMBOL int WildMidi_SetOption(midi * handle, uint16_t options, uint16_t setti
         _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL handle)", 0);
         return (-1);
     }
+    if (options & ~(WM_LN_MEASURE | WM_LN_TRUE_PEAK)) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(invalid option)", 0);
+        return (-1);
+    }
+
+    /* allocated outside the lock, a WM_MO_REALTIME caller never waits on it */
+    if (options) {
+        loudness = _WM_init_loudness(_WM_SampleRate, !!(options & WM_LN_TRUE_PEAK));
+        if (loudness == NULL) {
+            _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, 0);
+            return (-1);
+        }
+    }
 
     mdi = (struct _mdi *) handle;
     _WM_Lock(&mdi->lock);
-    if ((!(options & 0x800F)) || (options & 0x7FF0)) {
-        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(invalid option)", 0);
-        _WM_Unlock(&mdi->lock);
+    old = mdi->loudness;
+    mdi->loudness = loudness;
+    _WM_Unlock(&mdi->lock);
+    _WM_free_loudness(old);
+    return (0);
+}
+
+WM_SYMBOL int WildMidi_GetLoudness(midi * handle, struct _WM_Loudness *loudness) {
+    struct _mdi *mdi;
+
+    if (!WM_Initialized) {
+        _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
         return (-1);
     }
-    if (setting & 0x7FF0) {
-        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(invalid setting)", 0);
+    if (handle == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL handle)", 0);
+        return (-1);
+    }
+    if (loudness == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL loudness)", 0);
+        return (-1);
+    }
+
+    mdi = (struct _mdi *) handle;
+    _WM_Lock(&mdi->lock);
+    if (mdi->loudness == NULL) {
         _WM_Unlock(&mdi->lock);
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(loudness not measured)", 0);
         return (-1);
     }
+    _WM_get_loudness(mdi->loudness, loudness);
+    _WM_Unlock(&mdi->lock);
+    return (0);
+}
 
-    mdi->extra_info.mixer_options = ((mdi->extra_info.mixer_options & (0x80FF ^ options))
-                                    | (options & setting));
+WM_SYMBOL int WildMidi_SetWaveform(midi * handle, uint32_t frames_per_bin) {
+    struct _mdi *mdi;
+    struct _waveform *waveform = NULL;
+    struct _waveform *old;
+    uint32_t total;
 
-    if (options & WM_MO_LOG_VOLUME) {
-            _WM_AdjustChannelVolumes(mdi, 16);  /* Settings greater than 15
-                                                   adjusts all channels */
-    } else if (options & WM_MO_REVERB) {
-        _WM_reset_reverb(mdi->reverb);
+    if (!WM_Initialized) {
+        _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
+        return (-1);
+    }
+    if (handle == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL handle)", 0);
+        return (-1);
+    }
+    if ((frames_per_bin) && ((frames_per_bin < 16) || (frames_per_bin > 65536))) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(frames per bin out of range)", 0);
+        return (-1);
+    }
+
+    mdi = (struct _mdi *) handle;
+    if (frames_per_bin) {
+        _WM_Lock(&mdi->lock);
+        total = mdi->extra_info.approx_total_samples;
+        _WM_Unlock(&mdi->lock);
+        /* allocated outside the lock, as in WildMidi_SetLoudness */
+        waveform = _WM_init_waveform(frames_per_bin, total);
+        if (waveform == NULL) {
+            _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, 0);
+            return (-1);
+        }
     }
 
+    _WM_Lock(&mdi->lock);
+    old = mdi->waveform;
+    mdi->waveform = waveform;
+    _WM_Unlock(&mdi->lock);
+    _WM_free_waveform(old);
+    return (0);
+}
+
+WM_SYMBOL int WildMidi_GetWaveform(midi * handle, uint8_t level, uint32_t first,
+                                   struct _WM_WaveBin *bins, uint32_t *count) {
+    struct _mdi *mdi;
+    uint32_t total;
+
+    if (!WM_Initialized) {
+        _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
+        return (-1);
+    }
+    if (handle == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL handle)", 0);
+        return (-1);
+    }
+    if (level >= WM_WAVEFORM_LEVELS) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(invalid level)", 0);
+        return (-1);
+    }
+    if ((bins != NULL) && (count == NULL)) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL count)", 0);
+        return (-1);
+    }
+
+    mdi = (struct _mdi *) handle;
+    _WM_Lock(&mdi->lock);
+    if (mdi->waveform == NULL) {
+        _WM_Unlock(&mdi->lock);
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(waveform not built)", 0);
+        return (-1);
+    }
+    total = _WM_get_waveform(mdi->waveform, level, first, bins, count);
+    _WM_Unlock(&mdi->lock);
+    return ((int) total);
+}
+
+/*
+ After each write to a shared memory ring, the lyric and marker that
+ last played if they are new, then where the midi has got to.
+ */
+static void shm_records(struct _WM_Shm *shm, struct _mdi *mdi) {
+    uint32_t current, total;
+
+    if (shm->handle != mdi) {
+        shm->handle = mdi;
+        shm->lyric_count = 0;
+        shm->marker_count = 0;
+    }
+    _WM_Lock(&mdi->lock);
+    current = mdi->extra_info.current_sample;
+    total = mdi->extra_info.approx_total_samples;
+    if (mdi->lyric_count != shm->lyric_count) {
+        shm->lyric_count = mdi->lyric_count;
+        if (mdi->last_lyric != NULL) {
+            _WM_shm_add_record(shm, WM_SHM_LYRIC, current, total, mdi->last_lyric);
+        }
+    }
+    if (mdi->marker_count != shm->marker_count) {
+        shm->marker_count = mdi->marker_count;
+        if (mdi->last_marker != NULL) {
+            _WM_shm_add_record(shm, WM_SHM_MARKER, current, total, mdi->last_marker);
+        }
+    }
+    _WM_Unlock(&mdi->lock);
+    _WM_shm_add_record(shm, WM_SHM_POSITION, current, total, NULL);
+}
+
+WM_SYMBOL struct _WM_Shm *WildMidi_ShmCreate(const char *name, uint32_t rate, uint32_t ring_bytes, int *fd) {
+    struct _WM_Shm *shm;
+
+    if ((rate < 11025) || (rate > 65535)) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG,
+                "(rate out of bounds, range is 11025 - 65535)", 0);
+        return (NULL);
+    }
+    if ((ring_bytes < 4096) || (ring_bytes > 0x40000000) || (ring_bytes & (ring_bytes - 1))) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(ring size not a power of 2 from 4096 to 1GB)", 0);
+        return (NULL);
+    }
+    if ((shm = _WM_shm_create(name, rate, ring_bytes)) == NULL) {
+        return (NULL);
+    }
+    if (fd != NULL) *fd = shm->fd;
+    return (shm);
+}
+
+WM_SYMBOL uint32_t WildMidi_ShmSpace(struct _WM_Shm *shm) {
+    if (shm == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL shm)", 0);
+        return (0);
+    }
+    return (_WM_shm_space(shm));
+}
+
+WM_SYMBOL int WildMidi_ShmWrite(struct _WM_Shm *shm, midi *handle, const int8_t *buffer, uint32_t size) {
+    uint32_t done = 0;
+    uint32_t part;
+    int8_t *dest;
+
+    if (shm == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL shm)", 0);
+        return (-1);
+    }
+    if ((handle != NULL) && (!WM_Initialized)) {
+        _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
+        return (-1);
+    }
+    if (buffer == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL buffer)", 0);
+        return (-1);
+    }
+    if (size % 4) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(size not a multiple of 4)", 0);
+        return (-1);
+    }
+
+    /* twice at most, up to the end of the ring then on from its start */
+    while (done < size) {
+        part = size - done;
+        dest = _WM_shm_claim(shm, done, &part);
+        if (part == 0) break;
+        memcpy(dest, &buffer[done], part);
+        done += part;
+    }
+    if (done) {
+        _WM_shm_publish(shm, done);
+        if (handle != NULL) shm_records(shm, (struct _mdi *) handle);
+    }
+    return ((int) done);
+}
+
+WM_SYMBOL int WildMidi_ShmRender(struct _WM_Shm *shm, midi *handle, uint32_t size) {
+    uint32_t done = 0;
+    uint32_t part;
+    int8_t *dest;
+    int ret = 0;
+
+    if (!WM_Initialized) {
+        _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
+        return (-1);
+    }
+    if ((shm == NULL) || (handle == NULL)) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL shm or handle)", 0);
+        return (-1);
+    }
+    if (size % 4) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(size not a multiple of 4)", 0);
+        return (-1);
+    }
+
+    /* rendered straight into the ring, no copy on this side either */
+    while (done < size) {
+        part = size - done;
+        dest = _WM_shm_claim(shm, done, &part);
+        if (part == 0) break;
+        ret = WildMidi_GetOutput(handle, dest, part);
+        if (ret <= 0) break;
+        done += ret;
+        if ((uint32_t) ret < part) break;
+    }
+    if (done) {
+        _WM_shm_publish(shm, done);
+        shm_records(shm, (struct _mdi *) handle);
+        return ((int) done);
+    }
+    return ((ret < 0) ? -1 : 0);
+}
+
+WM_SYMBOL int WildMidi_ShmClose(struct _WM_Shm *shm) {
+    if (shm == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL shm)", 0);
+        return (-1);
+    }
+    _WM_shm_close(shm);
+    return (0);
+}
+
+#define RERENDER_BLOCK 16384
+
+/*
+ Mixes mdi on to sample target, copying what lands inside buffer there.
+ Returns 1 if the midi ended first.
+ */
+static int rerender_to(struct _mdi *mdi, uint32_t target, int8_t *buffer, uint32_t size) {
+    int8_t block[RERENDER_BLOCK];
+    uint32_t pos;
+    uint32_t want;
+    uint32_t copy;
+    int ret;
+
+    while (mdi->extra_info.current_sample < target) {
+        pos = mdi->extra_info.current_sample;
+        want = target - pos;
+        if (want > (RERENDER_BLOCK / 4)) {
+            want = RERENDER_BLOCK / 4;
+        }
+        ret = _WM_mix_block(mdi, block, want * 4);
+        if (ret <= 0) {
+            return (1);
+        }
+        if (pos < (size / 4)) {
+            copy = size - (pos * 4);
+            if (copy > (uint32_t) ret) {
+                copy = ret;
+            }
+            memcpy(&buffer[pos * 4], block, copy);
+        }
+        if ((uint32_t) ret < (want * 4)) {
+            return (1);
+        }
+    }
+    return (0);
+}
+
+/* index of the first checkpoint at or after sample */
+static uint32_t checkpoint_from(struct _mdi *mdi, uint32_t sample) {
+    uint32_t i = 0;
+
+    while ((i < mdi->checkpoint_count) && (mdi->checkpoints[i].sample < sample)) {
+        i++;
+    }
+    return (i);
+}
+
+/*
+ Played from the last checkpoint before start, on a clone so the handle
+ keeps its place. The handle is locked only to copy each checkpoint the
+ clone plays to, and to write back the state it arrives there in; the
+ clone itself plays unlocked.
+
+ Past end, the change is over at a checkpoint arrived at in exactly the
+ same state, reverb and all: from there on the old output still holds.
+ The integer reverb seldom gets back to the same state, so it is also
+ over once the notes arrive at a checkpoint as they were and the reverb
+ tail of what differed has died away, max_reverb_time after. Returns 1
+ then, the old output past region_end keeping a low level residue.
+ */
+WM_SYMBOL int WildMidi_RerenderRegion(midi * handle, unsigned long int start, unsigned long int end,
+                                      int8_t *buffer, uint32_t size, unsigned long int *region_end) {
+    struct _mdi *mdi;
+    struct _mdi *work;
+    struct _mdi_state old;
+    struct _mdi_state state;
+    uint32_t next = 0;
+    uint32_t current;
+    uint32_t target;
+    uint32_t settled = 0;
+    uint32_t tail = 0;
+    uint32_t i;
+    int have_old;
+    int saved;
+    int added;
+    int ended = 0;
+    int guessed = 0;
+
+    if (!WM_Initialized) {
+        _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
+        return (-1);
+    }
+    if (handle == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL handle)", 0);
+        return (-1);
+    }
+    if (buffer == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL buffer pointer)", 0);
+        return (-1);
+    }
+    if (size % 4) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(size not a multiple of 4)", 0);
+        return (-1);
+    }
+    if ((start > end) || (end > 0xffffffff)) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(invalid region)", 0);
+        return (-1);
+    }
+
+    mdi = (struct _mdi *) handle;
+    _WM_Lock(&mdi->lock);
+    work = _WM_cloneMDI(mdi);
+    if (work == NULL) {
+        _WM_Unlock(&mdi->lock);
+        return (-1);
+    }
+    work->extra_info.mixer_options &= ~(WM_MO_LOOP | WM_MO_REALTIME);
+    work->checkpoint_interval = 0;
+    work->speed = SPEED_NORMAL;
+    if ((work->extra_info.mixer_options & WM_MO_REVERB) && (work->reverb != NULL)) {
+        tail = work->reverb->max_reverb_time;
+    }
+
+    i = checkpoint_from(mdi, start);
+    if (i > 0) {
+        _WM_restore_state(work, &mdi->checkpoints[i - 1]);
+        next = mdi->checkpoints[i - 1].sample + 1;
+    }
+    _WM_Unlock(&mdi->lock);
+
+    for (;;) {
+        current = work->extra_info.current_sample;
+        have_old = 0;
+        added = 0;
+
+        _WM_Lock(&mdi->lock);
+        i = checkpoint_from(mdi, next);
+        if (i < mdi->checkpoint_count) {
+            target = mdi->checkpoints[i].sample;
+            if (target > end) {
+                have_old = (_WM_copy_state(&old, &mdi->checkpoints[i]) == 0);
+            }
+        } else if (mdi->checkpoint_interval) {
+            /* past the last one, add more as playing would */
+            added = 1;
+            target = mdi->checkpoint_interval;
+            if (mdi->checkpoint_count) {
+                target += mdi->checkpoints[mdi->checkpoint_count - 1].sample;
+            }
+            if (target <= current) {
+                target = current + mdi->checkpoint_interval;
+            }
+            if (target < current) {
+                target = 0xffffffff;
+            }
+        } else {
+            target = 0xffffffff;
+        }
+        _WM_Unlock(&mdi->lock);
+
+        if (rerender_to(work, target, buffer, size)) {
+            if (have_old) {
+                _WM_free_state(&old);
+            }
+            ended = 1;
+            break;
+        }
+        next = target + 1;
+
+        if (have_old) {
+            if ((work->samples_to_mix) && (_WM_same_notes(work, &old))) {
+                if (!settled) {
+                    settled = target + tail;
+                    if (settled < target) {
+                        settled = 0xffffffff;
+                    }
+                }
+                if (_WM_same_state(work, &old)) {
+                    _WM_free_state(&old);
+                    break;
+                }
+                if (target >= settled) {
+                    guessed = 1;
+                    _WM_free_state(&old);
+                    break;
+                }
+            }
+            _WM_free_state(&old);
+        }
+
+        if (added) {
+            if (work->samples_to_mix) {
+                _WM_Lock(&mdi->lock);
+                if ((mdi->checkpoint_count == 0)
+                    || (mdi->checkpoints[mdi->checkpoint_count - 1].sample < target)) {
+                    _WM_add_checkpoint(mdi, work);
+                }
+                _WM_Unlock(&mdi->lock);
+            }
+            continue;
+        }
+
+        saved = ((work->samples_to_mix) && (_WM_save_state(work, &state) == 0));
+        _WM_Lock(&mdi->lock);
+        i = checkpoint_from(mdi, target);
+        if ((i < mdi->checkpoint_count) && (mdi->checkpoints[i].sample == target)) {
+            _WM_free_state(&mdi->checkpoints[i]);
+            if (saved) {
+                memcpy(&mdi->checkpoints[i], &state, sizeof(struct _mdi_state));
+                saved = 0;
+            } else {
+                /* an event now plays right on it */
+                memmove(&mdi->checkpoints[i], &mdi->checkpoints[i + 1],
+                        (mdi->checkpoint_count - i - 1) * sizeof(struct _mdi_state));
+                mdi->checkpoint_count--;
+            }
+        }
+        _WM_Unlock(&mdi->lock);
+        if (saved) {
+            _WM_free_state(&state);
+        }
+    }
+
+    if (ended) {
+        /* the midi may have got shorter */
+        _WM_Lock(&mdi->lock);
+        while ((mdi->checkpoint_count)
+               && (mdi->checkpoints[mdi->checkpoint_count - 1].sample >= next)) {
+            _WM_free_state(&mdi->checkpoints[--mdi->checkpoint_count]);
+        }
+        _WM_Unlock(&mdi->lock);
+    }
+    if (region_end != NULL) {
+        *region_end = work->extra_info.current_sample;
+    }
+
+    _WM_freeMDI(work);
+    return (guessed);
+}
+
+/*
+ Render cost, in nanoseconds per output sample. The defaults were
+ measured on an x86_64 build, WildMidi_SetCostModel takes figures for
+ the machine at hand, WildMidi_Calibrate measures them.
+ */
+#define WM_COST_MODEL_DEFAULT {10.0f, 15.0f, 160.0f, 3000.0f}
+
+static struct _WM_CostModel WM_CostModel = WM_COST_MODEL_DEFAULT;
+
+#define COST_BLOCKS_PER_SEC 100
+
+static uint16_t voice_percentile(const uint32_t *hist, uint32_t max_voices,
+                                 uint64_t total, uint32_t percent) {
+    uint64_t want = (total * percent + 99) / 100;
+    uint64_t seen = 0;
+    uint32_t i;
+
+    for (i = 0; i < max_voices; i++) {
+        seen += hist[i];
+        if ((seen >= want) && (seen != 0))
+            break;
+    }
+    return ((uint16_t) i);
+}
+
+static float cost_load(struct _mdi *mdi, uint16_t options, double voices) {
+    double ns = WM_CostModel.mix_ns;
+
+    if (options & WM_MO_ENHANCED_RESAMPLING) {
+        ns += voices * WM_CostModel.gauss_ns;
+    } else {
+        ns += voices * WM_CostModel.linear_ns;
+    }
+    if ((options & WM_MO_REVERB) && (mdi->reverb != NULL)) {
+        ns += WM_CostModel.reverb_ns / mdi->reverb->decimate;
+    }
+    return ((float) (ns * _WM_SampleRate / 1000000000.0));
+}
+
+/*
+ The voices are counted by playing the midi through on a clone of the
+ handle, with linear resampling and no reverb as how long a note sounds
+ does not depend on either. With partial_patches sample_bytes only
+ counts the zones the notes play. The cost is worked out for options,
+ the mixer options of the handle the clone was made from.
+ */
+static int probe_cost(struct _mdi *work, uint16_t options, struct _WM_RenderCost *cost) {
+    uint32_t block_samples = _WM_SampleRate / COST_BLOCKS_PER_SEC;
+    uint32_t max_voices = 2 * 16 * 128;
+    uint32_t *hist;
+    int8_t *block;
+    struct _note *note_data;
+    struct _event *event;
+    struct _sample *sample;
+    uint64_t voice_samples = 0;
+    uint64_t window_voice_samples = 0;
+    uint64_t peak_window = 0;
+    uint32_t window_blocks = 0;
+    uint32_t voices;
+    uint32_t pos = 0;
+    uint32_t second = 0;
+    uint32_t events_in_second = 0;
+    uint32_t i;
+    int ret;
+
+    hist = (uint32_t *) calloc(max_voices + 1, sizeof(uint32_t));
+    block = (int8_t *) malloc(block_samples * 4);
+    if ((hist == NULL) || (block == NULL)) {
+        free(hist);
+        free(block);
+        _WM_GLOBAL_ERROR(WM_ERR_MEM, "to estimate render cost", 0);
+        return (-1);
+    }
+
+    memset(cost, 0, sizeof(struct _WM_RenderCost));
+    cost->approx_total_samples = work->extra_info.approx_total_samples;
+
+    event = work->events;
+    while (event->do_event) {
+        if ((pos / _WM_SampleRate) != second) {
+            if (events_in_second > cost->peak_events_per_sec)
+                cost->peak_events_per_sec = events_in_second;
+            events_in_second = 0;
+            second = pos / _WM_SampleRate;
+        }
+        cost->event_count++;
+        events_in_second++;
+        pos += event->samples_to_next;
+        event = WM_NEXT_EVENT(event);
+    }
+    if (events_in_second > cost->peak_events_per_sec)
+        cost->peak_events_per_sec = events_in_second;
+    if (cost->approx_total_samples) {
+        cost->mean_events_per_sec = (float) ((double) cost->event_count * _WM_SampleRate
+                                             / cost->approx_total_samples);
+    }
+
+    /* play through from the start */
+    work->extra_info.mixer_options &= ~(WM_MO_ENHANCED_RESAMPLING | WM_MO_REVERB
+                                        | WM_MO_LOOP | WM_MO_REALTIME);
+    work->checkpoint_interval = 0;
+    work->speed = SPEED_NORMAL;
+    _WM_ResetToStart(work);
+    for (note_data = work->note; note_data != NULL; note_data = note_data->next) {
+        note_data->active = 0;
+        note_data->replay = NULL;
+    }
+    work->note = NULL;
+
+    do {
+        ret = _WM_mix_block(work, block, block_samples * 4);
+        if (ret <= 0)
+            break;
+        voices = 0;
+        for (note_data = work->note; note_data != NULL; note_data = note_data->next) {
+            voices++;
+        }
+        if (voices > max_voices)
+            voices = max_voices;
+        if (voices > cost->peak_voices)
+            cost->peak_voices = (uint16_t) voices;
+        hist[voices] += (uint32_t) ret / 4;
+        voice_samples += (uint64_t) voices * ((uint32_t) ret / 4);
+
+        window_voice_samples += (uint64_t) voices * ((uint32_t) ret / 4);
+        if (++window_blocks == COST_BLOCKS_PER_SEC) {
+            if (window_voice_samples > peak_window)
+                peak_window = window_voice_samples;
+            window_voice_samples = 0;
+            window_blocks = 0;
+        }
+    } while ((uint32_t) ret == (block_samples * 4));
+    if (window_blocks && (window_voice_samples / window_blocks) > (peak_window / COST_BLOCKS_PER_SEC)) {
+        peak_window = window_voice_samples * COST_BLOCKS_PER_SEC / window_blocks;
+    }
+
+    if (cost->approx_total_samples) {
+        cost->mean_voices = (float) ((double) voice_samples / cost->approx_total_samples);
+    }
+    cost->median_voices = voice_percentile(hist, max_voices, cost->approx_total_samples, 50);
+    cost->p95_voices = voice_percentile(hist, max_voices, cost->approx_total_samples, 95);
+    cost->p99_voices = voice_percentile(hist, max_voices, cost->approx_total_samples, 99);
+
+    cost->cpu_load = cost_load(work, options, cost->mean_voices);
+    cost->peak_cpu_load = cost_load(work, options, (double) peak_window
+                                    / ((double) block_samples * COST_BLOCKS_PER_SEC));
+
+    cost->patch_count = work->patch_count;
+    _WM_Lock(&_WM_patch_lock);
+    for (i = 0; i < work->patch_count; i++) {
+        for (sample = work->patches[i]->first_sample; sample != NULL; sample = sample->next) {
+            if (sample->ulaw_data) {
+                cost->sample_bytes += (sample->data_length >> 10) + 2;
+            } else if (sample->data) {
+                cost->sample_bytes += ((sample->data_length >> 10) + 2) * sizeof(int16_t);
+            }
+            if (sample->drum_cache) {
+                cost->sample_bytes += ((sample->drum_cache->data_length >> 10) + 2) * sizeof(int16_t);
+            }
+        }
+    }
+    _WM_Unlock(&_WM_patch_lock);
+
+    free(hist);
+    free(block);
+    return (0);
+}
+
+WM_SYMBOL int WildMidi_GetRenderCost(midi * handle, struct _WM_RenderCost *cost) {
+    struct _mdi *mdi;
+    struct _mdi *work;
+    uint16_t options;
+    int ret;
+
+    if (!WM_Initialized) {
+        _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
+        return (-1);
+    }
+    if (handle == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL handle)", 0);
+        return (-1);
+    }
+    if (cost == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL cost pointer)", 0);
+        return (-1);
+    }
+
+    mdi = (struct _mdi *) handle;
+    _WM_Lock(&mdi->lock);
+    work = _WM_cloneMDI(mdi);
+    options = mdi->extra_info.mixer_options;
+    _WM_Unlock(&mdi->lock);
+    if (work == NULL) {
+        return (-1);
+    }
+
+    /* the clone plays on its own, the handle stays free */
+    ret = probe_cost(work, options, cost);
+    _WM_freeMDI(work);
+    return (ret);
+}
+
+WM_SYMBOL int WildMidi_SetCostModel(const struct _WM_CostModel *model) {
+    static const struct _WM_CostModel default_model = WM_COST_MODEL_DEFAULT;
+
+    if (model == NULL) {
+        model = &default_model;
+    } else if ((model->mix_ns < 0.0f) || (model->linear_ns < 0.0f)
+               || (model->gauss_ns < 0.0f) || (model->reverb_ns < 0.0f)) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(negative cost)", 0);
+        return (-1);
+    }
+    memcpy(&WM_CostModel, model, sizeof(struct _WM_CostModel));
+    return (0);
+}
+
+WM_SYMBOL int WildMidi_GetCostModel(struct _WM_CostModel *model) {
+    if (model == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL model)", 0);
+        return (-1);
+    }
+    memcpy(model, &WM_CostModel, sizeof(struct _WM_CostModel));
+    return (0);
+}
+
+WM_SYMBOL int WildMidi_Calibrate(struct _WM_CostModel *model) {
+    struct _WM_CostModel measured;
+
+    if (!WM_Initialized) {
+        _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
+        return (-1);
+    }
+    if (_WM_calibrate(&measured) == -1) {
+        return (-1);
+    }
+    memcpy(&WM_CostModel, &measured, sizeof(struct _WM_CostModel));
+    if (model != NULL) {
+        memcpy(model, &measured, sizeof(struct _WM_CostModel));
+    }
+    return (0);
+}
+
+static void put_le32(uint8_t *p, uint32_t val) {
+    p[0] = val & 0xff;
+    p[1] = (val >> 8) & 0xff;
+    p[2] = (val >> 16) & 0xff;
+    p[3] = (val >> 24) & 0xff;
+}
+
+/* renders mdi from its current position to a 16bit stereo wav file */
+static int render_wav(struct _mdi *mdi, const char *wavfile) {
+    uint8_t wav_hdr[44] = {
+        'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'A', 'V', 'E',
+        'f', 'm', 't', ' ', 16, 0, 0, 0,
+        1, 0,       /* WAVE_FORMAT_PCM */
+        2, 0,       /* channels */
+        0, 0, 0, 0, /* rate */
+        0, 0, 0, 0, /* bytes per second */
+        4, 0,       /* block alignment */
+        16, 0,      /* bits */
+        'd', 'a', 't', 'a', 0, 0, 0, 0
+    };
+    int8_t *buffer;
+    uint32_t wav_size = 0;
+    FILE *out;
+    int ret;
+
+    if ((out = fopen(wavfile, "wb")) == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_OPEN, wavfile, errno);
+        return (-1);
+    }
+    buffer = (int8_t *) malloc(16384);
+    if (buffer == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_MEM, NULL, 0);
+        goto _fail;
+    }
+    put_le32(&wav_hdr[24], _WM_SampleRate);
+    put_le32(&wav_hdr[28], _WM_SampleRate * 4);
+    if (fwrite(wav_hdr, 1, 44, out) != 44) {
+        _WM_GLOBAL_ERROR(WM_ERR_WRITE, wavfile, errno);
+        goto _fail;
+    }
+
+    while ((ret = WildMidi_GetOutput(mdi, buffer, 16384)) > 0) {
+#ifdef WORDS_BIGENDIAN
+        /* wav data is little-endian */
+        uint16_t *swp = (uint16_t *) buffer;
+        int i;
+        for (i = (ret / 2) - 1; i >= 0; --i) {
+            swp[i] = (swp[i] << 8) | (swp[i] >> 8);
+        }
+#endif
+        if (fwrite(buffer, 1, ret, out) != (size_t) ret) {
+            _WM_GLOBAL_ERROR(WM_ERR_WRITE, wavfile, errno);
+            goto _fail;
+        }
+        wav_size += ret;
+    }
+    if (ret < 0) goto _fail;
+
+    put_le32(&wav_hdr[4], wav_size + 36);
+    put_le32(&wav_hdr[40], wav_size);
+    if ((fseek(out, 0, SEEK_SET) != 0)
+     || (fwrite(wav_hdr, 1, 44, out) != 44)) {
+        _WM_GLOBAL_ERROR(WM_ERR_WRITE, wavfile, errno);
+        goto _fail;
+    }
+    free(buffer);
+    if (fclose(out) != 0) {
+        _WM_GLOBAL_ERROR(WM_ERR_WRITE, wavfile, errno);
+        remove(wavfile);
+        return (-1);
+    }
+    return (0);
+
+_fail:
+    free(buffer);
+    fclose(out);
+    remove(wavfile);
+    return (-1);
+}
+
+#define HASH_VAL(k, v) k = _WM_hash_bytes(k, &(v), sizeof(v))
+
+/*
+ The render cache key: everything that changes the output of a render.
+ Patches are keyed by their settings and the content of their files, so
+ an edited config or a replaced patch file gives a new key. Returns 0 if
+ a patch file can no longer be read, the render is then not cached.
+ mdi only needs its patches listed, see _WM_initMDI.
+ */
+static uint64_t render_key(struct _mdi *mdi, const uint8_t *mididata, uint32_t midisize) {
+    uint64_t key = WM_HASH_INIT;
+    long version = WildMidi_GetVersion();
+    uint16_t options = mdi->extra_info.mixer_options & (WM_MO_LOG_VOLUME
+                        | WM_MO_ENHANCED_RESAMPLING | WM_MO_REVERB
+                        | WM_MO_ROUNDTEMPO | WM_MO_STRIPSILENCE);
+    uint32_t i;
+    int j;
+
+    HASH_VAL(key, version);
+    key = _WM_hash_bytes(key, mididata, midisize);
+    HASH_VAL(key, options);
+    HASH_VAL(key, _WM_SampleRate);
+    HASH_VAL(key, _WM_MasterVolume);
+
+    _WM_Lock(&WM_ConvertOptions.lock);
+    HASH_VAL(key, WM_ConvertOptions.xmi_convert_type);
+    HASH_VAL(key, WM_ConvertOptions.frequency);
+    _WM_Unlock(&WM_ConvertOptions.lock);
+
+    HASH_VAL(key, _WM_reverb_room_width);
+    HASH_VAL(key, _WM_reverb_room_length);
+    HASH_VAL(key, _WM_reverb_listen_posx);
+    HASH_VAL(key, _WM_reverb_listen_posy);
+    HASH_VAL(key, _WM_reverb_decimate);
+    HASH_VAL(key, _WM_fix_release);
+    HASH_VAL(key, _WM_auto_amp);
+    HASH_VAL(key, _WM_auto_amp_with_amp);
+    HASH_VAL(key, _WM_compact_samples);
+    HASH_VAL(key, _WM_compact_min_snr);
+    HASH_VAL(key, _WM_prerender_drums);
+    HASH_VAL(key, _WM_gauss_n);
+
+    for (i = 0; i < mdi->patch_count; i++) {
+        struct _patch *patch = mdi->patches[i];
+
+        HASH_VAL(key, patch->patchid);
+        key = _WM_hash_bytes(key, patch->filename, strlen(patch->filename));
+        HASH_VAL(key, patch->amp);
+        HASH_VAL(key, patch->keep);
+        HASH_VAL(key, patch->remove);
+        HASH_VAL(key, patch->note);
+        for (j = 0; j < 6; j++) {
+            HASH_VAL(key, patch->env[j].time);
+            HASH_VAL(key, patch->env[j].level);
+            HASH_VAL(key, patch->env[j].set);
+        }
+
+        if (_WM_hash_file(&key, patch->filename) == -1) {
+            return (0);
+        }
+    }
+
+    /* 0 is kept for "no key" */
+    return ((key == 0) ? 1 : key);
+}
+
+WM_SYMBOL int WildMidi_SetRenderCache(const char *dir, uint32_t max_mbytes) {
+    if (!WM_Initialized) {
+        _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
+        return (-1);
+    }
+    return (_WM_set_render_cache(dir, max_mbytes));
+}
+
+WM_SYMBOL int WildMidi_RenderToFile(const char *midifile, const char *wavfile) {
+    uint8_t *mididata = NULL;
+    uint32_t midisize = 0;
+    uint64_t key = 0;
+    struct _mdi *listed;
+    midi *handle;
+    int ret;
+
+    if (!WM_Initialized) {
+        _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
+        return (-1);
+    }
+    if (midifile == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL filename)", 0);
+        return (-1);
+    }
+    if (wavfile == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL output filename)", 0);
+        return (-1);
+    }
+    if (_WM_MixerOptions & WM_MO_LOOP) {
+        /* would never reach the end */
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(WM_MO_LOOP set)", 0);
+        return (-1);
+    }
+
+    if ((mididata = (uint8_t *) _WM_BufferFile(midifile, &midisize)) == NULL) {
+        return (-1);
+    }
+
+    /* a hit only parses the song, listing its patches without loading them */
+    if ((_WM_render_cache_enabled()) && (midisize >= 18)
+            && ((listed = parse_midi(mididata, midisize, 1)) != NULL)) {
+        key = render_key(listed, mididata, midisize);
+        _WM_freeMDI(listed);
+        if ((key != 0) && (_WM_render_cache_fetch(key, wavfile) == 0)) {
+            _WM_FreeBufferFile(mididata);
+            return (0);
+        }
+    }
+
+    handle = WildMidi_OpenBuffer(mididata, midisize);
+    _WM_FreeBufferFile(mididata);
+    if (handle == NULL) {
+        return (-1);
+    }
+    /* nothing to keep up with, wait for every patch so the file comes
+       out the same each time */
+    ((struct _mdi *) handle)->async_load = 0;
+
+    ret = render_wav((struct _mdi *) handle, wavfile);
+    WildMidi_Close(handle);
+
+    if ((ret == 0) && (key != 0)) {
+        _WM_render_cache_store(key, wavfile);
+    }
+    return (ret);
+}
+
+WM_SYMBOL int WildMidi_GetMidiOutput(midi * handle, int8_t **buffer, uint32_t *size) {
+    if (__builtin_expect((!WM_Initialized), 0)) {
+        _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
+        return (-1);
+    }
+    if (__builtin_expect((handle == NULL), 0)) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL handle)", 0);
+        return (-1);
+    }
+    if (__builtin_expect((buffer == NULL), 0)) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL buffer pointer)", 0);
+        return (-1);
+    }
+    return _WM_Event2Midi((struct _mdi *)handle, (uint8_t **)buffer, size);
+}
+
+
+WM_SYMBOL int WildMidi_SetOption(midi * handle, uint16_t options, uint16_t setting) {
+    struct _mdi *mdi;
+
+    if (!WM_Initialized) {
+        _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
+        return (-1);
+    }
+    if (handle == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL handle)", 0);
+        return (-1);
+    }
+
+    mdi = (struct _mdi *) handle;
+    _WM_Lock(&mdi->lock);
+    if ((!(options & 0x800F)) || (options & 0x7FF0)) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(invalid option)", 0);
+        _WM_Unlock(&mdi->lock);
+        return (-1);
+    }
+    if (setting & 0x7FF0) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(invalid setting)", 0);
+        _WM_Unlock(&mdi->lock);
+        return (-1);
+    }
+
+    mdi->extra_info.mixer_options = ((mdi->extra_info.mixer_options & (0x80FF ^ options))
+                                    | (options & setting));
+
+    if (options & WM_MO_LOG_VOLUME) {
+            _WM_AdjustChannelVolumes(mdi, 16);  /* Settings greater than 15
+                                                   adjusts all channels */
+    } else if (options & WM_MO_REVERB) {
+        _WM_reset_reverb(mdi->reverb);
+    }
+
+    _WM_Unlock(&mdi->lock);
+    return (0);
+}
+
+WM_SYMBOL int WildMidi_SetSpeed(midi * handle, float ratio) {
+    struct _mdi *mdi;
+
+    if (!WM_Initialized) {
+        _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
+        return (-1);
+    }
+    if (handle == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL handle)", 0);
+        return (-1);
+    }
+    if (!((ratio >= 0.1f) && (ratio <= 10.0f))) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(speed out of range)", 0);
+        return (-1);
+    }
+
+    mdi = (struct _mdi *) handle;
+    _WM_Lock(&mdi->lock);
+    mdi->speed = (uint32_t) (ratio * SPEED_NORMAL + 0.5f);
+    _WM_Unlock(&mdi->lock);
+    return (0);
+}
+
+WM_SYMBOL int WildMidi_SetMute(midi * handle, uint16_t mute, uint16_t solo) {
+    struct _mdi *mdi;
+
+    if (!WM_Initialized) {
+        _WM_GLOBAL_ERROR(WM_ERR_NOT_INIT, NULL, 0);
+        return (-1);
+    }
+    if (handle == NULL) {
+        _WM_GLOBAL_ERROR(WM_ERR_INVALID_ARG, "(NULL handle)", 0);
+        return (-1);
+    }
+
+    mdi = (struct _mdi *) handle;
+    _WM_Lock(&mdi->lock);
+    /* with any channel soloed, every channel that isn't is muted too */
+    mdi->muted = mute | ((solo) ? (uint16_t) ~solo : 0);
     _WM_Unlock(&mdi->lock);
     return (0);
 }
@@ -2098,8 +3650,10 @@ WM_SYMBOL int WildMidi_Shutdown(void) {
         /* closes open handle and rotates the handles list. */
         WildMidi_Close((struct _mdi *) first_handle->handle);
     }
+    _WM_stop_patch_loader();
     WM_FreePatches();
-    free_gauss();
+    _WM_free_gauss();
+    _WM_set_render_cache(NULL, 0);
 
     /* reset the globals */
     _cvt_reset_options ();
@@ -2108,14 +3662,22 @@ WM_SYMBOL int WildMidi_Shutdown(void) {
     _WM_fix_release = 0;
     _WM_auto_amp = 0;
     _WM_auto_amp_with_amp = 0;
+    _WM_compact_samples = 0;
+    _WM_compact_min_snr = 36.0f;
+    _WM_prerender_drums = 0;
+    _WM_partial_patches = 0;
+    _WM_lock_memory_failures = 0;
+    _WM_async_load = 0;
     _WM_reverb_room_width = 16.875f;
     _WM_reverb_room_length = 22.5f;
     _WM_reverb_listen_posx = 8.4375f;
     _WM_reverb_listen_posy = 16.875f;
+    _WM_reverb_decimate = 0;
 
     WM_Initialized = 0;
 
     if (_WM_Global_ErrorS != NULL) free(_WM_Global_ErrorS);
+    _WM_Global_ErrorS = NULL;
 
     _WM_BufferFile = _WM_BufferFileImpl;
     _WM_FreeBufferFile = _WM_FreeBufferFileImpl;
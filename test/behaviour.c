@@ -0,0 +1,1610 @@
+/*
+ * behaviour.c -- library behaviour tests, run by ctest
+ *
+ * Copyright (C) WildMidi Developers 2026
+ *
+ * This file is part of WildMIDI.
+ *
+ * WildMIDI is free software: you can redistribute and/or modify the player
+ * under the terms of the GNU General Public License and you can redistribute
+ * and/or modify the library under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either version 3 of
+ * the licenses, or(at your option) any later version.
+ *
+ * WildMIDI is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License and
+ * the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License and the
+ * GNU Lesser General Public License along with WildMIDI.  If not,  see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ Plays a song made up here, with patches and a config also written here
+ into the directory given on the command line, and checks that the calls
+ which should not change the output don't:
+
+ - WildMidi_SaveState then WildMidi_RestoreState carries on bit for bit,
+   and a state with its reverb positions out of range is refused
+ - a handle from WildMidi_Clone plays as one freshly opened
+ - an edit undone by WildMidi_DeleteMidiEvent leaves the output as it was,
+   and a WildMidi_MoveMidiEvent plays as the event put there to begin with
+ - a patch only an edit brings in, through a bank select, plays
+ - unloading a patch leaves the sample data it shares with one still
+   playing alone
+ - keep=pingpong and keep=reverse play the song as the samples unrolled
+   when they are loaded do
+ - compact_samples plays the song within the snr it keeps each sample to,
+   and compacts nothing that would fall short of it
+ - prerender_drums plays one shot drums as loaded do, but for the linear
+   mixer's interpolation being its own
+ - reverb_decimate's wet level follows the full rate reverb's
+ - WildMidi_GetLoudness gives the loudness and peaks of a held tone
+ - with partial_patches the zone a note added by an edit plays is loaded
+   by the edit, not read from the patch file while rendering
+ - WildMidi_RerenderRegion gives what rendering the edited song does,
+   past where it says it stopped on the reverb tail only but for a low
+   level residue
+ - WildMidi_SetSpeed at 1.0 and WildMidi_SetMute with 0, 0 change nothing
+ - WildMidi_Calibrate sets figures that are times and changes no output
+ - WildMidi_SetMute plays the song as it is without the notes of the
+   channels it leaves out, and a channel unmuted part way carries on as
+   if it had been heard all along
+ - WildMidi_SetSpeed at 2.0 and 0.75 keeps the pitch, stretches the song
+   to match and gives the same output however much each call renders
+ - each level of the WildMidi_GetWaveform overview gives the min, max
+   and rms of the output its bins cover
+ - WildMidi_ShmWrite and WildMidi_ShmRender wrap the ring and stop at the
+   reader, leaving what it has still to read alone
+
+ Each runs with and without reverb, but for those that need a config of
+ their own.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "wildmidi_lib.h"
+#include "render_cache.h" /* _WM_hash_bytes, for the check of a saved state */
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define RATE 44100
+#define BLOCK 4096
+/* where split.pat goes from its triangle to its square, about 600Hz,
+   above every note the song plays */
+#define SPLIT_FREQ 600000
+/* what WildMidi_RerenderRegion may leave of an edit's reverb past where
+   it stopped on the tail, in 16 bit steps */
+#define RERENDER_RESIDUE 64
+/* compact_samples' default, which the whole song has to keep to as well */
+#define COMPACT_SNR 36.0
+/* how close keep=pingpong and keep=reverse play to the unrolled samples,
+   in dB; a reversed note's last frame is off where the sample runs out */
+#define PINGPONG_SNR 60.0
+#define REVERSE_SNR 45.0
+/* how close prerender_drums plays to the drums as loaded, in dB, with
+   the enhanced mixer and with the linear one */
+#define DRUM_CACHE_SNR 70.0
+#define DRUM_LINEAR_SNR 25.0
+/* how closely reverb_decimate's wet level over each 50ms has to follow
+   the full rate reverb's, as a correlation, and how far off it may be
+   overall, in dB. It comes out about 3dB louder on the song, the 4kHz
+   band and the lowest ones gain the most at the reduced rate */
+#define DECIMATE_CORR 0.99
+#define DECIMATE_GAIN 4.0
+/* how far WildMidi_GetLoudness may be from the power of a tone about
+   1kHz, in LU; K-weighting adds about 0.1 there */
+#define LOUDNESS_LU 0.25
+/* frames a bottom level bin of the waveform overview covers */
+#define WAVEFORM_FRAMES 100
+
+static const char *test_dir;
+static char cfg_file[4096];
+static uint8_t *song;
+static uint32_t song_size;
+static int failures = 0;
+
+/* ---- the test data ---- */
+
+static void put_le(uint8_t *p, uint32_t val, int bytes) {
+    while (bytes--) {
+        *p++ = val & 0xff;
+        val >>= 8;
+    }
+}
+
+/* 16 bit, looped, sustained, with an envelope */
+#define LOOPED (0x01 | 0x04 | 0x20 | 0x40)
+/*
+ Looped as a ping pong from half way to 1000 samples short of the end.
+ Unrolling it reads the sample after the loop, so the loop can't end on
+ the last one.
+ */
+#define PINGPONG (LOOPED | 0x08)
+/* one shot, stored back to front */
+#define REVERSE (0x01 | 0x10 | 0x40)
+/* one shot, as drums often are */
+#define ONESHOT (0x01 | 0x40)
+
+/* the waves write_patch makes */
+#define TRIANGLE 0
+#define SQUARE 1
+#define SINE 2
+
+/*
+ One 16 bit sample, rooted at middle C, with an envelope that sustains
+ until note off and then dies away over about a fifth of a second, so
+ notes have a release tail. modes are the patch file's. With split, in
+ mHz, not 0 there are two: the wave asked for below split and the other
+ of triangle and square above it.
+ */
+static int write_patch(const char *dir, const char *name, int wave, uint32_t split, uint8_t modes) {
+    uint8_t header[239];
+    uint8_t sample[96];
+    uint8_t data[2 * 4410];
+    char path[4096];
+    FILE *f;
+    int32_t val;
+    uint32_t count = (split) ? 2 : 1;
+    uint32_t n;
+    uint32_t i;
+
+    sprintf(path, "%s/%s.pat", dir, name);
+    if ((f = fopen(path, "wb")) == NULL) {
+        perror(path);
+        return (-1);
+    }
+    memset(header, 0, sizeof(header));
+    memcpy(header, "GF1PATCH110\0ID#000002", 22);
+    header[82] = 1; /* instruments */
+    header[151] = 1; /* layers */
+    header[198] = (uint8_t) count; /* samples */
+    fwrite(header, 1, sizeof(header), f);
+
+    for (n = 0; n < count; n++) {
+        memset(sample, 0, sizeof(sample));
+        put_le(&sample[8], sizeof(data), 4);
+        put_le(&sample[12], (modes & 0x08) ? sizeof(data) / 2 : 0, 4);
+        put_le(&sample[16], (modes & 0x08) ? sizeof(data) - 2000 : sizeof(data), 4);
+        put_le(&sample[20], RATE, 2);
+        put_le(&sample[22], (n == 0) ? 0 : split, 4);
+        put_le(&sample[26], ((split) && (n == 0)) ? split : 20000000, 4);
+        put_le(&sample[30], 261626, 4);
+        for (i = 0; i < 6; i++) {
+            sample[37 + i] = (i < 3) ? 0x3f : 0xa0;
+            sample[43 + i] = (i < 3) ? 240 : 0;
+        }
+        sample[55] = modes;
+
+        for (i = 0; i < sizeof(data) / 2; i++) {
+            /* about 262Hz, a triangle or a square */
+            val = (int32_t) ((i * 262 * 4 / 441) % 400) - 200;
+            if (wave == SINE) {
+                /* 260Hz, 26 whole cycles so the loop joins up */
+                val = (int32_t) (12000.0 * sin(2.0 * M_PI * 26.0 * i / (sizeof(data) / 2)));
+            } else if ((wave == SQUARE) ^ (n == 1)) {
+                val = (val < 0) ? -12000 : 12000;
+            } else {
+                val = ((val < 0) ? -val : val) * 120 - 12000;
+            }
+            put_le(&data[i * 2], (uint32_t) val, 2);
+        }
+        fwrite(sample, 1, sizeof(sample), f);
+        fwrite(data, 1, sizeof(data), f);
+    }
+    fclose(f);
+    return (0);
+}
+
+/*
+ The config name.cfg, written into the test directory as path: the
+ patches with program 0 of bank 0 played by program0, then settings,
+ which can put other patches in place of those.
+ */
+static int write_config(const char *name, const char *settings, const char *program0, char *path) {
+    FILE *f;
+
+    /* patch file names are taken from the directory of the config */
+    sprintf(path, "%s/%s.cfg", test_dir, name);
+    if ((f = fopen(path, "w")) == NULL) {
+        perror(path);
+        return (-1);
+    }
+    fprintf(f, "bank 0\n0 %s\n1 square\n", program0);
+    fprintf(f, "bank 1\n0 square\n");
+    fprintf(f, "drumset 0\n36 square\n38 triangle\n");
+    fprintf(f, "%s", settings);
+    fclose(f);
+    return (0);
+}
+
+static int write_data(void) {
+    if ((write_patch(test_dir, "triangle", TRIANGLE, 0, LOOPED) != 0)
+        || (write_patch(test_dir, "square", SQUARE, 0, LOOPED) != 0)
+        || (write_patch(test_dir, "split", TRIANGLE, SPLIT_FREQ, LOOPED) != 0)
+        || (write_patch(test_dir, "pingpong", TRIANGLE, 0, PINGPONG) != 0)
+        || (write_patch(test_dir, "reverse", TRIANGLE, 0, REVERSE) != 0)
+        || (write_patch(test_dir, "oneshot", SQUARE, 0, ONESHOT) != 0)
+        || (write_patch(test_dir, "sine", SINE, 0, LOOPED) != 0))
+        return (-1);
+    return (write_config("behaviour", "", "triangle", cfg_file));
+}
+
+static uint8_t *put_event(uint8_t *p, uint32_t delta, const uint8_t *event, uint32_t size) {
+    uint8_t var[4];
+    int n = 0;
+
+    var[n++] = delta & 0x7f;
+    while ((delta >>= 7) != 0) {
+        var[n++] = 0x80 | (delta & 0x7f);
+    }
+    while (n--) {
+        *p++ = var[n];
+    }
+    memcpy(p, event, size);
+    return (p + size);
+}
+
+/* puts a note or bend at tick if its channel is one of channels */
+static uint8_t *put_note(uint8_t *p, uint16_t channels, uint32_t tick, uint32_t *last,
+                         uint8_t status, uint8_t data1, uint8_t data2) {
+    uint8_t event[3];
+
+    if (!(channels & (1 << (status & 0x0f))))
+        return (p);
+    event[0] = status; event[1] = data1; event[2] = data2;
+    p = put_event(p, tick - *last, event, 3);
+    *last = tick;
+    return (p);
+}
+
+/*
+ About four seconds at the default tempo, 96 ticks a quarter note: a
+ melody on channel 1, held notes with a pitch bend on channel 2 and
+ drums on channel 10. Only the notes and bends of channels, a bit a
+ channel as WildMidi_SetMute has them, are put in.
+ */
+static int make_song(uint16_t channels, uint8_t **midi_data, uint32_t *size) {
+    static const uint8_t melody[16] = {
+        60, 62, 64, 65, 67, 69, 71, 72, 71, 69, 67, 65, 64, 62, 60, 55
+    };
+    static const uint8_t setup[][3] = {
+        {0xC0, 0, 0}, {0xC1, 1, 0}, {0xB0, 7, 110}, {0xB1, 7, 90},
+        {0xB1, 10, 30}, {0xB0, 10, 90}
+    };
+    uint8_t *data;
+    uint8_t *track;
+    uint8_t *p;
+    uint8_t event[3];
+    uint32_t tick;
+    uint32_t last = 0;
+    uint32_t i;
+
+    data = (uint8_t *) malloc(4096);
+    if (data == NULL)
+        return (-1);
+    memcpy(data, "MThd", 4);
+    put_le(data + 4, 0x06000000, 4); /* big endian 6 */
+    data[8] = 0; data[9] = 0; /* format 0 */
+    data[10] = 0; data[11] = 1; /* one track */
+    data[12] = 0; data[13] = 96;
+    memcpy(data + 14, "MTrk", 4);
+    track = p = data + 22;
+
+    for (i = 0; i < sizeof(setup) / sizeof(setup[0]); i++) {
+        p = put_event(p, 0, setup[i], (setup[i][0] >= 0xC0) ? 2 : 3);
+    }
+
+    /* each 24 ticks something happens, in tick order */
+    for (tick = 0; tick < 16 * 48; tick += 24) {
+        if ((tick % 48) == 0) {
+            p = put_note(p, channels, tick, &last, 0x90, melody[tick / 48], 100);
+            if ((tick % 192) == 0) {
+                p = put_note(p, channels, tick, &last, 0x91, 36 + (uint8_t) (tick / 96), 90);
+            }
+            p = put_note(p, channels, tick, &last, 0x99, ((tick % 96) == 0) ? 36 : 38, 80);
+        } else {
+            p = put_note(p, channels, tick, &last, 0x80, melody[tick / 48], 0);
+            p = put_note(p, channels, tick, &last, 0x89, (((tick - 24) % 96) == 0) ? 36 : 38, 0);
+            if ((tick % 192) == 168) {
+                p = put_note(p, channels, tick, &last, 0x81, 36 + (uint8_t) ((tick - 168) / 96), 0);
+            } else if ((tick % 192) == 72) {
+                p = put_note(p, channels, tick, &last, 0xE1, 0, 0x50);
+            } else if ((tick % 192) == 120) {
+                p = put_note(p, channels, tick, &last, 0xE1, 0, 0x40);
+            }
+        }
+    }
+    /* the end, 96 ticks after the last note off */
+    event[0] = 0xFF; event[1] = 0x2F; event[2] = 0;
+    p = put_event(p, (16 * 48 - 24 + 96) - last, event, 3);
+
+    data[18] = (uint8_t) ((p - track) >> 24);
+    data[19] = (uint8_t) ((p - track) >> 16);
+    data[20] = (uint8_t) ((p - track) >> 8);
+    data[21] = (uint8_t) (p - track);
+    *midi_data = data;
+    *size = (uint32_t) (p - data);
+    return (0);
+}
+
+/* ---- helpers ---- */
+
+static void init(const char *config, uint16_t options) {
+    if (WildMidi_Init(config, RATE, options) != 0) {
+        fprintf(stderr, "WildMidi_Init: %s\n", WildMidi_GetError());
+        exit(1);
+    }
+}
+
+static midi *open_song(void) {
+    midi *handle = WildMidi_OpenBuffer(song, song_size);
+
+    if (handle == NULL) {
+        fprintf(stderr, "WildMidi_OpenBuffer: %s\n", WildMidi_GetError());
+        exit(1);
+    }
+    return (handle);
+}
+
+/* renders what is left of handle, or limit bytes of it if not 0 */
+static int8_t *render(midi *handle, uint32_t limit, uint32_t *size) {
+    int8_t *output = NULL;
+    uint32_t done = 0;
+    uint32_t want;
+    int ret;
+
+    for (;;) {
+        output = (int8_t *) realloc(output, done + BLOCK);
+        if (output == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        want = BLOCK;
+        if ((limit) && (want > (limit - done))) {
+            want = limit - done;
+        }
+        if (want == 0)
+            break;
+        ret = WildMidi_GetOutput(handle, output + done, want);
+        if (ret < 0) {
+            fprintf(stderr, "WildMidi_GetOutput: %s\n", WildMidi_GetError());
+            exit(1);
+        }
+        if (ret == 0)
+            break;
+        done += (uint32_t) ret;
+    }
+    *size = done;
+    return (output);
+}
+
+static int8_t *render_song(uint32_t *size) {
+    midi *handle = open_song();
+    int8_t *output = render(handle, 0, size);
+
+    WildMidi_Close(handle);
+    return (output);
+}
+
+static void check(const char *what, uint16_t options, const int8_t *got, uint32_t got_size,
+                  const int8_t *want, uint32_t want_size) {
+    uint32_t i;
+
+    if ((got_size == want_size) && (memcmp(got, want, want_size) == 0))
+        return;
+    for (i = 0; (i < got_size) && (i < want_size) && (got[i] == want[i]); i++);
+    fprintf(stderr, "FAIL: %s (options 0x%04x): %u bytes where %u were wanted, first difference at sample %u\n",
+            what, options, got_size, want_size, i / 4);
+    failures++;
+}
+
+static void edit(midi *handle, const uint8_t *event, unsigned long int pos, int insert) {
+    int ret = (insert) ? WildMidi_InsertMidiEvent(handle, event, 3, pos)
+                       : WildMidi_DeleteMidiEvent(handle, event, 3, pos);
+
+    if (ret != 0) {
+        fprintf(stderr, "%s: %s\n", (insert) ? "WildMidi_InsertMidiEvent" : "WildMidi_DeleteMidiEvent",
+                WildMidi_GetError());
+        exit(1);
+    }
+}
+
+static const uint8_t note_on[3] = {0x90, 76, 110};
+static const uint8_t note_off[3] = {0x80, 76, 0};
+#define EDIT_POS (RATE * 3 / 2)
+#define EDIT_LEN (RATE / 4)
+
+/* ---- the tests ---- */
+
+static void test_state(uint16_t options, const int8_t *want, uint32_t want_size) {
+    midi *handle = open_song();
+    midi *other = open_song();
+    uint8_t *state;
+    uint32_t state_size;
+    uint32_t half = (want_size / 2) & ~3;
+    int8_t *first;
+    int8_t *rest;
+    uint32_t first_size;
+    uint32_t rest_size;
+
+    first = render(handle, half, &first_size);
+    if (WildMidi_SaveState(handle, &state, &state_size) != 0) {
+        fprintf(stderr, "WildMidi_SaveState: %s\n", WildMidi_GetError());
+        exit(1);
+    }
+    rest = render(handle, 0, &rest_size);
+    check("carrying on after WildMidi_SaveState", options, rest, rest_size, want + half, want_size - half);
+    free(rest);
+
+    /* into another handle, and back into the one that saved it */
+    if ((WildMidi_RestoreState(other, state, state_size) != 0)
+        || ((rest = render(other, 0, &rest_size)) == NULL)) {
+        fprintf(stderr, "WildMidi_RestoreState: %s\n", WildMidi_GetError());
+        exit(1);
+    }
+    check("WildMidi_RestoreState in another handle", options, rest, rest_size, want + half, want_size - half);
+    free(rest);
+    if (WildMidi_RestoreState(handle, state, state_size) != 0) {
+        fprintf(stderr, "WildMidi_RestoreState: %s\n", WildMidi_GetError());
+        exit(1);
+    }
+    rest = render(handle, 0, &rest_size);
+    check("WildMidi_RestoreState in the same handle", options, rest, rest_size, want + half, want_size - half);
+
+    free(rest);
+    free(first);
+    free(state);
+    WildMidi_Close(other);
+    WildMidi_Close(handle);
+}
+
+/*
+ A saved state made bad where its checks can't see it: one of the
+ reverb's buffer positions, or its phase, out of range, with the check
+ hash redone. The layout is the one described in mdi_state.c.
+ */
+static void test_corrupt_state(uint16_t options, const int8_t *want, uint32_t want_size) {
+    static const struct {
+        const char *what;
+        uint32_t index; /* into the reverb state */
+        uint32_t value;
+    } bad[] = {
+        {"l_out", 384, 0x10000000},
+        {"r_out", 385, 0xffffffff},
+        {"r_sp_in[7]", 386 + 15, 0x7fffffff},
+        {"r_in[3]", 402 + 7, 0x80000000},
+        {"phase", 410, 1},
+    };
+    midi *handle = open_song();
+    uint8_t *state;
+    uint8_t *copy;
+    uint32_t state_size;
+    uint32_t half = (want_size / 2) & ~3;
+    uint32_t at;
+    uint64_t hash;
+    int8_t *output;
+    uint32_t output_size;
+    uint32_t i;
+
+    free(render(handle, half, &output_size));
+    if (WildMidi_SaveState(handle, &state, &state_size) != 0) {
+        fprintf(stderr, "WildMidi_SaveState: %s\n", WildMidi_GetError());
+        exit(1);
+    }
+    copy = (uint8_t *) malloc(state_size);
+    if (copy == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    /* past the header, the channels, the note and slot counts and the notes */
+    at = 44 + (16 * 25);
+    at += 8 + (state[at + 4] | (state[at + 5] << 8)) * 44;
+    if ((at + 4 + (410 + 1) * 4) > state_size) {
+        fprintf(stderr, "FAIL: no reverb in the state saved (options 0x%04x)\n", options);
+        failures++;
+        at = state_size;
+    }
+    for (i = 0; (at < state_size) && (i < sizeof(bad) / sizeof(bad[0])); i++) {
+        memcpy(copy, state, state_size);
+        put_le(&copy[at + 4 + bad[i].index * 4], bad[i].value, 4);
+        hash = _WM_hash_bytes(WM_HASH_INIT, &copy[16], state_size - 16);
+        put_le(&copy[8], (uint32_t) hash, 4);
+        put_le(&copy[12], (uint32_t) (hash >> 32), 4);
+        if (WildMidi_RestoreState(handle, copy, state_size) == 0) {
+            fprintf(stderr, "FAIL: WildMidi_RestoreState took a state with %s out of range (options 0x%04x)\n",
+                    bad[i].what, options);
+            failures++;
+            WildMidi_RestoreState(handle, state, state_size);
+        }
+        WildMidi_ClearError();
+    }
+
+    /* and nothing of those went in */
+    output = render(handle, 0, &output_size);
+    check("playing on after refusing corrupt states", options, output, output_size, want + half, want_size - half);
+
+    free(output);
+    free(copy);
+    free(state);
+    WildMidi_Close(handle);
+}
+
+static void test_clone(uint16_t options, const int8_t *want, uint32_t want_size) {
+    midi *handle = open_song();
+    midi *clone;
+    int8_t *first;
+    int8_t *output;
+    uint32_t first_size;
+    uint32_t output_size;
+
+    /* cloned part way through, the clone still starts from the beginning */
+    first = render(handle, RATE * 4, &first_size);
+    if ((clone = WildMidi_Clone(handle)) == NULL) {
+        fprintf(stderr, "WildMidi_Clone: %s\n", WildMidi_GetError());
+        exit(1);
+    }
+    output = render(clone, 0, &output_size);
+    check("a clone against a fresh handle", options, output, output_size, want, want_size);
+    free(output);
+    output = render(handle, 0, &output_size);
+    check("the handle cloned", options, output, output_size, want + first_size, want_size - first_size);
+
+    free(output);
+    free(first);
+    WildMidi_Close(clone);
+    WildMidi_Close(handle);
+}
+
+static void test_edits(uint16_t options, const int8_t *want, uint32_t want_size) {
+    midi *handle;
+    int8_t *output;
+    int8_t *moved;
+    uint32_t output_size;
+    uint32_t moved_size;
+
+    handle = open_song();
+    edit(handle, note_on, EDIT_POS, 1);
+    edit(handle, note_off, EDIT_POS + EDIT_LEN, 1);
+    output = render(handle, 0, &output_size);
+    WildMidi_Close(handle);
+    if ((output_size == want_size) && (memcmp(output, want, want_size) == 0)) {
+        fprintf(stderr, "FAIL: inserting a note (options 0x%04x) did not change the output\n", options);
+        failures++;
+    }
+    free(output);
+
+    handle = open_song();
+    edit(handle, note_on, EDIT_POS, 1);
+    edit(handle, note_off, EDIT_POS + EDIT_LEN, 1);
+    edit(handle, note_off, EDIT_POS + EDIT_LEN, 0);
+    edit(handle, note_on, EDIT_POS, 0);
+    output = render(handle, 0, &output_size);
+    WildMidi_Close(handle);
+    check("an insert undone by a delete", options, output, output_size, want, want_size);
+    free(output);
+
+    /* moved, and put there to begin with */
+    handle = open_song();
+    edit(handle, note_on, EDIT_POS, 1);
+    edit(handle, note_off, EDIT_POS + EDIT_LEN, 1);
+    if (WildMidi_MoveMidiEvent(handle, note_off, 3, EDIT_POS + EDIT_LEN, EDIT_POS + 2 * EDIT_LEN) != 0) {
+        fprintf(stderr, "WildMidi_MoveMidiEvent: %s\n", WildMidi_GetError());
+        exit(1);
+    }
+    moved = render(handle, 0, &moved_size);
+    WildMidi_Close(handle);
+    handle = open_song();
+    edit(handle, note_on, EDIT_POS, 1);
+    edit(handle, note_off, EDIT_POS + 2 * EDIT_LEN, 1);
+    output = render(handle, 0, &output_size);
+    WildMidi_Close(handle);
+    check("a moved event", options, moved, moved_size, output, output_size);
+
+    free(output);
+    free(moved);
+}
+
+static void test_edited_bank(uint16_t options) {
+    static const uint8_t bank_select[3] = {0xB0, 0, 1};
+    static const uint8_t program[3] = {0xC0, 0, 0};
+    static const uint8_t square[3] = {0xC0, 1, 0};
+    midi *handle;
+    int8_t *output;
+    int8_t *expect;
+    uint32_t output_size;
+    uint32_t expect_size;
+    int ret;
+
+    /* the melody goes on with bank 1's program 0, the same square as
+       bank 0's program 1, which the song as opened never plays */
+    handle = open_song();
+    ret = WildMidi_InsertMidiEvent(handle, bank_select, 3, EDIT_POS);
+    if (ret == 0)
+        ret = WildMidi_InsertMidiEvent(handle, program, 2, EDIT_POS);
+    if (ret != 0) {
+        fprintf(stderr, "WildMidi_InsertMidiEvent: %s\n", WildMidi_GetError());
+        exit(1);
+    }
+    output = render(handle, 0, &output_size);
+    WildMidi_Close(handle);
+
+    handle = open_song();
+    if (WildMidi_InsertMidiEvent(handle, square, 2, EDIT_POS) != 0) {
+        fprintf(stderr, "WildMidi_InsertMidiEvent: %s\n", WildMidi_GetError());
+        exit(1);
+    }
+    expect = render(handle, 0, &expect_size);
+    WildMidi_Close(handle);
+    check("a patch an edited bank select brings in", options, output, output_size, expect, expect_size);
+
+    free(expect);
+    free(output);
+}
+
+/*
+ Re-renders the edit into output, which then has to be expect up to where
+ it stopped, and all through unless it reports stopping on the reverb
+ tail. Past it what is left of the reverb of the edit is let through.
+ */
+static void rerender(midi *handle, const char *what, uint16_t options, int8_t *output,
+                     uint32_t output_size, const int8_t *expect, uint32_t expect_size) {
+    unsigned long int region_end;
+    uint32_t exact;
+    uint32_t i;
+    int residue = 0;
+    int diff;
+    int ret;
+
+    ret = WildMidi_RerenderRegion(handle, EDIT_POS, EDIT_POS + EDIT_LEN, output, output_size, &region_end);
+    if (ret < 0) {
+        fprintf(stderr, "WildMidi_RerenderRegion: %s\n", WildMidi_GetError());
+        exit(1);
+    }
+    if ((ret == 1) && (!(options & WM_MO_REVERB))) {
+        fprintf(stderr, "FAIL: %s (options 0x%04x) stopped on a reverb tail without reverb\n", what, options);
+        failures++;
+    }
+    if ((region_end < EDIT_POS + EDIT_LEN) || (region_end > output_size / 4)) {
+        fprintf(stderr, "FAIL: %s (options 0x%04x) stopped at sample %lu\n", what, options, region_end);
+        failures++;
+        return;
+    }
+
+    exact = (ret == 1) ? (uint32_t) region_end * 4 : output_size;
+    check(what, options, output, exact, expect, (expect_size < exact) ? expect_size : exact);
+    for (i = exact; (i + 1 < output_size) && (i + 1 < expect_size); i += 2) {
+        diff = (int16_t) ((uint8_t) output[i] | ((uint8_t) output[i + 1] << 8))
+             - (int16_t) ((uint8_t) expect[i] | ((uint8_t) expect[i + 1] << 8));
+        if (diff < 0) diff = -diff;
+        if (diff > residue) residue = diff;
+    }
+    if ((output_size != expect_size) || (residue > RERENDER_RESIDUE)) {
+        fprintf(stderr, "FAIL: %s (options 0x%04x): %u bytes where %u were wanted, past sample %lu off by up to %d\n",
+                what, options, output_size, expect_size, region_end, residue);
+        failures++;
+    }
+}
+
+static void test_shared_samples(uint16_t options, const int8_t *want, uint32_t want_size) {
+    static const uint8_t bank_select[3] = {0xB0, 0, 1};
+    static const uint8_t program[3] = {0xC0, 0, 0};
+    midi *handle = open_song();
+    midi *other;
+    void *reuse[8];
+    int8_t *first;
+    int8_t *output;
+    uint32_t first_size;
+    uint32_t output_size;
+    uint32_t i;
+
+    /* bank 1's program 0 shares its data with the square handle plays */
+    first = render(handle, RATE * 4, &first_size);
+    other = open_song();
+    if ((WildMidi_InsertMidiEvent(other, bank_select, 3, 0) != 0)
+        || (WildMidi_InsertMidiEvent(other, program, 2, 0) != 0)) {
+        fprintf(stderr, "WildMidi_InsertMidiEvent: %s\n", WildMidi_GetError());
+        exit(1);
+    }
+    free(render(other, RATE * 4, &output_size));
+    WildMidi_Close(other);
+
+    /* unloaded with it, which must leave the shared data to handle; what
+       was wrongly freed is likely handed out again here, and overwritten */
+    for (i = 0; i < sizeof(reuse) / sizeof(reuse[0]); i++) {
+        reuse[i] = malloc(2 * (4410 + 2));
+        if (reuse[i] != NULL)
+            memset(reuse[i], 0x55, 2 * (4410 + 2));
+    }
+    output = render(handle, 0, &output_size);
+    check("a patch sharing its samples unloaded while playing them", options,
+          output, output_size, want + first_size, want_size - first_size);
+
+    for (i = 0; i < sizeof(reuse) / sizeof(reuse[0]); i++) {
+        free(reuse[i]);
+    }
+    free(output);
+    free(first);
+    WildMidi_Close(handle);
+}
+
+static void test_rerender(uint16_t options, const int8_t *want, uint32_t want_size) {
+    midi *handle = open_song();
+    midi *edited;
+    int8_t *output;
+    int8_t *expect;
+    uint32_t output_size;
+    uint32_t expect_size;
+
+    WildMidi_SetCheckpoints(handle, RATE / 2);
+    output = render(handle, 0, &output_size);
+
+    edited = open_song();
+    edit(edited, note_on, EDIT_POS, 1);
+    edit(edited, note_off, EDIT_POS + EDIT_LEN, 1);
+    expect = render(edited, 0, &expect_size);
+    WildMidi_Close(edited);
+
+    edit(handle, note_on, EDIT_POS, 1);
+    edit(handle, note_off, EDIT_POS + EDIT_LEN, 1);
+    rerender(handle, "WildMidi_RerenderRegion after an insert", options, output, output_size,
+             expect, expect_size);
+
+    /* and back again */
+    edit(handle, note_off, EDIT_POS + EDIT_LEN, 0);
+    edit(handle, note_on, EDIT_POS, 0);
+    rerender(handle, "WildMidi_RerenderRegion after a delete", options, output, output_size,
+             want, want_size);
+
+    free(expect);
+    free(output);
+    WildMidi_Close(handle);
+}
+
+static void test_neutral(uint16_t options, const int8_t *want, uint32_t want_size) {
+    midi *handle = open_song();
+    int8_t *output;
+    uint32_t output_size;
+
+    if ((WildMidi_SetSpeed(handle, 1.0f) != 0) || (WildMidi_SetMute(handle, 0x0003, 0) != 0)
+        || (WildMidi_SetMute(handle, 0, 0) != 0)) {
+        fprintf(stderr, "WildMidi_SetSpeed/SetMute: %s\n", WildMidi_GetError());
+        exit(1);
+    }
+    output = render(handle, 0, &output_size);
+    check("WildMidi_SetSpeed 1.0 and WildMidi_SetMute 0, 0", options, output, output_size, want, want_size);
+    free(output);
+    WildMidi_Close(handle);
+}
+
+/*
+ WildMidi_Calibrate gives figures that could be nanoseconds on any
+ machine, sets them as the model, and changes no output, neither of a
+ handle part way through nor of one opened after it.
+ */
+static void test_calibrate(uint16_t options, const int8_t *want, uint32_t want_size) {
+    struct _WM_CostModel model;
+    struct _WM_CostModel set;
+    midi *handle = open_song();
+    int8_t *output;
+    int8_t *rest;
+    uint32_t output_size;
+    uint32_t rest_size;
+    float figures[4];
+    int i;
+
+    output = render(handle, (want_size / 8) * 4, &output_size);
+    if (WildMidi_Calibrate(&model) != 0) {
+        fprintf(stderr, "WildMidi_Calibrate: %s\n", WildMidi_GetError());
+        exit(1);
+    }
+    figures[0] = model.mix_ns;
+    figures[1] = model.linear_ns;
+    figures[2] = model.gauss_ns;
+    figures[3] = model.reverb_ns;
+    /* every figure is a time, no more than a millisecond a frame or voice */
+    for (i = 0; i < 4; i++) {
+        if (!((figures[i] > 0.0f) && (figures[i] < 1000000.0f))) {
+            fprintf(stderr, "FAIL: WildMidi_Calibrate gave mix_ns %g, linear_ns %g, gauss_ns %g, "
+                    "reverb_ns %g\n", model.mix_ns, model.linear_ns, model.gauss_ns, model.reverb_ns);
+            failures++;
+            break;
+        }
+    }
+    if ((WildMidi_GetCostModel(&set) != 0) || (memcmp(&set, &model, sizeof(model)) != 0)) {
+        fprintf(stderr, "FAIL: WildMidi_Calibrate didn't set the figures it gave as the model\n");
+        failures++;
+    }
+
+    rest = render(handle, 0, &rest_size);
+    WildMidi_Close(handle);
+    if ((output = (int8_t *) realloc(output, output_size + rest_size)) == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    memcpy(output + output_size, rest, rest_size);
+    check("WildMidi_Calibrate half way through", options, output, output_size + rest_size,
+          want, want_size);
+    free(rest);
+    free(output);
+
+    output = render_song(&output_size);
+    check("WildMidi_Calibrate then WildMidi_OpenBuffer", options, output, output_size, want, want_size);
+    free(output);
+}
+
+/* the song with only the notes of channels, rendered with mute and solo */
+static int8_t *render_channels(uint16_t channels, uint16_t mute, uint16_t solo, uint32_t *size) {
+    uint8_t *data;
+    uint32_t data_size;
+    midi *handle;
+    int8_t *output;
+
+    if (make_song(channels, &data, &data_size) != 0) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    if ((handle = WildMidi_OpenBuffer(data, data_size)) == NULL) {
+        fprintf(stderr, "WildMidi_OpenBuffer: %s\n", WildMidi_GetError());
+        exit(1);
+    }
+    if (WildMidi_SetMute(handle, mute, solo) != 0) {
+        fprintf(stderr, "WildMidi_SetMute: %s\n", WildMidi_GetError());
+        exit(1);
+    }
+    output = render(handle, 0, size);
+    WildMidi_Close(handle);
+    free(data);
+    return (output);
+}
+
+/*
+ Muting the drums, or soloing the other two channels, plays the song
+ as it is without the drum notes, and muting the melody as it is
+ without the melody. Drums unmuted part way carry on as if they had
+ been heard all along, so without reverb, whose tail still misses what
+ they would have fed it, the output from there on is the song's.
+ */
+static void test_mute(uint16_t options, const int8_t *want, uint32_t want_size) {
+    midi *handle;
+    int8_t *expect;
+    int8_t *output;
+    int8_t *rest;
+    uint32_t expect_size;
+    uint32_t output_size;
+    uint32_t rest_size;
+    uint32_t half = RATE * 4 * 2;
+
+    expect = render_channels(0xfdff, 0, 0, &expect_size);
+    output = render_channels(0xffff, 0x0200, 0, &output_size);
+    check("WildMidi_SetMute of the drums", options, output, output_size, expect, expect_size);
+    free(output);
+    output = render_channels(0xffff, 0, 0x0003, &output_size);
+    check("WildMidi_SetMute soloing all but the drums", options, output, output_size,
+          expect, expect_size);
+    free(output);
+
+    handle = open_song();
+    if (WildMidi_SetMute(handle, 0x0200, 0) != 0) {
+        fprintf(stderr, "WildMidi_SetMute: %s\n", WildMidi_GetError());
+        exit(1);
+    }
+    output = render(handle, half, &output_size);
+    if (WildMidi_SetMute(handle, 0, 0) != 0) {
+        fprintf(stderr, "WildMidi_SetMute: %s\n", WildMidi_GetError());
+        exit(1);
+    }
+    rest = render(handle, 0, &rest_size);
+    WildMidi_Close(handle);
+    check("WildMidi_SetMute of the drums for the first half", options, output, output_size,
+          expect, half);
+    if (!(options & WM_MO_REVERB)) {
+        check("WildMidi_SetMute unmuting the drums half way", options, rest, rest_size,
+              want + half, want_size - half);
+    }
+    free(rest);
+    free(output);
+    free(expect);
+
+    expect = render_channels(0xfffe, 0, 0, &expect_size);
+    output = render_channels(0xffff, 0x0001, 0, &output_size);
+    check("WildMidi_SetMute of the melody", options, output, output_size, expect, expect_size);
+    free(output);
+    free(expect);
+}
+
+/* renders what is left of handle at speed, size bytes a call */
+static int8_t *render_at(midi *handle, float speed, uint32_t size, uint32_t *output_size) {
+    int8_t *output = NULL;
+    int8_t *part;
+    uint32_t part_size;
+    uint32_t done = 0;
+
+    if (WildMidi_SetSpeed(handle, speed) != 0) {
+        fprintf(stderr, "WildMidi_SetSpeed: %s\n", WildMidi_GetError());
+        exit(1);
+    }
+    do {
+        part = render(handle, size, &part_size);
+        if ((output = (int8_t *) realloc(output, done + part_size + 1)) == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        memcpy(output + done, part, part_size);
+        done += part_size;
+        free(part);
+    } while (part_size == size);
+    *output_size = done;
+    return (output);
+}
+
+/*
+ The song at twice and at three quarters of its speed. Up to the first
+ event after the start the output is the same as at normal speed, the
+ notes keep their pitch, and its length goes with the speed. Fractions
+ of a sample are carried between calls, so how much each renders
+ doesn't change the output.
+ */
+static void test_speed(uint16_t options, const int8_t *want, uint32_t want_size) {
+    static const float speeds[2] = {2.0f, 0.75f};
+    static const char *what[2] = {"WildMidi_SetSpeed 2.0", "WildMidi_SetSpeed 0.75"};
+    char calls[64];
+    midi *handle;
+    int8_t *output;
+    int8_t *again;
+    uint32_t output_size;
+    uint32_t again_size;
+    uint32_t total;
+    uint32_t length;
+    uint32_t first;
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        handle = open_song();
+        total = WildMidi_GetInfo(handle)->approx_total_samples;
+        output = render_at(handle, speeds[i], BLOCK, &output_size);
+
+        /* the first note off is an eighth of a second in at normal speed */
+        first = (uint32_t) ((RATE / 8) / ((speeds[i] > 1.0f) ? speeds[i] : 1.0f)) * 4;
+        if ((output_size < first) || (want_size < first)) {
+            first = 0;
+        }
+        check(what[i], options, output, first, want, first);
+
+        /* the release at the end is in approx_total_samples */
+        length = (uint32_t) (total / speeds[i] + 0.5);
+        if ((output_size / 4 + 1 < length) || (output_size / 4 > length + 1)
+            || (WildMidi_GetInfo(handle)->current_sample != total)) {
+            fprintf(stderr, "FAIL: %s (options 0x%04x) rendered %u samples where %u were wanted, "
+                    "ending at song sample %u of %u\n", what[i], options, output_size / 4, length,
+                    WildMidi_GetInfo(handle)->current_sample, total);
+            failures++;
+        }
+        WildMidi_Close(handle);
+
+        handle = open_song();
+        again = render_at(handle, speeds[i], 4 * 1001, &again_size);
+        sprintf(calls, "%s, 1001 samples a call", what[i]);
+        check(calls, options, again, again_size, output, output_size);
+        WildMidi_Close(handle);
+        free(again);
+        free(output);
+    }
+}
+
+/*
+ Every level of the overview against the output it was built from,
+ which puts each level's bins in line with those under them too. 100
+ frames a bin doesn't divide the blocks render asks for.
+ */
+static void test_waveform(uint16_t options, const int8_t *want, uint32_t want_size) {
+    const int16_t *w = (const int16_t *) want;
+    struct _WM_WaveBin *bins;
+    struct _WM_WaveBin bin;
+    midi *handle = open_song();
+    int8_t *output;
+    uint32_t output_size;
+    uint32_t frames = want_size / 4;
+    uint32_t span = WAVEFORM_FRAMES;
+    uint32_t count;
+    uint32_t total;
+    uint32_t n;
+    uint32_t i;
+    double sum[2];
+    int level;
+    int ch;
+
+    if (WildMidi_SetWaveform(handle, WAVEFORM_FRAMES) != 0) {
+        fprintf(stderr, "WildMidi_SetWaveform: %s\n", WildMidi_GetError());
+        exit(1);
+    }
+    output = render(handle, 0, &output_size);
+    check("WildMidi_SetWaveform", options, output, output_size, want, want_size);
+    free(output);
+
+    for (level = 0; level < WM_WAVEFORM_LEVELS; level++, span *= 16) {
+        total = WildMidi_GetWaveform(handle, (uint8_t) level, 0, NULL, NULL);
+        if (total != (frames + span - 1) / span) {
+            fprintf(stderr, "FAIL: WildMidi_GetWaveform (options 0x%04x) has %u bins at level %d "
+                    "where %u were wanted\n", options, total, level, (frames + span - 1) / span);
+            failures++;
+            break;
+        }
+        if ((bins = (struct _WM_WaveBin *) malloc(total * sizeof(struct _WM_WaveBin))) == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        count = total;
+        WildMidi_GetWaveform(handle, (uint8_t) level, 0, bins, &count);
+        for (n = 0; n < count; n++) {
+            for (ch = 0; ch < 2; ch++) {
+                bin.min[ch] = 32767;
+                bin.max[ch] = -32768;
+                sum[ch] = 0.0;
+            }
+            for (i = n * span; (i < (n + 1) * span) && (i < frames); i++) {
+                for (ch = 0; ch < 2; ch++) {
+                    if (w[i * 2 + ch] < bin.min[ch]) bin.min[ch] = w[i * 2 + ch];
+                    if (w[i * 2 + ch] > bin.max[ch]) bin.max[ch] = w[i * 2 + ch];
+                    sum[ch] += (double) w[i * 2 + ch] * w[i * 2 + ch];
+                }
+            }
+            for (ch = 0; ch < 2; ch++) {
+                /* upper levels merge rounded values */
+                if ((bins[n].min[ch] != bin.min[ch]) || (bins[n].max[ch] != bin.max[ch])
+                    || (fabs(bins[n].rms[ch] - sqrt(sum[ch] / (i - n * span))) > 1.0))
+                    break;
+            }
+            if (ch < 2) {
+                fprintf(stderr, "FAIL: WildMidi_GetWaveform (options 0x%04x) level %d bin %u is "
+                        "%d to %d at %u rms where the output has %d to %d at %.1f\n", options, level,
+                        n, bins[n].min[ch], bins[n].max[ch], bins[n].rms[ch], bin.min[ch],
+                        bin.max[ch], sqrt(sum[ch] / (i - n * span)));
+                failures++;
+                break;
+            }
+        }
+        free(bins);
+    }
+    WildMidi_Close(handle);
+}
+
+#ifndef _WIN32
+/* the reader's side, which the test plays itself */
+static int8_t *shm_map(int fd, struct _WM_ShmHeader **header) {
+    struct stat st;
+    void *map;
+
+    if ((fstat(fd, &st) != 0)
+        || ((map = mmap(NULL, (size_t) st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)) {
+        perror("mapping the shm ring");
+        exit(1);
+    }
+    *header = (struct _WM_ShmHeader *) map;
+    return ((int8_t *) map + (*header)->header_size);
+}
+
+static void shm_expect(const char *what, int got, int want, const int8_t *ring,
+                       const int8_t *data, uint32_t from, uint32_t size) {
+    uint32_t i;
+
+    if (got != want) {
+        fprintf(stderr, "FAIL: %s returned %d where %d was wanted\n", what, got, want);
+        failures++;
+        return;
+    }
+    for (i = 0; i < size; i++) {
+        if (ring[(from + i) & 4095] != data[i]) {
+            fprintf(stderr, "FAIL: %s left ring byte %u wrong\n", what, (from + i) & 4095);
+            failures++;
+            return;
+        }
+    }
+}
+
+static void test_shm(const int8_t *want) {
+    struct _WM_Shm *shm;
+    struct _WM_ShmHeader *header;
+    midi *handle;
+    int8_t data[4096];
+    int8_t *ring;
+    uint32_t i;
+    int fd;
+
+    if ((shm = WildMidi_ShmCreate(NULL, RATE, 4096, &fd)) == NULL) {
+        /* no memfd here, nothing to test */
+        return;
+    }
+    ring = shm_map(fd, &header);
+    for (i = 0; i < sizeof(data); i++) {
+        data[i] = (int8_t) (i * 7 + 1);
+    }
+
+    /* up to 96 bytes short of the end, which the reader then reads */
+    shm_expect("WildMidi_ShmWrite up to the end", WildMidi_ShmWrite(shm, NULL, data, 4000), 4000,
+               ring, data, 0, 4000);
+    header->read_pos = 4000;
+
+    /* across the end */
+    shm_expect("WildMidi_ShmWrite across the end", WildMidi_ShmWrite(shm, NULL, data + 8, 400), 400,
+               ring, data + 8, 4000, 400);
+
+    /* more than is free, the 400 bytes not yet read must stay */
+    shm_expect("WildMidi_ShmWrite past the reader", WildMidi_ShmWrite(shm, NULL, data, 4000), 3696,
+               ring, data, 304, 3696);
+    shm_expect("WildMidi_ShmWrite past the reader", 400, 400, ring, data + 8, 4000, 400);
+    if (WildMidi_ShmSpace(shm) != 0) {
+        fprintf(stderr, "FAIL: WildMidi_ShmSpace gives %u on a full ring\n", WildMidi_ShmSpace(shm));
+        failures++;
+    }
+    if (WildMidi_ShmWrite(shm, NULL, data, 4) != 0) {
+        fprintf(stderr, "FAIL: WildMidi_ShmWrite wrote to a full ring\n");
+        failures++;
+    }
+
+    /* rendered across the end, as GetOutput would give it */
+    header->read_pos = header->write_pos;
+    handle = open_song();
+    shm_expect("WildMidi_ShmRender across the end", WildMidi_ShmRender(shm, handle, 400), 400,
+               ring, want, 4000, 400);
+    header->read_pos = header->write_pos - 100;
+    shm_expect("WildMidi_ShmRender past the reader", WildMidi_ShmRender(shm, handle, 4096), 3996,
+               ring, want + 400, 304, 3996);
+    shm_expect("WildMidi_ShmRender past the reader", 100, 100, ring, want + 300, 204, 100);
+    if (WildMidi_ShmSpace(shm) != 0) {
+        fprintf(stderr, "FAIL: WildMidi_ShmSpace gives %u after rendering up to the reader\n",
+                WildMidi_ShmSpace(shm));
+        failures++;
+    }
+    WildMidi_Close(handle);
+
+    munmap(header, header->header_size + 4096);
+    WildMidi_ShmClose(shm);
+}
+#endif
+
+/* ---- the tests with a config of their own ---- */
+
+/* the song rendered with the config written as name.cfg, see write_config */
+static int8_t *render_with(const char *name, const char *settings, const char *program0,
+                           uint16_t options, uint32_t *size) {
+    char config[4096];
+    int8_t *output;
+
+    if (write_config(name, settings, program0, config) != 0)
+        exit(1);
+    init(config, options);
+    output = render_song(size);
+    WildMidi_Shutdown();
+    return (output);
+}
+
+/* how far got is from want, in dB of signal to noise */
+static double snr(const int8_t *got, const int8_t *want, uint32_t size) {
+    const int16_t *g = (const int16_t *) got;
+    const int16_t *w = (const int16_t *) want;
+    double signal = 0.0;
+    double noise = 0.0;
+    uint32_t i;
+
+    for (i = 0; i < size / 2; i++) {
+        signal += (double) w[i] * w[i];
+        noise += ((double) g[i] - w[i]) * ((double) g[i] - w[i]);
+    }
+    if (noise == 0.0)
+        return (1000.0);
+    return (10.0 * log10(signal / noise));
+}
+
+/*
+ The melody played from ping pong and reverse samples as loaded, and
+ from the copies unrolled forward that the patch loading makes without
+ keep=, with each mixer.
+ */
+static void test_native_loops(void) {
+    static const char *patches[2] = {"pingpong", "reverse"};
+    static const double least_snr[2] = {PINGPONG_SNR, REVERSE_SNR};
+    static const uint16_t mixers[2] = {0, WM_MO_ENHANCED_RESAMPLING};
+    char native[64];
+    int8_t *unrolled;
+    int8_t *output;
+    uint32_t unrolled_size;
+    uint32_t output_size;
+    double ratio;
+    uint32_t i;
+    uint32_t j;
+
+    for (i = 0; i < 2; i++) {
+        sprintf(native, "%s keep=%s", patches[i], patches[i]);
+        for (j = 0; j < 2; j++) {
+            unrolled = render_with("unrolled", "", patches[i], mixers[j], &unrolled_size);
+            output = render_with("native", "", native, mixers[j], &output_size);
+            ratio = (output_size == unrolled_size) ? snr(output, unrolled, unrolled_size) : 0.0;
+            if (ratio < least_snr[i]) {
+                fprintf(stderr, "FAIL: keep=%s (options 0x%04x) played the song at %.1fdB from the "
+                        "unrolled samples, %u bytes where %u were wanted\n", patches[i], mixers[j],
+                        ratio, output_size, unrolled_size);
+                failures++;
+            }
+            free(output);
+            free(unrolled);
+        }
+    }
+}
+
+static void test_compact_samples(void) {
+    int8_t *plain;
+    int8_t *output;
+    uint32_t plain_size;
+    uint32_t output_size;
+    double ratio;
+
+    plain = render_with("plain", "", "triangle", 0, &plain_size);
+
+    /* the triangle and square convert at over the default 36dB */
+    output = render_with("compact", "compact_samples\n", "triangle", 0, &output_size);
+    ratio = (output_size == plain_size) ? snr(output, plain, plain_size) : 0.0;
+    if ((ratio < COMPACT_SNR) || (ratio >= 1000.0)) {
+        fprintf(stderr, "FAIL: compact_samples played the song at %.1fdB from the 16 bit samples, "
+                "%u bytes where %u were wanted\n", ratio, output_size, plain_size);
+        failures++;
+    }
+    free(output);
+
+    /* and at none at all, nothing is compacted */
+    output = render_with("uncompacted", "compact_samples 200\n", "triangle", 0, &output_size);
+    check("compact_samples 200", 0, output, output_size, plain, plain_size);
+    free(output);
+
+    free(plain);
+}
+
+/*
+ The drums from one shot samples, prerendered to the output rate and
+ played as loaded, with each mixer. The Gauss interpolation of the cache
+ is the enhanced mixer's, the linear one only comes close to it.
+ */
+static void test_drum_cache(void) {
+    static const uint16_t mixers[2] = {0, WM_MO_ENHANCED_RESAMPLING};
+    static const double least_snr[2] = {DRUM_LINEAR_SNR, DRUM_CACHE_SNR};
+    int8_t *played;
+    int8_t *output;
+    uint32_t played_size;
+    uint32_t output_size;
+    double ratio;
+    uint32_t j;
+
+    for (j = 0; j < 2; j++) {
+        played = render_with("drums", "drumset 0\n36 oneshot\n38 oneshot\n", "triangle",
+                             mixers[j], &played_size);
+        output = render_with("drum_cache", "drumset 0\n36 oneshot\n38 oneshot\nprerender_drums\n",
+                             "triangle", mixers[j], &output_size);
+        ratio = (output_size == played_size) ? snr(output, played, played_size) : 0.0;
+        /* the same to the bit would mean the cache went unused */
+        if ((ratio < least_snr[j]) || (ratio >= 1000.0)) {
+            fprintf(stderr, "FAIL: prerender_drums (options 0x%04x) played the song at %.1fdB from "
+                    "the drums as loaded, %u bytes where %u were wanted\n", mixers[j], ratio,
+                    output_size, played_size);
+            failures++;
+        }
+        free(output);
+        free(played);
+    }
+}
+
+/*
+ The level of what reverb adds to dry over each 50ms of the song, which
+ gets the window count.
+ */
+static double *wet_levels(const int8_t *output, const int8_t *dry, uint32_t size, uint32_t *count) {
+    const int16_t *o = (const int16_t *) output;
+    const int16_t *d = (const int16_t *) dry;
+    uint32_t window = RATE / 20 * 2;
+    double *levels;
+    double sum;
+    double wet;
+    uint32_t i;
+    uint32_t j;
+
+    *count = (size / 2) / window;
+    if ((levels = (double *) malloc(*count * sizeof(double))) == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < *count; i++) {
+        sum = 0.0;
+        for (j = i * window; j < (i + 1) * window; j++) {
+            wet = (double) o[j] - d[j];
+            sum += wet * wet;
+        }
+        levels[i] = sqrt(sum / window);
+    }
+    return (levels);
+}
+
+/*
+ The song with the reverb at half rate, as reverb_decimate runs it, and
+ at the full rate. The wet parts can't match sample for sample, the
+ delays round to other lengths, but their level has to follow the full
+ rate one's.
+ */
+static void test_reverb_decimate(void) {
+    int8_t *dry;
+    int8_t *full;
+    int8_t *output;
+    double *full_levels;
+    double *levels;
+    uint32_t dry_size;
+    uint32_t full_size;
+    uint32_t output_size;
+    uint32_t count;
+    double sum_f = 0.0;
+    double sum_d = 0.0;
+    double sum_ff = 0.0;
+    double sum_dd = 0.0;
+    double sum_fd = 0.0;
+    double corr;
+    double gain;
+    uint32_t i;
+
+    dry = render_with("dry", "", "triangle", 0, &dry_size);
+    full = render_with("full", "", "triangle", WM_MO_REVERB, &full_size);
+    output = render_with("decimated", "reverb_decimate\n", "triangle", WM_MO_REVERB, &output_size);
+    if ((full_size != dry_size) || (output_size != dry_size)
+        || (memcmp(output, full, full_size) == 0)) {
+        fprintf(stderr, "FAIL: reverb_decimate rendered %u bytes, %u at the full rate and %u dry, "
+                "or the same as the full rate\n", output_size, full_size, dry_size);
+        failures++;
+        free(output);
+        free(full);
+        free(dry);
+        return;
+    }
+
+    full_levels = wet_levels(full, dry, dry_size, &count);
+    levels = wet_levels(output, dry, dry_size, &count);
+    for (i = 0; i < count; i++) {
+        sum_f += full_levels[i];
+        sum_d += levels[i];
+        sum_ff += full_levels[i] * full_levels[i];
+        sum_dd += levels[i] * levels[i];
+        sum_fd += full_levels[i] * levels[i];
+    }
+    corr = (sum_fd - sum_f * sum_d / count)
+           / sqrt((sum_ff - sum_f * sum_f / count) * (sum_dd - sum_d * sum_d / count));
+    gain = 20.0 * log10(sum_d / sum_f);
+    if ((corr < DECIMATE_CORR) || (fabs(gain) > DECIMATE_GAIN)) {
+        fprintf(stderr, "FAIL: reverb_decimate's wet level follows the full rate one's at %.3f, "
+                "%.1fdB from it\n", corr, gain);
+        failures++;
+    }
+
+    free(levels);
+    free(full_levels);
+    free(output);
+    free(full);
+    free(dry);
+}
+
+/*
+ The tone test_loudness plays: program 0 then note 84 held for three
+ seconds, at 96 ticks a quarter note and the default tempo.
+ */
+static const uint8_t tone[] = {
+    'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 1, 0, 96,
+    'M', 'T', 'r', 'k', 0, 0, 0, 16,
+    0x00, 0xC0, 0,
+    0x00, 0x90, 84, 127,
+    0x84, 0x40, 0x80, 84, 0,
+    0x00, 0xFF, 0x2F, 0
+};
+
+/* loudness from the mean square of the channels over size bytes, in LUFS */
+static double tone_lufs(const int8_t *output, uint32_t size) {
+    const int16_t *o = (const int16_t *) output;
+    double sum = 0.0;
+    uint32_t i;
+
+    for (i = 0; i < size / 2; i++) {
+        sum += ((double) o[i] / 32768.0) * ((double) o[i] / 32768.0);
+    }
+    /* the -0.691 of BS.1770 is there to take off what K-weighting adds at 1kHz */
+    return (10.0 * log10(sum / (size / 4)));
+}
+
+static void loudness_expect(const char *what, double got, double want, double within) {
+    if (fabs(got - want) > within) {
+        fprintf(stderr, "FAIL: WildMidi_GetLoudness gave %.2f for the %s where %.2f was wanted\n",
+                got, what, want);
+        failures++;
+    }
+}
+
+/*
+ A held sine near 1kHz measured while it plays, against the power and
+ peak of the output it gives.
+ */
+static void test_loudness(void) {
+    const int16_t *o;
+    struct _WM_Loudness loudness;
+    char config[4096];
+    midi *handle;
+    int8_t *output;
+    uint32_t output_size;
+    uint32_t momentary = RATE * 4 * 4 / 10;
+    double peak = 0.0;
+    double want;
+    uint32_t i;
+
+    if (write_config("tone", "", "sine", config) != 0)
+        exit(1);
+    init(config, 0);
+    if ((handle = WildMidi_OpenBuffer(tone, sizeof(tone))) == NULL) {
+        fprintf(stderr, "WildMidi_OpenBuffer: %s\n", WildMidi_GetError());
+        exit(1);
+    }
+    if (WildMidi_SetLoudness(handle, WM_LN_MEASURE | WM_LN_TRUE_PEAK) != 0) {
+        fprintf(stderr, "WildMidi_SetLoudness: %s\n", WildMidi_GetError());
+        exit(1);
+    }
+
+    /* up to the note off */
+    output = render(handle, RATE * 4 * 3, &output_size);
+    if (WildMidi_GetLoudness(handle, &loudness) != 0) {
+        fprintf(stderr, "WildMidi_GetLoudness: %s\n", WildMidi_GetError());
+        exit(1);
+    }
+    o = (const int16_t *) output;
+    for (i = 0; i < output_size / 2; i++) {
+        if (fabs((double) o[i]) > peak) peak = fabs((double) o[i]);
+    }
+    if (loudness.samples != output_size / 4) {
+        fprintf(stderr, "FAIL: WildMidi_GetLoudness measured %u samples of %u\n",
+                loudness.samples, output_size / 4);
+        failures++;
+    }
+    want = tone_lufs(output + output_size - momentary, momentary);
+    loudness_expect("momentary loudness", loudness.momentary, want, LOUDNESS_LU);
+    /* the last three seconds, all there is */
+    loudness_expect("short term loudness", loudness.short_term, tone_lufs(output, output_size),
+                    LOUDNESS_LU);
+    /* the attack is under the relative gate */
+    loudness_expect("integrated loudness", loudness.integrated, want, LOUDNESS_LU);
+    loudness_expect("loudness range", loudness.range, 0.0, 0.0);
+    peak = 20.0 * log10(peak / 32768.0);
+    loudness_expect("sample peak", loudness.sample_peak, peak, 0.01);
+    /* at 42 samples a cycle the samples miss the peak by under 0.03dB */
+    loudness_expect("true peak", loudness.true_peak, peak + 0.015, 0.0155);
+
+    free(output);
+    WildMidi_Close(handle);
+    WildMidi_Shutdown();
+}
+
+static void test_partial_patches(void) {
+    static const uint8_t high_on[3] = {0x90, 84, 110};
+    static const uint8_t high_off[3] = {0x80, 84, 0};
+    char whole[4096];
+    char partial[4096];
+    char patch[4096];
+    char moved[4096];
+    midi *handle;
+    int8_t *output;
+    int8_t *expect;
+    uint32_t output_size;
+    uint32_t expect_size;
+
+    if ((write_config("whole", "", "split", whole) != 0)
+        || (write_config("partial", "partial_patches\n", "split", partial) != 0))
+        exit(1);
+    sprintf(patch, "%s/split.pat", test_dir);
+    sprintf(moved, "%s/split.moved", test_dir);
+
+    /* a note above the split, in the zone the song as opened doesn't play */
+    init(whole, 0);
+    handle = open_song();
+    edit(handle, high_on, EDIT_POS, 1);
+    edit(handle, high_off, EDIT_POS + EDIT_LEN, 1);
+    expect = render(handle, 0, &expect_size);
+    WildMidi_Close(handle);
+    WildMidi_Shutdown();
+
+    /* loaded by the edit, the patch file isn't needed while rendering */
+    init(partial, 0);
+    handle = open_song();
+    edit(handle, high_on, EDIT_POS, 1);
+    edit(handle, high_off, EDIT_POS + EDIT_LEN, 1);
+    if (rename(patch, moved) != 0) {
+        perror(patch);
+        exit(1);
+    }
+    output = render(handle, 0, &output_size);
+    if (rename(moved, patch) != 0) {
+        perror(moved);
+        exit(1);
+    }
+    WildMidi_Close(handle);
+    check("partial_patches with the zone an edit plays", 0, output, output_size, expect, expect_size);
+
+    free(expect);
+    free(output);
+    WildMidi_Shutdown();
+}
+
+int main(int argc, char **argv) {
+    static const uint16_t option_sets[] = {
+        0, WM_MO_REVERB, WM_MO_ENHANCED_RESAMPLING | WM_MO_REVERB
+    };
+    int8_t *want;
+    uint32_t want_size;
+    uint16_t options;
+    uint32_t i;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s directory\n", argv[0]);
+        return (1);
+    }
+    test_dir = argv[1];
+    if ((write_data() != 0) || (make_song(0xffff, &song, &song_size) != 0))
+        return (1);
+
+    for (i = 0; i < sizeof(option_sets) / sizeof(option_sets[0]); i++) {
+        options = option_sets[i];
+        init(cfg_file, options);
+        want = render_song(&want_size);
+        if (want_size < RATE * 4 * 3) {
+            fprintf(stderr, "FAIL: the song rendered to only %u bytes\n", want_size);
+            return (1);
+        }
+
+        test_state(options, want, want_size);
+        if (options & WM_MO_REVERB) {
+            test_corrupt_state(options, want, want_size);
+        }
+        test_clone(options, want, want_size);
+        test_edits(options, want, want_size);
+        test_edited_bank(options);
+        test_shared_samples(options, want, want_size);
+        test_rerender(options, want, want_size);
+        test_neutral(options, want, want_size);
+        test_calibrate(options, want, want_size);
+        test_mute(options, want, want_size);
+        test_speed(options, want, want_size);
+        test_waveform(options, want, want_size);
+#ifndef _WIN32
+        test_shm(want);
+#endif
+
+        free(want);
+        WildMidi_Shutdown();
+    }
+
+    test_native_loops();
+    test_compact_samples();
+    test_drum_cache();
+    test_reverb_decimate();
+    test_loudness();
+    test_partial_patches();
+
+    free(song);
+    if (failures) {
+        fprintf(stderr, "%d failed\n", failures);
+        return (1);
+    }
+    printf("all passed\n");
+    return (0);
+}